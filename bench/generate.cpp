@@ -0,0 +1,128 @@
+/**
+ * @file generate.cpp
+ * @brief Bulk generation of synthetic NCM libraries
+ * @details Workers claim file indices from a shared counter and encode
+ * straight to disk; the list file is written afterwards in index order.
+ */
+
+#include "generate.h"
+#include "synthetic.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+namespace bench {
+
+namespace {
+    /** @brief Files per shard directory */
+    constexpr uint64_t SHARD_SIZE = 1000;
+
+    uint64_t parse_size(const string& text) {
+        size_t end = 0;
+        uint64_t value = stoull(text, &end);
+        string suffix = text.substr(end);
+        if (suffix == "K" || suffix == "k") return value << 10;
+        if (suffix == "M" || suffix == "m") return value << 20;
+        if (suffix == "G" || suffix == "g") return value << 30;
+        if (!suffix.empty()) throw runtime_error("Invalid size: " + text);
+        return value;
+    }
+
+    filesystem::path file_path(const filesystem::path& dir, uint64_t index) {
+        char shard[32];
+        snprintf(shard, sizeof(shard), "%04llu", (unsigned long long)(index / SHARD_SIZE));
+        return dir / shard / ("synthetic_" + to_string(index) + ".ncm");
+    }
+} // anonymous namespace
+
+vector<size_class> parse_size_mix(const string& mix) {
+    vector<size_class> out;
+    stringstream ss(mix);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (item.empty()) continue;
+        size_class c;
+        size_t colon = item.find(':');
+        try {
+            c.size = parse_size(item.substr(0, colon));
+            if (colon != string::npos) c.weight = stod(item.substr(colon + 1));
+        } catch (const logic_error&) {
+            throw runtime_error("Invalid size mix entry: " + item);
+        }
+        if (c.weight <= 0) throw runtime_error("Size mix weights must be positive: " + item);
+        out.push_back(c);
+    }
+    if (out.empty()) throw runtime_error("Empty size mix");
+    return out;
+}
+
+generate_stats generate(const generate_settings& settings) {
+    vector<double> weights;
+    for (const auto& c : settings.mix) weights.push_back(c.weight);
+
+    for (uint64_t shard = 0; shard * SHARD_SIZE < settings.count; ++shard) {
+        filesystem::create_directories(file_path(settings.dir, shard * SHARD_SIZE).parent_path());
+    }
+
+    atomic<uint64_t> next{0};
+    atomic<uint64_t> bytes{0};
+    mutex error_mtx;
+    exception_ptr error;
+    auto worker = [&] {
+        try {
+            uint64_t i;
+            while ((i = next.fetch_add(1)) < settings.count) {
+                // The size depends on the index only, not on the thread that claims it
+                uint64_t seed = settings.seed + i;
+                mt19937_64 rng(seed);
+                discrete_distribution<size_t> pick(weights.begin(), weights.end());
+                uint64_t size = settings.mix[pick(rng)].size;
+                write_ncm(file_path(settings.dir, i), (size_t)size, settings.cover_size, seed);
+                bytes += size;
+            }
+        } catch (...) {
+            lock_guard<mutex> lock(error_mtx);
+            if (!error) error = current_exception();
+            next = settings.count;
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (unsigned int t = 1; t < settings.threads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (error) {
+        rethrow_exception(error);
+    }
+
+    filesystem::path list = settings.dir / "inputs.txt";
+    ofstream out(list, ios::trunc);
+    for (uint64_t i = 0; i < settings.count; ++i) {
+        out << file_path(settings.dir, i).string() << '\n';
+    }
+    if (!out.flush()) {
+        throw runtime_error("Unable to write " + list.string());
+    }
+
+    generate_stats stats;
+    stats.files = settings.count;
+    stats.bytes = bytes;
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+} // namespace bench
@@ -0,0 +1,63 @@
+/**
+ * @file generate.h
+ * @brief Bulk generation of synthetic NCM libraries
+ * @details Writes any number of reproducible files with a weighted mix of
+ * audio sizes, sharded into subdirectories, plus a list file that can be
+ * handed to ncmpp -i for scheduler and I/O scaling runs.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+/**
+ * @brief One audio size of a mix and its relative weight
+ */
+struct size_class {
+    std::uint64_t size = 0;
+    double weight = 1;
+};
+
+/**
+ * @brief Parse a size mix such as "512K:50,4M:40,64M:10"
+ * @details Sizes take an optional K, M or G suffix (powers of 1024);
+ * a missing weight counts as 1.
+ * @throws std::runtime_error on malformed entries
+ */
+std::vector<size_class> parse_size_mix(const std::string& mix);
+
+/**
+ * @brief Generation settings
+ */
+struct generate_settings {
+    std::filesystem::path dir;
+    std::uint64_t count = 0;
+    std::vector<size_class> mix;
+    std::size_t cover_size = 64 * 1024;
+    std::uint64_t seed = 1;
+    unsigned int threads = 1;
+};
+
+/**
+ * @brief Totals of a generation run
+ */
+struct generate_stats {
+    std::uint64_t files = 0;
+    std::uint64_t bytes = 0;
+    double seconds = 0;
+};
+
+/**
+ * @brief Write count files below dir and the list dir/inputs.txt
+ * @details File i goes to dir/<i / 1000>/synthetic_<i>.ncm and depends only
+ * on seed + i, so runs are repeatable and can be extended.
+ * @throws std::runtime_error if a file cannot be written
+ */
+generate_stats generate(const generate_settings& settings);
+
+} // namespace bench
@@ -0,0 +1,368 @@
+/**
+ * @file main.cpp
+ * @brief Entry point of ncmpp_bench
+ * @details Microbenchmarks of the decode hot path (key scheduling, keystream
+ * XOR, base64, AES-ECB and PKCS#7) and end-to-end conversion runs over
+ * synthetic NCM files at several thread counts. Results are printed as a
+ * table or as one JSON object per line for regression tracking. --verify
+ * runs the encoder round-trip checks instead, and --generate writes a
+ * synthetic library for load tests.
+ */
+
+#include "cmdline.h"
+#include "generate.h"
+#include "synthetic.h"
+#include "verify.h"
+#include "base64.h"
+#include "base64_simd.h"
+#include "DecoderContext.h"
+#include "keystream.h"
+#include "pkcs7.h"
+#include "ncmlib/batch.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    using bench_clock = chrono::steady_clock;
+
+    /**
+     * @brief Keep a value alive so the benchmarked work is not optimized away
+     */
+    template <typename T>
+    void keep(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile T sink;
+        sink = value;
+#endif
+    }
+
+    /**
+     * @brief Run settings shared by all benchmarks
+     */
+    struct settings {
+        string filter;
+        double min_time_s = 0.2;
+        unsigned int repetitions = 3;
+        bool json = false;
+    };
+
+    /**
+     * @brief Print one result in the selected format
+     * @param fields Extra "key":value pairs for JSON output, already formatted
+     */
+    void report(const settings& s, const string& name, double ns_per_op, double mb_per_s, const string& fields) {
+        if (s.json) {
+            cout << "{\"name\":\"" << name << "\",\"ns_per_op\":" << ns_per_op << ",\"mb_per_s\":" << mb_per_s
+                 << fields << "}" << endl;
+        } else {
+            char line[160];
+            snprintf(line, sizeof(line), "%-28s %14.1f ns/op %12.1f MB/s", name.c_str(), ns_per_op, mb_per_s);
+            cout << line << endl;
+        }
+    }
+
+    /**
+     * @brief Time fn, scaling the iteration count until a run lasts min_time_s
+     * @param bytes Bytes processed per call, for the throughput column
+     * @details Reports the fastest of the repetitions, and the median in JSON.
+     */
+    void run_micro(const settings& s, const string& name, size_t bytes, const function<void()>& fn) {
+        if (name.find(s.filter) == string::npos) {
+            return;
+        }
+        uint64_t iterations = 1;
+        vector<double> ns;
+        while (ns.size() < s.repetitions) {
+            auto start = bench_clock::now();
+            for (uint64_t i = 0; i < iterations; ++i) {
+                fn();
+            }
+            double elapsed = chrono::duration<double>(bench_clock::now() - start).count();
+            if (elapsed < s.min_time_s) {
+                // Calibrating; grow towards the target with some headroom
+                double scale = elapsed > 0 ? s.min_time_s / elapsed * 1.2 : 100;
+                iterations = max<uint64_t>(iterations + 1, (uint64_t)(iterations * min(scale, 100.0)));
+                continue;
+            }
+            ns.push_back(elapsed * 1e9 / (double)iterations);
+        }
+        sort(ns.begin(), ns.end());
+        double best = ns.front();
+        double median = ns[ns.size() / 2];
+        ostringstream fields;
+        fields << ",\"kind\":\"micro\",\"bytes_per_op\":" << bytes << ",\"iterations\":" << iterations
+               << ",\"ns_per_op_median\":" << median;
+        report(s, name, best, bytes / best * 1e3, fields.str());
+    }
+
+    void run_micro_suite(const settings& s) {
+        // Key scheduling and keystream table
+        vector<unsigned char> key(112);
+        for (size_t i = 0; i < key.size(); ++i) key[i] = (unsigned char)(i * 131 + 7);
+        unsigned char key_box[256];
+        run_micro(s, "key_box/schedule", key.size(), [&] {
+            ncm::keystream::schedule(key.data(), key.size(), key_box);
+            keep(key_box[0]);
+        });
+        ncm::keystream::table ks;
+        run_micro(s, "keystream/build", ncm::keystream::period, [&] {
+            ncm::keystream::build(key_box, ks);
+            keep(ks.bytes[0]);
+        });
+
+        // Keystream XOR over one audio chunk, at an odd offset as after a tagged head
+        const size_t chunk = 1024 * 1024;
+        vector<unsigned char> src(chunk, 0x5a), dst(chunk);
+        run_micro(s, "keystream/xor_scalar", chunk, [&] {
+            ncm::keystream::apply_scalar(ks, src.data(), dst.data(), chunk, 13);
+            keep(dst[0]);
+        });
+        run_micro(s, string("keystream/xor_") + ncm::keystream::kernel_name(), chunk, [&] {
+            ncm::keystream::apply(ks, src.data(), dst.data(), chunk, 13);
+            keep(dst[0]);
+        });
+
+        // Base64 of a metadata-sized block
+        string text = bench::make_base64(3 * 1024, 1);
+        vector<unsigned char> decoded(ncm::base64::max_decoded_size(text.size()));
+        run_micro(s, "base64/base64_decode", text.size(), [&] {
+            string out = base64_decode(string_view(text));
+            keep(out.data());
+        });
+        run_micro(s, "base64/decode_scalar", text.size(), [&] {
+            keep(ncm::base64::decode_scalar(text.data(), text.size(), decoded.data()));
+        });
+        run_micro(s, string("base64/decode_") + ncm::base64::kernel_name(), text.size(), [&] {
+            keep(ncm::base64::decode(text.data(), text.size(), decoded.data()));
+        });
+
+        // AES-128-ECB on the key block and a metadata block; the data is
+        // decrypted in place over and over, only its size matters
+        ncm::DecoderContext& ctx = ncm::DecoderContext::local();
+        vector<unsigned char> key_block(128, 0x11), meta_block(2048, 0x22);
+        run_micro(s, "aes_ecb/decrypt_core", key_block.size(), [&] {
+            keep(ctx.decrypt_core(key_block.data(), key_block.size(), key_block.data()));
+        });
+        run_micro(s, "aes_ecb/decrypt_meta", meta_block.size(), [&] {
+            keep(ctx.decrypt_meta(meta_block.data(), meta_block.size(), meta_block.data()));
+        });
+
+        // PKCS#7 removal on a padded metadata block
+        vector<unsigned char> padded(2048, 0x33), unpadded(padded.size());
+        fill(padded.end() - 9, padded.end(), 9);
+        run_micro(s, "pkcs7/unpad", padded.size(), [&] {
+            pkcs7::unpad(padded.data(), (unsigned int)padded.size(), unpadded.data());
+            keep(unpadded[0]);
+        });
+    }
+
+    /**
+     * @brief End-to-end run configuration
+     */
+    struct e2e_settings {
+        size_t file_mb = 16;
+        unsigned int count = 16;
+        vector<unsigned int> threads;
+        filesystem::path dir;
+        bool keep_files = false;
+    };
+
+    vector<unsigned int> parse_thread_list(const string& list) {
+        vector<unsigned int> out;
+        stringstream ss(list);
+        string item;
+        while (getline(ss, item, ',')) {
+            if (item.empty()) continue;
+            unsigned int n = item == "hw" ? thread::hardware_concurrency() : (unsigned int)stoul(item);
+            if (n == 0) throw runtime_error("Thread counts must be at least 1");
+            out.push_back(n);
+        }
+        if (out.empty()) throw runtime_error("Empty thread list");
+        return out;
+    }
+
+    /**
+     * @brief Convert every input once with the given thread count
+     * @return Wall time in seconds
+     * @throws std::runtime_error if any file fails
+     */
+    double convert_all(const vector<filesystem::path>& inputs, const filesystem::path& out_dir, unsigned int threads) {
+        filesystem::remove_all(out_dir);
+        filesystem::create_directories(out_dir);
+
+        ncm::batch_options options;
+        options.threads = threads;
+        ncm::Batch batch(options);
+        auto start = bench_clock::now();
+        for (const auto& in : inputs) {
+            ncm::batch_job job;
+            job.input = in;
+            job.output = out_dir / in.stem();
+            batch.submit(std::move(job));
+        }
+        ncm::batch_result r;
+        while (batch.next(r)) {
+            if (!r.ok()) {
+                throw runtime_error("Conversion failed: " + inputs[r.index].string() + ": " + r.error);
+            }
+        }
+        return chrono::duration<double>(bench_clock::now() - start).count();
+    }
+
+    void run_e2e_suite(const settings& s, const e2e_settings& e) {
+        bool any = false;
+        for (unsigned int t : e.threads) {
+            any = any || ("e2e/threads=" + to_string(t)).find(s.filter) != string::npos;
+        }
+        if (!any) {
+            return;
+        }
+
+        filesystem::path in_dir = e.dir / "in";
+        filesystem::path out_dir = e.dir / "out";
+        filesystem::create_directories(in_dir);
+        vector<filesystem::path> inputs;
+        uint64_t audio_bytes = 0;
+        size_t audio_size = e.file_mb * 1024 * 1024;
+        for (unsigned int i = 0; i < e.count; ++i) {
+            filesystem::path path = in_dir / ("synthetic_" + to_string(i) + ".ncm");
+            bench::write_ncm(path, audio_size, 64 * 1024, i + 1);
+            inputs.push_back(path);
+            audio_bytes += audio_size;
+        }
+
+        // Untimed pass so every run reads from a warm page cache
+        convert_all(inputs, out_dir, e.threads.front());
+
+        for (unsigned int t : e.threads) {
+            string name = "e2e/threads=" + to_string(t);
+            if (name.find(s.filter) == string::npos) continue;
+            vector<double> seconds;
+            for (unsigned int rep = 0; rep < s.repetitions; ++rep) {
+                seconds.push_back(convert_all(inputs, out_dir, t));
+            }
+            sort(seconds.begin(), seconds.end());
+            double best = seconds.front();
+            ostringstream fields;
+            fields << ",\"kind\":\"e2e\",\"threads\":" << t << ",\"files\":" << e.count << ",\"file_mb\":" << e.file_mb
+                   << ",\"seconds\":" << best << ",\"seconds_median\":" << seconds[seconds.size() / 2]
+                   << ",\"files_per_s\":" << e.count / best;
+            report(s, name, best * 1e9 / e.count, audio_bytes / best / 1e6, fields.str());
+        }
+
+        filesystem::remove_all(out_dir);
+        if (!e.keep_files) {
+            filesystem::remove_all(in_dir);
+        }
+    }
+
+    void run_generate(const settings& s, const bench::generate_settings& g) {
+        bench::generate_stats stats = bench::generate(g);
+        double mb = stats.bytes / 1e6;
+        if (s.json) {
+            cout << "{\"name\":\"generate\",\"files\":" << stats.files << ",\"mb\":" << mb
+                 << ",\"seconds\":" << stats.seconds << ",\"files_per_s\":" << stats.files / stats.seconds
+                 << ",\"mb_per_s\":" << mb / stats.seconds << ",\"list\":\"" << (g.dir / "inputs.txt").generic_string()
+                 << "\"}" << endl;
+        } else {
+            cout << "Generated " << stats.files << " files (" << mb << " MB of audio) in " << stats.seconds << " s; list: "
+                 << (g.dir / "inputs.txt").string() << endl;
+        }
+    }
+} // anonymous namespace
+
+/**
+ * @brief Entry point of ncmpp_bench
+ * @return 0 on success, 1 on error
+ */
+int main(int argc, char* argv[]) {
+    try {
+        cmdline::parser cmd;
+        cmd.set_program_name("ncmpp_bench");
+        cmd.add<string>("filter", '\0', "Only run benchmarks whose name contains this text", false, "");
+        cmd.add<unsigned int>("min-time", '\0', "Minimum duration of each timed microbenchmark run in ms", false, 200);
+        cmd.add<unsigned int>("repetitions", 'r', "Timed runs per benchmark; the fastest is reported", false, 3);
+        cmd.add<unsigned int>("size", '\0', "Audio size of each synthetic file in MiB", false, 16);
+        cmd.add<unsigned int>("count", 'n', "Number of synthetic files for the end-to-end runs or --generate", false, 16);
+        cmd.add<string>("threads", 't', "Comma-separated thread counts for the end-to-end runs (hw = all cores); --generate uses the largest",
+                        false, "1,2,4,hw");
+        cmd.add<string>("dir", '\0', "Working directory for synthetic files (default: a temporary directory)",
+                        false, "");
+        cmd.add("keep", '\0', "Keep the synthetic input files");
+        cmd.add("verify", '\0', "Only run the encoder round-trip checks of the decoding kernels");
+        cmd.add<string>("generate", '\0', "Only write -n synthetic files and an inputs.txt list below this directory",
+                        false, "");
+        cmd.add<string>("mix", '\0', "Audio size mix for --generate, e.g. 512K:50,4M:40,64M:10 (default: --size)",
+                        false, "");
+        cmd.add<unsigned int>("cover", '\0', "Cover size of generated files in KiB", false, 64);
+        cmd.add<unsigned long long>("seed", '\0', "Seed of the first generated file", false, 1);
+        cmd.add("json", '\0', "Print one JSON object per result instead of a table");
+        cmd.add("help", 'h', "Print this help message");
+        cmd.parse_check(argc, argv);
+
+        settings s;
+        s.filter = cmd.get<string>("filter");
+        s.min_time_s = cmd.get<unsigned int>("min-time") / 1000.0;
+        s.repetitions = max(1u, cmd.get<unsigned int>("repetitions"));
+        s.json = cmd.exist("json");
+
+        e2e_settings e;
+        e.file_mb = cmd.get<unsigned int>("size");
+        e.count = max(1u, cmd.get<unsigned int>("count"));
+        e.threads = parse_thread_list(cmd.get<string>("threads"));
+        e.keep_files = cmd.exist("keep");
+        bool temp_dir = cmd.get<string>("dir").empty();
+        e.dir = temp_dir ? filesystem::temp_directory_path() / "ncmpp_bench" : filesystem::path(cmd.get<string>("dir"));
+
+        if (cmd.exist("verify")) {
+            bench::run_verify(cout);
+            return 0;
+        }
+        if (!cmd.get<string>("generate").empty()) {
+            bench::generate_settings g;
+            g.dir = cmd.get<string>("generate");
+            g.count = e.count;
+            string mix = cmd.get<string>("mix");
+            g.mix = bench::parse_size_mix(mix.empty() ? to_string(e.file_mb) + "M" : mix);
+            g.cover_size = (size_t)cmd.get<unsigned int>("cover") * 1024;
+            g.seed = cmd.get<unsigned long long>("seed");
+            g.threads = *max_element(e.threads.begin(), e.threads.end());
+            run_generate(s, g);
+            return 0;
+        }
+
+        if (s.json) {
+            cout << "{\"name\":\"context\",\"keystream_kernel\":\"" << ncm::keystream::kernel_name()
+                 << "\",\"base64_kernel\":\"" << ncm::base64::kernel_name()
+                 << "\",\"hardware_threads\":" << thread::hardware_concurrency() << "}" << endl;
+        } else {
+            cout << "keystream kernel: " << ncm::keystream::kernel_name() << ", base64 kernel: "
+                 << ncm::base64::kernel_name() << ", hardware threads: " << thread::hardware_concurrency() << endl;
+        }
+
+        run_micro_suite(s);
+        run_e2e_suite(s, e);
+
+        if (temp_dir && !e.keep_files) {
+            error_code ec;
+            filesystem::remove_all(e.dir, ec);
+        }
+        return 0;
+    } catch (const exception& e) {
+        cerr << "[ERROR] " << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,92 @@
+/**
+ * @file synthetic.cpp
+ * @brief Synthetic NCM container builder
+ * @details The RC4 key is derived from the seed instead of drawn at random,
+ * so the same seed always yields the same file.
+ */
+
+#include "synthetic.h"
+#include "base64.h"
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+using namespace std;
+
+namespace bench {
+
+namespace {
+    /** @brief Length of the RC4 key, as found in real files */
+    constexpr size_t RC4_KEY_SIZE = 112;
+
+    /** @brief "fLaC" and the header of a final, empty STREAMINFO block */
+    const unsigned char FLAC_HEAD[] = {'f', 'L', 'a', 'C', 0x80, 0, 0, 34};
+    constexpr size_t FLAC_HEAD_SIZE = sizeof(FLAC_HEAD) + 34;
+} // anonymous namespace
+
+void fill_random(unsigned char* p, size_t n, uint64_t seed) {
+    mt19937_64 rng(seed);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v = rng();
+        memcpy(p + i, &v, 8);
+    }
+    uint64_t v = rng();
+    memcpy(p + i, &v, n - i);
+}
+
+void make_audio(vector<unsigned char>& out, size_t audio_size, uint64_t seed) {
+    audio_size = max(audio_size, FLAC_HEAD_SIZE);
+    out.resize(audio_size);
+    memcpy(out.data(), FLAC_HEAD, sizeof(FLAC_HEAD));
+    memset(out.data() + sizeof(FLAC_HEAD), 0, 34);
+    fill_random(out.data() + FLAC_HEAD_SIZE, audio_size - FLAC_HEAD_SIZE, seed);
+}
+
+vector<unsigned char> make_cover(size_t size, uint64_t seed) {
+    vector<unsigned char> cover(size);
+    if (size >= 4) {
+        fill_random(cover.data(), size, seed ^ 0x9e3779b97f4a7c15ull);
+        const unsigned char soi[] = {0xff, 0xd8, 0xff, 0xe0};
+        memcpy(cover.data(), soi, sizeof(soi));
+    }
+    return cover;
+}
+
+ncm::encode_input make_input(const vector<unsigned char>& audio, const vector<unsigned char>& cover, uint64_t seed) {
+    ncm::track_info track;
+    track.format = "flac";
+    track.music_id = seed;
+    track.music_name = "Synthetic " + to_string(seed);
+    track.artists = {"Benchmark"};
+    track.album = "ncmpp_bench";
+    track.bitrate = 999000;
+    track.duration = 240000;
+
+    ncm::encode_input input;
+    input.audio = audio.data();
+    input.audio_size = audio.size();
+    input.cover = cover.data();
+    input.cover_size = cover.size();
+    input.metadata = ncm::metadata_json(track);
+    input.key.resize(RC4_KEY_SIZE);
+    fill_random((unsigned char*)input.key.data(), RC4_KEY_SIZE, ~seed);
+    return input;
+}
+
+void write_ncm(const filesystem::path& path, size_t audio_size, size_t cover_size, uint64_t seed) {
+    // Kept per thread, so generating many files does not reallocate
+    thread_local vector<unsigned char> audio;
+    make_audio(audio, audio_size, seed);
+    vector<unsigned char> cover = make_cover(cover_size, seed);
+    ncm::ncmEncode(make_input(audio, cover, seed), path.string());
+}
+
+string make_base64(size_t size, uint64_t seed) {
+    mt19937_64 rng(seed);
+    string text(size, ' ');
+    for (auto& c : text) c = (char)(' ' + rng() % 95);
+    return base64_encode((const unsigned char*)text.data(), text.size());
+}
+
+} // namespace bench
@@ -0,0 +1,66 @@
+/**
+ * @file synthetic.h
+ * @brief Synthetic NCM containers for benchmarks
+ * @details Wraps random audio behind a minimal FLAC header into valid NCM
+ * files through ncm::ncmEncode(), so end-to-end runs and load tests need no
+ * real music library. Everything is derived from a seed and reproducible.
+ */
+
+#pragma once
+#include "ncmlib/encoder.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+/**
+ * @brief Random audio starting with "fLaC" and an empty STREAMINFO block
+ * @param out Receives audio_size bytes; reused to avoid reallocating
+ * @param audio_size Total size, at least the 42-byte header
+ * @param seed Random seed
+ */
+void make_audio(std::vector<unsigned char>& out, std::size_t audio_size, std::uint64_t seed);
+
+/**
+ * @brief Encoder input for one synthetic track
+ * @param audio Audio from make_audio(), referenced by the result
+ * @param cover Cover bytes, referenced by the result (may be empty)
+ * @param seed Seed of the track id, title and RC4 key
+ */
+ncm::encode_input make_input(const std::vector<unsigned char>& audio, const std::vector<unsigned char>& cover,
+                             std::uint64_t seed);
+
+/**
+ * @brief Random "JPEG" cover: a JPEG start marker followed by random bytes
+ * @param size Cover size (0 for none)
+ * @param seed Random seed
+ */
+std::vector<unsigned char> make_cover(std::size_t size, std::uint64_t seed);
+
+/**
+ * @brief Write one NCM container to a file
+ * @param path Output path
+ * @param audio_size Bytes of audio including the FLAC header
+ * @param cover_size Bytes of cover (0 for none)
+ * @param seed Seed of the audio, cover and RC4 key
+ * @throws std::runtime_error if encoding or writing fails
+ */
+void write_ncm(const std::filesystem::path& path, std::size_t audio_size, std::size_t cover_size,
+               std::uint64_t seed);
+
+/**
+ * @brief Random printable metadata-sized text, base64-encoded
+ * @param size Length of the text before encoding
+ * @param seed Random seed
+ */
+std::string make_base64(std::size_t size, std::uint64_t seed);
+
+/**
+ * @brief Fill a buffer with random bytes
+ */
+void fill_random(unsigned char* p, std::size_t n, std::uint64_t seed);
+
+} // namespace bench
@@ -0,0 +1,407 @@
+/**
+ * @file verify.cpp
+ * @brief Round-trip checks of the decoding kernels
+ * @details Audio sizes straddle the keystream period and the 1 MiB chunk
+ * size, keys cover the shortest and longest RC4 key lengths, and the
+ * Decoder is fed chunks at odd offsets to exercise unaligned kernel entry.
+ * Tagged FLAC and ID3 heads are parsed back with readers independent of
+ * the writers.
+ */
+
+#include "verify.h"
+#include "synthetic.h"
+#include "base64.h"
+#include "base64_simd.h"
+#include "keystream.h"
+#include "tags.h"
+#include "ncmlib/decoder.h"
+#include "ncmlib/ncmdump.h"
+#include "ncmlib/probe.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using namespace std;
+
+namespace bench {
+
+namespace {
+    void check(bool ok, const string& what) {
+        if (!ok) throw runtime_error("Round-trip mismatch: " + what);
+    }
+
+    /**
+     * @brief Encode and decode one track through ncmDecode() and Decoder
+     */
+    void roundtrip(size_t audio_size, size_t cover_size, size_t key_size, uint64_t seed) {
+        string name = "audio=" + to_string(audio_size) + " cover=" + to_string(cover_size) +
+                      " key=" + to_string(key_size);
+        vector<unsigned char> audio;
+        make_audio(audio, audio_size, seed);
+        vector<unsigned char> cover = make_cover(cover_size, seed);
+        ncm::encode_input input = make_input(audio, cover, seed);
+        input.key.resize(key_size, 'k');
+        vector<unsigned char> file = ncm::ncmEncode(input);
+
+        // Sequential decoding into callbacks
+        vector<unsigned char> out, cover_out;
+        ncm::dump_sink sink;
+        sink.on_cover = [&](const unsigned char* data, size_t len) { cover_out.assign(data, data + len); };
+        sink.on_audio = [&](const unsigned char* data, size_t len) {
+            size_t pos = out.size();
+            out.resize(pos + len);
+            memcpy(out.data() + pos, data, len);
+        };
+        ncm::dump_result r = ncm::ncmDecode(file.data(), file.size(), sink);
+        check(r.format == "flac", name + ": format");
+        check(out == audio, name + ": ncmDecode audio");
+        check(cover_out == cover, name + ": cover");
+
+        // Position-independent decryption in uneven chunks
+        ncm::Decoder decoder;
+        check(decoder.parse_header(file.data(), file.size()) == 0, name + ": header");
+        check(decoder.audio_offset() + audio.size() == file.size(), name + ": audio offset");
+        vector<unsigned char> chunked(audio.size());
+        mt19937_64 rng(seed);
+        for (size_t pos = 0; pos < audio.size();) {
+            size_t len = min<size_t>(audio.size() - pos, 1 + rng() % 70000);
+            decoder.decrypt(file.data() + decoder.audio_offset() + pos, chunked.data() + pos, len, pos);
+            pos += len;
+        }
+        check(chunked == audio, name + ": Decoder audio");
+    }
+
+    void check_keystream() {
+        unsigned char key[112];
+        fill_random(key, sizeof(key), 7);
+        unsigned char key_box[256];
+        ncm::keystream::schedule(key, sizeof(key), key_box);
+        ncm::keystream::table ks;
+        ncm::keystream::build(key_box, ks);
+
+        vector<unsigned char> src(4096 + 300), fast(src.size()), slow(src.size());
+        fill_random(src.data(), src.size(), 8);
+        for (size_t offset = 0; offset < 300; ++offset) {
+            for (size_t len : {0, 1, 15, 31, 63, 64, 255, 256, 257, 4096}) {
+                ncm::keystream::apply(ks, src.data() + offset, fast.data(), len, offset * 7);
+                ncm::keystream::apply_scalar(ks, src.data() + offset, slow.data(), len, offset * 7);
+                check(memcmp(fast.data(), slow.data(), len) == 0,
+                      string("keystream ") + ncm::keystream::kernel_name() + " at offset " + to_string(offset) +
+                          " len " + to_string(len));
+            }
+        }
+    }
+
+    void check_base64() {
+        for (size_t size = 0; size < 700; size += 7) {
+            string text = make_base64(size, size);
+            vector<unsigned char> fast(ncm::base64::max_decoded_size(text.size()));
+            vector<unsigned char> slow(fast.size());
+            size_t n = ncm::base64::decode(text.data(), text.size(), fast.data());
+            size_t m = ncm::base64::decode_scalar(text.data(), text.size(), slow.data());
+            string legacy = base64_decode(string_view(text));
+            check(n == m && n == legacy.size() && memcmp(fast.data(), slow.data(), n) == 0 &&
+                      memcmp(fast.data(), legacy.data(), n) == 0,
+                  string("base64 ") + ncm::base64::kernel_name() + " on " + to_string(text.size()) + " bytes");
+        }
+    }
+
+    void check_probe() {
+        ncm::track_info track;
+        track.format = "mp3";
+        track.music_id = 1234567890123ull;
+        track.music_name = "Tr\"ack \\ \xe6\xad\x8c";
+        track.artists = {"A", "B\xc3\xa9"};
+        track.album = "Album";
+        track.bitrate = 320000;
+        track.duration = 123456;
+
+        vector<unsigned char> audio(1000, 0x42);
+        ncm::encode_input input;
+        input.audio = audio.data();
+        input.audio_size = audio.size();
+        input.metadata = ncm::metadata_json(track);
+
+        filesystem::path path = filesystem::temp_directory_path() / "ncmpp_bench_verify.ncm";
+        ncm::ncmEncode(input, path.string());
+        ncm::track_info read = ncm::probe(path);
+        error_code ec;
+        filesystem::remove(path, ec);
+
+        check(read.format == track.format && read.music_id == track.music_id &&
+                  read.music_name == track.music_name && read.artists == track.artists &&
+                  read.album == track.album && read.bitrate == track.bitrate && read.duration == track.duration,
+              "metadata");
+        check(read.cover_size == 0 && read.audio_size == audio.size(), "probe offsets");
+    }
+
+    uint32_t be(const unsigned char* p, int bytes) {
+        uint32_t v = 0;
+        for (int i = 0; i < bytes; ++i) v = v << 8 | p[i];
+        return v;
+    }
+
+    uint32_t le32(const unsigned char* p) {
+        return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    uint32_t syncsafe(const unsigned char* p) {
+        return (uint32_t)p[0] << 21 | (uint32_t)p[1] << 14 | (uint32_t)p[2] << 7 | p[3];
+    }
+
+    void append(vector<unsigned char>& out, const string& s) {
+        out.insert(out.end(), s.begin(), s.end());
+    }
+
+    void append_le32(vector<unsigned char>& out, uint32_t v) {
+        for (int i = 0; i < 4; ++i) out.push_back((unsigned char)(v >> (8 * i)));
+    }
+
+    void append_flac_block(vector<unsigned char>& out, unsigned char type, bool last, const vector<unsigned char>& body) {
+        out.push_back((unsigned char)(type | (last ? 0x80 : 0)));
+        out.push_back((unsigned char)(body.size() >> 16));
+        out.push_back((unsigned char)(body.size() >> 8));
+        out.push_back((unsigned char)body.size());
+        out.insert(out.end(), body.begin(), body.end());
+    }
+
+    struct flac_block {
+        unsigned char type;
+        bool last;
+        vector<unsigned char> body;
+    };
+
+    /**
+     * @brief Split a FLAC head into its metadata blocks
+     * @return Blocks up to the one flagged last; the flag must be on no other
+     */
+    vector<flac_block> parse_flac(const vector<unsigned char>& head, const string& name) {
+        check(head.size() >= 4 && memcmp(head.data(), "fLaC", 4) == 0, name + ": FLAC signature");
+        vector<flac_block> blocks;
+        size_t pos = 4;
+        while (blocks.empty() || !blocks.back().last) {
+            check(pos + 4 <= head.size(), name + ": FLAC block header");
+            size_t size = be(head.data() + pos + 1, 3);
+            check(pos + 4 + size <= head.size(), name + ": FLAC block size");
+            blocks.push_back({(unsigned char)(head[pos] & 0x7f), (head[pos] & 0x80) != 0,
+                              vector<unsigned char>(head.begin() + pos + 4, head.begin() + pos + 4 + size)});
+            pos += 4 + size;
+        }
+        check(pos == head.size(), name + ": bytes after the last FLAC block");
+        return blocks;
+    }
+
+    /**
+     * @brief Vendor string and comments of a VORBIS_COMMENT body
+     */
+    vector<string> parse_comments(const vector<unsigned char>& body, string& vendor, const string& name) {
+        check(body.size() >= 8, name + ": comment block size");
+        size_t pos = 4 + le32(body.data());
+        check(pos + 4 <= body.size(), name + ": vendor length");
+        vendor.assign(body.begin() + 4, body.begin() + pos);
+        uint32_t count = le32(body.data() + pos);
+        pos += 4;
+        vector<string> comments;
+        for (uint32_t i = 0; i < count; ++i) {
+            check(pos + 4 <= body.size() && pos + 4 + le32(body.data() + pos) <= body.size(), name + ": comment length");
+            size_t len = le32(body.data() + pos);
+            comments.emplace_back(body.begin() + pos + 4, body.begin() + pos + 4 + len);
+            pos += 4 + len;
+        }
+        check(pos == body.size(), name + ": bytes after the comments");
+        return comments;
+    }
+
+    void check_flac_tags() {
+        vector<unsigned char> streaminfo(34);
+        fill_random(streaminfo.data(), streaminfo.size(), 11);
+        vector<unsigned char> comments;
+        append_le32(comments, 3);
+        append(comments, "ref");
+        append_le32(comments, 3);
+        for (string c : {"TITLE=Old", "GENRE=Pop", "artist=Old"}) {
+            append_le32(comments, (uint32_t)c.size());
+            append(comments, c);
+        }
+        vector<unsigned char> old_picture(40, 0x11);
+        vector<unsigned char> padding(100, 0);
+        vector<unsigned char> cover = make_cover(300, 12);
+
+        // STREAMINFO, comments, an old picture and padding, then the first frame
+        vector<unsigned char> audio;
+        append(audio, "fLaC");
+        append_flac_block(audio, 0, false, streaminfo);
+        append_flac_block(audio, 4, false, comments);
+        append_flac_block(audio, 6, false, old_picture);
+        append_flac_block(audio, 1, true, padding);
+        size_t header_end = audio.size();
+        append(audio, "\xff\xf8" "frame");
+
+        ncm::tags::tag_set tags;
+        tags.cover = cover.data();
+        tags.cover_size = cover.size();
+        tags.title = "New \xe6\xad\x8c";
+        tags.artists = {"A", "B"};
+        tags.album = "Album";
+        check(ncm::tags::head_size("flac", audio.data(), 8) > 8, "flac: head_size asks for more");
+        check(ncm::tags::head_size("flac", audio.data(), audio.size()) == header_end, "flac: head_size");
+
+        vector<unsigned char> head;
+        size_t consumed = 0;
+        check(ncm::tags::rewrite_head("flac", audio.data(), audio.size(), tags, head, consumed), "flac: rewrite");
+        check(consumed == header_end, "flac: consumed");
+        vector<flac_block> blocks = parse_flac(head, "flac");
+        check(blocks.size() == 4 && blocks[0].type == 0 && blocks[1].type == 4 && blocks[2].type == 6 &&
+                  blocks[3].type == 1,
+              "flac: block order");
+        check(blocks[0].body == streaminfo && blocks[3].body == padding, "flac: kept blocks");
+
+        string vendor;
+        vector<string> written = parse_comments(blocks[1].body, vendor, "flac");
+        check(vendor == "ref", "flac: vendor kept");
+        check(written == vector<string>{"GENRE=Pop", "TITLE=" + tags.title, "ARTIST=A", "ARTIST=B", "ALBUM=Album"},
+              "flac: comments");
+
+        const vector<unsigned char>& pic = blocks[2].body;
+        check(pic.size() > 32 && be(pic.data(), 4) == 3, "flac: picture type");
+        size_t mime_len = be(pic.data() + 4, 4);
+        check(string(pic.begin() + 8, pic.begin() + 8 + mime_len) == "image/jpeg", "flac: picture MIME type");
+        size_t pos = 8 + mime_len;
+        pos += 4 + be(pic.data() + pos, 4) + 16;
+        check(be(pic.data() + pos, 4) == cover.size() &&
+                  vector<unsigned char>(pic.begin() + pos + 4, pic.end()) == cover,
+              "flac: picture data");
+
+        // STREAMINFO flagged last: the flag moves to the new comment block
+        vector<unsigned char> bare;
+        append(bare, "fLaC");
+        append_flac_block(bare, 0, true, streaminfo);
+        ncm::tags::tag_set text;
+        text.title = "T";
+        check(ncm::tags::rewrite_head("flac", bare.data(), bare.size(), text, head, consumed), "flac bare: rewrite");
+        check(consumed == bare.size(), "flac bare: consumed");
+        blocks = parse_flac(head, "flac bare");
+        check(blocks.size() == 2 && blocks[0].type == 0 && !blocks[0].last && blocks[1].type == 4,
+              "flac bare: last block flag");
+        check(parse_comments(blocks[1].body, vendor, "flac bare") == vector<string>{"TITLE=T"} && vendor == "ncmpp",
+              "flac bare: comments");
+    }
+
+    /**
+     * @brief Frames of an ID3v2 tag by id, in order
+     * @return Pairs of frame id and body
+     */
+    vector<pair<string, vector<unsigned char>>> parse_id3(const vector<unsigned char>& head, unsigned char major,
+                                                           const string& name) {
+        check(head.size() >= 10 && memcmp(head.data(), "ID3", 3) == 0 && head[3] == major && head[5] == 0,
+              name + ": ID3 header");
+        check(10 + syncsafe(head.data() + 6) == head.size(), name + ": ID3 tag size");
+        vector<pair<string, vector<unsigned char>>> frames;
+        size_t pos = 10;
+        while (pos < head.size()) {
+            check(pos + 10 <= head.size(), name + ": frame header");
+            size_t size = major == 4 ? syncsafe(head.data() + pos + 4) : be(head.data() + pos + 4, 4);
+            check(pos + 10 + size <= head.size(), name + ": frame size");
+            frames.emplace_back(string(head.begin() + pos, head.begin() + pos + 4),
+                                vector<unsigned char>(head.begin() + pos + 10, head.begin() + pos + 10 + size));
+            pos += 10 + size;
+        }
+        return frames;
+    }
+
+    void append_id3_frame(vector<unsigned char>& out, const char* id, const string& body) {
+        append(out, id);
+        for (int i = 3; i >= 0; --i) out.push_back((unsigned char)(body.size() >> (8 * i)));
+        out.push_back(0);
+        out.push_back(0);
+        append(out, body);
+    }
+
+    vector<unsigned char> bytes(const string& s) {
+        return vector<unsigned char>(s.begin(), s.end());
+    }
+
+    void check_id3_tags() {
+        vector<unsigned char> cover = make_cover(300, 13);
+        ncm::tags::tag_set tags;
+        tags.cover = cover.data();
+        tags.cover_size = cover.size();
+        tags.title = "\xe6\xad\x8c";                // U+6B4C
+        tags.artists = {"A", "B\xc3\xa9"};           // U+00E9
+        tags.album = "\xf0\x9f\x98\x80";           // U+1F600, a surrogate pair in UTF-16
+        tags.duration_ms = 123456;
+
+        // v2.3 tag with a kept TCON and a replaced TIT2, then the first frame
+        vector<unsigned char> frames;
+        append_id3_frame(frames, "TCON", string("\0Pop", 4));
+        append_id3_frame(frames, "TIT2", string("\0Old", 4));
+        vector<unsigned char> audio = {'I', 'D', '3', 3, 0, 0, 0, 0, 0, (unsigned char)frames.size()};
+        audio.insert(audio.end(), frames.begin(), frames.end());
+        size_t tag_end = audio.size();
+        append(audio, "\xff\xfb" "frame");
+        check(ncm::tags::head_size("mp3", audio.data(), audio.size()) == tag_end, "id3v2.3: head_size");
+
+        vector<unsigned char> head;
+        size_t consumed = 0;
+        check(ncm::tags::rewrite_head("mp3", audio.data(), audio.size(), tags, head, consumed), "id3v2.3: rewrite");
+        check(consumed == tag_end, "id3v2.3: consumed");
+        auto parsed = parse_id3(head, 3, "id3v2.3");
+        check(parsed.size() == 6 && parsed[0].first == "TCON" && parsed[1].first == "TIT2" &&
+                  parsed[2].first == "TPE1" && parsed[3].first == "TALB" && parsed[4].first == "TLEN" &&
+                  parsed[5].first == "APIC",
+              "id3v2.3: frame order");
+        check(parsed[0].second == bytes(string("\0Pop", 4)), "id3v2.3: kept frame");
+        check(parsed[1].second == vector<unsigned char>{1, 0xFF, 0xFE, 0x4C, 0x6B}, "id3v2.3: UTF-16 title");
+        check(parsed[2].second == vector<unsigned char>{1, 0xFF, 0xFE, 'A', 0, '/', 0, 'B', 0, 0xE9, 0},
+              "id3v2.3: joined UTF-16 artists");
+        check(parsed[3].second == vector<unsigned char>{1, 0xFF, 0xFE, 0x3D, 0xD8, 0x00, 0xDE},
+              "id3v2.3: UTF-16 surrogate pair");
+        check(parsed[4].second == bytes(string("\0" "123456", 7)), "id3v2.3: Latin-1 duration");
+        vector<unsigned char> apic = bytes(string("\0image/jpeg\0\x03" "Front Cover\0", 25));
+        apic.insert(apic.end(), cover.begin(), cover.end());
+        check(parsed[5].second == apic, "id3v2.3: picture");
+
+        // No tag: a new v2.4 tag with syncsafe frame sizes and UTF-8 text
+        vector<unsigned char> bare = {0xFF, 0xFB, 0x90, 0x00};
+        check(ncm::tags::head_size("mp3", bare.data(), bare.size()) > bare.size(), "id3v2.4: head_size asks for more");
+        bare.resize(64, 0);
+        check(ncm::tags::head_size("mp3", bare.data(), bare.size()) == 0, "id3v2.4: head_size without a tag");
+        check(ncm::tags::rewrite_head("mp3", bare.data(), bare.size(), tags, head, consumed), "id3v2.4: rewrite");
+        check(consumed == 0, "id3v2.4: consumed");
+        parsed = parse_id3(head, 4, "id3v2.4");
+        check(parsed.size() == 5 && parsed[1].first == "TPE1" && parsed[4].first == "APIC", "id3v2.4: frames");
+        check(parsed[0].second == bytes("\x03" + tags.title), "id3v2.4: UTF-8 title");
+        check(parsed[1].second == bytes(string("\x03" "A\0B\xc3\xa9", 6)), "id3v2.4: NUL-separated artists");
+        check(parsed[4].second.size() == 25 + cover.size() &&
+                  equal(cover.begin(), cover.end(), parsed[4].second.end() - cover.size()),
+              "id3v2.4: picture");
+    }
+} // anonymous namespace
+
+void run_verify(ostream& log) {
+    check_keystream();
+    log << "verify/keystream_" << ncm::keystream::kernel_name() << " ok" << endl;
+    check_base64();
+    log << "verify/base64_" << ncm::base64::kernel_name() << " ok" << endl;
+
+    uint64_t seed = 1;
+    for (size_t audio_size : {42, 255, 256, 257, 70001, 1024 * 1024 - 1, 1024 * 1024 + 13, 3 * 1024 * 1024 + 7}) {
+        for (size_t key_size : {1, 112, 255}) {
+            roundtrip(audio_size, (seed % 3) * 1000, key_size, seed);
+            seed++;
+        }
+    }
+    log << "verify/roundtrip ok" << endl;
+    check_probe();
+    log << "verify/metadata ok" << endl;
+    check_flac_tags();
+    check_id3_tags();
+    log << "verify/tags ok" << endl;
+}
+
+} // namespace bench
@@ -0,0 +1,23 @@
+/**
+ * @file verify.h
+ * @brief Round-trip checks of the decoding kernels
+ * @details Encodes random audio with ncm::ncmEncode() and decodes it through
+ * every path, and compares the dispatched SIMD kernels with their scalar
+ * references, so a kernel change that breaks output is caught before its
+ * speed is measured. The FLAC and ID3 heads written by the tag embedder are
+ * parsed back as well.
+ */
+
+#pragma once
+#include <ostream>
+
+namespace bench {
+
+/**
+ * @brief Run all round-trip checks
+ * @param log Receives one line per passed check
+ * @throws std::runtime_error naming the first mismatch
+ */
+void run_verify(std::ostream& log);
+
+} // namespace bench
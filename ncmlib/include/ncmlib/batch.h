@@ -0,0 +1,169 @@
+/**
+ * @file batch.h
+ * @brief Batch conversion API for applications embedding ncmlib
+ * @details Runs many dumps on an internal thread pool or a caller-supplied
+ * executor and reports each file through a callback or a completion queue.
+ * Per-file failures are reported as results rather than thrown, so a long
+ * batch keeps going and pays no exception unwinding on the caller's side.
+ */
+
+#pragma once
+
+#include "ncmlib/error.h"
+#include "ncmlib/ncmdump.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace ncm {
+
+/**
+ * @brief One file to convert
+ * @details The input is either a path or a container held in memory.
+ */
+struct batch_job {
+    /** @brief Path to the input .ncm file; unused when data is set */
+    std::filesystem::path input;
+
+    /** @brief In-memory container; must stay valid until the job's result is reported */
+    const unsigned char* data = nullptr;
+
+    /** @brief Size of data */
+    std::size_t size = 0;
+
+    /** @brief Output path without extension */
+    std::filesystem::path output;
+};
+
+/**
+ * @brief Outcome of one job
+ */
+struct batch_result {
+    /** @brief Submission index of the job, counting from 0 for each Batch */
+    std::size_t index = 0;
+
+    /** @brief Format and written files; left default on failure */
+    dump_result result;
+
+    /** @brief Failure description, empty on success */
+    std::string error;
+
+    /** @brief Failure category, none on success */
+    error_kind kind = error_kind::none;
+
+    /** @brief Time spent on the job, excluding time queued */
+    std::uint64_t elapsed_us = 0;
+
+    bool ok() const { return error.empty(); }
+};
+
+/**
+ * @brief Counters passed to the progress callback after each job
+ */
+struct batch_progress {
+    /** @brief Jobs submitted so far */
+    std::size_t submitted = 0;
+
+    /** @brief Jobs finished so far, including failures */
+    std::size_t completed = 0;
+
+    /** @brief Jobs that failed */
+    std::size_t failed = 0;
+};
+
+/**
+ * @brief Batch configuration
+ */
+struct batch_options {
+    /** @brief Options applied to every dump */
+    dump_options dump;
+
+    /** @brief Threads of the internal pool; 0 uses the hardware concurrency */
+    unsigned int threads = 0;
+
+    /**
+     * @brief Caller-supplied executor running each job; replaces the internal pool
+     * @details Called once per job with a task that must be run exactly once.
+     * If it throws, the job runs on the submitting thread instead.
+     */
+    std::function<void(std::function<void()>)> executor;
+
+    /**
+     * @brief Called with each result; leave empty to collect results with Batch::next()
+     * @details Runs on the thread that finished the job. Calls are serialized.
+     */
+    std::function<void(const batch_result&)> on_result;
+
+    /** @brief Called after each job; runs like on_result and after it */
+    std::function<void(const batch_progress&)> on_progress;
+};
+
+/**
+ * @brief Converter for many files sharing one set of options and threads
+ * @details Usage:
+ * 1. Submit jobs with submit(); they start right away
+ * 2. Receive results through on_result, or pull them with next()
+ * 3. wait() or destroy the batch to block until every job finished,
+ *    or cancel() first to drop the jobs that have not started
+ *
+ * submit(), next(), wait() and cancel() may be called from different threads.
+ */
+class Batch {
+public:
+    explicit Batch(batch_options options = batch_options());
+    ~Batch();
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+    /**
+     * @brief Queue one job
+     * @return Submission index, reported back in batch_result::index
+     */
+    std::size_t submit(batch_job job);
+
+    /**
+     * @brief Queue a range of jobs
+     * @return Submission index of the first job
+     */
+    template <typename It>
+    std::size_t submit(It first, It last) {
+        std::size_t index = progress().submitted;
+        for (bool at_first = true; first != last; ++first, at_first = false) {
+            std::size_t i = submit(batch_job(*first));
+            if (at_first) index = i;
+        }
+        return index;
+    }
+
+    /**
+     * @brief Take the next completed result, blocking until one is available
+     * @return false once every submitted job has been returned; always false
+     * when on_result is set
+     */
+    bool next(batch_result& out);
+
+    /** @brief Block until every submitted job finished */
+    void wait();
+
+    /**
+     * @brief Drop the jobs that have not started
+     * @details Jobs already running finish normally. Every other job, including
+     * any submitted later, is reported without being run: error "Cancelled",
+     * kind error_kind::cancelled, its files untouched. Reporting them takes
+     * microseconds each, so wait() and the destructor return soon after the
+     * running jobs. May be called from the callbacks and more than once.
+     */
+    void cancel();
+
+    /** @brief Current counters */
+    batch_progress progress() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+} // namespace ncm
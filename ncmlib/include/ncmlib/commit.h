@@ -0,0 +1,83 @@
+/**
+ * @file commit.h
+ * @brief Atomic and durable placement of finished output files
+ * @details Outputs are written to a hidden temporary file next to their
+ * target and renamed over it once complete, so an interrupted write never
+ * leaves a truncated file under the final name. CommitBatch additionally
+ * makes the data durable before the rename, with one flush per directory
+ * and batch instead of one per file.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace ncm {
+
+/**
+ * @brief Temporary path for writing target
+ * @return A hidden, process-unique name in the directory of target
+ * (".<name>.<pid>-<n>.part", or ".ncmpp.<pid>-<n>.part" if that name would
+ * exceed 255 bytes)
+ */
+std::string temp_path(const std::string& target);
+
+/**
+ * @brief Atomically replace target by temp
+ * @throws std::runtime_error if the rename fails; temp is left in place
+ */
+void commit_file(const std::string& temp, const std::string& target);
+
+/**
+ * @brief Durable commits, grouped per directory
+ * @details Files are queued as finished temporary files. A flush makes
+ * their data durable, renames them into place and then syncs each directory
+ * once. On Linux writeback of the whole batch is started first, so the
+ * per-file fdatasync() calls mostly wait for I/O already in flight;
+ * elsewhere each file is flushed in turn. After a crash a target either
+ * holds its previous content or the complete new file.
+ *
+ * Thread-safe. A flush runs on the thread that triggers it; other threads
+ * keep queueing. Callbacks must not call flush().
+ */
+class CommitBatch {
+public:
+    /** @brief Called after a file was committed; the error is empty on success */
+    using callback = std::function<void(const std::string& error)>;
+
+    /** @param max_files Queued files that trigger a flush from add() */
+    explicit CommitBatch(std::size_t max_files = 256);
+
+    /** @brief Flushes the files still queued */
+    ~CommitBatch();
+
+    CommitBatch(const CommitBatch&) = delete;
+    CommitBatch& operator=(const CommitBatch&) = delete;
+
+    /**
+     * @brief Queue a closed temporary file to replace target
+     * @param on_done Optional; runs on the flushing thread once target is durable or the commit failed
+     */
+    void add(const std::string& temp, const std::string& target, callback on_done = callback());
+
+    /**
+     * @brief Commit everything queued so far
+     * @details Also waits for batches other threads took from the queue
+     * before this call, so every file queued earlier is committed on return.
+     * Failures are reported to the callbacks and logged; the temporary file
+     * of a failed commit is removed.
+     */
+    void flush();
+
+    /** @brief Number of files committed successfully so far */
+    std::size_t committed() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+} // namespace ncm
@@ -0,0 +1,76 @@
+/**
+ * @file decoder.h
+ * @brief Low-level NCM decoding API for callers that perform their own I/O
+ * @details Splits NCM processing into header parsing and position-independent
+ * audio decryption so reads and writes can be scheduled by the caller, for
+ * example through an asynchronous I/O engine.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace ncm {
+
+/**
+ * @brief Header parser and audio decryptor for a single NCM file
+ * @details Usage:
+ * 1. Call parse_header() with the first bytes of the file until it returns 0
+ * 2. Read the cover and audio at cover_offset() and audio_offset()
+ * 3. Call decrypt() on audio chunks in any order
+ *
+ * decrypt() is const and may be called from several threads at once.
+ */
+class Decoder {
+public:
+    Decoder();
+    ~Decoder();
+    Decoder(Decoder&&) noexcept;
+    Decoder& operator=(Decoder&&) noexcept;
+
+    /**
+     * @brief Parse the container header
+     * @param data File bytes starting at offset 0
+     * @param len Number of bytes available
+     * @param file_size Total size of the file, when known
+     * @return 0 once parsed, otherwise the number of leading bytes needed to
+     * make progress (always greater than len and at most file_size)
+     * @details The header is considered complete once it covers the cover
+     * image, so on success data also holds the cover bytes. Length fields
+     * reaching past file_size fail here, so callers never size buffers from
+     * a corrupt file's claims.
+     * @throws ncm::Error (truncated) if the header reaches past file_size
+     * @throws std::runtime_error if the header is malformed
+     */
+    std::size_t parse_header(const unsigned char* data, std::size_t len, std::uint64_t file_size = UINT64_MAX);
+
+    /** @brief Audio format from the metadata (e.g. "flac", "mp3") */
+    const std::string& format() const;
+
+    /** @brief Absolute offset of the cover image */
+    std::uint64_t cover_offset() const;
+
+    /** @brief Size of the cover image in bytes (0 if absent) */
+    std::uint32_t cover_size() const;
+
+    /** @brief Absolute offset of the first audio byte */
+    std::uint64_t audio_offset() const;
+
+    /**
+     * @brief Decrypt a chunk of audio
+     * @param src Encrypted bytes
+     * @param dst Output buffer (may be the same as src)
+     * @param len Number of bytes
+     * @param audio_pos Position of src[0] relative to audio_offset()
+     */
+    void decrypt(const unsigned char* src, unsigned char* dst, std::size_t len, std::uint64_t audio_pos) const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+} // namespace ncm
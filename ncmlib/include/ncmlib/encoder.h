@@ -0,0 +1,75 @@
+/**
+ * @file encoder.h
+ * @brief NCM container encoder, the inverse of decoding
+ * @details Wraps arbitrary audio, a metadata JSON object and cover bytes
+ * into a container that ncmDump() and Decoder accept, using the same key
+ * scheduling, keystream and AES code as the decoder. Intended for generating
+ * load-test libraries and as a round-trip oracle for the decoding kernels.
+ */
+
+#pragma once
+
+#include "ncmlib/probe.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ncm {
+
+/**
+ * @brief Contents of one container to encode
+ * @details Pointers are not copied and must stay valid during the call.
+ */
+struct encode_input {
+    /** @brief Audio stored as is, e.g. a complete FLAC or MP3 file */
+    const unsigned char* audio = nullptr;
+    std::size_t audio_size = 0;
+
+    /**
+     * @brief Metadata JSON object, stored behind the "music:" prefix
+     * @details Leave empty to write no metadata block; such files decode
+     * only through Decoder, since ncmDump() takes the format from it.
+     */
+    std::string metadata;
+
+    /** @brief Cover image bytes, typically a JPEG; optional */
+    const unsigned char* cover = nullptr;
+    std::size_t cover_size = 0;
+
+    /**
+     * @brief RC4 key material following the "neteasecloudmusic" prefix
+     * @details Leave empty for 112 random bytes, the length real files use.
+     * Pass a fixed key for reproducible output.
+     */
+    std::string key;
+};
+
+/**
+ * @brief Build a metadata JSON object from a track description
+ * @param track Format, id, title, artists, album, bitrate and duration are
+ * written; the offsets and sizes are ignored
+ * @return JSON text suitable for encode_input::metadata
+ */
+std::string metadata_json(const track_info& track);
+
+/**
+ * @brief Encode a container into memory
+ * @param input Audio, metadata, cover and key
+ * @return Complete file contents
+ * @throws std::runtime_error if a block exceeds the format's 32-bit lengths or
+ * encryption fails
+ */
+std::vector<unsigned char> ncmEncode(const encode_input& input);
+
+/**
+ * @brief Encode a container straight to a file
+ * @param input Audio, metadata, cover and key
+ * @param path Output path, created or truncated
+ * @details The audio is encrypted in chunks through a per-thread buffer, so
+ * memory does not grow with the audio size. Safe to call from several
+ * threads at once.
+ * @throws std::runtime_error on invalid input, encryption or I/O failure
+ */
+void ncmEncode(const encode_input& input, const std::string& path);
+
+} // namespace ncm
@@ -0,0 +1,64 @@
+/**
+ * @file error.h
+ * @brief Failure categories of conversions
+ * @details ncmlib reports failures as exceptions derived from
+ * std::runtime_error. Those caused by the input or output carry an
+ * error_kind, so batch tools can tell a corrupt download from a full disk
+ * without parsing messages.
+ */
+
+#pragma once
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+namespace ncm {
+
+/**
+ * @brief Why a file failed; the numeric values are stable
+ */
+enum class error_kind : int {
+    /** @brief Not a failure */
+    none = 0,
+    /** @brief The input is missing or cannot be read */
+    input = 1,
+    /** @brief The input ends inside the container */
+    truncated = 2,
+    /** @brief The container is malformed: not an NCM file, or a bad key, metadata block or padding */
+    corrupt = 3,
+    /** @brief An output could not be created, written or moved into place */
+    output = 4,
+    /** @brief Memory ran out */
+    memory = 5,
+    /** @brief Anything else */
+    other = 6,
+    /** @brief Never run: its batch was cancelled first (see ncm::Batch::cancel()) */
+    cancelled = 7,
+};
+
+/** @brief Stable name of a kind (e.g. "corrupt") */
+const char* error_kind_name(error_kind kind);
+
+/**
+ * @brief Failure caused by the data or files being converted
+ */
+class Error : public std::runtime_error {
+public:
+    Error(error_kind kind, const std::string& what) : std::runtime_error(what), _kind(kind) {}
+
+    error_kind kind() const noexcept { return _kind; }
+
+private:
+    error_kind _kind;
+};
+
+/**
+ * @brief Kind of any exception thrown by a conversion
+ * @details ncm::Error gives its own kind, std::bad_alloc is memory and
+ * std::filesystem errors, which come from creating output directories, are
+ * output; everything else is other.
+ */
+error_kind classify(const std::exception& e);
+
+} // namespace ncm
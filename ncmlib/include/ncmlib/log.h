@@ -0,0 +1,102 @@
+/**
+ * @file log.h
+ * @brief Leveled, asynchronous logging shared by ncmlib and its callers
+ * @details Each thread appends records to its own lock-free ring buffer; a
+ * single background thread drains all rings in order and hands the records to
+ * the installed sink. A disabled level costs one relaxed atomic load, and the
+ * default level is off so the library prints nothing unless asked to.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string_view>
+
+namespace ncm {
+namespace log {
+
+/**
+ * @brief Record severity, in increasing order
+ */
+enum class level : int {
+    trace,
+    debug,
+    info,
+    warn,
+    error,
+    off
+};
+
+/**
+ * @brief Destination for log records
+ * @details Called only from the background writer thread.
+ */
+class sink {
+public:
+    virtual ~sink() = default;
+
+    /** @brief Output one record */
+    virtual void write(level lvl, std::string_view message) = 0;
+
+    /** @brief Called after each batch of records */
+    virtual void flush() {}
+};
+
+/**
+ * @brief Sink writing "[LEVEL] message" lines to a C stream
+ * @param out Stream such as stdout or stderr; must outlive the sink
+ * @param color Wrap each line in an ANSI color for its level
+ */
+std::shared_ptr<sink> make_stream_sink(std::FILE* out, bool color);
+
+/** @brief Set the minimum level that is recorded (default: off) */
+void set_level(level lvl);
+
+/** @brief Minimum level that is recorded */
+level get_level();
+
+/**
+ * @brief Install the sink receiving records (default: plain lines on stderr)
+ * @details Records already queued may still go to the previous sink.
+ */
+void set_sink(std::shared_ptr<sink> s);
+
+/**
+ * @brief Whether records at lvl are currently recorded
+ */
+bool enabled(level lvl);
+
+/**
+ * @brief Queue a record
+ * @details Messages longer than a ring slot are copied to the heap. Blocks only if
+ * the calling thread's ring is full.
+ */
+void write(level lvl, std::string_view message);
+
+/**
+ * @brief Block until every record queued so far has reached the sink
+ */
+void flush();
+
+/**
+ * @brief Parse a level name ("trace", "debug", "info", "warn", "error", "off")
+ * @param name Level name
+ * @param out Parsed level
+ * @return false if name is not a level
+ */
+bool parse_level(std::string_view name, level& out);
+
+} // namespace log
+} // namespace ncm
+
+/**
+ * @brief Log a message, evaluating the message expression only if lvl is enabled
+ * @details Example: NCM_LOG(ncm::log::level::debug, "Read " + std::to_string(n) + " bytes");
+ */
+#define NCM_LOG(lvl, message)                          \
+    do {                                               \
+        if (::ncm::log::enabled(lvl)) {                \
+            ::ncm::log::write((lvl), (message));       \
+        }                                              \
+    } while (0)
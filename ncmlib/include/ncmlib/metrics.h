@@ -0,0 +1,141 @@
+/**
+ * @file metrics.h
+ * @brief Per-stage timing counters, histograms and trace spans
+ * @details Every thread records into its own counters, so the hot path never
+ * takes a lock or shares a cache line. Counters of exited threads are merged
+ * into process totals; snapshot() adds the live threads on top. Recording is
+ * off by default and a disabled span costs one relaxed atomic load.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace ncm {
+namespace metrics {
+
+/**
+ * @brief Processing stages that are timed
+ */
+enum class stage : int {
+    open,           // opening and mapping the input
+    key_decrypt,    // AES decryption of the RC4 key block
+    key_box,        // RC4 key scheduling and keystream table
+    metadata,       // metadata decoding, decryption and JSON parsing
+    cover_write,    // writing the separate cover image
+    cover_transcode, // decoding, resizing and re-encoding a cover
+    audio_read,     // reading encrypted audio from the input
+    audio_decrypt,  // keystream XOR over the audio
+    audio_write,    // writing decrypted audio
+    queue_wait,     // time a job waited for a worker
+    count
+};
+
+/** @brief Number of stages */
+constexpr std::size_t stage_count = (std::size_t)stage::count;
+
+/**
+ * @brief Number of histogram buckets
+ * @details Bucket i counts durations up to 2^i microseconds; the last bucket
+ * also takes everything longer.
+ */
+constexpr std::size_t bucket_count = 28;
+
+/** @brief Stable name of a stage (e.g. "key_decrypt") */
+const char* stage_name(stage s);
+
+/**
+ * @brief Turn recording on or off
+ * @param trace Also keep one span per timed call for write_trace()
+ */
+void enable(bool on, bool trace = false);
+
+/** @brief Whether counters are being recorded */
+bool enabled();
+
+/** @brief Monotonic clock in nanoseconds, the time base of all records */
+std::uint64_t now_ns();
+
+/**
+ * @brief Record a duration measured by the caller
+ * @param start_ns Start time from now_ns(), used for the trace span
+ * @param bytes Bytes processed, 0 if not applicable
+ * @details Does nothing while recording is off.
+ */
+void record(stage s, std::uint64_t start_ns, std::uint64_t duration_ns, std::uint64_t bytes = 0);
+
+/**
+ * @brief Times a scope as one call of a stage
+ */
+class span {
+public:
+    explicit span(stage s) : _stage(s), _start(enabled() ? now_ns() : 0) {}
+    ~span() {
+        if (_start) record(_stage, _start, now_ns() - _start, _bytes);
+    }
+    span(const span&) = delete;
+    span& operator=(const span&) = delete;
+
+    /** @brief Count bytes processed in this call */
+    void add_bytes(std::uint64_t n) { _bytes += n; }
+
+private:
+    stage _stage;
+    std::uint64_t _start;
+    std::uint64_t _bytes = 0;
+};
+
+/**
+ * @brief Totals of one stage
+ */
+struct stage_stats {
+    std::uint64_t calls = 0;
+    std::uint64_t total_ns = 0;
+    std::uint64_t max_ns = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t buckets[bucket_count] = {};
+};
+
+/**
+ * @brief Merged counters of all threads
+ */
+struct snapshot {
+    stage_stats stages[stage_count];
+
+    /** @brief Time since recording was first enabled */
+    double elapsed_s = 0;
+
+    /** @brief Trace spans dropped because a thread reached its span limit */
+    std::uint64_t dropped_spans = 0;
+};
+
+/** @brief Merge the counters of exited and running threads */
+snapshot collect();
+
+/**
+ * @brief Format a snapshot as one JSON object
+ * @details Keys are the stage names; each holds calls, total_ms, mean_us,
+ * max_us, bytes and the non-empty histogram buckets keyed by their upper
+ * bound in microseconds.
+ */
+std::string to_json(const snapshot& snap);
+
+/**
+ * @brief Format a snapshot in the Prometheus text exposition format
+ * @details ncm_stage_seconds is a histogram labelled by stage;
+ * ncm_stage_bytes_total counts bytes per stage.
+ */
+std::string to_prometheus(const snapshot& snap);
+
+/**
+ * @brief Write the recorded spans in the Chrome trace event format
+ * @details The output loads in chrome://tracing and Perfetto. Only spans
+ * recorded with tracing enabled are written.
+ */
+void write_trace(std::ostream& out);
+
+} // namespace metrics
+} // namespace ncm
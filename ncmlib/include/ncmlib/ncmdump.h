@@ -7,10 +7,145 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace ncm {
 
+/**
+ * @brief Tuning options for writing decrypted output
+ */
+struct dump_options {
+    /** @brief Open the audio output with O_DIRECT (FILE_FLAG_NO_BUFFERING on Windows) */
+    bool direct_io = false;
+
+    /** @brief Reserve the audio file's final size on disk before writing */
+    bool preallocate = true;
+
+    /**
+     * @brief Memory-map inputs of 1 MiB and more instead of reading them
+     * @details A mapped file that another process truncates while it is
+     * read raises SIGBUS and ends the process, so turn this off for inputs
+     * that may still be rewritten. Applies to inputs given by path, including
+     * those of ncm::Batch. Large audio is only split across the executor when
+     * the input is mapped.
+     */
+    bool map_input = true;
+
+    /**
+     * @brief Embed the cover into the audio instead of writing a separate .jpg
+     * @details FLAC gets a PICTURE metadata block and MP3 an ID3v2 APIC
+     * frame, written in the same pass as the audio. Other formats and audio
+     * whose header cannot be rewritten fall back to the .jpg file.
+     */
+    bool embed_cover = false;
+
+    /**
+     * @brief Write title, artists, album and duration from the NCM metadata
+     * @details Written as Vorbis comments for FLAC and ID3v2 frames for MP3,
+     * in the same pass as the audio; other formats are left untagged.
+     */
+    bool write_tags = false;
+
+    /**
+     * @brief Replaces the cover before it is written or embedded
+     * @details Called once per dump with the cover as stored, e.g. to
+     * downscale it. Return the replacement, or null to keep the original.
+     * The same replacement may be shared by many dumps. Leave empty to keep
+     * every cover as stored.
+     */
+    std::function<std::shared_ptr<const std::vector<unsigned char>>(const unsigned char* data, std::size_t len)>
+        transform_cover;
+
+    /**
+     * @brief Places the separate cover file instead of writing it
+     * @details Called with the cover bytes and the target path (the output
+     * path plus ".jpg"). Return true once the file is placed, e.g. as a link
+     * to an identical cover written earlier, or false to have it written as
+     * usual. A file created at a temporary path should be moved into place
+     * through commit like the others. Leave empty to always write.
+     */
+    std::function<bool(const unsigned char* data, std::size_t len, const std::string& path)> place_cover;
+
+    /**
+     * @brief Moves a finished output from its temporary file to the final path
+     * @details Audio and cover are written to hidden temporary files next to
+     * their targets and renamed into place once complete, so an interrupted
+     * dump never leaves a truncated file under the final name. Leave empty
+     * to rename at once; set it to defer the rename, e.g. to
+     * CommitBatch::add() for durable commits. The callee takes over the
+     * temporary file, and the paths in dump_result only exist once it has
+     * been committed.
+     */
+    std::function<void(const std::string& temp, const std::string& target)> commit;
+
+    /**
+     * @brief Runs a task on another thread, used to split large audio sections
+     * @details Leave empty to decrypt serially. Tasks may start after the
+     * dump has returned and must simply be run; the calling thread also works
+     * on the file, so a busy executor never stalls the dump.
+     */
+    std::function<void(std::function<void()>)> executor;
+
+    /** @brief Audio sections at least this large are split across the executor */
+    std::uint64_t parallel_threshold = 64ull * 1024 * 1024;
+
+    /** @brief Size of each independently decrypted chunk (multiple of 1 MiB) */
+    std::uint64_t parallel_chunk_size = 8ull * 1024 * 1024;
+
+    /**
+     * @brief Runs the decryption of each audio chunk, e.g. to bound CPU work across dumps
+     * @details Called with a task decrypting one chunk, which must have run
+     * when the call returns. Reads and writes happen outside of it, so many
+     * dumps can wait on I/O while only a few decrypt at once. Leave empty to
+     * decrypt directly. Chunks split across the executor are not gated.
+     */
+    std::function<void(const std::function<void()>& task)> decrypt_gate;
+};
+
+/**
+ * @brief Files produced by a dump
+ */
+struct dump_result {
+    /** @brief Audio format from the metadata (e.g. "flac", "mp3") */
+    std::string format;
+
+    /** @brief Path of the decrypted audio, i.e. the output path plus "." + format */
+    std::string audio_path;
+
+    /** @brief Path of the extracted cover image, empty if there is none or it was embedded */
+    std::string cover_path;
+
+    /** @brief Whether the cover was embedded into the audio */
+    bool cover_embedded = false;
+
+    /** @brief Whether the text tags were written into the audio */
+    bool tags_written = false;
+};
+
+/**
+ * @brief Callbacks receiving decoded output instead of files
+ * @details Called on the decoding thread in this order: on_format once,
+ * on_cover at most once, then on_audio for each chunk. Pointers are only
+ * valid during the call. An exception thrown by a callback stops decoding
+ * and propagates to the caller.
+ */
+struct dump_sink {
+    /** @brief Audio format (e.g. "flac", "mp3"), before any other output; optional */
+    std::function<void(const std::string& format)> on_format;
+
+    /** @brief Cover image when it is not embedded into the audio; optional */
+    std::function<void(const unsigned char* data, std::size_t len)> on_cover;
+
+    /** @brief Decrypted audio, in order; required */
+    std::function<void(const unsigned char* data, std::size_t len)> on_audio;
+};
+
 /**
  * @brief Decrypt and extract audio from an NCM file
  * @param path Path to the input .ncm file
@@ -25,4 +160,71 @@ namespace ncm {
  */
 void ncmDump(std::string path, std::string outPath);
 
+/**
+ * @brief Decrypt and extract audio from an NCM file with explicit output options
+ * @param path Path to the input .ncm file
+ * @param outPath Output path for the decrypted file (without extension)
+ * @param options Output tuning options
+ * @return Format and paths of the written files
+ * @throws std::exception if file processing fails
+ */
+dump_result ncmDump(const std::string& path, const std::string& outPath, const dump_options& options);
+
+/**
+ * @brief Decrypt an NCM container held in memory to files
+ * @param data Container bytes; not copied, must stay valid during the call
+ * @param len Number of bytes
+ * @param outPath Output path for the decrypted file (without extension)
+ * @param options Output tuning options
+ * @return Format and paths of the written files
+ * @throws std::exception if decoding or writing fails
+ */
+dump_result ncmDump(const unsigned char* data, std::size_t len, const std::string& outPath,
+                    const dump_options& options = dump_options());
+
+/**
+ * @brief Decrypt an NCM file into callbacks instead of output files
+ * @param path Path to the input .ncm file
+ * @param sink Receives the format, cover and audio
+ * @param options Tag options (embed_cover, write_tags); the file options do not apply
+ * @return Format and whether the cover and tags were embedded; the paths are empty
+ * @details Audio is handed over in fixed-size chunks as it is decrypted, so
+ * memory stays constant and a sink that blocks, such as a pipe write,
+ * throttles decoding.
+ * @throws std::exception if decoding fails or a callback throws
+ */
+dump_result ncmDecode(const std::string& path, const dump_sink& sink, const dump_options& options = dump_options());
+
+/**
+ * @brief Decrypt an NCM container held in memory into callbacks
+ * @param data Container bytes; not copied, must stay valid during the call
+ * @param len Number of bytes
+ * @param sink Receives the format, cover and audio
+ * @param options Tag options (embed_cover, write_tags); the file options do not apply
+ * @return Format and whether the cover and tags were embedded; the paths are empty
+ * @throws std::exception if decoding fails or a callback throws
+ */
+dump_result ncmDecode(const unsigned char* data, std::size_t len, const dump_sink& sink,
+                      const dump_options& options = dump_options());
+
+/**
+ * @brief Decrypt an NCM container read from a stream into callbacks
+ * @param in Binary stream positioned at the container start, read front to
+ * back only, so pipes and sockets work
+ * @param sink Receives the format, cover and audio
+ * @param options Tag options (embed_cover, write_tags); the file options do not apply
+ * @return Format and whether the cover and tags were embedded; the paths are empty
+ * @throws std::exception if decoding fails or a callback throws
+ */
+dump_result ncmDecode(std::istream& in, const dump_sink& sink, const dump_options& options = dump_options());
+
+/**
+ * @brief Allocate the calling thread's reusable decoding state now
+ * @details Each thread keeps its cipher contexts, header scratch memory and
+ * audio buffer across files. They are normally created by the first file a
+ * thread decodes; a worker pinned to a NUMA node calls this right after
+ * pinning so the memory is placed on that node. Optional.
+ */
+void prepare_thread();
+
 } // namespace ncm
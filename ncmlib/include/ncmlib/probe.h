@@ -0,0 +1,67 @@
+/**
+ * @file probe.h
+ * @brief Header-only metadata scan for NCM files
+ * @details Reads the container header up to the cover image without
+ * decrypting the key or touching the audio payload, so whole libraries can be
+ * scanned quickly to plan output paths or find duplicates.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace ncm {
+
+/**
+ * @brief Track description taken from an NCM header
+ * @details Fields missing from the metadata are left empty or zero.
+ */
+struct track_info {
+    /** @brief Audio format (e.g. "flac", "mp3") */
+    std::string format;
+
+    /** @brief NetEase track id */
+    std::uint64_t music_id = 0;
+
+    /** @brief Track title */
+    std::string music_name;
+
+    /** @brief Artist names in the order listed */
+    std::vector<std::string> artists;
+
+    /** @brief Album title */
+    std::string album;
+
+    /** @brief Bitrate in bits per second */
+    std::uint32_t bitrate = 0;
+
+    /** @brief Duration in milliseconds */
+    std::uint64_t duration = 0;
+
+    /** @brief Absolute offset of the cover image */
+    std::uint64_t cover_offset = 0;
+
+    /** @brief Size of the cover image in bytes (0 if absent) */
+    std::uint32_t cover_size = 0;
+
+    /** @brief Absolute offset of the first audio byte */
+    std::uint64_t audio_offset = 0;
+
+    /** @brief Size of the encrypted audio payload in bytes */
+    std::uint64_t audio_size = 0;
+};
+
+/**
+ * @brief Read track metadata from an NCM file without decoding audio
+ * @param path Path to the input .ncm file
+ * @return Parsed track description
+ * @details Only the header is read; the key block is skipped undecrypted.
+ * Safe to call from several threads at once and prints nothing.
+ * @throws std::runtime_error if the file cannot be opened or the header is malformed
+ */
+track_info probe(const std::filesystem::path& path);
+
+} // namespace ncm
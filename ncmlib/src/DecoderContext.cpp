@@ -0,0 +1,211 @@
+/**
+ * @file DecoderContext.cpp
+ * @brief Reusable per-thread decoding state implementation
+ */
+
+#include "DecoderContext.h"
+#include "utils.h"
+#include "ncmlib/error.h"
+#include "openssl/evp.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+namespace ncm {
+
+namespace {
+    /**
+     * @brief AES-128 ECB mode decryption key for core data
+     * @note This is a fixed key used for decrypting the core key data in NCM files
+     */
+    constexpr auto CORE_KEY = utils::hex_bytes("687A4852416D736F356B496E62617857");
+
+    /**
+     * @brief AES-128 ECB mode decryption key for metadata
+     * @note This is a fixed key used for decrypting the metadata in NCM files
+     */
+    constexpr auto META_KEY = utils::hex_bytes("2331346C6A6B5F215C5D2630553C2728");
+
+    static_assert(CORE_KEY.size() == 16 && META_KEY.size() == 16, "AES-128 keys are 16 bytes");
+
+    /**
+     * @brief Create a context keyed for AES-128-ECB without padding
+     * @param encrypt Key for encryption instead of decryption
+     */
+    EVP_CIPHER_CTX* new_keyed_context(const unsigned char* key, bool encrypt = false) {
+        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+        if (!ctx) {
+            throw runtime_error("Failed to create new EVP cipher context");
+        }
+        if (1 != EVP_CipherInit_ex(ctx, EVP_aes_128_ecb(), NULL, key, NULL, encrypt ? 1 : 0)) {
+            EVP_CIPHER_CTX_free(ctx);
+            throw runtime_error(encrypt ? "Failed to initialize EVP encryption" : "Failed to initialize EVP decryption");
+        }
+        // Disable padding since NCM uses fixed-size blocks
+        EVP_CIPHER_CTX_set_padding(ctx, 0);
+        return ctx;
+    }
+
+    /**
+     * @brief Key schedules for the two fixed keys, expanded once per process
+     * @details Never used for decryption directly; each DecoderContext copies
+     * them, which duplicates the expanded schedule instead of recomputing it.
+     */
+    struct key_schedules {
+        EVP_CIPHER_CTX* core;
+        EVP_CIPHER_CTX* meta;
+
+        key_schedules() {
+            core = new_keyed_context(CORE_KEY.data());
+            try {
+                meta = new_keyed_context(META_KEY.data());
+            } catch (...) {
+                EVP_CIPHER_CTX_free(core);
+                throw;
+            }
+        }
+
+        ~key_schedules() {
+            EVP_CIPHER_CTX_free(core);
+            EVP_CIPHER_CTX_free(meta);
+        }
+
+        static const key_schedules& get() {
+            static const key_schedules schedules;
+            return schedules;
+        }
+    };
+
+    /**
+     * @brief Create a context sharing a prototype's cipher and key schedule
+     */
+    EVP_CIPHER_CTX* copy_context(const EVP_CIPHER_CTX* proto) {
+        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+        if (!ctx || 1 != EVP_CIPHER_CTX_copy(ctx, proto)) {
+            EVP_CIPHER_CTX_free(ctx);
+            throw runtime_error("Failed to copy EVP cipher context");
+        }
+        return ctx;
+    }
+
+    /**
+     * @brief Run one ECB decryption on a keyed context
+     */
+    size_t ecb_decrypt(EVP_CIPHER_CTX* ctx, const unsigned char* in, size_t len, unsigned char* out) {
+        int out_len = 0;
+        int final_len = 0;
+
+        // Reset the block state while keeping the cipher and key
+        if (1 != EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, NULL)) {
+            throw runtime_error("Failed to initialize EVP decryption");
+        }
+        if (1 != EVP_DecryptUpdate(ctx, out, &out_len, in, (int)len)) {
+            throw Error(error_kind::corrupt, "Failed to update EVP decryption");
+        }
+        if (1 != EVP_DecryptFinal_ex(ctx, out + out_len, &final_len)) {
+            throw Error(error_kind::corrupt, "Failed to finalize EVP decryption");
+        }
+        return (size_t)(out_len + final_len);
+    }
+
+    /**
+     * @brief Run one ECB encryption on a keyed context
+     */
+    size_t ecb_encrypt(EVP_CIPHER_CTX* ctx, const unsigned char* in, size_t len, unsigned char* out) {
+        int out_len = 0;
+        int final_len = 0;
+
+        if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, NULL)) {
+            throw runtime_error("Failed to initialize EVP encryption");
+        }
+        if (1 != EVP_EncryptUpdate(ctx, out, &out_len, in, (int)len)) {
+            throw runtime_error("Failed to update EVP encryption");
+        }
+        if (1 != EVP_EncryptFinal_ex(ctx, out + out_len, &final_len)) {
+            throw runtime_error("Failed to finalize EVP encryption");
+        }
+        return (size_t)(out_len + final_len);
+    }
+
+    /** @brief Alignment of arena allocations */
+    constexpr size_t ARENA_ALIGN = 16;
+
+    /** @brief Smallest block the arena allocates */
+    constexpr size_t ARENA_MIN_BLOCK = 16 * 1024;
+} // anonymous namespace
+
+unsigned char* ScratchArena::alloc(size_t n) {
+    n = (n + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    if (_blocks.empty() || _blocks.back().size - _used < n) {
+        size_t size = max(n, ARENA_MIN_BLOCK);
+        if (!_blocks.empty()) {
+            size = max(size, _blocks.back().size * 2);
+        }
+        // new[] of unsigned char is aligned for any fundamental type
+        _blocks.push_back({make_unique<unsigned char[]>(size), size});
+        _used = 0;
+    }
+    unsigned char* p = _blocks.back().data.get() + _used;
+    _used += n;
+    _total += n;
+    return p;
+}
+
+void ScratchArena::reset() {
+    // Coalesce into a single block covering the high-water mark
+    if (_blocks.size() > 1) {
+        size_t size = max(_total, _blocks.back().size);
+        _blocks.clear();
+        _blocks.push_back({make_unique<unsigned char[]>(size), size});
+    }
+    _used = 0;
+    _total = 0;
+}
+
+DecoderContext::DecoderContext() {
+    const key_schedules& schedules = key_schedules::get();
+    _core = copy_context(schedules.core);
+    try {
+        _meta = copy_context(schedules.meta);
+    } catch (...) {
+        EVP_CIPHER_CTX_free(_core);
+        throw;
+    }
+}
+
+DecoderContext::~DecoderContext() {
+    EVP_CIPHER_CTX_free(_core);
+    EVP_CIPHER_CTX_free(_meta);
+    EVP_CIPHER_CTX_free(_core_enc);
+    EVP_CIPHER_CTX_free(_meta_enc);
+}
+
+DecoderContext& DecoderContext::local() {
+    thread_local DecoderContext ctx;
+    return ctx;
+}
+
+size_t DecoderContext::decrypt_core(const unsigned char* in, size_t len, unsigned char* out) {
+    return ecb_decrypt(_core, in, len, out);
+}
+
+size_t DecoderContext::decrypt_meta(const unsigned char* in, size_t len, unsigned char* out) {
+    return ecb_decrypt(_meta, in, len, out);
+}
+
+size_t DecoderContext::encrypt_core(const unsigned char* in, size_t len, unsigned char* out) {
+    if (!_core_enc) {
+        _core_enc = new_keyed_context(CORE_KEY.data(), true);
+    }
+    return ecb_encrypt(_core_enc, in, len, out);
+}
+
+size_t DecoderContext::encrypt_meta(const unsigned char* in, size_t len, unsigned char* out) {
+    if (!_meta_enc) {
+        _meta_enc = new_keyed_context(META_KEY.data(), true);
+    }
+    return ecb_encrypt(_meta_enc, in, len, out);
+}
+
+}
@@ -0,0 +1,117 @@
+/**
+ * @file DecoderContext.h
+ * @brief Reusable per-thread state for NCM header decoding
+ * @details Holds ready-keyed AES contexts for the CORE and META keys and a
+ * scratch arena so that parsing a header costs no heap allocation, cipher
+ * lookup or key expansion once the context has warmed up. The encoder uses the
+ * same context for the reverse direction. A context must only be used by one
+ * thread at a time.
+ */
+
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
+
+namespace ncm {
+
+/**
+ * @brief Bump allocator for short-lived scratch memory
+ * @details Allocations stay valid until reset(). After a reset the arena
+ * keeps one block large enough for everything allocated before it, so a
+ * steady workload stops allocating after the first file.
+ */
+class ScratchArena {
+public:
+    ScratchArena() = default;
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    /**
+     * @brief Allocate n bytes aligned to 16
+     * @return Uninitialised memory valid until the next reset()
+     */
+    unsigned char* alloc(std::size_t n);
+
+    /** @brief Release every allocation at once */
+    void reset();
+
+private:
+    struct Block {
+        std::unique_ptr<unsigned char[]> data;
+        std::size_t size;
+    };
+
+    std::vector<Block> _blocks;
+    std::size_t _used = 0;   // bytes used in the last block
+    std::size_t _total = 0;  // bytes handed out since the last reset
+};
+
+/**
+ * @brief Cipher contexts and scratch memory shared by consecutive files
+ */
+class DecoderContext {
+public:
+    /**
+     * @brief Copy the process-wide key schedules into this context
+     * @throws std::runtime_error if the cipher contexts cannot be created
+     */
+    DecoderContext();
+    ~DecoderContext();
+    DecoderContext(const DecoderContext&) = delete;
+    DecoderContext& operator=(const DecoderContext&) = delete;
+
+    /**
+     * @brief Context owned by the calling thread
+     * @details Created on first use and destroyed when the thread exits.
+     */
+    static DecoderContext& local();
+
+    /**
+     * @brief Decrypt the RC4 key block with the CORE key (AES-128-ECB)
+     * @param in Ciphertext, a multiple of 16 bytes
+     * @param len Ciphertext length
+     * @param out Output buffer of at least len bytes (may be the same as in)
+     * @return Number of bytes written; padding is not removed
+     * @throws std::runtime_error if decryption fails
+     */
+    std::size_t decrypt_core(const unsigned char* in, std::size_t len, unsigned char* out);
+
+    /**
+     * @brief Decrypt the metadata block with the META key (AES-128-ECB)
+     * @see decrypt_core
+     */
+    std::size_t decrypt_meta(const unsigned char* in, std::size_t len, unsigned char* out);
+
+    /**
+     * @brief Encrypt a padded RC4 key block with the CORE key (AES-128-ECB)
+     * @param in Plaintext with PKCS#7 padding already applied, a multiple of 16 bytes
+     * @param len Plaintext length
+     * @param out Output buffer of at least len bytes (may be the same as in)
+     * @return Number of bytes written
+     * @details The encryption contexts are keyed on first use, so decoders
+     * never pay for them.
+     * @throws std::runtime_error if encryption fails
+     */
+    std::size_t encrypt_core(const unsigned char* in, std::size_t len, unsigned char* out);
+
+    /**
+     * @brief Encrypt a padded metadata block with the META key (AES-128-ECB)
+     * @see encrypt_core
+     */
+    std::size_t encrypt_meta(const unsigned char* in, std::size_t len, unsigned char* out);
+
+    /** @brief Scratch memory for the header currently being parsed */
+    ScratchArena& scratch() { return _scratch; }
+
+private:
+    EVP_CIPHER_CTX* _core = nullptr;
+    EVP_CIPHER_CTX* _meta = nullptr;
+    EVP_CIPHER_CTX* _core_enc = nullptr;
+    EVP_CIPHER_CTX* _meta_enc = nullptr;
+    ScratchArena _scratch;
+};
+
+}
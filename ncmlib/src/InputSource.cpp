@@ -0,0 +1,232 @@
+/**
+ * @file InputSource.cpp
+ * @brief Stream and memory-mapped input backends
+ * @details The mmap backend uses mmap/madvise on POSIX systems and
+ * CreateFileMapping/MapViewOfFile on Windows.
+ */
+
+#include "InputSource.h"
+#include "ncmlib/error.h"
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace ncm {
+
+void InputSource::_throw_truncated(size_t wanted) const {
+    string of = _size == unknown_size ? string() : " of " + to_string(_size);
+    throw Error(error_kind::truncated, "Unexpected end of file: wanted " + to_string(wanted) + " bytes at offset " +
+                        to_string(_pos) + of);
+}
+
+namespace {
+    // Largest read take() does before checking that more data follows
+    constexpr size_t TAKE_STEP = 1024 * 1024;
+
+    /**
+     * @brief Buffered std::istream backend for small files and caller streams
+     * @details Owns the stream when opened from a path. Caller streams may
+     * not be seekable, so skip() reads past the bytes.
+     */
+    class StreamSource : public InputSource {
+    public:
+        StreamSource(ifstream&& file, uint64_t size)
+            : InputSource(size), _owned(make_unique<ifstream>(std::move(file))), _in(*_owned) {}
+
+        explicit StreamSource(istream& in) : InputSource(unknown_size), _in(in) {}
+
+        const unsigned char* take(size_t n) override {
+            if (n > _size - _pos) _throw_truncated(n);
+            // Grow the buffer only as bytes arrive: on a stream of unknown
+            // size, n comes from an unchecked length field
+            size_t got = 0;
+            while (got < n) {
+                size_t step = min(n - got, TAKE_STEP);
+                if (_scratch.size() < got + step) _scratch.resize(got + step);
+                _in.read((char*)_scratch.data() + got, step);
+                if ((size_t)_in.gcount() != step) _throw_truncated(n);
+                got += step;
+            }
+            _pos += n;
+            return _scratch.data();
+        }
+
+        void skip(size_t n) override {
+            if (n > _size - _pos) _throw_truncated(n);
+            if (_owned) {
+                _in.seekg(n, ios::cur);
+            } else {
+                _in.ignore((streamsize)n);
+                if ((size_t)_in.gcount() != n) _throw_truncated(n);
+            }
+            _pos += n;
+        }
+
+        size_t next(size_t max, const unsigned char*& data) override {
+            max = (size_t)min<uint64_t>(max, _size - _pos);
+            if (_scratch.size() < max) _scratch.resize(max);
+            _in.read((char*)_scratch.data(), max);
+            size_t len = _in.gcount();
+            _pos += len;
+            data = _scratch.data();
+            return len;
+        }
+
+        const char* backend_name() const override { return "stream"; }
+
+    private:
+        unique_ptr<ifstream> _owned;
+        istream& _in;
+        vector<unsigned char> _scratch;
+    };
+
+    /**
+     * @brief Contiguous in-memory bytes, not owned by the source
+     */
+    class MemorySource : public InputSource {
+    public:
+        MemorySource(const unsigned char* data, uint64_t size) : InputSource(size), _data(data) {}
+
+        const unsigned char* take(size_t n) override {
+            if (n > _size - _pos) _throw_truncated(n);
+            const unsigned char* p = _data + _pos;
+            _pos += n;
+            return p;
+        }
+
+        void skip(size_t n) override {
+            take(n);
+        }
+
+        size_t next(size_t max, const unsigned char*& data) override {
+            size_t len = (size_t)min<uint64_t>(max, _size - _pos);
+            data = _data + _pos;
+            _pos += len;
+            return len;
+        }
+
+        const unsigned char* data() const override { return _data; }
+
+        const char* backend_name() const override { return "memory"; }
+
+    protected:
+        const unsigned char* _data;
+    };
+
+    /**
+     * @brief Read-only mapping of an entire file
+     */
+    class MappedSource : public MemorySource {
+    public:
+        static unique_ptr<InputSource> open(const filesystem::path& path) {
+#ifdef _WIN32
+            HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                      FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (file == INVALID_HANDLE_VALUE) return nullptr;
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+                CloseHandle(file);
+                return nullptr;
+            }
+            HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            CloseHandle(file);
+            if (!mapping) return nullptr;
+            void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (!view) {
+                CloseHandle(mapping);
+                return nullptr;
+            }
+            return unique_ptr<InputSource>(new MappedSource((const unsigned char*)view, (uint64_t)size.QuadPart, mapping));
+#else
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) return nullptr;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0) {
+                ::close(fd);
+                return nullptr;
+            }
+            void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (view == MAP_FAILED) return nullptr;
+            return unique_ptr<InputSource>(new MappedSource((const unsigned char*)view, (uint64_t)st.st_size));
+#endif
+        }
+
+        ~MappedSource() override {
+#ifdef _WIN32
+            UnmapViewOfFile(_data);
+            CloseHandle(_mapping);
+#else
+            munmap((void*)_data, _size);
+#endif
+        }
+
+        void advise_sequential() override {
+#ifndef _WIN32
+            // madvise needs a page-aligned start; round down from the current offset.
+            uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+            uint64_t start = _pos / page * page;
+            madvise((void*)(_data + start), _size - start, MADV_SEQUENTIAL);
+#endif
+        }
+
+        const char* backend_name() const override { return "mmap"; }
+
+    private:
+#ifdef _WIN32
+        MappedSource(const unsigned char* data, uint64_t size, HANDLE mapping)
+            : MemorySource(data, size), _mapping(mapping) {}
+
+        HANDLE _mapping;
+#else
+        MappedSource(const unsigned char* data, uint64_t size) : MemorySource(data, size) {}
+#endif
+    };
+} // anonymous namespace
+
+unique_ptr<InputSource> InputSource::from_memory(const unsigned char* data, size_t len) {
+    return make_unique<MemorySource>(data, len);
+}
+
+unique_ptr<InputSource> InputSource::from_stream(istream& in) {
+    return make_unique<StreamSource>(in);
+}
+
+/**
+ * @brief Open a file, choosing the backend from its size
+ * @param path File to open
+ * @param mmap_threshold Minimum size for the mmap backend
+ * @return Source positioned at offset 0, or nullptr if the file cannot be opened
+ */
+unique_ptr<InputSource> InputSource::open(const filesystem::path& path, uint64_t mmap_threshold) {
+    error_code ec;
+    uint64_t size = filesystem::file_size(path, ec);
+    if (ec) return nullptr;
+
+    if (size >= mmap_threshold) {
+        if (auto mapped = MappedSource::open(path)) {
+            return mapped;
+        }
+    }
+
+    ifstream file(path, ios::in | ios::binary);
+    if (!file.is_open()) return nullptr;
+    return make_unique<StreamSource>(std::move(file), size);
+}
+
+}
@@ -0,0 +1,113 @@
+/**
+ * @file InputSource.h
+ * @brief Sequential input backends for NCM container parsing
+ * @details Provides a common reader interface over a buffered std::ifstream
+ * or caller-owned std::istream, a read-only memory mapping of the whole file
+ * or a caller-owned buffer. Large files
+ * are mapped so header parsers and the audio decryptor can read straight
+ * from the page cache without intermediate copies.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <limits>
+#include <memory>
+
+namespace ncm {
+
+/**
+ * @brief Forward-only byte source over an NCM file
+ * @details Pointers returned by take() and next() stay valid until the next
+ * call on the same source.
+ */
+class InputSource {
+public:
+    /** @brief Files at least this large are memory-mapped by default */
+    static constexpr std::uint64_t default_mmap_threshold = 1024 * 1024;
+
+    /** @brief size() of sources whose length is not known up front */
+    static constexpr std::uint64_t unknown_size = std::numeric_limits<std::uint64_t>::max();
+
+    virtual ~InputSource() = default;
+
+    /**
+     * @brief Open a file, choosing the backend from its size
+     * @param path File to open
+     * @param mmap_threshold Minimum size for the mmap backend
+     * @return Source positioned at offset 0, or nullptr if the file cannot be opened
+     * @details Falls back to the stream backend when mapping fails.
+     */
+    static std::unique_ptr<InputSource> open(const std::filesystem::path& path,
+                                             std::uint64_t mmap_threshold = default_mmap_threshold);
+
+    /**
+     * @brief Wrap a caller-owned buffer without copying it
+     * @param data Start of the NCM container bytes
+     * @param len Number of bytes available
+     * @return Source positioned at offset 0; data must outlive it
+     */
+    static std::unique_ptr<InputSource> from_memory(const unsigned char* data, std::size_t len);
+
+    /**
+     * @brief Read from a caller-owned stream, such as a pipe or socket
+     * @param in Binary stream positioned at the start of the NCM container; must outlive the source
+     * @return Source of unknown_size; next() returns 0 once the stream ends
+     * @details The stream is read front to back only, so it need not be seekable.
+     */
+    static std::unique_ptr<InputSource> from_stream(std::istream& in);
+
+    /**
+     * @brief Read exactly n bytes
+     * @param n Number of bytes
+     * @return Pointer to the bytes
+     * @throws std::runtime_error if fewer than n bytes remain
+     */
+    virtual const unsigned char* take(std::size_t n) = 0;
+
+    /**
+     * @brief Advance past n bytes
+     * @throws std::runtime_error if fewer than n bytes remain
+     */
+    virtual void skip(std::size_t n) = 0;
+
+    /**
+     * @brief Read up to max bytes
+     * @param max Largest chunk wanted
+     * @param data Receives a pointer to the chunk
+     * @return Chunk length, 0 at end of file
+     */
+    virtual std::size_t next(std::size_t max, const unsigned char*& data) = 0;
+
+    /**
+     * @brief Whole file contents for random access
+     * @return Start of the file, or nullptr for backends that are not memory-backed
+     */
+    virtual const unsigned char* data() const { return nullptr; }
+
+    /**
+     * @brief Hint that the rest of the file will be read front to back
+     */
+    virtual void advise_sequential() {}
+
+    /** @brief Short backend name for diagnostics */
+    virtual const char* backend_name() const = 0;
+
+    /** @brief Total file size in bytes, or unknown_size */
+    std::uint64_t size() const { return _size; }
+
+    /** @brief Current read offset */
+    std::uint64_t position() const { return _pos; }
+
+protected:
+    explicit InputSource(std::uint64_t size) : _size(size) {}
+
+    [[noreturn]] void _throw_truncated(std::size_t wanted) const;
+
+    std::uint64_t _size;
+    std::uint64_t _pos = 0;
+};
+
+}
@@ -7,132 +7,289 @@
 
 #include "NcmFile.h"
 #include "utils.h"
-#include "base64.h"
+#include "base64_simd.h"
 #include "pkcs7.h"
-#include "openssl/evp.h"
-#include <fstream>
+#include "keystream.h"
+#include "tags.h"
+#include "ncmlib/error.h"
+#include "ncmlib/log.h"
+#include "ncmlib/metrics.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
-#include <iostream>
 
 using namespace std;
 
-// ANSI color codes
-const char* RESET = "\033[0m";
-const char* BLUE = "\033[34m";
-const char* GREEN = "\033[32m";
-const char* YELLOW = "\033[33m";
-const char* RED = "\033[31m";
-const char* CYAN = "\033[36m";
 using namespace ncm;
 using namespace ncm::utils;
 
 namespace {
+    using level = ncm::log::level;
+
     /**
-     * @brief AES-128 ECB mode decryption key for core data
-     * @note This is a fixed key used for decrypting the core key data in NCM files
+     * @brief Size of each audio decrypt/write chunk
+     * @note A multiple of both the keystream period and the direct I/O alignment
      */
-    const char CORE_HEX_KEY[] = "687A4852416D736F356B496E62617857";
-    
+    constexpr size_t AUDIO_CHUNK_SIZE = 1024 * 1024;
+
     /**
-     * @brief AES-128 ECB mode decryption key for metadata
-     * @note This is a fixed key used for decrypting the metadata in NCM files
+     * @brief Scratch reserved by prepare_thread(), enough for the key and metadata of a typical header
      */
-    const char META_HEX_KEY[] = "2331346C6A6B5F215C5D2630553C2728";
+    constexpr size_t SCRATCH_WARMUP = 64 * 1024;
 
     /**
-     * @brief Decrypt data using AES-128 ECB mode
-     * @param ciphertext The encrypted data
-     * @param ciphertext_len Length of encrypted data
-     * @param key AES-128 key (16 bytes)
-     * @return Decrypted data as unsigned char vector
-     * @throws runtime_error if decryption fails
+     * @brief Per-thread audio output buffer, reused across files
      */
-    vector<unsigned char> aes_ecb_decrypt(const unsigned char* ciphertext, int ciphertext_len, const unsigned char* key) {
-        EVP_CIPHER_CTX* ctx = nullptr;
-        vector<unsigned char> plaintext(ciphertext_len);
-        int len;
-        int plaintext_len;
-
-        try {
-            // Create new cipher context
-            if (!(ctx = EVP_CIPHER_CTX_new())) {
-                throw runtime_error("Failed to create new EVP cipher context");
-            }
+    AlignedBuffer& audio_buffer() {
+        thread_local AlignedBuffer buffer;
+        return buffer;
+    }
 
-            // Initialize decryption with AES-128 ECB
-            if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, key, NULL)) {
-                throw runtime_error("Failed to initialize EVP decryption");
-            }
+    /**
+     * @brief Read an unsigned integer member that may be stored as a number or a string
+     */
+    uint64_t get_uint(const rapidjson::Value& obj, const char* name) {
+        auto it = obj.FindMember(name);
+        if (it == obj.MemberEnd()) return 0;
+        const rapidjson::Value& v = it->value;
+        if (v.IsUint64()) return v.GetUint64();
+        if (v.IsNumber()) return v.GetDouble() > 0 ? (uint64_t)v.GetDouble() : 0;
+        if (v.IsString()) return strtoull(v.GetString(), nullptr, 10);
+        return 0;
+    }
 
-            // Disable padding since NCM uses fixed-size blocks
-            EVP_CIPHER_CTX_set_padding(ctx, 0);
+    string get_string(const rapidjson::Value& obj, const char* name) {
+        auto it = obj.FindMember(name);
+        if (it == obj.MemberEnd() || !it->value.IsString()) return string();
+        return string(it->value.GetString(), it->value.GetStringLength());
+    }
 
-            // Decrypt the data
-            if (1 != EVP_DecryptUpdate(ctx, plaintext.data(), &len, ciphertext, ciphertext_len)) {
-                throw runtime_error("Failed to update EVP decryption");
+    /**
+     * @brief Work shared between the dumping thread and executor helpers
+     * @details Chunks are claimed through an atomic counter. Helpers that
+     * start after every chunk has been claimed return without touching the
+     * input or output, so the state only needs to outlive them via shared_ptr.
+     */
+    struct parallel_audio {
+        const unsigned char* src;
+        uint64_t audio_pos;     // keystream position of src[0]
+        uint64_t out_pos;       // output offset of src[0]
+        uint64_t size;
+        uint64_t chunk_size;
+        uint64_t chunk_count;
+        const keystream::table* ks;
+        OutputFile* out;
+
+        atomic<uint64_t> next_chunk{0};
+        atomic<bool> failed{false};
+        mutex mtx;
+        condition_variable cv;
+        uint64_t finished = 0;
+        exception_ptr error;
+
+        /**
+         * @brief Claim and process chunks until none are left
+         */
+        void work() {
+            for (;;) {
+                uint64_t index = next_chunk.fetch_add(1);
+                if (index >= chunk_count) return;
+
+                if (!failed) {
+                    try {
+                        process(index);
+                    } catch (...) {
+                        lock_guard<mutex> lock(mtx);
+                        if (!error) error = current_exception();
+                        failed = true;
+                    }
+                }
+
+                lock_guard<mutex> lock(mtx);
+                if (++finished == chunk_count) cv.notify_all();
             }
-            plaintext_len = len;
+        }
 
-            // Finalize decryption
-            if (1 != EVP_DecryptFinal_ex(ctx, plaintext.data() + len, &len)) {
-                throw runtime_error("Failed to finalize EVP decryption");
+        void process(uint64_t index) {
+            unsigned char* buff = audio_buffer().reserve(AUDIO_CHUNK_SIZE);
+            uint64_t begin = index * chunk_size;
+            uint64_t end = min(size, begin + chunk_size);
+            for (uint64_t pos = begin; pos < end; pos += AUDIO_CHUNK_SIZE) {
+                size_t len = (size_t)min<uint64_t>(AUDIO_CHUNK_SIZE, end - pos);
+                {
+                    metrics::span t(metrics::stage::audio_decrypt);
+                    t.add_bytes(len);
+                    keystream::apply(*ks, src + pos, buff, len, audio_pos + pos);
+                }
+                metrics::span t(metrics::stage::audio_write);
+                t.add_bytes(len);
+                out->write_at(out_pos + pos, buff, len);
             }
-            plaintext_len += len;
-
-            EVP_CIPHER_CTX_free(ctx);
-
-            // Resize to actual decrypted data size
-            plaintext.resize(plaintext_len);
-            return plaintext;
-            
-        } catch (...) {
-            if (ctx) EVP_CIPHER_CTX_free(ctx);
-            throw;
         }
-    }
+    };
 } // anonymous namespace
 
+/**
+ * @brief Allocate and touch the calling thread's decoder context and audio buffer
+ * @details Pages land on the NUMA node of the thread that first writes them,
+ * so a worker pinned before calling this keeps its per-thread state local.
+ */
+void NcmFile::prepare_thread() {
+    DecoderContext& ctx = DecoderContext::local();
+    ctx.scratch().alloc(SCRATCH_WARMUP);
+    ctx.scratch().reset();
+    unsigned char* buff = audio_buffer().reserve(AUDIO_CHUNK_SIZE);
+    memset(buff, 0, AUDIO_CHUNK_SIZE);
+}
+
 /**
  * @brief Construct NcmFile object from filesystem path
  * @param path Path to the .ncm file to process
  * @throws runtime_error if file cannot be opened
  */
-NcmFile::NcmFile(const filesystem::path& path) : _path(path) {
-    _file.open(_path, ios::in | ios::binary);
-    if (!_file.is_open()) {
-        throw runtime_error("Failed to open file: " + path.string());
+NcmFile::NcmFile(const filesystem::path& path) : NcmFile(path, DecoderContext::local()) {}
+
+/**
+ * @brief Construct NcmFile object from filesystem path with a caller-owned context
+ * @param path Path to the .ncm file to process
+ * @param ctx Decoding state reused across files; must not be shared between threads
+ * @param mmap_threshold Minimum size for the mmap backend, see InputSource::open()
+ * @throws runtime_error if file cannot be opened
+ */
+NcmFile::NcmFile(const filesystem::path& path, DecoderContext& ctx, uint64_t mmap_threshold)
+    : _path(path), _ctx(ctx) {
+    {
+        metrics::span t(metrics::stage::open);
+        _input = InputSource::open(_path, mmap_threshold);
+    }
+    if (!_input) {
+        throw Error(error_kind::input, "Failed to open file: " + path.string());
     }
     
-    std::cout << "[INFO] Opening NCM file: " << BLUE << path.string() << RESET << std::endl;
+    NCM_LOG(level::debug, "Opening NCM file: " + path.string() + " (" + _input->backend_name() + ")");
 }
 
+/**
+ * @brief Construct NcmFile object over an already opened source
+ * @param input Source positioned at the start of the NCM container
+ */
+NcmFile::NcmFile(unique_ptr<InputSource> input) : NcmFile(std::move(input), DecoderContext::local()) {}
+
+/**
+ * @brief Construct NcmFile object over an already opened source with a caller-owned context
+ * @param input Source positioned at the start of the NCM container
+ * @param ctx Decoding state reused across files; must not be shared between threads
+ */
+NcmFile::NcmFile(unique_ptr<InputSource> input, DecoderContext& ctx) : _ctx(ctx), _input(std::move(input)) {}
+
 /**
  * @brief Dump decrypted audio and cover image from NCM file
  * @param out_path Output path for the decrypted audio file (without extension)
+ * @param options Output tuning options
  * @details This method performs the complete NCM file processing:
  * 1. Reads and decrypts the key data
  * 2. Sets up the key box for audio decryption
  * 3. Reads and parses metadata
  * 4. Extracts cover image if available
  * 5. Decrypts and writes the audio data
+ * @return Format and paths of the written files
  */
-void NcmFile::dump(const filesystem::path& out_path) {
-    std::cout << "[INFO] Processing NCM file: " << BLUE << _path.filename() << RESET << std::endl;
+dump_result NcmFile::dump(const filesystem::path& out_path, const dump_options& options) {
+    NCM_LOG(level::debug, "Processing NCM file: " + _path.filename().string());
     
     try {
-        _read_key_data();
-        _setup_key_box();
-        _read_metadata();
-        _parse_metadata();
-        _dump_audio_data(out_path);
+        read_header();
+        dump_result result = _dump_audio_data(out_path, options);
         
-        std::cout << GREEN << "[SUCCESS] Successfully processed: " << RESET << BLUE << _path.filename() << RESET << std::endl;
+        NCM_LOG(level::debug, "Successfully processed: " + _path.filename().string());
+        return result;
+    } catch (const exception& e) {
+        NCM_LOG(level::debug, "Failed to process " + _path.filename().string() + ": " + e.what());
+        throw;
+    }
+}
+
+/**
+ * @brief Decrypt the audio into caller callbacks
+ * @param sink Receives the format first, then the cover unless it is embedded, then the audio in order
+ * @param options Tag options; direct_io, preallocate and the executor apply to files only
+ * @return Format and whether the cover and tags were embedded
+ * @details Exceptions thrown by the callbacks stop decoding and propagate.
+ */
+dump_result NcmFile::dump(const dump_sink& sink, const dump_options& options) {
+    NCM_LOG(level::debug, "Decoding NCM stream: " + _path.filename().string());
+    if (!sink.on_audio) {
+        throw runtime_error("dump_sink has no audio callback");
+    }
+
+    try {
+        read_header();
+        return _decode_audio_data(sink, options);
     } catch (const exception& e) {
-        std::cerr << RED << "[ERROR] Failed to process " << RESET << BLUE << _path.filename() << RESET << ": " << e.what() << std::endl;
+        NCM_LOG(level::debug, "Failed to decode " + _path.filename().string() + ": " + e.what());
         throw;
     }
 }
 
+/**
+ * @brief Parse everything ahead of the cover image
+ * @details Decrypts the key data, sets up the key box, reads the metadata and
+ * locates the cover image. Afterwards the source is positioned at the cover.
+ */
+void NcmFile::read_header() {
+    _ctx.scratch().reset();
+    _read_key_data();
+    _setup_key_box();
+    {
+        metrics::span t(metrics::stage::metadata);
+        _read_metadata();
+        _parse_metadata();
+    }
+    _read_cover_info();
+}
+
+/**
+ * @brief Parse only the metadata and cover location
+ * @details Skips the key block without decrypting it, so the key stream is
+ * left unset. Afterwards the source is positioned at the cover.
+ */
+void NcmFile::read_tags() {
+    _ctx.scratch().reset();
+    _skip_key_data();
+    {
+        metrics::span t(metrics::stage::metadata);
+        _read_metadata();
+        _parse_metadata();
+    }
+    _read_cover_info();
+}
+
+/**
+ * @brief Audio format reported by the metadata (e.g. "flac", "mp3")
+ * @throws runtime_error if the metadata has no format
+ */
+string NcmFile::format() const {
+    if (!_metadata.IsObject() || !_metadata.HasMember("format") || !_metadata["format"].IsString()) {
+        throw Error(error_kind::corrupt, "Missing audio format in metadata");
+    }
+    return _metadata["format"].GetString();
+}
+
+/**
+ * @brief Skip the file header and the encrypted key block
+ */
+void NcmFile::_skip_key_data() {
+    _input->skip(10);
+    unsigned int key_len = little_int(_input->take(4));
+    _input->skip(key_len);
+}
+
 /**
  * @brief Read and decrypt the key data from NCM file
  * @details Reads the encrypted key data from the NCM file structure:
@@ -143,217 +300,464 @@ void NcmFile::dump(const filesystem::path& out_path) {
  * - Removes PKCS7 padding
  */
 void NcmFile::_read_key_data() {
-    std::cout << CYAN << "[DEBUG] Reading key data..." << RESET << std::endl;
+    NCM_LOG(level::trace, "Reading key data...");
+    metrics::span t(metrics::stage::key_decrypt);
     
     // Skip 10 bytes of file header
-    _file.seekg(10, ios::cur);
+    _input->skip(10);
     
     // Read key length (4 bytes, little-endian)
-    unsigned char key_len_bin[4];
-    _file.read((char*)key_len_bin, 4);
-    unsigned int key_len = little_int(key_len_bin);
+    unsigned int key_len = little_int(_input->take(4));
     
-    std::cout << CYAN << "[DEBUG] Key data length: " << key_len << " bytes" << RESET << std::endl;
+    NCM_LOG(level::trace, "Key data length: " + to_string(key_len) + " bytes");
 
-    // Read encrypted key data
-    vector<unsigned char> key_data_bin(key_len);
-    _file.read((char*)key_data_bin.data(), key_len);
-    
-    // Apply XOR 0x64 to each byte
+    // Read encrypted key data and apply XOR 0x64 to each byte
+    const unsigned char* key_data_src = _input->take(key_len);
+    unsigned char* key_data_bin = _ctx.scratch().alloc(key_len);
     for (unsigned int i = 0; i < key_len; i++) {
-        key_data_bin[i] ^= 0x64;
+        key_data_bin[i] = key_data_src[i] ^ 0x64;
     }
 
-    // Decrypt using AES-128 ECB
-    unsigned char core_key[16];
-    hex2str(CORE_HEX_KEY, core_key);
-    vector<unsigned char> decrypted_key = aes_ecb_decrypt(key_data_bin.data(), key_len, core_key);
+    // Decrypt in place using AES-128 ECB
+    size_t decrypted_len = _ctx.decrypt_core(key_data_bin, key_len, key_data_bin);
 
-    // Remove PKCS7 padding
-    unsigned int unpadded_len = pkcs7::pad_size(decrypted_key.data(), decrypted_key.size());
-    _key_data.resize(unpadded_len);
-    pkcs7::unpad(decrypted_key.data(), decrypted_key.size(), _key_data.data());
+    // The PKCS7 padding is simply left out of the used length
+    unsigned int unpadded_len = pkcs7::pad_size(key_data_bin, (unsigned int)decrypted_len);
+    if (unpadded_len <= 17) {
+        throw Error(error_kind::corrupt, "Invalid key data length: " + to_string(unpadded_len) + " bytes");
+    }
+    _key_data = key_data_bin;
+    _key_len = unpadded_len;
     
-    std::cout << CYAN << "[DEBUG] Successfully decrypted key data, length: " << unpadded_len << " bytes" << RESET << std::endl;
+    NCM_LOG(level::trace, "Successfully decrypted key data, length: " + to_string(unpadded_len) + " bytes");
 }
 
 /**
  * @brief Setup the key box for audio data decryption
  * @details Implements the RC4-like key scheduling algorithm to generate
- * a 256-byte key box used for decrypting the audio stream
+ * a 256-byte key box, then expands it into the keystream cycle used for
+ * decrypting the audio stream
  */
 void NcmFile::_setup_key_box() {
-    std::cout << "[DEBUG] Setting up key box..." << std::endl;
-    
-    // Skip the first 17 bytes of key data (header)
-    unsigned char* key_data_use = _key_data.data() + 17;
-    unsigned int key_len_unpad = _key_data.size();
-
-    // Initialize key box with identity permutation
-    _key_box.resize(256);
-    for (unsigned int i = 0; i < 256; i++) {
-        _key_box[i] = i;
-    }
-
-    // RC4-like key scheduling algorithm
-    unsigned char c = 0;
-    unsigned char last_byte = 0;
-    unsigned int key_offset = 0;
-    unsigned char swap = 0;
+    NCM_LOG(level::trace, "Setting up key box...");
+    metrics::span t(metrics::stage::key_box);
     
-    for (unsigned int i = 0; i < 256; i++) {
-        swap = _key_box[i];
-        c = (swap + last_byte + key_data_use[key_offset]) & 0xff;
-        key_offset++;
-        if (key_offset >= key_len_unpad - 17) {
-            key_offset = 0;
-        }
-        _key_box[i] = _key_box[c];
-        _key_box[c] = swap;
-        last_byte = c;
-    }
+    // Skip the first 17 bytes of key data ("neteasecloudmusic")
+    keystream::schedule(_key_data + 17, _key_len - 17, _key_box);
+    keystream::build(_key_box, _keystream);
     
-    std::cout << CYAN << "[DEBUG] Key box setup complete" << RESET << std::endl;
+    NCM_LOG(level::trace, string("Key box setup complete (") + keystream::kernel_name() + " kernel)");
 }
 
 void NcmFile::_read_metadata() {
-    unsigned char mata_len_bin[4];
-    _file.read((char*)mata_len_bin, 4);
-    unsigned int mata_len = little_int(mata_len_bin);
+    unsigned int mata_len = little_int(_input->take(4));
     if (mata_len == 0) return; // No metadata
+    if (mata_len <= 22) {
+        throw Error(error_kind::corrupt, "Invalid metadata length: " + to_string(mata_len) + " bytes");
+    }
 
-    vector<unsigned char> mata_data_bin(mata_len);
-    _file.read((char*)mata_data_bin.data(), mata_len);
-
+    const unsigned char* mata_data_src = _input->take(mata_len);
+    unsigned char* mata_data_bin = _ctx.scratch().alloc(mata_len);
     for (unsigned int i = 0; i < mata_len; i++) {
-        mata_data_bin[i] ^= 0x63;
+        mata_data_bin[i] = mata_data_src[i] ^ 0x63;
     }
 
-    string mata_data_base64((char*)mata_data_bin.data() + 22, mata_len - 22);
-    string mata_data_str = base64_decode(mata_data_base64);
-
-    unsigned char mata_key[16];
-    hex2str(META_HEX_KEY, mata_key);
-    vector<unsigned char> mata_data_decrypted = aes_ecb_decrypt((const unsigned char*)mata_data_str.c_str(), mata_data_str.length(), mata_key);
+    // Skip the "163 key(Don't modify):" prefix and decode into scratch memory
+    const char* mata_data_base64 = (const char*)mata_data_bin + 22;
+    size_t mata_base64_len = mata_len - 22;
+    unsigned char* mata_data = _ctx.scratch().alloc(base64::max_decoded_size(mata_base64_len));
+    size_t mata_data_len = base64::decode(mata_data_base64, mata_base64_len, mata_data);
 
-    unsigned int mata_len_unpad = pkcs7::pad_size(mata_data_decrypted.data(), mata_data_decrypted.size());
-    vector<unsigned char> mata_data(mata_len_unpad);
-    pkcs7::unpad(mata_data_decrypted.data(), mata_data_decrypted.size(), mata_data.data());
+    // Decrypt in place
+    size_t decrypted_len = _ctx.decrypt_meta(mata_data, mata_data_len, mata_data);
 
-    string mata_str((char*)mata_data.data() + 6, mata_len_unpad - 6);
-    _metadata.Parse(mata_str.c_str(), mata_str.length());
+    // Parse past the "music:" prefix, stopping before the PKCS7 padding
+    unsigned int mata_len_unpad = pkcs7::pad_size(mata_data, (unsigned int)decrypted_len);
+    if (mata_len_unpad < 6) {
+        throw Error(error_kind::corrupt, "Invalid metadata length: " + to_string(mata_len_unpad) + " bytes");
+    }
+    _metadata.Parse((const char*)mata_data + 6, mata_len_unpad - 6);
 }
 
 void NcmFile::_parse_metadata() {
-    // This is already done in _read_metadata. 
-    // This method could be used for further processing if needed.
+    _track = track_info();
+    if (!_metadata.IsObject()) {
+        return;
+    }
+
+    _track.format = get_string(_metadata, "format");
+    _track.music_id = get_uint(_metadata, "musicId");
+    _track.music_name = get_string(_metadata, "musicName");
+    _track.album = get_string(_metadata, "album");
+    _track.bitrate = (uint32_t)get_uint(_metadata, "bitrate");
+    _track.duration = get_uint(_metadata, "duration");
+
+    // "artist" is a list of [name, id] pairs
+    auto artists = _metadata.FindMember("artist");
+    if (artists != _metadata.MemberEnd() && artists->value.IsArray()) {
+        for (const auto& entry : artists->value.GetArray()) {
+            if (entry.IsArray() && !entry.Empty() && entry[0].IsString()) {
+                _track.artists.emplace_back(entry[0].GetString(), entry[0].GetStringLength());
+            }
+        }
+    }
 }
 
 /**
- * @brief Dump decrypted audio and cover image from NCM file
- * @param out_path Output path for the decrypted audio file (without extension)
- * @details This function:
- * 1. Extracts cover image if present
- * 2. Determines output format from metadata
- * 3. Decrypts and writes the audio data using the key box
- * 4. Handles progress reporting and error handling
+ * @brief Locate the cover image
+ * @details Skips the 9-byte CRC block and reads the 4-byte cover length
  */
-void NcmFile::_dump_audio_data(const filesystem::path& out_path) {
-    std::cout << CYAN << "[DEBUG] Extracting audio and cover data..." << RESET << std::endl;
-    
+void NcmFile::_read_cover_info() {
     // Skip 9 bytes (CRC checksum)
-    _file.seekg(9, ios::cur);
+    _input->skip(9);
     
     // Read cover image length
-    unsigned char image_len_bin[4];
-    _file.read((char*)image_len_bin, 4);
-    unsigned int image_len = little_int(image_len_bin);
+    _cover_size = little_int(_input->take(4));
+    _cover_offset = _input->position();
+}
+
+/**
+ * @brief Take the cover and build the tagged head of the audio
+ * @param options Output tuning options
+ * @param write_cover Receives the cover when it is not embedded
+ * @param result Receives whether the cover and tags were embedded
+ * @param head Receives the decrypted leading audio and its tagged replacement
+ * @details The cover is replaced by options.transform_cover if set, then
+ * embedded when requested and the head can be rewritten; otherwise it goes
+ * to write_cover.
+ */
+void NcmFile::_prepare_audio(const dump_options& options, const chunk_writer& write_cover, dump_result& result,
+                             AudioHead& head) {
+    unsigned int image_len = _cover_size;
+    const unsigned char* image_data = nullptr;
+    shared_ptr<const vector<unsigned char>> replaced;
+
+    tags::tag_set tags;
+    if (options.write_tags) {
+        tags.title = _track.music_name;
+        tags.artists = _track.artists;
+        tags.album = _track.album;
+        tags.duration_ms = _track.duration;
+    }
+    bool embed_cover = options.embed_cover && image_len > 0;
+    bool rewrite = tags::supported(result.format) && (embed_cover || !tags.empty());
+    embed_cover = embed_cover && rewrite;
 
     if (image_len > 0) {
-        std::cout << CYAN << "[DEBUG] Found cover image, size: " << image_len << " bytes" << RESET << std::endl;
+        NCM_LOG(level::trace, "Found cover image, size: " + to_string(image_len) + " bytes");
         
-        vector<unsigned char> image_data(image_len);
-        _file.read((char*)image_data.data(), image_len);
-
-        filesystem::path cover_path = out_path;
-        cover_path += ".jpg";
-
-        // Ensure directory exists
-        if (cover_path.has_parent_path()) {
-            filesystem::create_directories(cover_path.parent_path());
+        image_data = _input->take(image_len);
+        if (options.transform_cover) {
+            // The replacement outlives every use below, unlike take() pointers
+            replaced = options.transform_cover(image_data, image_len);
+            if (replaced) {
+                image_data = replaced->data();
+                image_len = (unsigned int)replaced->size();
+            }
+        }
+        if (embed_cover && !replaced) {
+            // take() pointers do not survive the next read; keep the cover for the tag
+            unsigned char* copy = _ctx.scratch().alloc(image_len);
+            memcpy(copy, image_data, image_len);
+            image_data = copy;
+        } else if (!embed_cover) {
+            write_cover(image_data, image_len);
         }
+    } else {
+        NCM_LOG(level::trace, "No cover image found");
+    }
 
-        // Write cover image
-        ofstream cover_of(cover_path, ios::out | ios::binary);
-        if (cover_of.is_open()) {
-            cover_of.write((char*)image_data.data(), image_len);
-            cover_of.close();
-            std::cout << "[INFO] Cover image extracted: " << BLUE << cover_path.filename() << RESET << std::endl;
+    if (rewrite) {
+        if (embed_cover) {
+            tags.cover = image_data;
+            tags.cover_size = image_len;
+        }
+        bool tagged = _read_tagged_head(result.format, tags, head.lead, head.head, head.consumed);
+        result.cover_embedded = tagged && embed_cover;
+        result.tags_written = tagged && options.write_tags;
+        if (tagged) {
+            NCM_LOG(level::debug, "Writing tags into " + result.format + " stream");
+        } else if (embed_cover) {
+            NCM_LOG(level::warn, "Cannot tag " + _path.filename().string() + ", writing the cover separately");
+            write_cover(image_data, image_len);
         } else {
-            std::cerr << "[WARNING] Failed to write cover image: " << cover_path << std::endl;
+            NCM_LOG(level::warn, "Cannot tag " + _path.filename().string() + ", writing it untagged");
         }
-    } else {
-        std::cout << CYAN << "[DEBUG] No cover image found" << RESET << std::endl;
-        _file.seekg(image_len, ios::cur);
     }
+}
+
+/**
+ * @brief Dump decrypted audio and cover image from NCM file
+ * @param out_path Output path for the decrypted audio file (without extension)
+ * @param options Output tuning options
+ * @details This function:
+ * 1. Extracts cover image if present, or keeps it for embedding
+ * 2. Determines output format from metadata
+ * 3. Builds the tagged head of the audio when embedding the cover or
+ *    writing tags
+ * 4. Decrypts and writes the audio data using the key box
+ * @return Format and paths of the written files; cover_path stays empty if
+ * the cover could not be written or was embedded
+ */
+dump_result NcmFile::_dump_audio_data(const filesystem::path& out_path, const dump_options& options) {
+    NCM_LOG(level::trace, "Extracting audio and cover data...");
+    
+    dump_result result;
+    result.format = format();
+    AudioHead head;
+    _prepare_audio(options, [&](const unsigned char* data, size_t len) {
+        _write_cover_file(out_path, data, len, options, result);
+    }, result, head);
 
     // Determine output file extension from metadata
-    string extname = "." + string(_metadata["format"].GetString());
+    string extname = "." + result.format;
     filesystem::path tgt = out_path;
     
     // Add extension directly to preserve full filename including dots
     tgt += extname;
 
-    std::cout << "[INFO] Writing audio file: " << BLUE << tgt.filename() << RESET << std::endl;
+    NCM_LOG(level::debug, "Writing audio file: " + tgt.filename().string());
 
     // Ensure directory exists
     if (tgt.has_parent_path()) {
         filesystem::create_directories(tgt.parent_path());
     }
 
-    // Open output file
-    ofstream of(tgt, ios::out | ios::binary);
-    if (!of.is_open()) {
-        throw runtime_error("Failed to open output file: " + tgt.string());
+    // Open a temporary output file, committed to tgt once complete; the audio
+    // runs to the end of the input. A tagged head shifts the audio off the
+    // direct I/O alignment, so it is buffered.
+    OutputFile of(tgt, options.direct_io && head.head.empty(), true);
+    if (options.preallocate && _input->size() != InputSource::unknown_size) {
+        uint64_t remaining = _input->size() - _input->position();
+        of.preallocate(head.head.size() + (head.lead.size() - head.consumed) + remaining);
     }
 
-    // Process audio data with clean progress bar
-    unsigned char buff[0x8000]; // 32KB buffer
-    uint64_t total_bytes = 0;
-    
     auto progress_start = chrono::steady_clock::now();
-    uint64_t last_reported_bytes = 0;
+
+    if (!head.lead.empty()) {
+        of.write(head.head.data(), head.head.size());
+        of.write(head.lead.data() + head.consumed, head.lead.size() - head.consumed);
+    }
+    uint64_t total_bytes = head.lead.size();
+
+    // Large memory-backed files can be split across idle executor threads
+    uint64_t remaining = _input->size() - _input->position();
+    if (options.executor && remaining >= options.parallel_threshold && _input->data()) {
+        total_bytes += _write_audio_parallel(of, head.lead.size(), options);
+    } else {
+        total_bytes += _write_audio_serial([&of](const unsigned char* data, size_t len) { of.write(data, len); },
+                                           head.lead.size(), options);
+    }
+    of.commit(options.commit);
+    
+    auto progress_end = chrono::steady_clock::now();
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(progress_end - progress_start).count();
+    
+    NCM_LOG(level::debug, "Wrote " + to_string(total_bytes / 1024 / 1024) + " MB of audio in " + to_string(elapsed) + " ms");
+
+    result.audio_path = tgt.string();
+    return result;
+}
+
+/**
+ * @brief Decrypt the audio into caller callbacks instead of files
+ * @param sink Receives the format, the cover unless embedded, and the audio
+ * @param options Tag options and decrypt_gate; the file and executor options are not used
+ * @return Format and whether the cover and tags were embedded; the paths stay empty
+ */
+dump_result NcmFile::_decode_audio_data(const dump_sink& sink, const dump_options& options) {
+    dump_result result;
+    result.format = format();
+    if (sink.on_format) {
+        sink.on_format(result.format);
+    }
+
+    AudioHead head;
+    _prepare_audio(options, [&sink](const unsigned char* data, size_t len) {
+        if (sink.on_cover) sink.on_cover(data, len);
+    }, result, head);
+
+    if (!head.head.empty()) {
+        sink.on_audio(head.head.data(), head.head.size());
+    }
+    if (head.lead.size() > head.consumed) {
+        sink.on_audio(head.lead.data() + head.consumed, head.lead.size() - head.consumed);
+    }
+    uint64_t total_bytes = head.lead.size() + _write_audio_serial(sink.on_audio, head.lead.size(), options);
+
+    NCM_LOG(level::debug, "Decoded " + to_string(total_bytes) + " bytes of audio");
+    return result;
+}
+
+/**
+ * @brief Write the cover image next to the audio as out_path + ".jpg"
+ * @details options.place_cover gets the first chance to provide the file;
+ * otherwise it is written to a temporary file and committed.
+ * Failures are logged and leave result.cover_path empty; the audio is still
+ * written.
+ */
+void NcmFile::_write_cover_file(const filesystem::path& out_path, const unsigned char* data, size_t len,
+                                const dump_options& options, dump_result& result) {
+    filesystem::path cover_path = out_path;
+    cover_path += ".jpg";
+
+    // Ensure directory exists
+    if (cover_path.has_parent_path()) {
+        filesystem::create_directories(cover_path.parent_path());
+    }
+
+    // Write cover image
+    try {
+        metrics::span t(metrics::stage::cover_write);
+        if (options.place_cover && options.place_cover(data, len, cover_path.string())) {
+            result.cover_path = cover_path.string();
+            NCM_LOG(level::debug, "Cover image placed: " + cover_path.filename().string());
+            return;
+        }
+        t.add_bytes(len);
+        OutputFile cover_of(cover_path, false, true);
+        cover_of.write(data, len);
+        cover_of.commit(options.commit);
+        result.cover_path = cover_path.string();
+        NCM_LOG(level::debug, "Cover image extracted: " + cover_path.filename().string());
+    } catch (const exception& e) {
+        NCM_LOG(level::warn, "Failed to write cover image " + cover_path.string() + ": " + e.what());
+    }
+}
+
+/**
+ * @brief Decrypt the leading audio and build its tagged replacement
+ * @param fmt Audio format
+ * @param tags Metadata to embed
+ * @param lead Receives the decrypted leading audio read from the input
+ * @param head Receives the bytes replacing the first consumed bytes of lead
+ * @param consumed Receives the number of bytes of lead replaced by head
+ * @return false if the stream cannot be tagged; lead must still be written
+ */
+bool NcmFile::_read_tagged_head(const string& fmt, const tags::tag_set& tags, vector<unsigned char>& lead,
+                                vector<unsigned char>& head, size_t& consumed) {
+    while (true) {
+        size_t needed = tags::head_size(fmt, lead.data(), lead.size());
+        if (needed <= lead.size()) {
+            break;
+        }
+        // Read in bounded steps: a corrupt size field must not allocate more
+        // than the audio holds, and streams do not know their length
+        const unsigned char* chunk = nullptr;
+        size_t n = _input->next(min(needed - lead.size(), AUDIO_CHUNK_SIZE), chunk);
+        if (n == 0) {
+            break;  // The audio ends inside its header; rewrite_head() rejects it
+        }
+        size_t pos = lead.size();
+        lead.resize(pos + n);
+        keystream::apply(_keystream, chunk, lead.data() + pos, n, pos);
+    }
+    return tags::rewrite_head(fmt, lead.data(), lead.size(), tags, head, consumed);
+}
+
+/**
+ * @brief Decrypt and write the rest of the audio front to back on the calling thread
+ * @param write Receives each decrypted chunk in order
+ * @param audio_pos Position of the next input byte relative to the audio start
+ * @param options Supplies the decrypt gate
+ * @return Number of audio bytes written
+ */
+uint64_t NcmFile::_write_audio_serial(const chunk_writer& write, uint64_t audio_pos, const dump_options& options) {
+    unsigned char* buff = audio_buffer().reserve(AUDIO_CHUNK_SIZE);
+    uint64_t total_bytes = 0;
     
-    _file.read((char*)buff, sizeof(buff));
-    unsigned int buff_len = _file.gcount();
+    _input->advise_sequential();
+    const unsigned char* chunk = nullptr;
+    size_t buff_len = _read_audio_chunk(chunk);
     
     while (buff_len > 0) {
-        // Apply decryption using key box
-        for (unsigned int i = 0; i < buff_len; i++) {
-            int j = (i + 1) & 0xff;
-            buff[i] ^= _key_box[(_key_box[j] + _key_box[(_key_box[j] + j) & 0xff]) & 0xff];
+        // Decrypt from the input chunk into the output buffer
+        auto decrypt = [&] {
+            metrics::span t(metrics::stage::audio_decrypt);
+            t.add_bytes(buff_len);
+            keystream::apply(_keystream, chunk, buff, buff_len, audio_pos + total_bytes);
+        };
+        if (options.decrypt_gate) {
+            options.decrypt_gate(decrypt);
+        } else {
+            decrypt();
         }
         
         // Write decrypted data
-        of.write((char*)buff, buff_len);
-        total_bytes += buff_len;
-        
-        // Clean progress indicator - show dots every 10MB
-        if (total_bytes - last_reported_bytes >= 10 * 1024 * 1024) {
-            std::cout << "." << std::flush;
-            last_reported_bytes = total_bytes;
+        {
+            metrics::span t(metrics::stage::audio_write);
+            t.add_bytes(buff_len);
+            write(buff, buff_len);
         }
+        total_bytes += buff_len;
         
         // Read next chunk
-        _file.read((char*)buff, sizeof(buff));
-        buff_len = _file.gcount();
+        buff_len = _read_audio_chunk(chunk);
     }
-    
-    auto progress_end = chrono::steady_clock::now();
-    auto elapsed = chrono::duration_cast<chrono::milliseconds>(progress_end - progress_start).count();
-    
-    // Simple completion summary
-    if (total_bytes > 0) {
-        std::cout << " ✓ " << (total_bytes / 1024 / 1024) << "MB in " << elapsed << "ms" << std::endl;
+    return total_bytes;
+}
+
+/**
+ * @brief Read the next chunk of encrypted audio
+ * @param chunk Receives a pointer valid until the next read
+ * @return Number of bytes, 0 at the end of the input
+ */
+size_t NcmFile::_read_audio_chunk(const unsigned char*& chunk) {
+    metrics::span t(metrics::stage::audio_read);
+    size_t n = _input->next(AUDIO_CHUNK_SIZE, chunk);
+    t.add_bytes(n);
+    return n;
+}
+
+/**
+ * @brief Decrypt and write the rest of the audio as independent chunks on several threads
+ * @param of Output file, written with positional writes from its current size on
+ * @param audio_pos Position of the next input byte relative to the audio start
+ * @param options Supplies the executor and chunk size
+ * @return Number of audio bytes written
+ * @details The keystream depends only on the position, so each chunk can be
+ * decrypted on its own. The calling thread works through chunks as well and
+ * then waits for the helpers still running.
+ */
+uint64_t NcmFile::_write_audio_parallel(OutputFile& of, uint64_t audio_pos, const dump_options& options) {
+    // The unaligned tail is written last, by this thread alone, so that an
+    // output in direct I/O mode only leaves it once no other writes are in flight.
+    const unsigned char* src = _input->data() + _input->position();
+    uint64_t audio_size = _input->size() - _input->position();
+
+    auto work = make_shared<parallel_audio>();
+    work->src = src;
+    work->audio_pos = audio_pos;
+    work->out_pos = of.size();
+    work->size = audio_size / AlignedBuffer::alignment * AlignedBuffer::alignment;
+    work->chunk_size = max<uint64_t>(AUDIO_CHUNK_SIZE, options.parallel_chunk_size / AUDIO_CHUNK_SIZE * AUDIO_CHUNK_SIZE);
+    work->chunk_count = (work->size + work->chunk_size - 1) / work->chunk_size;
+    work->ks = &_keystream;
+    work->out = &of;
+
+    NCM_LOG(level::debug, "Decrypting audio in " + to_string(work->chunk_count) + " parallel chunks");
+
+    for (uint64_t i = 1; i < work->chunk_count; i++) {
+        try {
+            options.executor([work] { work->work(); });
+        } catch (...) {
+            break; // Executor refused; the remaining chunks run here
+        }
     }
+    work->work();
+
+    unique_lock<mutex> lock(work->mtx);
+    work->cv.wait(lock, [&] { return work->finished == work->chunk_count; });
+    if (work->error) {
+        rethrow_exception(work->error);
+    }
+
+    if (size_t tail = (size_t)(audio_size - work->size)) {
+        unsigned char* buff = audio_buffer().reserve(AUDIO_CHUNK_SIZE);
+        keystream::apply(_keystream, src + work->size, buff, tail, audio_pos + work->size);
+        of.write_at(work->out_pos + work->size, buff, tail);
+    }
+
+    _input->skip(audio_size);
+    return audio_size;
 }
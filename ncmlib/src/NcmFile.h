@@ -1,30 +1,89 @@
 
 #pragma once
-#include <fstream>
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include "rapidjson/document.h"
+#include "keystream.h"
+#include "tags.h"
+#include "DecoderContext.h"
+#include "InputSource.h"
+#include "OutputFile.h"
+#include "ncmlib/ncmdump.h"
+#include "ncmlib/probe.h"
 
 namespace ncm {
 
+/** @brief Smallest input mapped under these options, for the NcmFile constructor */
+inline std::uint64_t mmap_threshold(const dump_options& options) {
+    return options.map_input ? InputSource::default_mmap_threshold : InputSource::unknown_size;
+}
+
 class NcmFile {
 public:
     NcmFile(const std::filesystem::path& path);
-    void dump(const std::filesystem::path& out_path);
+    NcmFile(const std::filesystem::path& path, DecoderContext& ctx,
+            std::uint64_t mmap_threshold = InputSource::default_mmap_threshold);
+    NcmFile(std::unique_ptr<InputSource> input);
+    NcmFile(std::unique_ptr<InputSource> input, DecoderContext& ctx);
+    dump_result dump(const std::filesystem::path& out_path, const dump_options& options = dump_options());
+    dump_result dump(const dump_sink& sink, const dump_options& options = dump_options());
+
+    void read_header();
+    void read_tags();
+    const rapidjson::Document& metadata() const { return _metadata; }
+    const track_info& track() const { return _track; }
+    std::string format() const;
+    std::uint64_t cover_offset() const { return _cover_offset; }
+    std::uint32_t cover_size() const { return _cover_size; }
+    std::uint64_t audio_offset() const { return _cover_offset + _cover_size; }
+    const keystream::table& key_stream() const { return _keystream; }
+
+    static void prepare_thread();
 
 private:
+    using chunk_writer = std::function<void(const unsigned char*, std::size_t)>;
+
+    /**
+     * @brief Decrypted leading audio and the tagged bytes replacing its first `consumed` bytes
+     */
+    struct AudioHead {
+        std::vector<unsigned char> lead;
+        std::vector<unsigned char> head;
+        std::size_t consumed = 0;
+    };
+
+    void _skip_key_data();
     void _read_key_data();
     void _setup_key_box();
     void _read_metadata();
     void _parse_metadata();
-    void _dump_audio_data(const std::filesystem::path& out_path);
+    void _read_cover_info();
+    void _prepare_audio(const dump_options& options, const chunk_writer& write_cover, dump_result& result,
+                        AudioHead& head);
+    dump_result _dump_audio_data(const std::filesystem::path& out_path, const dump_options& options);
+    dump_result _decode_audio_data(const dump_sink& sink, const dump_options& options);
+    void _write_cover_file(const std::filesystem::path& out_path, const unsigned char* data, std::size_t len,
+                           const dump_options& options, dump_result& result);
+    bool _read_tagged_head(const std::string& fmt, const tags::tag_set& tags, std::vector<unsigned char>& lead,
+                           std::vector<unsigned char>& head, std::size_t& consumed);
+    std::uint64_t _write_audio_serial(const chunk_writer& write, std::uint64_t audio_pos, const dump_options& options);
+    std::size_t _read_audio_chunk(const unsigned char*& chunk);
+    std::uint64_t _write_audio_parallel(OutputFile& of, std::uint64_t audio_pos, const dump_options& options);
 
     std::filesystem::path _path;
-    std::ifstream _file;
-    std::vector<unsigned char> _key_data;
-    std::vector<unsigned char> _key_box;
+    DecoderContext& _ctx;
+    std::unique_ptr<InputSource> _input;
+    const unsigned char* _key_data = nullptr;  // In _ctx scratch, valid while reading the header
+    std::size_t _key_len = 0;
+    unsigned char _key_box[256];
+    keystream::table _keystream;
     rapidjson::Document _metadata;
+    track_info _track;  // Fields taken from _metadata; offsets are left unset
+    std::uint64_t _cover_offset = 0;
+    std::uint32_t _cover_size = 0;
 };
 
 }
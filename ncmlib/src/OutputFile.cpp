@@ -0,0 +1,256 @@
+/**
+ * @file OutputFile.cpp
+ * @brief Positional file writer implementation
+ * @details Direct I/O requires aligned buffers, offsets and lengths. The
+ * writer switches back to buffered mode on the first unaligned transfer,
+ * which in practice is the final partial chunk of a file.
+ */
+
+#include "OutputFile.h"
+#include "ncmlib/commit.h"
+#include "ncmlib/error.h"
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace ncm {
+
+AlignedBuffer::~AlignedBuffer() {
+#ifdef _WIN32
+    _aligned_free(_data);
+#else
+    free(_data);
+#endif
+}
+
+unsigned char* AlignedBuffer::reserve(size_t size) {
+    if (size <= _capacity) return _data;
+
+    size = (size + alignment - 1) / alignment * alignment;
+#ifdef _WIN32
+    void* p = _aligned_malloc(size, alignment);
+    if (!p) throw bad_alloc();
+    _aligned_free(_data);
+#else
+    void* p = nullptr;
+    if (posix_memalign(&p, alignment, size) != 0) throw bad_alloc();
+    free(_data);
+#endif
+    _data = (unsigned char*)p;
+    _capacity = size;
+    return _data;
+}
+
+namespace {
+    bool is_aligned(uint64_t value) {
+        return value % AlignedBuffer::alignment == 0;
+    }
+} // anonymous namespace
+
+#ifdef _WIN32
+
+void OutputFile::_open(bool direct_io) {
+    const filesystem::path& path = _path;
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+    HANDLE h = INVALID_HANDLE_VALUE;
+    if (direct_io) {
+        // Shared for writing so _leave_direct_mode() can open a buffered
+        // handle to the same file before this one is closed
+        h = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS,
+                        flags | FILE_FLAG_NO_BUFFERING, nullptr);
+        _direct = h != INVALID_HANDLE_VALUE;
+    }
+    if (h == INVALID_HANDLE_VALUE) {
+        h = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, flags, nullptr);
+    }
+    if (h == INVALID_HANDLE_VALUE) {
+        throw Error(error_kind::output, "Failed to open output file: " + path.string());
+    }
+    _handle = h;
+}
+
+OutputFile::~OutputFile() {
+    if (_handle) CloseHandle((HANDLE)_handle);
+    _discard_temporary();
+}
+
+void OutputFile::preallocate(uint64_t size) {
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = (LONGLONG)size;
+    SetFileInformationByHandle((HANDLE)_handle, FileAllocationInfo, &info, sizeof(info));
+}
+
+void OutputFile::write_at(uint64_t offset, const unsigned char* data, size_t len) {
+    if (_direct && !(is_aligned(offset) && is_aligned(len) && is_aligned((uintptr_t)data))) {
+        _leave_direct_mode();
+    }
+    while (len > 0) {
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)(offset & 0xffffffff);
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD chunk = (DWORD)min<size_t>(len, 0x40000000);
+        DWORD written = 0;
+        if (!WriteFile((HANDLE)_handle, data, chunk, &written, &ov)) {
+            throw Error(error_kind::output, "Failed to write output file: " + _path.string());
+        }
+        data += written;
+        offset += written;
+        len -= written;
+    }
+}
+
+void OutputFile::close() {
+    if (!_handle) return;
+    BOOL ok = CloseHandle((HANDLE)_handle);
+    _handle = nullptr;
+    if (!ok) throw Error(error_kind::output, "Failed to close output file: " + _path.string());
+}
+
+void OutputFile::_leave_direct_mode() {
+    // Unbuffered handles cannot be switched in place; reopen the same file.
+    HANDLE h = CreateFileW(_path.c_str(), GENERIC_WRITE, FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+    CloseHandle((HANDLE)_handle);
+    if (h == INVALID_HANDLE_VALUE) {
+        _handle = nullptr;
+        throw Error(error_kind::output, "Failed to reopen output file: " + _path.string());
+    }
+    _handle = h;
+    _direct = false;
+}
+
+#else
+
+void OutputFile::_open(bool direct_io) {
+    const filesystem::path& path = _path;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+    if (direct_io) {
+        _fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        _direct = _fd >= 0;
+    }
+#endif
+    if (_fd < 0) {
+        _fd = ::open(path.c_str(), flags, 0644);
+    }
+    if (_fd < 0) {
+        throw Error(error_kind::output, "Failed to open output file: " + path.string() + ": " + strerror(errno));
+    }
+}
+
+OutputFile::~OutputFile() {
+    if (_fd >= 0) ::close(_fd);
+    _discard_temporary();
+}
+
+void OutputFile::preallocate(uint64_t size) {
+#if defined(__linux__)
+    if (size > 0) {
+        // KEEP_SIZE reserves extents without exposing unwritten bytes if the
+        // audio turns out shorter than expected.
+        fallocate(_fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+    }
+#else
+    (void)size;
+#endif
+}
+
+void OutputFile::write_at(uint64_t offset, const unsigned char* data, size_t len) {
+    if (_direct && !(is_aligned(offset) && is_aligned(len) && is_aligned((uintptr_t)data))) {
+        _leave_direct_mode();
+    }
+    while (len > 0) {
+        ssize_t n = ::pwrite(_fd, data, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw Error(error_kind::output, "Failed to write output file: " + _path.string() + ": " + strerror(errno));
+        }
+        data += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+void OutputFile::close() {
+    if (_fd < 0) return;
+    int rc = ::close(_fd);
+    _fd = -1;
+    if (rc != 0) {
+        throw Error(error_kind::output, "Failed to close output file: " + _path.string() + ": " + strerror(errno));
+    }
+}
+
+void OutputFile::_leave_direct_mode() {
+#ifdef O_DIRECT
+    int flags = fcntl(_fd, F_GETFL);
+    if (flags >= 0) fcntl(_fd, F_SETFL, flags & ~O_DIRECT);
+#endif
+    _direct = false;
+}
+
+#endif
+
+OutputFile::OutputFile(const filesystem::path& path, bool direct_io) : _path(path) {
+    _open(direct_io);
+}
+
+OutputFile::OutputFile(const filesystem::path& path, bool direct_io, bool temporary) : _path(path) {
+    if (temporary) {
+        _target = path;
+        _path = temp_path(path.string());
+    }
+    _open(direct_io);
+}
+
+void OutputFile::commit(const committer& commit) {
+    close();
+    if (_target.empty()) {
+        return;
+    }
+    // From here on the committer owns the temporary file
+    string temp = _path.string();
+    string target = _target.string();
+    _target.clear();
+    if (commit) {
+        commit(temp, target);
+        return;
+    }
+    try {
+        commit_file(temp, target);
+    } catch (...) {
+        error_code ec;
+        filesystem::remove(temp, ec);
+        throw;
+    }
+}
+
+void OutputFile::_discard_temporary() {
+    if (!_target.empty()) {
+        error_code ec;
+        filesystem::remove(_path, ec);
+    }
+}
+
+void OutputFile::write(const unsigned char* data, size_t len) {
+    write_at(_offset, data, len);
+    _offset += len;
+}
+
+}
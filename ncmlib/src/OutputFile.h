@@ -0,0 +1,139 @@
+/**
+ * @file OutputFile.h
+ * @brief Positional file writer and aligned buffers for decrypted output
+ * @details Writes go straight to the file descriptor with pwrite (WriteFile
+ * with an explicit offset on Windows), skipping the std::ofstream buffer.
+ * Optionally opens the target for direct I/O and preallocates its final size,
+ * and writes through a temporary file that commit() renames into place.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+namespace ncm {
+
+/**
+ * @brief Heap buffer aligned for direct I/O
+ * @details Memory is allocated on first use and kept for reuse; the buffer
+ * only grows.
+ */
+class AlignedBuffer {
+public:
+    /** @brief Alignment of the buffer start and of direct I/O transfers */
+    static constexpr std::size_t alignment = 4096;
+
+    AlignedBuffer() = default;
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+    ~AlignedBuffer();
+
+    /**
+     * @brief Ensure the buffer holds at least size bytes
+     * @param size Minimum capacity, rounded up to the alignment
+     * @return Pointer to the buffer start
+     */
+    unsigned char* reserve(std::size_t size);
+
+    unsigned char* data() const { return _data; }
+    std::size_t capacity() const { return _capacity; }
+
+private:
+    unsigned char* _data = nullptr;
+    std::size_t _capacity = 0;
+};
+
+/**
+ * @brief Write-only output file using positional writes
+ */
+class OutputFile {
+public:
+    /**
+     * @brief Create or truncate an output file
+     * @param path Target path
+     * @param direct_io Request O_DIRECT (FILE_FLAG_NO_BUFFERING on Windows);
+     * silently falls back to buffered I/O where unsupported
+     * @throws std::runtime_error if the file cannot be opened
+     */
+    OutputFile(const std::filesystem::path& path, bool direct_io = false);
+
+    /**
+     * @brief Create a temporary file next to path, moved there by commit()
+     * @param path Target path
+     * @param direct_io As above
+     * @param temporary Write to temp_path(path) instead of path; if the
+     * file is destroyed without commit(), the temporary file is removed
+     * @throws std::runtime_error if the file cannot be opened
+     */
+    OutputFile(const std::filesystem::path& path, bool direct_io, bool temporary);
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+    ~OutputFile();
+
+    /**
+     * @brief Reserve disk space for the final file size
+     * @param size Expected size in bytes
+     * @details Best effort: filesystems without fallocate support are ignored.
+     * The visible file size is not changed.
+     */
+    void preallocate(std::uint64_t size);
+
+    /**
+     * @brief Append data at the current write offset
+     * @throws std::runtime_error on write failure
+     */
+    void write(const unsigned char* data, std::size_t len);
+
+    /**
+     * @brief Write data at an absolute offset without moving the append offset
+     * @throws std::runtime_error on write failure
+     * @details Safe to call concurrently for disjoint ranges.
+     */
+    void write_at(std::uint64_t offset, const unsigned char* data, std::size_t len);
+
+    /**
+     * @brief Close the file
+     * @throws std::runtime_error if closing fails
+     */
+    void close();
+
+    /** @brief Function moving a closed temporary file (first argument) to the target (second) */
+    using committer = std::function<void(const std::string& temp, const std::string& target)>;
+
+    /**
+     * @brief Close the file and move a temporary file to the target path
+     * @param commit Performs the move; empty renames at once with commit_file()
+     * @details The committer takes over the temporary file, including its
+     * removal on failure. Same as close() for files opened without a
+     * temporary path.
+     * @throws std::runtime_error if closing or renaming fails
+     */
+    void commit(const committer& commit = committer());
+
+    /** @brief Whether direct I/O is active */
+    bool direct() const { return _direct; }
+
+    /** @brief Bytes appended with write() so far */
+    std::uint64_t size() const { return _offset; }
+
+private:
+    void _open(bool direct_io);
+    void _leave_direct_mode();
+    void _discard_temporary();
+
+    std::filesystem::path _path;    // File written, the temporary file if any
+    std::filesystem::path _target;  // Final path, empty without a temporary file
+#ifdef _WIN32
+    void* _handle = nullptr;
+#else
+    int _fd = -1;
+#endif
+    std::atomic<bool> _direct = false;
+    std::uint64_t _offset = 0;
+};
+
+}
@@ -40,6 +40,7 @@
  */ 
 
 #include "base64.h"
+#include "ncmlib/error.h"
 #include <algorithm>
 #include <stdexcept>
 #include <iostream>
@@ -75,7 +76,7 @@ static unsigned int pos_of_char(const unsigned char chr) {
  // 2020-10-23: Throw std::exception rather than const char*
  //(Pablo Martin-Gomez, https://github.com/Bouska)
  //
-    throw std::runtime_error("Input is not valid base64-encoded data.");
+    throw ncm::Error(ncm::error_kind::corrupt, "Input is not valid base64-encoded data.");
 }
 
 static std::string insert_linebreaks(std::string str, size_t distance) {
@@ -0,0 +1,306 @@
+/**
+ * @file base64_simd.cpp
+ * @brief Runtime-dispatched base64 decoding kernels
+ * @details Characters are translated to 6-bit values with nibble lookups
+ * (vpshufb / tbl) that also flag anything outside the alphabet, then packed
+ * four values to three bytes. Kernels stop at the first block containing a
+ * character they do not handle and leave the rest to the scalar loop, which
+ * pinpoints the error or accepts the URL-safe characters.
+ */
+
+#include "base64_simd.h"
+#include "ncmlib/error.h"
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define NCM_BASE64_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define NCM_BASE64_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NCM_TARGET(x) __attribute__((target(x)))
+#else
+#define NCM_TARGET(x)
+#endif
+
+namespace ncm {
+namespace base64 {
+
+namespace {
+    /** @brief Marks characters outside the alphabet in the decode table */
+    constexpr unsigned char INVALID = 0xff;
+
+    constexpr std::array<unsigned char, 256> make_decode_table() {
+        std::array<unsigned char, 256> t{};
+        for (auto& v : t) v = INVALID;
+        for (int i = 0; i < 26; i++) {
+            t['A' + i] = (unsigned char)i;
+            t['a' + i] = (unsigned char)(26 + i);
+        }
+        for (int i = 0; i < 10; i++) {
+            t['0' + i] = (unsigned char)(52 + i);
+        }
+        t['+'] = t['-'] = 62;
+        t['/'] = t['_'] = 63;
+        return t;
+    }
+
+    constexpr std::array<unsigned char, 256> DECODE_TABLE = make_decode_table();
+
+    [[noreturn]] void throw_invalid() {
+        throw Error(error_kind::corrupt, "Input is not valid base64-encoded data.");
+    }
+
+    /**
+     * @brief Kernel signature
+     * @param src Characters without padding
+     * @param len Number of characters
+     * @param dst Output buffer
+     * @return Number of characters consumed, always a multiple of 4; the
+     * matching output is len / 4 * 3 bytes
+     * @details A kernel may write scratch bytes past its output as long as
+     * the caller still writes over them, so it keeps a margin of unconsumed
+     * input behind every store.
+     */
+    using kernel_fn = std::size_t (*)(const char* src, std::size_t len, unsigned char* dst);
+
+    struct kernel {
+        const char* name;
+        kernel_fn fn;
+    };
+
+    std::size_t decode_none(const char*, std::size_t, unsigned char*) {
+        return 0;
+    }
+
+#ifdef NCM_BASE64_X86
+    /**
+     * @brief Translate 16 characters to 6-bit values
+     * @return false if any character is outside the standard alphabet
+     */
+    NCM_TARGET("ssse3")
+    inline bool translate_ssse3(__m128i in, __m128i& values) {
+        const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                             0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+        const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                             0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+
+        __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+        __m128i lo = _mm_and_si128(in, nibble);
+        __m128i bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo), _mm_shuffle_epi8(lut_hi, hi));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xffff) {
+            return false;
+        }
+        __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+        values = _mm_add_epi8(in, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(slash, hi)));
+        return true;
+    }
+
+    NCM_TARGET("ssse3")
+    std::size_t decode_ssse3(const char* src, std::size_t len, unsigned char* dst) {
+        const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        std::size_t i = 0;
+        // Each store writes 4 scratch bytes; 8 more characters overwrite them
+        for (; i + 16 + 8 <= len; i += 16, dst += 12) {
+            __m128i values;
+            if (!translate_ssse3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), values)) {
+                break;
+            }
+            __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+            __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi8(packed, pack));
+        }
+        return i;
+    }
+
+    NCM_TARGET("avx2")
+    std::size_t decode_avx2(const char* src, std::size_t len, unsigned char* dst) {
+        const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                                0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+        const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                                0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                  0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                              2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+        std::size_t i = 0;
+        // Each store writes 8 scratch bytes; 12 more characters overwrite them
+        for (; i + 32 + 12 <= len; i += 32, dst += 24) {
+            __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibble);
+            __m256i lo = _mm256_and_si256(in, nibble);
+            __m256i bad = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo), _mm256_shuffle_epi8(lut_hi, hi));
+            if (!_mm256_testz_si256(bad, bad)) {
+                break;
+            }
+            __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+            __m256i values = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(slash, hi)));
+
+            __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+            __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+            packed = _mm256_shuffle_epi8(packed, pack);
+            // Close the gap between the two 12-byte lane results
+            packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), packed);
+        }
+        // Finish a short run with the 16-byte kernel
+        return i + decode_ssse3(src + i, len - i, dst);
+    }
+
+    /**
+     * @brief Query CPU features, including OS support for the wider registers
+     */
+    kernel detect_kernel() {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return {"avx2", decode_avx2};
+        if (__builtin_cpu_supports("ssse3")) return {"ssse3", decode_ssse3};
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int max_leaf = info[0];
+        __cpuid(info, 1);
+        bool ssse3 = (info[2] & (1 << 9)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+        if (max_leaf >= 7) {
+            __cpuidex(info, 7, 0);
+            bool avx2 = (info[1] & (1 << 5)) != 0;
+            if (avx2 && (xcr0 & 0x6) == 0x6) return {"avx2", decode_avx2};
+        }
+        if (ssse3) return {"ssse3", decode_ssse3};
+#endif
+        return {"scalar", decode_none};
+    }
+#elif defined(NCM_BASE64_NEON)
+    /**
+     * @brief Translate 16 characters to 6-bit values
+     * @return false if any character is outside the standard alphabet
+     */
+    inline bool translate_neon(uint8x16_t in, uint8x16_t& values) {
+        static const uint8_t lut_lo_bytes[16] = {0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a};
+        static const uint8_t lut_hi_bytes[16] = {0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10};
+        static const int8_t lut_roll_bytes[16] = {0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0};
+
+        uint8x16_t hi = vshrq_n_u8(in, 4);
+        uint8x16_t lo = vandq_u8(in, vdupq_n_u8(0x0f));
+        uint8x16_t bad = vandq_u8(vqtbl1q_u8(vld1q_u8(lut_lo_bytes), lo), vqtbl1q_u8(vld1q_u8(lut_hi_bytes), hi));
+        if (vmaxvq_u8(bad) != 0) {
+            return false;
+        }
+        uint8x16_t slash = vceqq_u8(in, vdupq_n_u8('/'));
+        uint8x16_t roll = vqtbl1q_u8(vreinterpretq_u8_s8(vld1q_s8(lut_roll_bytes)), vaddq_u8(slash, hi));
+        values = vaddq_u8(in, roll);
+        return true;
+    }
+
+    std::size_t decode_neon(const char* src, std::size_t len, unsigned char* dst) {
+        std::size_t i = 0;
+        for (; i + 64 <= len; i += 64, dst += 48) {
+            // De-interleave so each register holds one of the four values of 16 groups
+            uint8x16x4_t in = vld4q_u8(reinterpret_cast<const uint8_t*>(src + i));
+            uint8x16x4_t v;
+            if (!translate_neon(in.val[0], v.val[0]) || !translate_neon(in.val[1], v.val[1]) ||
+                !translate_neon(in.val[2], v.val[2]) || !translate_neon(in.val[3], v.val[3])) {
+                break;
+            }
+            uint8x16x3_t out;
+            out.val[0] = vorrq_u8(vshlq_n_u8(v.val[0], 2), vshrq_n_u8(v.val[1], 4));
+            out.val[1] = vorrq_u8(vshlq_n_u8(v.val[1], 4), vshrq_n_u8(v.val[2], 2));
+            out.val[2] = vorrq_u8(vshlq_n_u8(v.val[2], 6), v.val[3]);
+            vst3q_u8(dst, out);
+        }
+        return i;
+    }
+
+    kernel detect_kernel() {
+        return {"neon", decode_neon};
+    }
+#else
+    kernel detect_kernel() {
+        return {"scalar", decode_none};
+    }
+#endif
+
+    const kernel& selected_kernel() {
+        static const kernel k = detect_kernel();
+        return k;
+    }
+} // anonymous namespace
+
+namespace {
+    std::size_t decode_with(const kernel& k, const char* src, std::size_t len, unsigned char* dst) {
+        // Up to two '=' characters of padding
+        for (int n = 0; n < 2 && len > 0 && src[len - 1] == '='; n++) {
+            len--;
+        }
+        if (len % 4 == 1) {
+            throw_invalid();
+        }
+
+        std::size_t i = k.fn(src, len, dst);
+        unsigned char* out = dst + i / 4 * 3;
+
+        const unsigned char* s = reinterpret_cast<const unsigned char*>(src);
+        for (; i + 4 <= len; i += 4) {
+            unsigned char a = DECODE_TABLE[s[i]], b = DECODE_TABLE[s[i + 1]];
+            unsigned char c = DECODE_TABLE[s[i + 2]], d = DECODE_TABLE[s[i + 3]];
+            if ((a | b | c | d) & 0xc0) {
+                throw_invalid();
+            }
+            *out++ = (unsigned char)(a << 2 | b >> 4);
+            *out++ = (unsigned char)(b << 4 | c >> 2);
+            *out++ = (unsigned char)(c << 6 | d);
+        }
+
+        // Final group of 2 or 3 characters
+        if (i < len) {
+            unsigned char a = DECODE_TABLE[s[i]], b = DECODE_TABLE[s[i + 1]];
+            if ((a | b) & 0xc0) {
+                throw_invalid();
+            }
+            *out++ = (unsigned char)(a << 2 | b >> 4);
+            if (len - i == 3) {
+                unsigned char c = DECODE_TABLE[s[i + 2]];
+                if (c & 0xc0) {
+                    throw_invalid();
+                }
+                *out++ = (unsigned char)(b << 4 | c >> 2);
+            }
+        }
+        return (std::size_t)(out - dst);
+    }
+} // anonymous namespace
+
+std::size_t decode(const char* src, std::size_t len, unsigned char* dst) {
+    return decode_with(selected_kernel(), src, len, dst);
+}
+
+std::size_t decode_scalar(const char* src, std::size_t len, unsigned char* dst) {
+    return decode_with({"scalar", decode_none}, src, len, dst);
+}
+
+const char* kernel_name() {
+    return selected_kernel().name;
+}
+
+} // namespace base64
+} // namespace ncm
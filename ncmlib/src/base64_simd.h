@@ -0,0 +1,47 @@
+/**
+ * @file base64_simd.h
+ * @brief Vectorized base64 decoder for the NCM metadata block
+ * @details Decodes straight from the source span into a caller buffer. Whole
+ * vector blocks are translated and packed in registers; the remainder and any
+ * block with characters outside the standard alphabet go through a table
+ * driven scalar loop.
+ */
+
+#pragma once
+#include <cstddef>
+
+namespace ncm {
+namespace base64 {
+
+/**
+ * @brief Upper bound of the decoded size for len input characters
+ */
+constexpr std::size_t max_decoded_size(std::size_t len) {
+    return len / 4 * 3 + 3;
+}
+
+/**
+ * @brief Decode base64 text
+ * @param src Encoded characters; trailing '=' padding is optional
+ * @param len Number of characters
+ * @param dst Output buffer of at least max_decoded_size(len) bytes
+ * @return Number of bytes written
+ * @details Accepts the URL-safe '-' and '_' as well, like base64_decode().
+ * @throws std::runtime_error if the input is not valid base64
+ */
+std::size_t decode(const char* src, std::size_t len, unsigned char* dst);
+
+/**
+ * @brief decode() without the vector kernels
+ * @details Reference for cross-checks and benchmarks.
+ */
+std::size_t decode_scalar(const char* src, std::size_t len, unsigned char* dst);
+
+/**
+ * @brief Name of the kernel selected for this CPU
+ * @return One of "scalar", "ssse3", "avx2", "neon"
+ */
+const char* kernel_name();
+
+} // namespace base64
+} // namespace ncm
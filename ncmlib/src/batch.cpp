@@ -0,0 +1,210 @@
+/**
+ * @file batch.cpp
+ * @brief Batch conversion implementation
+ * @details Jobs run either on worker threads owned by the batch or as tasks
+ * handed to the caller's executor. Each job reports on the thread that ran
+ * it; completion is counted only after the callbacks returned, so wait()
+ * also waits for them. Cancelled jobs still go through the same reporting,
+ * so every submitted job yields exactly one result.
+ */
+
+#include "ncmlib/batch.h"
+#include "ncmlib/log.h"
+#include "NcmFile.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace ncm {
+
+struct Batch::Impl {
+    batch_options options;
+
+    mutex mtx;
+    condition_variable work_cv;     // internal pool: a job was queued or the batch stops
+    condition_variable done_cv;     // a job finished
+    batch_progress progress;
+    size_t done = 0;                // jobs whose callbacks have returned
+    size_t returned = 0;            // results handed out by next()
+    deque<pair<batch_job, size_t>> pending;
+    deque<batch_result> results;
+    bool stopping = false;
+    bool cancelled = false;         // jobs not yet started are reported instead of run
+    vector<thread> threads;
+
+    /** @brief Serializes the result and progress callbacks */
+    mutex callback_mtx;
+
+    void worker() {
+        while (true) {
+            unique_lock<mutex> lock(mtx);
+            work_cv.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (pending.empty()) {
+                return;
+            }
+            auto item = std::move(pending.front());
+            pending.pop_front();
+            lock.unlock();
+
+            run(item.first, item.second);
+        }
+    }
+
+    void run(const batch_job& job, size_t index) {
+        auto start = chrono::steady_clock::now();
+        batch_result r;
+        r.index = index;
+        {
+            lock_guard<mutex> lock(mtx);
+            if (cancelled) {
+                r.error = "Cancelled";
+                r.kind = error_kind::cancelled;
+            }
+        }
+        if (!r.ok()) {
+            finish(std::move(r));
+            return;
+        }
+        try {
+            if (job.data) {
+                NcmFile file(InputSource::from_memory(job.data, job.size), DecoderContext::local());
+                r.result = file.dump(job.output, options.dump);
+            } else {
+                NcmFile file(job.input, DecoderContext::local(), mmap_threshold(options.dump));
+                r.result = file.dump(job.output, options.dump);
+            }
+        } catch (const exception& e) {
+            r.error = *e.what() ? e.what() : "Unknown error";
+            r.kind = classify(e);
+        } catch (...) {
+            r.error = "Unknown error";
+            r.kind = error_kind::other;
+        }
+        r.elapsed_us = (uint64_t)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+        finish(std::move(r));
+    }
+
+    void finish(batch_result&& r) {
+        bool failed = !r.ok();
+        {
+            lock_guard<mutex> callbacks(callback_mtx);
+            batch_progress snapshot;
+            {
+                lock_guard<mutex> lock(mtx);
+                progress.completed++;
+                if (failed) progress.failed++;
+                snapshot = progress;
+            }
+            // A throwing callback must not take down a pool or executor thread
+            try {
+                if (options.on_result) options.on_result(r);
+                if (options.on_progress) options.on_progress(snapshot);
+            } catch (const exception& e) {
+                NCM_LOG(log::level::warn, string("Batch callback failed: ") + e.what());
+            } catch (...) {
+                NCM_LOG(log::level::warn, "Batch callback failed");
+            }
+        }
+
+        // Last use of this object by the job; the batch may be destroyed
+        // as soon as the lock is released
+        lock_guard<mutex> lock(mtx);
+        if (!options.on_result) {
+            results.push_back(std::move(r));
+        }
+        done++;
+        done_cv.notify_all();
+    }
+};
+
+Batch::Batch(batch_options options) : _impl(make_unique<Impl>()) {
+    _impl->options = std::move(options);
+    if (!_impl->options.executor) {
+        unsigned int threads = _impl->options.threads;
+        if (threads == 0) threads = thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        for (unsigned int i = 0; i < threads; ++i) {
+            _impl->threads.emplace_back([impl = _impl.get()] { impl->worker(); });
+        }
+    }
+}
+
+Batch::~Batch() {
+    wait();
+    {
+        lock_guard<mutex> lock(_impl->mtx);
+        _impl->stopping = true;
+    }
+    _impl->work_cv.notify_all();
+    for (auto& t : _impl->threads) {
+        t.join();
+    }
+}
+
+size_t Batch::submit(batch_job job) {
+    Impl* impl = _impl.get();
+    size_t index;
+    {
+        lock_guard<mutex> lock(impl->mtx);
+        index = impl->progress.submitted++;
+        if (!impl->options.executor) {
+            impl->pending.emplace_back(std::move(job), index);
+        }
+    }
+    if (!impl->options.executor) {
+        impl->work_cv.notify_one();
+        return index;
+    }
+
+    // Shared so that a refused task can still run here without copying the job again
+    auto shared = make_shared<batch_job>(std::move(job));
+    function<void()> task = [impl, shared, index] { impl->run(*shared, index); };
+    try {
+        impl->options.executor(task);
+    } catch (...) {
+        NCM_LOG(log::level::debug, "Executor refused a batch job; running it on the submitting thread");
+        task();
+    }
+    return index;
+}
+
+bool Batch::next(batch_result& out) {
+    unique_lock<mutex> lock(_impl->mtx);
+    if (_impl->options.on_result) {
+        return false;
+    }
+    _impl->done_cv.wait(lock, [this] {
+        return !_impl->results.empty() || _impl->returned == _impl->progress.submitted;
+    });
+    if (_impl->results.empty()) {
+        return false;
+    }
+    out = std::move(_impl->results.front());
+    _impl->results.pop_front();
+    _impl->returned++;
+    return true;
+}
+
+void Batch::cancel() {
+    lock_guard<mutex> lock(_impl->mtx);
+    _impl->cancelled = true;
+}
+
+void Batch::wait() {
+    unique_lock<mutex> lock(_impl->mtx);
+    _impl->done_cv.wait(lock, [this] { return _impl->done == _impl->progress.submitted; });
+}
+
+batch_progress Batch::progress() const {
+    lock_guard<mutex> lock(_impl->mtx);
+    return _impl->progress;
+}
+
+} // namespace ncm
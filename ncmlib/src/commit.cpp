@@ -0,0 +1,290 @@
+/**
+ * @file commit.cpp
+ * @brief Atomic and durable output commit implementation
+ * @details A rename within one directory replaces the target atomically on
+ * POSIX file systems and with MoveFileExW on Windows. For durability the
+ * temporary file's data must reach the disk before the rename does, and the
+ * rename itself only persists once its directory is synced.
+ */
+
+#include "ncmlib/commit.h"
+#include "ncmlib/error.h"
+#include "ncmlib/log.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <process.h>
+#else
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace ncm {
+
+namespace {
+    using level = log::level;
+
+    string last_error() {
+#ifdef _WIN32
+        return system_category().message((int)GetLastError());
+#else
+        return strerror(errno);
+#endif
+    }
+
+#ifdef _WIN32
+    bool flush_file(const string& path) {
+        HANDLE h = CreateFileW(filesystem::path(path).c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h == INVALID_HANDLE_VALUE) return false;
+        BOOL ok = FlushFileBuffers(h);
+        CloseHandle(h);
+        return ok != 0;
+    }
+#else
+    bool fsync_path(const string& path, int flags) {
+        int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+        if (fd < 0) return false;
+        int rc = ::fsync(fd);
+        ::close(fd);
+        return rc == 0;
+    }
+
+    /** @brief Flush the data of a file, and its metadata only as far as needed to read it back */
+    bool datasync_path(const string& path) {
+#if defined(__linux__)
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        int rc = ::fdatasync(fd);
+        ::close(fd);
+        return rc == 0;
+#else
+        return fsync_path(path, O_RDONLY);
+#endif
+    }
+#endif
+
+    /**
+     * @brief Rename temp over target
+     * @param durable Have Windows flush the rename before returning; POSIX
+     * callers sync the directory instead
+     */
+    void rename_file(const string& temp, const string& target, bool durable) {
+#ifdef _WIN32
+        DWORD flags = MOVEFILE_REPLACE_EXISTING | (durable ? MOVEFILE_WRITE_THROUGH : 0);
+        if (!MoveFileExW(filesystem::path(temp).c_str(), filesystem::path(target).c_str(), flags)) {
+            throw Error(error_kind::output, "Failed to rename " + temp + " to " + target + ": " + last_error());
+        }
+#else
+        (void)durable;
+        if (::rename(temp.c_str(), target.c_str()) != 0) {
+            throw Error(error_kind::output, "Failed to rename " + temp + " to " + target + ": " + last_error());
+        }
+#endif
+    }
+
+    /** @brief Longest file name most file systems accept (NAME_MAX) */
+    constexpr size_t MAX_NAME_BYTES = 255;
+
+    struct pending_commit {
+        string temp;
+        string target;
+        CommitBatch::callback on_done;
+    };
+} // anonymous namespace
+
+string temp_path(const string& target) {
+    static atomic<unsigned long long> counter{0};
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = (int)getpid();
+#endif
+    filesystem::path p(target);
+    string suffix = "." + to_string(pid) + "-" + to_string(++counter) + ".part";
+    string name = "." + p.filename().string() + suffix;
+    if (name.size() > MAX_NAME_BYTES) {
+        // Long titles fit NAME_MAX only just; the target name must not fail because of the suffix
+        name = ".ncmpp" + suffix;
+    }
+    return (p.parent_path() / name).string();
+}
+
+void commit_file(const string& temp, const string& target) {
+    rename_file(temp, target, false);
+}
+
+struct CommitBatch::Impl {
+    size_t max_files;
+    mutable mutex mtx;
+    vector<pending_commit> queue;
+    atomic<size_t> committed{0};
+
+    // Batches taken from the queue and still being committed, by sequence number
+    uint64_t taken = 0;
+    set<uint64_t> in_progress;
+    condition_variable batch_done;
+
+    /**
+     * @brief Start writeback of every temporary file of a batch without waiting
+     * @details The disk then works on all files at once, and the flush of each
+     * file in commit_group() mostly waits for I/O already in flight. Only a
+     * hint: files that cannot be opened fail in the flush.
+     */
+    static void start_writeback(const vector<pending_commit>& batch) {
+#if defined(__linux__)
+        for (const pending_commit& c : batch) {
+            int fd = ::open(c.temp.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) continue;
+            ::sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+            ::close(fd);
+        }
+#else
+        (void)batch;
+#endif
+    }
+
+    /**
+     * @brief Make the data of a temporary file durable
+     * @return Error, empty on success
+     */
+    static string sync_data(const string& temp) {
+#ifdef _WIN32
+        if (!flush_file(temp)) return "Failed to flush " + temp + ": " + last_error();
+#else
+        if (!datasync_path(temp)) return "Failed to sync " + temp + ": " + last_error();
+#endif
+        return string();
+    }
+
+    void commit_group(const string& dir, const vector<pending_commit*>& files) {
+        vector<pair<pending_commit*, string>> done;
+        done.reserve(files.size());
+        bool renamed = false;
+        for (pending_commit* c : files) {
+            string error = sync_data(c->temp);
+            if (error.empty()) {
+                try {
+                    rename_file(c->temp, c->target, true);
+                    renamed = true;
+                } catch (const exception& e) {
+                    error = e.what();
+                }
+            }
+            if (!error.empty()) {
+                error_code ec;
+                filesystem::remove(c->temp, ec);
+            }
+            done.emplace_back(c, std::move(error));
+        }
+
+#ifndef _WIN32
+        // The renames persist once the directory entry changes are on disk
+        if (renamed && !fsync_path(dir, O_RDONLY | O_DIRECTORY)) {
+            string error = "Failed to sync directory " + dir + ": " + last_error();
+            for (auto& d : done) {
+                if (d.second.empty()) d.second = error;
+            }
+        }
+#else
+        (void)renamed;
+#endif
+
+        for (auto& [c, error] : done) {
+            if (error.empty()) {
+                committed++;
+            } else {
+                NCM_LOG(level::error, error);
+            }
+            if (c->on_done) {
+                try {
+                    c->on_done(error);
+                } catch (const exception& e) {
+                    NCM_LOG(level::error, string("Commit callback failed: ") + e.what());
+                }
+            }
+        }
+    }
+};
+
+CommitBatch::CommitBatch(size_t max_files) : _impl(make_unique<Impl>()) {
+    _impl->max_files = max_files ? max_files : 1;
+}
+
+CommitBatch::~CommitBatch() {
+    flush();
+}
+
+void CommitBatch::add(const string& temp, const string& target, callback on_done) {
+    bool full;
+    {
+        lock_guard<mutex> lock(_impl->mtx);
+        _impl->queue.push_back({temp, target, std::move(on_done)});
+        full = _impl->queue.size() >= _impl->max_files;
+    }
+    if (full) {
+        flush();
+    }
+}
+
+void CommitBatch::flush() {
+    vector<pending_commit> batch;
+    uint64_t seq;
+    {
+        lock_guard<mutex> lock(_impl->mtx);
+        batch.swap(_impl->queue);
+        if (!batch.empty()) {
+            _impl->in_progress.insert(++_impl->taken);
+        }
+        seq = _impl->taken;
+    }
+
+    if (!batch.empty()) {
+        Impl::start_writeback(batch);
+        map<string, vector<pending_commit*>> groups;
+        for (auto& c : batch) {
+            string dir = filesystem::path(c.target).parent_path().string();
+            groups[dir.empty() ? "." : dir].push_back(&c);
+        }
+        for (const auto& [dir, files] : groups) {
+            _impl->commit_group(dir, files);
+        }
+        NCM_LOG(level::debug, "Committed " + to_string(batch.size()) + " files in " + to_string(groups.size()) +
+                                  " directories");
+        {
+            lock_guard<mutex> lock(_impl->mtx);
+            _impl->in_progress.erase(seq);
+        }
+        _impl->batch_done.notify_all();
+    }
+
+    // Files queued before this call may be in a batch another thread took
+    unique_lock<mutex> lock(_impl->mtx);
+    _impl->batch_done.wait(lock, [this, seq] {
+        return _impl->in_progress.empty() || *_impl->in_progress.begin() > seq;
+    });
+}
+
+size_t CommitBatch::committed() const {
+    return _impl->committed.load();
+}
+
+} // namespace ncm
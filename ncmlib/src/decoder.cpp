@@ -0,0 +1,100 @@
+/**
+ * @file decoder.cpp
+ * @brief Low-level NCM decoding API implementation
+ * @details Header parsing reuses NcmFile over an in-memory source; the
+ * resulting keystream is kept for decrypting audio chunks.
+ */
+
+#include "ncmlib/decoder.h"
+#include "ncmlib/error.h"
+#include "ncmlib/metrics.h"
+#include "NcmFile.h"
+#include "keystream.h"
+#include "utils.h"
+#include <stdexcept>
+
+using namespace std;
+
+namespace ncm {
+
+struct Decoder::Impl {
+    keystream::table keystream;
+    string format;
+    uint64_t cover_offset = 0;
+    uint32_t cover_size = 0;
+    bool parsed = false;
+};
+
+namespace {
+    /**
+     * @brief Walk the length fields to find how many bytes the header spans
+     * @param data File bytes starting at offset 0
+     * @param len Number of bytes available
+     * @return Header size through the end of the cover image, or the next
+     * length field boundary if data is too short to tell
+     */
+    uint64_t required_header_size(const unsigned char* data, size_t len) {
+        uint64_t pos = 10;                              // magic and gap
+        if (pos + 4 > len) return pos + 4;
+        pos += 4 + utils::little_int(data + pos);       // key block
+        if (pos + 4 > len) return pos + 4;
+        pos += 4 + utils::little_int(data + pos);       // metadata block
+        pos += 9;                                       // CRC and gap
+        if (pos + 4 > len) return pos + 4;
+        pos += 4 + utils::little_int(data + pos);       // cover image
+        return pos;
+    }
+} // anonymous namespace
+
+Decoder::Decoder() : _impl(make_unique<Impl>()) {}
+Decoder::~Decoder() = default;
+Decoder::Decoder(Decoder&&) noexcept = default;
+Decoder& Decoder::operator=(Decoder&&) noexcept = default;
+
+size_t Decoder::parse_header(const unsigned char* data, size_t len, uint64_t file_size) {
+    uint64_t needed = required_header_size(data, len);
+    if (needed > file_size) {
+        throw Error(error_kind::truncated, "Truncated NCM header: needs " + to_string(needed) + " bytes, file has " +
+                                               to_string(file_size));
+    }
+    if (needed > len) {
+        return (size_t)needed;
+    }
+
+    NcmFile file(InputSource::from_memory(data, len));
+    file.read_header();
+
+    _impl->keystream = file.key_stream();
+    _impl->format = file.format();
+    _impl->cover_offset = file.cover_offset();
+    _impl->cover_size = file.cover_size();
+    _impl->parsed = true;
+    return 0;
+}
+
+const string& Decoder::format() const {
+    return _impl->format;
+}
+
+uint64_t Decoder::cover_offset() const {
+    return _impl->cover_offset;
+}
+
+uint32_t Decoder::cover_size() const {
+    return _impl->cover_size;
+}
+
+uint64_t Decoder::audio_offset() const {
+    return _impl->cover_offset + _impl->cover_size;
+}
+
+void Decoder::decrypt(const unsigned char* src, unsigned char* dst, size_t len, uint64_t audio_pos) const {
+    if (!_impl->parsed) {
+        throw logic_error("Decoder::decrypt called before the header was parsed");
+    }
+    metrics::span t(metrics::stage::audio_decrypt);
+    t.add_bytes(len);
+    keystream::apply(_impl->keystream, src, dst, len, audio_pos);
+}
+
+} // namespace ncm
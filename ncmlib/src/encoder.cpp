@@ -0,0 +1,182 @@
+/**
+ * @file encoder.cpp
+ * @brief NCM container encoder implementation
+ * @details Runs the decoding steps backwards: the key block is
+ * "neteasecloudmusic" plus the RC4 key, PKCS#7-padded, encrypted with the
+ * CORE key and XORed with 0x64; the metadata is "music:" plus the JSON,
+ * encrypted with the META key, base64-encoded behind the
+ * "163 key(Don't modify):" prefix and XORed with 0x63. The audio is XORed
+ * with the keystream, which is its own inverse.
+ */
+
+#include "ncmlib/encoder.h"
+#include "DecoderContext.h"
+#include "OutputFile.h"
+#include "base64.h"
+#include "keystream.h"
+#include "pkcs7.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "openssl/rand.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+namespace ncm {
+
+namespace {
+    const char MAGIC[] = "CTENFDAM";
+    const char KEY_PREFIX[] = "neteasecloudmusic";
+    const char META_PREFIX[] = "163 key(Don't modify):";
+    const char MUSIC_PREFIX[] = "music:";
+
+    /** @brief Length of a random RC4 key, as found in real files */
+    constexpr size_t DEFAULT_KEY_SIZE = 112;
+
+    /** @brief Size of each audio encrypt/write chunk */
+    constexpr size_t AUDIO_CHUNK_SIZE = 1024 * 1024;
+
+    /** @brief Per-thread audio output buffer, reused across files */
+    AlignedBuffer& audio_buffer() {
+        thread_local AlignedBuffer buffer;
+        return buffer;
+    }
+
+    void put_u32(vector<unsigned char>& out, size_t v, const char* what) {
+        if (v > numeric_limits<uint32_t>::max()) {
+            throw runtime_error(string(what) + " too large: " + to_string(v) + " bytes");
+        }
+        for (int i = 0; i < 4; ++i) out.push_back((unsigned char)(v >> (8 * i)));
+    }
+
+    /**
+     * @brief Pad and encrypt a block with one of the fixed keys
+     * @param encrypt DecoderContext::encrypt_core or encrypt_meta
+     */
+    vector<unsigned char> encrypt_block(const string& plain,
+                                        size_t (DecoderContext::*encrypt)(const unsigned char*, size_t, unsigned char*)) {
+        if (plain.size() >= numeric_limits<uint32_t>::max() - 16) {
+            throw runtime_error("Block too large: " + to_string(plain.size()) + " bytes");
+        }
+        vector<unsigned char> block(pkcs7::padded_size((unsigned int)plain.size()));
+        pkcs7::pad((const unsigned char*)plain.data(), (unsigned int)plain.size(), block.data());
+        DecoderContext& ctx = DecoderContext::local();
+        block.resize((ctx.*encrypt)(block.data(), block.size(), block.data()));
+        return block;
+    }
+
+    /**
+     * @brief Build everything up to the first audio byte and the audio keystream
+     * @param header Receives the header, key, metadata and cover
+     * @param ks Receives the keystream derived from the RC4 key
+     */
+    void build_header(const encode_input& input, vector<unsigned char>& header, keystream::table& ks) {
+        string key = input.key;
+        if (key.empty()) {
+            key.resize(DEFAULT_KEY_SIZE);
+            if (RAND_bytes((unsigned char*)key.data(), (int)key.size()) != 1) {
+                throw runtime_error("Failed to generate a random key");
+            }
+        }
+        unsigned char key_box[256];
+        keystream::schedule((const unsigned char*)key.data(), key.size(), key_box);
+        keystream::build(key_box, ks);
+
+        vector<unsigned char> key_block = encrypt_block(KEY_PREFIX + key, &DecoderContext::encrypt_core);
+        for (auto& b : key_block) b ^= 0x64;
+
+        string meta_block;
+        if (!input.metadata.empty()) {
+            vector<unsigned char> meta_enc = encrypt_block(MUSIC_PREFIX + input.metadata, &DecoderContext::encrypt_meta);
+            meta_block = META_PREFIX + base64_encode(meta_enc.data(), meta_enc.size());
+            for (auto& c : meta_block) c ^= 0x63;
+        }
+
+        // Magic and the two version bytes found in real files
+        header.assign(MAGIC, MAGIC + 8);
+        header.push_back(0x01);
+        header.push_back(0x70);
+        header.reserve(header.size() + 4 + key_block.size() + 4 + meta_block.size() + 13 + input.cover_size);
+
+        put_u32(header, key_block.size(), "Key block");
+        header.insert(header.end(), key_block.begin(), key_block.end());
+        put_u32(header, meta_block.size(), "Metadata");
+        header.insert(header.end(), meta_block.begin(), meta_block.end());
+
+        // CRC and gap; the decoder does not check them
+        header.resize(header.size() + 9);
+        put_u32(header, input.cover_size, "Cover");
+        if (input.cover_size > 0) {
+            header.insert(header.end(), input.cover, input.cover + input.cover_size);
+        }
+    }
+} // anonymous namespace
+
+string metadata_json(const track_info& track) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("musicId");
+    writer.Uint64(track.music_id);
+    writer.Key("musicName");
+    writer.String(track.music_name.c_str(), (rapidjson::SizeType)track.music_name.size());
+
+    // "artist" is a list of [name, id] pairs; the ids are not tracked
+    writer.Key("artist");
+    writer.StartArray();
+    for (const auto& artist : track.artists) {
+        writer.StartArray();
+        writer.String(artist.c_str(), (rapidjson::SizeType)artist.size());
+        writer.Uint(0);
+        writer.EndArray();
+    }
+    writer.EndArray();
+
+    writer.Key("album");
+    writer.String(track.album.c_str(), (rapidjson::SizeType)track.album.size());
+    writer.Key("bitrate");
+    writer.Uint(track.bitrate);
+    writer.Key("duration");
+    writer.Uint64(track.duration);
+    writer.Key("format");
+    writer.String(track.format.c_str(), (rapidjson::SizeType)track.format.size());
+    writer.EndObject();
+    return string(buffer.GetString(), buffer.GetSize());
+}
+
+vector<unsigned char> ncmEncode(const encode_input& input) {
+    vector<unsigned char> out;
+    keystream::table ks;
+    build_header(input, out, ks);
+
+    size_t audio_pos = out.size();
+    out.resize(audio_pos + input.audio_size);
+    if (input.audio_size > 0) {
+        keystream::apply(ks, input.audio, out.data() + audio_pos, input.audio_size, 0);
+    }
+    return out;
+}
+
+void ncmEncode(const encode_input& input, const string& path) {
+    vector<unsigned char> header;
+    keystream::table ks;
+    build_header(input, header, ks);
+
+    OutputFile of(path, false, true);
+    of.preallocate(header.size() + input.audio_size);
+    of.write(header.data(), header.size());
+
+    unsigned char* buff = audio_buffer().reserve(AUDIO_CHUNK_SIZE);
+    for (size_t pos = 0; pos < input.audio_size; pos += AUDIO_CHUNK_SIZE) {
+        size_t len = min(AUDIO_CHUNK_SIZE, input.audio_size - pos);
+        keystream::apply(ks, input.audio + pos, buff, len, pos);
+        of.write(buff, len);
+    }
+    of.commit();
+}
+
+} // namespace ncm
@@ -0,0 +1,41 @@
+/**
+ * @file error.cpp
+ * @brief Failure category names and classification
+ */
+
+#include "ncmlib/error.h"
+#include <filesystem>
+#include <new>
+
+using namespace std;
+
+namespace ncm {
+
+const char* error_kind_name(error_kind kind) {
+    switch (kind) {
+        case error_kind::none: return "none";
+        case error_kind::input: return "input";
+        case error_kind::truncated: return "truncated";
+        case error_kind::corrupt: return "corrupt";
+        case error_kind::output: return "output";
+        case error_kind::memory: return "memory";
+        case error_kind::cancelled: return "cancelled";
+        case error_kind::other: break;
+    }
+    return "other";
+}
+
+error_kind classify(const exception& e) {
+    if (auto* err = dynamic_cast<const Error*>(&e)) {
+        return err->kind();
+    }
+    if (dynamic_cast<const bad_alloc*>(&e)) {
+        return error_kind::memory;
+    }
+    if (dynamic_cast<const filesystem::filesystem_error*>(&e)) {
+        return error_kind::output;
+    }
+    return error_kind::other;
+}
+
+} // namespace ncm
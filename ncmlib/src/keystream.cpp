@@ -0,0 +1,247 @@
+/**
+ * @file keystream.cpp
+ * @brief Keystream construction and runtime-dispatched XOR kernels
+ * @details Each kernel keeps one full keystream period in vector registers and
+ * XORs it over the input 256 bytes at a time. The best kernel for the running
+ * CPU is picked once on first use.
+ */
+
+#include "keystream.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define NCM_KEYSTREAM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define NCM_KEYSTREAM_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NCM_TARGET(x) __attribute__((target(x)))
+#else
+#define NCM_TARGET(x)
+#endif
+
+namespace ncm {
+namespace keystream {
+
+namespace {
+    /**
+     * @brief Kernel signature
+     * @param ks Keystream table pointer already advanced to the stream phase
+     * @param src Input bytes
+     * @param dst Output bytes (may alias src)
+     * @param len Number of bytes to process
+     */
+    using kernel_fn = void (*)(const unsigned char* ks, const unsigned char* src, unsigned char* dst, std::size_t len);
+
+    struct kernel {
+        const char* name;
+        kernel_fn fn;
+    };
+
+    /**
+     * @brief Portable fallback, also used for the sub-vector tail of every kernel
+     * @param pos Position of src[0] within the current period
+     */
+    void xor_tail(const unsigned char* ks, const unsigned char* src, unsigned char* dst, std::size_t len, std::size_t pos) {
+        for (std::size_t i = 0; i < len; i++) {
+            dst[i] = src[i] ^ ks[(pos + i) % period];
+        }
+    }
+
+    void xor_scalar(const unsigned char* ks, const unsigned char* src, unsigned char* dst, std::size_t len) {
+        xor_tail(ks, src, dst, len, 0);
+    }
+
+#ifdef NCM_KEYSTREAM_X86
+    NCM_TARGET("sse2")
+    void xor_sse2(const unsigned char* ks, const unsigned char* src, unsigned char* dst, std::size_t len) {
+        constexpr std::size_t lanes = period / 16;
+        __m128i k[lanes];
+        for (std::size_t v = 0; v < lanes; v++) {
+            k[v] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ks + v * 16));
+        }
+
+        std::size_t i = 0;
+        for (; i + period <= len; i += period) {
+            for (std::size_t v = 0; v < lanes; v++) {
+                __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + v * 16));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + v * 16), _mm_xor_si128(d, k[v]));
+            }
+        }
+
+        std::size_t v = 0;
+        for (; i + 16 <= len; i += 16, v++) {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(d, k[v]));
+        }
+        xor_tail(ks, src + i, dst + i, len - i, v * 16);
+    }
+
+    NCM_TARGET("avx2")
+    void xor_avx2(const unsigned char* ks, const unsigned char* src, unsigned char* dst, std::size_t len) {
+        constexpr std::size_t lanes = period / 32;
+        __m256i k[lanes];
+        for (std::size_t v = 0; v < lanes; v++) {
+            k[v] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ks + v * 32));
+        }
+
+        std::size_t i = 0;
+        for (; i + period <= len; i += period) {
+            for (std::size_t v = 0; v < lanes; v++) {
+                __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + v * 32));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + v * 32), _mm256_xor_si256(d, k[v]));
+            }
+        }
+
+        std::size_t v = 0;
+        for (; i + 32 <= len; i += 32, v++) {
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(d, k[v]));
+        }
+        xor_tail(ks, src + i, dst + i, len - i, v * 32);
+    }
+
+    NCM_TARGET("avx512f")
+    void xor_avx512(const unsigned char* ks, const unsigned char* src, unsigned char* dst, std::size_t len) {
+        constexpr std::size_t lanes = period / 64;
+        __m512i k[lanes];
+        for (std::size_t v = 0; v < lanes; v++) {
+            k[v] = _mm512_loadu_si512(ks + v * 64);
+        }
+
+        std::size_t i = 0;
+        for (; i + period <= len; i += period) {
+            for (std::size_t v = 0; v < lanes; v++) {
+                __m512i d = _mm512_loadu_si512(src + i + v * 64);
+                _mm512_storeu_si512(dst + i + v * 64, _mm512_xor_si512(d, k[v]));
+            }
+        }
+
+        std::size_t v = 0;
+        for (; i + 64 <= len; i += 64, v++) {
+            __m512i d = _mm512_loadu_si512(src + i);
+            _mm512_storeu_si512(dst + i, _mm512_xor_si512(d, k[v]));
+        }
+        xor_tail(ks, src + i, dst + i, len - i, v * 64);
+    }
+
+    /**
+     * @brief Query CPU features, including OS support for the wider registers
+     */
+    kernel detect_kernel() {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return {"avx512", xor_avx512};
+        if (__builtin_cpu_supports("avx2")) return {"avx2", xor_avx2};
+        if (__builtin_cpu_supports("sse2")) return {"sse2", xor_sse2};
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int max_leaf = info[0];
+        __cpuid(info, 1);
+        bool sse2 = (info[3] & (1 << 26)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+        if (max_leaf >= 7) {
+            __cpuidex(info, 7, 0);
+            bool avx2 = (info[1] & (1 << 5)) != 0;
+            bool avx512f = (info[1] & (1 << 16)) != 0;
+            if (avx512f && (xcr0 & 0xe6) == 0xe6) return {"avx512", xor_avx512};
+            if (avx2 && (xcr0 & 0x6) == 0x6) return {"avx2", xor_avx2};
+        }
+        if (sse2) return {"sse2", xor_sse2};
+#endif
+        return {"scalar", xor_scalar};
+    }
+#elif defined(NCM_KEYSTREAM_NEON)
+    void xor_neon(const unsigned char* ks, const unsigned char* src, unsigned char* dst, std::size_t len) {
+        constexpr std::size_t lanes = period / 16;
+        uint8x16_t k[lanes];
+        for (std::size_t v = 0; v < lanes; v++) {
+            k[v] = vld1q_u8(ks + v * 16);
+        }
+
+        std::size_t i = 0;
+        for (; i + period <= len; i += period) {
+            for (std::size_t v = 0; v < lanes; v++) {
+                vst1q_u8(dst + i + v * 16, veorq_u8(vld1q_u8(src + i + v * 16), k[v]));
+            }
+        }
+
+        std::size_t v = 0;
+        for (; i + 16 <= len; i += 16, v++) {
+            vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), k[v]));
+        }
+        xor_tail(ks, src + i, dst + i, len - i, v * 16);
+    }
+
+    kernel detect_kernel() {
+        return {"neon", xor_neon};
+    }
+#else
+    kernel detect_kernel() {
+        return {"scalar", xor_scalar};
+    }
+#endif
+
+    const kernel& selected_kernel() {
+        static const kernel k = detect_kernel();
+        return k;
+    }
+} // anonymous namespace
+
+void schedule(const unsigned char* key, std::size_t len, unsigned char* key_box) {
+    for (unsigned int i = 0; i < 256; i++) {
+        key_box[i] = (unsigned char)i;
+    }
+
+    unsigned char last_byte = 0;
+    std::size_t key_offset = 0;
+    for (unsigned int i = 0; i < 256; i++) {
+        unsigned char swap = key_box[i];
+        unsigned char c = (unsigned char)((swap + last_byte + key[key_offset]) & 0xff);
+        key_offset++;
+        if (key_offset >= len) {
+            key_offset = 0;
+        }
+        key_box[i] = key_box[c];
+        key_box[c] = swap;
+        last_byte = c;
+    }
+}
+
+/**
+ * @brief Build the keystream table from an NCM key box
+ * @param key_box 256-byte key box produced by the key scheduling step
+ * @param out Table to fill
+ * @details Byte i of the cycle is the value the original per-byte loop XORed
+ * at every stream position p with p % 256 == i.
+ */
+void build(const unsigned char* key_box, table& out) {
+    for (std::size_t i = 0; i < period; i++) {
+        std::size_t j = (i + 1) & 0xff;
+        unsigned char k = key_box[(key_box[j] + key_box[(key_box[j] + j) & 0xff]) & 0xff];
+        out.bytes[i] = k;
+        out.bytes[i + period] = k;
+    }
+}
+
+void apply(const table& ks, const unsigned char* src, unsigned char* dst, std::size_t len, std::uint64_t offset) {
+    selected_kernel().fn(ks.bytes + offset % period, src, dst, len);
+}
+
+void apply_scalar(const table& ks, const unsigned char* src, unsigned char* dst, std::size_t len, std::uint64_t offset) {
+    xor_scalar(ks.bytes + offset % period, src, dst, len);
+}
+
+const char* kernel_name() {
+    return selected_kernel().name;
+}
+
+} // namespace keystream
+} // namespace ncm
@@ -0,0 +1,69 @@
+/**
+ * @file keystream.h
+ * @brief Precomputed keystream and SIMD XOR kernels for NCM audio decryption
+ * @details The NCM audio cipher derives each keystream byte only from the
+ * stream position modulo 256, so the whole keystream is a single 256-byte
+ * cycle that can be computed once per file and XORed over the audio.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace ncm {
+namespace keystream {
+
+/** @brief Length of the repeating keystream cycle in bytes */
+constexpr std::size_t period = 256;
+
+/**
+ * @brief One keystream cycle, stored twice back to back
+ * @details The second copy lets a kernel read a full period starting at any
+ * phase without wrapping, so every load is a plain contiguous vector load.
+ */
+struct table {
+    alignas(64) unsigned char bytes[period * 2];
+};
+
+/**
+ * @brief Run the RC4-like key scheduling step of the NCM cipher
+ * @param key Decrypted key material after the "neteasecloudmusic" prefix
+ * @param len Key length in bytes, at least 1
+ * @param key_box Receives the 256-byte key box
+ */
+void schedule(const unsigned char* key, std::size_t len, unsigned char* key_box);
+
+/**
+ * @brief Build the keystream table from an NCM key box
+ * @param key_box 256-byte key box produced by the key scheduling step
+ * @param out Table to fill
+ */
+void build(const unsigned char* key_box, table& out);
+
+/**
+ * @brief XOR the keystream over a span of audio data
+ * @param ks Keystream table built by build()
+ * @param src Encrypted input bytes
+ * @param dst Output buffer (may be the same as src)
+ * @param len Number of bytes to process
+ * @param offset Position of src[0] relative to the start of the audio stream
+ * @details Uses the widest kernel supported by the running CPU; the result is
+ * identical to the scalar cipher for any offset and length.
+ */
+void apply(const table& ks, const unsigned char* src, unsigned char* dst, std::size_t len, std::uint64_t offset);
+
+/**
+ * @brief apply() through the portable scalar kernel whatever the CPU supports
+ * @details Reference for cross-checks and benchmarks of the vector kernels.
+ */
+void apply_scalar(const table& ks, const unsigned char* src, unsigned char* dst, std::size_t len,
+                  std::uint64_t offset);
+
+/**
+ * @brief Name of the kernel selected for this CPU
+ * @return One of "scalar", "sse2", "avx2", "avx512", "neon"
+ */
+const char* kernel_name();
+
+} // namespace keystream
+} // namespace ncm
@@ -0,0 +1,323 @@
+/**
+ * @file log.cpp
+ * @brief Asynchronous logging implementation
+ * @details Every thread that logs owns a single-producer ring of fixed-size
+ * slots, registered once with the logger. Records carry a global sequence
+ * number so the writer can restore submission order across threads before
+ * passing a batch to the sink. Messages that do not fit a slot are copied to
+ * the heap and freed by the writer. The writer thread starts with the first
+ * record and sleeps on an atomic counter when there is nothing to drain.
+ */
+
+#include "ncmlib/log.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace ncm {
+namespace log {
+
+namespace {
+    /** @brief Message bytes per ring slot; longer messages spill to the heap */
+    constexpr size_t SLOT_TEXT = 496;
+
+    /** @brief Slots per thread ring */
+    constexpr size_t RING_SLOTS = 128;
+
+    struct record {
+        uint64_t seq;
+        level lvl;
+        uint32_t len;
+        char text[SLOT_TEXT];
+
+        /** @brief Message longer than SLOT_TEXT, released by the writer */
+        unique_ptr<char[]> spill;
+
+        string_view message() const {
+            return string_view(spill ? spill.get() : text, len);
+        }
+    };
+
+    /**
+     * @brief Single-producer, single-consumer record ring
+     * @details head is only written by the owning thread, tail only by the
+     * writer. Slots between tail and head are owned by the writer.
+     */
+    struct ring {
+        alignas(64) atomic<size_t> head{0};
+        alignas(64) atomic<size_t> tail{0};
+        atomic<bool> retired{false};
+        record slots[RING_SLOTS];
+    };
+
+    atomic<int> current_level{(int)level::off};
+
+    const char* level_name(level lvl) {
+        switch (lvl) {
+            case level::trace: return "TRACE";
+            case level::debug: return "DEBUG";
+            case level::info: return "INFO";
+            case level::warn: return "WARN";
+            case level::error: return "ERROR";
+            default: return "";
+        }
+    }
+
+    class stream_sink : public sink {
+    public:
+        stream_sink(FILE* out, bool color) : _out(out), _color(color) {}
+
+        void write(level lvl, string_view message) override {
+            const char* color = "";
+            const char* reset = "";
+            if (_color) {
+                if (lvl == level::error) color = "\033[31m";
+                else if (lvl == level::warn) color = "\033[33m";
+                else if (lvl <= level::debug) color = "\033[36m";
+                else color = "\033[32m";
+                reset = "\033[0m";
+            }
+            fprintf(_out, "%s[%s] %.*s%s\n", color, level_name(lvl), (int)message.size(), message.data(), reset);
+        }
+
+        void flush() override {
+            fflush(_out);
+        }
+
+    private:
+        FILE* _out;
+        bool _color;
+    };
+
+    class logger {
+    public:
+        /**
+         * @brief Process-wide logger
+         * @note Intentionally leaked so that logging stays valid during static
+         * destruction; pending records are flushed at exit instead.
+         */
+        static logger& get() {
+            static logger* instance = new logger;
+            return *instance;
+        }
+
+        shared_ptr<ring> register_ring() {
+            auto r = make_shared<ring>();
+            {
+                lock_guard<mutex> lock(_rings_mtx);
+                _rings.push_back(r);
+            }
+            call_once(_started, [this] {
+                thread([this] { run(); }).detach();
+                atexit([] { logger::get().flush(); });
+            });
+            return r;
+        }
+
+        uint64_t next_seq() {
+            return _seq.fetch_add(1, memory_order_relaxed);
+        }
+
+        /** @brief Announce a record pushed to a ring */
+        void published() {
+            _pushed.fetch_add(1, memory_order_release);
+            _pushed.notify_one();
+        }
+
+        void set_sink(shared_ptr<sink> s) {
+            lock_guard<mutex> lock(_sink_mtx);
+            _sink = std::move(s);
+        }
+
+        void flush() {
+            uint64_t target = _pushed.load(memory_order_acquire);
+            uint64_t done = _written.load(memory_order_acquire);
+            while (done < target) {
+                _written.wait(done, memory_order_acquire);
+                done = _written.load(memory_order_acquire);
+            }
+        }
+
+    private:
+        logger() : _sink(make_stream_sink(stderr, false)) {}
+
+        void run() {
+            vector<shared_ptr<ring>> rings;
+            vector<pair<ring*, size_t>> spans;  // ring and its head snapshot
+            vector<record*> batch;
+
+            while (true) {
+                uint64_t seen = _pushed.load(memory_order_acquire);
+                {
+                    lock_guard<mutex> lock(_rings_mtx);
+                    rings = _rings;
+                }
+
+                spans.clear();
+                batch.clear();
+                for (const auto& r : rings) {
+                    size_t tail = r->tail.load(memory_order_relaxed);
+                    size_t head = r->head.load(memory_order_acquire);
+                    for (size_t i = tail; i != head; i++) {
+                        batch.push_back(&r->slots[i % RING_SLOTS]);
+                    }
+                    spans.emplace_back(r.get(), head);
+                }
+
+                if (batch.empty()) {
+                    _prune(rings);
+                    _pushed.wait(seen, memory_order_acquire);
+                    continue;
+                }
+
+                sort(batch.begin(), batch.end(), [](const record* a, const record* b) { return a->seq < b->seq; });
+                shared_ptr<sink> s;
+                {
+                    lock_guard<mutex> lock(_sink_mtx);
+                    s = _sink;
+                }
+                if (s) {
+                    for (const record* rec : batch) {
+                        s->write(rec->lvl, rec->message());
+                    }
+                    s->flush();
+                }
+                for (record* rec : batch) {
+                    rec->spill.reset();
+                }
+
+                // Hand the slots back to their producers
+                for (const auto& [r, head] : spans) {
+                    r->tail.store(head, memory_order_release);
+                }
+                _written.fetch_add(batch.size(), memory_order_release);
+                _written.notify_all();
+            }
+        }
+
+        /** @brief Drop rings of exited threads once they are empty */
+        void _prune(const vector<shared_ptr<ring>>& rings) {
+            bool any = false;
+            for (const auto& r : rings) {
+                // retired is set after the final push, so an empty retired ring stays empty
+                if (r->retired.load(memory_order_acquire) &&
+                    r->tail.load(memory_order_relaxed) == r->head.load(memory_order_acquire)) {
+                    any = true;
+                    break;
+                }
+            }
+            if (!any) return;
+
+            lock_guard<mutex> lock(_rings_mtx);
+            _rings.erase(remove_if(_rings.begin(), _rings.end(), [](const shared_ptr<ring>& r) {
+                return r->retired.load(memory_order_acquire) &&
+                       r->tail.load(memory_order_relaxed) == r->head.load(memory_order_acquire);
+            }), _rings.end());
+        }
+
+        mutex _rings_mtx;
+        vector<shared_ptr<ring>> _rings;
+        mutex _sink_mtx;
+        shared_ptr<sink> _sink;
+        atomic<uint64_t> _seq{0};
+        atomic<uint64_t> _pushed{0};
+        atomic<uint64_t> _written{0};
+        once_flag _started;
+    };
+
+    /**
+     * @brief Owns the calling thread's ring and retires it on thread exit
+     */
+    struct ring_holder {
+        shared_ptr<ring> r;
+
+        ~ring_holder() {
+            if (r) r->retired.store(true, memory_order_release);
+        }
+    };
+
+    ring& local_ring() {
+        thread_local ring_holder holder;
+        if (!holder.r) {
+            holder.r = logger::get().register_ring();
+        }
+        return *holder.r;
+    }
+} // anonymous namespace
+
+shared_ptr<sink> make_stream_sink(FILE* out, bool color) {
+    return make_shared<stream_sink>(out, color);
+}
+
+void set_level(level lvl) {
+    current_level.store((int)lvl, memory_order_relaxed);
+}
+
+level get_level() {
+    return (level)current_level.load(memory_order_relaxed);
+}
+
+void set_sink(shared_ptr<sink> s) {
+    logger::get().set_sink(std::move(s));
+}
+
+bool enabled(level lvl) {
+    return lvl != level::off && (int)lvl >= current_level.load(memory_order_relaxed);
+}
+
+void write(level lvl, string_view message) {
+    if (!enabled(lvl)) {
+        return;
+    }
+
+    ring& r = local_ring();
+    logger& l = logger::get();
+    size_t head = r.head.load(memory_order_relaxed);
+    while (head - r.tail.load(memory_order_acquire) >= RING_SLOTS) {
+        // Ring full: the writer is already awake, give it time to drain
+        this_thread::yield();
+    }
+
+    record& rec = r.slots[head % RING_SLOTS];
+    rec.seq = l.next_seq();
+    rec.lvl = lvl;
+    rec.len = (uint32_t)message.size();
+    if (message.size() > SLOT_TEXT) {
+        rec.spill.reset(new char[message.size()]);
+        memcpy(rec.spill.get(), message.data(), message.size());
+    } else {
+        memcpy(rec.text, message.data(), message.size());
+    }
+
+    r.head.store(head + 1, memory_order_release);
+    l.published();
+}
+
+void flush() {
+    logger::get().flush();
+}
+
+bool parse_level(string_view name, level& out) {
+    static const pair<string_view, level> names[] = {
+        {"trace", level::trace}, {"debug", level::debug}, {"info", level::info},
+        {"warn", level::warn}, {"error", level::error}, {"off", level::off},
+    };
+    for (const auto& [n, lvl] : names) {
+        if (n == name) {
+            out = lvl;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace log
+} // namespace ncm
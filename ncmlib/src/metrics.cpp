@@ -0,0 +1,290 @@
+/**
+ * @file metrics.cpp
+ * @brief Per-stage metrics implementation
+ * @details Each thread owns one counter block, registered with a process
+ * registry on first use. Only the owning thread writes its counters, so
+ * updates are plain relaxed loads and stores; collect() may read them at any
+ * time. When a thread exits its block is merged into the registry totals and
+ * its spans are handed over, so nothing recorded on pool threads is lost.
+ */
+
+#include "ncmlib/metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace ncm {
+namespace metrics {
+
+namespace {
+    /** @brief Spans kept per thread; later spans are counted as dropped */
+    constexpr size_t MAX_SPANS_PER_THREAD = 1 << 20;
+
+    atomic<bool> recording{false};
+    atomic<bool> tracing{false};
+    atomic<uint64_t> enabled_at{0};
+
+    const char* const STAGE_NAMES[stage_count] = {
+        "open", "key_decrypt", "key_box", "metadata", "cover_write",
+        "cover_transcode", "audio_read", "audio_decrypt", "audio_write", "queue_wait",
+    };
+
+    struct counters {
+        atomic<uint64_t> calls{0};
+        atomic<uint64_t> total_ns{0};
+        atomic<uint64_t> max_ns{0};
+        atomic<uint64_t> bytes{0};
+        atomic<uint64_t> buckets[bucket_count] = {};
+    };
+
+    /** @brief Add to a counter that only the calling thread writes */
+    void bump(atomic<uint64_t>& c, uint64_t v) {
+        c.store(c.load(memory_order_relaxed) + v, memory_order_relaxed);
+    }
+
+    size_t bucket_index(uint64_t ns) {
+        uint64_t us = (ns + 999) / 1000;
+        size_t i = us <= 1 ? 0 : (size_t)bit_width(us - 1);
+        return min(i, bucket_count - 1);
+    }
+
+    struct trace_span {
+        uint64_t start_ns;
+        uint64_t duration_ns;
+        uint64_t bytes;
+        uint32_t tid;
+        stage s;
+    };
+
+    struct thread_metrics {
+        counters stages[stage_count];
+        uint32_t tid = 0;
+
+        /** @brief Guards spans against collection while the owner appends */
+        mutex spans_mtx;
+        vector<trace_span> spans;
+        uint64_t dropped = 0;
+    };
+
+    void add_stats(stage_stats& to, const counters& from) {
+        to.calls += from.calls.load(memory_order_relaxed);
+        to.total_ns += from.total_ns.load(memory_order_relaxed);
+        to.max_ns = max(to.max_ns, from.max_ns.load(memory_order_relaxed));
+        to.bytes += from.bytes.load(memory_order_relaxed);
+        for (size_t i = 0; i < bucket_count; ++i) {
+            to.buckets[i] += from.buckets[i].load(memory_order_relaxed);
+        }
+    }
+
+    class registry {
+    public:
+        /**
+         * @brief Process-wide registry
+         * @note Intentionally leaked so that threads exiting during static
+         * destruction can still retire their counters.
+         */
+        static registry& get() {
+            static registry* instance = new registry;
+            return *instance;
+        }
+
+        void add(thread_metrics* m) {
+            lock_guard<mutex> lock(_mtx);
+            m->tid = ++_next_tid;
+            _live.push_back(m);
+        }
+
+        void retire(thread_metrics* m) {
+            lock_guard<mutex> lock(_mtx);
+            _live.erase(remove(_live.begin(), _live.end(), m), _live.end());
+            for (size_t s = 0; s < stage_count; ++s) {
+                add_stats(_retired.stages[s], m->stages[s]);
+            }
+            lock_guard<mutex> spans(m->spans_mtx);
+            _retired.dropped_spans += m->dropped;
+            _retired_spans.insert(_retired_spans.end(), m->spans.begin(), m->spans.end());
+        }
+
+        snapshot collect() {
+            lock_guard<mutex> lock(_mtx);
+            snapshot snap = _retired;
+            for (thread_metrics* m : _live) {
+                for (size_t s = 0; s < stage_count; ++s) {
+                    add_stats(snap.stages[s], m->stages[s]);
+                }
+                lock_guard<mutex> spans(m->spans_mtx);
+                snap.dropped_spans += m->dropped;
+            }
+            return snap;
+        }
+
+        vector<trace_span> spans() {
+            lock_guard<mutex> lock(_mtx);
+            vector<trace_span> out = _retired_spans;
+            for (thread_metrics* m : _live) {
+                lock_guard<mutex> spans(m->spans_mtx);
+                out.insert(out.end(), m->spans.begin(), m->spans.end());
+            }
+            return out;
+        }
+
+    private:
+        mutex _mtx;
+        vector<thread_metrics*> _live;
+        snapshot _retired;
+        vector<trace_span> _retired_spans;
+        uint32_t _next_tid = 0;
+    };
+
+    /**
+     * @brief Registers the calling thread's counters and retires them on exit
+     */
+    struct thread_slot {
+        thread_metrics m;
+        thread_slot() { registry::get().add(&m); }
+        ~thread_slot() { registry::get().retire(&m); }
+    };
+
+    thread_metrics& local() {
+        thread_local thread_slot slot;
+        return slot.m;
+    }
+
+    string format_double(double v) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.9g", v);
+        return buf;
+    }
+} // anonymous namespace
+
+const char* stage_name(stage s) {
+    size_t i = (size_t)s;
+    return i < stage_count ? STAGE_NAMES[i] : "unknown";
+}
+
+void enable(bool on, bool trace) {
+    uint64_t expected = 0;
+    if (on) enabled_at.compare_exchange_strong(expected, now_ns());
+    tracing.store(on && trace, memory_order_relaxed);
+    recording.store(on, memory_order_relaxed);
+}
+
+bool enabled() {
+    return recording.load(memory_order_relaxed);
+}
+
+uint64_t now_ns() {
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record(stage s, uint64_t start_ns, uint64_t duration_ns, uint64_t bytes) {
+    if (!enabled() || (size_t)s >= stage_count) {
+        return;
+    }
+    thread_metrics& m = local();
+    counters& c = m.stages[(size_t)s];
+    bump(c.calls, 1);
+    bump(c.total_ns, duration_ns);
+    bump(c.bytes, bytes);
+    bump(c.buckets[bucket_index(duration_ns)], 1);
+    if (duration_ns > c.max_ns.load(memory_order_relaxed)) {
+        c.max_ns.store(duration_ns, memory_order_relaxed);
+    }
+
+    if (tracing.load(memory_order_relaxed)) {
+        lock_guard<mutex> lock(m.spans_mtx);
+        if (m.spans.size() < MAX_SPANS_PER_THREAD) {
+            m.spans.push_back({start_ns, duration_ns, bytes, m.tid, s});
+        } else {
+            m.dropped++;
+        }
+    }
+}
+
+snapshot collect() {
+    snapshot snap = registry::get().collect();
+    uint64_t start = enabled_at.load();
+    snap.elapsed_s = start ? (now_ns() - start) / 1e9 : 0;
+    return snap;
+}
+
+string to_json(const snapshot& snap) {
+    string out = "{\"elapsed_s\":" + format_double(snap.elapsed_s) + ",\"stages\":{";
+    for (size_t s = 0; s < stage_count; ++s) {
+        const stage_stats& st = snap.stages[s];
+        if (s) out += ',';
+        out += '"';
+        out += STAGE_NAMES[s];
+        out += "\":{\"calls\":" + to_string(st.calls);
+        out += ",\"total_ms\":" + format_double(st.total_ns / 1e6);
+        out += ",\"mean_us\":" + format_double(st.calls ? st.total_ns / 1e3 / st.calls : 0);
+        out += ",\"max_us\":" + format_double(st.max_ns / 1e3);
+        out += ",\"bytes\":" + to_string(st.bytes);
+        out += ",\"histogram_us\":{";
+        bool first = true;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            if (!st.buckets[i]) continue;
+            if (!first) out += ',';
+            first = false;
+            out += '"' + to_string(1ull << i) + "\":" + to_string(st.buckets[i]);
+        }
+        out += "}}";
+    }
+    out += "},\"dropped_spans\":" + to_string(snap.dropped_spans) + "}";
+    return out;
+}
+
+string to_prometheus(const snapshot& snap) {
+    string out;
+    out += "# HELP ncm_stage_seconds Time spent per call of a processing stage.\n";
+    out += "# TYPE ncm_stage_seconds histogram\n";
+    for (size_t s = 0; s < stage_count; ++s) {
+        const stage_stats& st = snap.stages[s];
+        string label = string("stage=\"") + STAGE_NAMES[s] + "\"";
+        uint64_t cumulative = 0;
+        // The last bucket is open-ended and only appears as +Inf
+        for (size_t i = 0; i + 1 < bucket_count; ++i) {
+            cumulative += st.buckets[i];
+            out += "ncm_stage_seconds_bucket{" + label + ",le=\"" + format_double((double)(1ull << i) * 1e-6) +
+                   "\"} " + to_string(cumulative) + "\n";
+        }
+        out += "ncm_stage_seconds_bucket{" + label + ",le=\"+Inf\"} " + to_string(st.calls) + "\n";
+        out += "ncm_stage_seconds_sum{" + label + "} " + format_double(st.total_ns / 1e9) + "\n";
+        out += "ncm_stage_seconds_count{" + label + "} " + to_string(st.calls) + "\n";
+    }
+    out += "# HELP ncm_stage_bytes_total Bytes processed per stage.\n";
+    out += "# TYPE ncm_stage_bytes_total counter\n";
+    for (size_t s = 0; s < stage_count; ++s) {
+        out += string("ncm_stage_bytes_total{stage=\"") + STAGE_NAMES[s] + "\"} " +
+               to_string(snap.stages[s].bytes) + "\n";
+    }
+    return out;
+}
+
+void write_trace(ostream& out) {
+    vector<trace_span> spans = registry::get().spans();
+    sort(spans.begin(), spans.end(), [](const trace_span& a, const trace_span& b) { return a.start_ns < b.start_ns; });
+    uint64_t origin = enabled_at.load();
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const trace_span& sp : spans) {
+        if (!first) out << ',';
+        first = false;
+        uint64_t start = sp.start_ns > origin ? sp.start_ns - origin : 0;
+        out << "\n{\"name\":\"" << STAGE_NAMES[(size_t)sp.s] << "\",\"cat\":\"ncm\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            << sp.tid << ",\"ts\":" << format_double(start / 1e3) << ",\"dur\":" << format_double(sp.duration_ns / 1e3);
+        if (sp.bytes) out << ",\"args\":{\"bytes\":" << sp.bytes << "}";
+        out << '}';
+    }
+    out << "\n]}\n";
+}
+
+} // namespace metrics
+} // namespace ncm
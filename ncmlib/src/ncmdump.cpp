@@ -6,9 +6,9 @@
  */
 
 #include "ncmlib/ncmdump.h"
+#include "ncmlib/log.h"
 #include "NcmFile.h"
 #include <stdexcept>
-#include <iostream>
 
 namespace ncm {
 
@@ -24,18 +24,49 @@ namespace ncm {
  * @throws std::exception if file processing fails
  */
 void ncmDump(std::string path, std::string outPath) {
-    try {
-        std::cout << "[INFO] Processing NCM file: " << path << std::endl;
-        std::cout << "[INFO] Output path: " << outPath << std::endl;
-        
-        NcmFile ncm_file(path);
-        ncm_file.dump(outPath);
-        
-        std::cout << "[SUCCESS] Successfully processed: " << path << std::endl;
-    } catch (const std::exception& e) {
-        std::cerr << "[ERROR] Failed to process " << path << ": " << e.what() << std::endl;
-        throw; // Re-throw to allow caller to handle
-    }
+    ncmDump(path, outPath, dump_options());
+}
+
+/**
+ * @brief Decrypt and extract audio from an NCM file with explicit output options
+ * @param path Path to the input .ncm file
+ * @param outPath Output path for the decrypted file (without extension)
+ * @param options Output tuning options
+ * @return Format and paths of the written files
+ * @throws std::exception if file processing fails
+ */
+dump_result ncmDump(const std::string& path, const std::string& outPath, const dump_options& options) {
+    NCM_LOG(log::level::debug, "Output path: " + outPath);
+
+    // Each worker thread keeps its cipher context and scratch memory across files
+    NcmFile ncm_file(path, DecoderContext::local(), mmap_threshold(options));
+    return ncm_file.dump(outPath, options);
+}
+
+dump_result ncmDump(const unsigned char* data, std::size_t len, const std::string& outPath,
+                    const dump_options& options) {
+    NcmFile ncm_file(InputSource::from_memory(data, len), DecoderContext::local());
+    return ncm_file.dump(outPath, options);
+}
+
+dump_result ncmDecode(const std::string& path, const dump_sink& sink, const dump_options& options) {
+    NcmFile ncm_file(path, DecoderContext::local(), mmap_threshold(options));
+    return ncm_file.dump(sink, options);
+}
+
+dump_result ncmDecode(const unsigned char* data, std::size_t len, const dump_sink& sink,
+                      const dump_options& options) {
+    NcmFile ncm_file(InputSource::from_memory(data, len), DecoderContext::local());
+    return ncm_file.dump(sink, options);
+}
+
+dump_result ncmDecode(std::istream& in, const dump_sink& sink, const dump_options& options) {
+    NcmFile ncm_file(InputSource::from_stream(in), DecoderContext::local());
+    return ncm_file.dump(sink, options);
+}
+
+void prepare_thread() {
+    NcmFile::prepare_thread();
 }
 
 } // namespace ncm
@@ -1,11 +1,12 @@
 /**
  * @file pkcs7.cpp
  * @brief PKCS#7 padding implementation for NCM file processing
- * @details Provides PKCS#7 (RFC 5652) padding removal functionality for AES-decrypted data
- * @note Used specifically for removing padding from decrypted key and metadata in NCM files
+ * @details Provides PKCS#7 (RFC 5652) padding and padding removal for AES-128 blocks
+ * @note Used for the key and metadata blocks of NCM files
  */
 
 #include "pkcs7.h"
+#include "ncmlib/error.h"
 #include <stdexcept>
 
 namespace pkcs7 {
@@ -27,13 +28,13 @@ unsigned int pad_size(const unsigned char* src_, unsigned int len_) {
     
     // Validate padding - padlen should be between 1 and 16 for AES-128
     if (padlen == 0 || padlen > 16) {
-        throw std::runtime_error("Invalid PKCS#7 padding length");
+        throw ncm::Error(ncm::error_kind::corrupt, "Invalid PKCS#7 padding length");
     }
     
     // Validate all padding bytes have the same value
     for (unsigned int i = len_ - padlen; i < len_; i++) {
         if (src_[i] != padlen) {
-            throw std::runtime_error("Invalid PKCS#7 padding bytes");
+            throw ncm::Error(ncm::error_kind::corrupt, "Invalid PKCS#7 padding bytes");
         }
     }
     
@@ -55,4 +56,24 @@ void unpad(const unsigned char* src_, unsigned int len_, unsigned char* tgt_) {
     }
 }
 
+/**
+ * @brief Append PKCS#7 padding to a 16-byte block boundary
+ * @param src_ Pointer to the data
+ * @param len_ Length of the data
+ * @param tgt_ Output buffer of at least padded_size(len_) bytes (may be the same as src_)
+ * @return Padded length
+ */
+unsigned int pad(const unsigned char* src_, unsigned int len_, unsigned char* tgt_) {
+    unsigned int size = padded_size(len_);
+    if (tgt_ != src_) {
+        for (unsigned int i = 0; i < len_; i++) {
+            tgt_[i] = src_[i];
+        }
+    }
+    for (unsigned int i = len_; i < size; i++) {
+        tgt_[i] = (unsigned char)(size - len_);
+    }
+    return size;
+}
+
 } // namespace pkcs7
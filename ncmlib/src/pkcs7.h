@@ -1,8 +1,9 @@
 /**
  * @file pkcs7.h
  * @brief PKCS#7 padding interface for NCM file processing
- * @details Header file for PKCS#7 padding removal functionality
- * @note Used for removing padding from AES-decrypted data in NCM files
+ * @details Header file for PKCS#7 padding and padding removal functionality
+ * @note Used for removing padding from AES-decrypted data in NCM files and
+ * adding it before encryption
  */
 
 #pragma once
@@ -27,4 +28,21 @@ unsigned int pad_size(const unsigned char* src_, unsigned int len_);
  */
 void unpad(const unsigned char* src_, unsigned int len_, unsigned char* tgt_);
 
+/**
+ * @brief Padded length of len_ bytes for a 16-byte block size
+ * @details Always adds at least one byte, a full block when len_ is aligned
+ */
+constexpr unsigned int padded_size(unsigned int len_) {
+    return (len_ / 16 + 1) * 16;
+}
+
+/**
+ * @brief Append PKCS#7 padding to a 16-byte block boundary
+ * @param src_ Pointer to the data
+ * @param len_ Length of the data
+ * @param tgt_ Output buffer of at least padded_size(len_) bytes (may be the same as src_)
+ * @return Padded length
+ */
+unsigned int pad(const unsigned char* src_, unsigned int len_, unsigned char* tgt_);
+
 } // namespace pkcs7
@@ -0,0 +1,37 @@
+/**
+ * @file probe.cpp
+ * @brief Header-only metadata scan implementation
+ * @details Opens the file through the stream backend, since only the first
+ * few kilobytes are ever read, and lets NcmFile parse the metadata block
+ * into the track fields.
+ */
+
+#include "ncmlib/probe.h"
+#include "NcmFile.h"
+#include "ncmlib/error.h"
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+namespace ncm {
+
+track_info probe(const filesystem::path& path) {
+    unique_ptr<InputSource> input = InputSource::open(path, numeric_limits<uint64_t>::max());
+    if (!input) {
+        throw Error(error_kind::input, "Can't open file: " + path.string());
+    }
+    uint64_t file_size = input->size();
+
+    NcmFile file(std::move(input));
+    file.read_tags();
+
+    track_info info = file.track();
+    info.cover_offset = file.cover_offset();
+    info.cover_size = file.cover_size();
+    info.audio_offset = file.audio_offset();
+    info.audio_size = file_size > info.audio_offset ? file_size - info.audio_offset : 0;
+    return info;
+}
+
+} // namespace ncm
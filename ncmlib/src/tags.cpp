@@ -0,0 +1,488 @@
+/**
+ * @file tags.cpp
+ * @brief FLAC metadata block and ID3v2 tag writers
+ * @details FLAC: the metadata block chain after "fLaC" is rebuilt with
+ * PICTURE and VORBIS_COMMENT blocks replaced and padding moved to the end.
+ * MP3: an existing ID3v2.3/2.4 tag is rebuilt in its own version with the
+ * written frames replaced; without one a new ID3v2.4 tag is prepended.
+ */
+
+#include "tags.h"
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+using namespace std;
+
+namespace ncm {
+namespace tags {
+
+namespace {
+    constexpr unsigned char FLAC_PICTURE = 6;
+    constexpr unsigned char FLAC_PADDING = 1;
+    constexpr unsigned char FLAC_VORBIS_COMMENT = 4;
+
+    /** @brief Largest FLAC metadata block body (24-bit length field) */
+    constexpr size_t FLAC_MAX_BLOCK = 0xFFFFFF;
+
+    /** @brief Largest ID3v2 tag or v2.4 frame body (28-bit syncsafe size) */
+    constexpr size_t ID3_MAX_SIZE = 0x0FFFFFFF;
+
+    /** @brief ID3v2 picture type and FLAC picture type "Cover (front)" */
+    constexpr unsigned char FRONT_COVER = 3;
+
+    const char COVER_DESCRIPTION[] = "Front Cover";
+
+    /** @brief Vendor string of a newly created Vorbis comment block */
+    const char VORBIS_VENDOR[] = "ncmpp";
+
+    uint32_t read_be32(const unsigned char* p) {
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+
+    uint32_t read_be24(const unsigned char* p) {
+        return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    }
+
+    uint32_t read_le32(const unsigned char* p) {
+        return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+    }
+
+    uint32_t read_syncsafe(const unsigned char* p) {
+        return (uint32_t)(p[0] & 0x7f) << 21 | (uint32_t)(p[1] & 0x7f) << 14 | (uint32_t)(p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+    }
+
+    void put_be32(vector<unsigned char>& out, uint32_t v) {
+        out.push_back((unsigned char)(v >> 24));
+        out.push_back((unsigned char)(v >> 16));
+        out.push_back((unsigned char)(v >> 8));
+        out.push_back((unsigned char)v);
+    }
+
+    void put_le32(vector<unsigned char>& out, uint32_t v) {
+        out.push_back((unsigned char)v);
+        out.push_back((unsigned char)(v >> 8));
+        out.push_back((unsigned char)(v >> 16));
+        out.push_back((unsigned char)(v >> 24));
+    }
+
+    void put_syncsafe(vector<unsigned char>& out, uint32_t v) {
+        out.push_back((unsigned char)((v >> 21) & 0x7f));
+        out.push_back((unsigned char)((v >> 14) & 0x7f));
+        out.push_back((unsigned char)((v >> 7) & 0x7f));
+        out.push_back((unsigned char)(v & 0x7f));
+    }
+
+    void put_bytes(vector<unsigned char>& out, const void* data, size_t len) {
+        const unsigned char* p = (const unsigned char*)data;
+        out.insert(out.end(), p, p + len);
+    }
+
+    /**
+     * @brief MIME type of an image from its signature
+     * @details NCM covers are JPEG; PNG signatures are recognised as well.
+     */
+    const char* image_mime(const unsigned char* data, size_t len) {
+        static const unsigned char PNG[] = {0x89, 'P', 'N', 'G'};
+        if (len >= sizeof(PNG) && memcmp(data, PNG, sizeof(PNG)) == 0) {
+            return "image/png";
+        }
+        return "image/jpeg";
+    }
+
+    /** @brief Whether any text field is set; the duration alone does not count for FLAC */
+    bool has_text(const tag_set& tags) {
+        return !tags.title.empty() || !tags.artists.empty() || !tags.album.empty();
+    }
+
+    // FLAC
+
+    size_t flac_head_size(const unsigned char* audio, size_t len) {
+        if (len < 4 || memcmp(audio, "fLaC", 4) != 0) {
+            return 4;   // rewrite_head() rejects the stream
+        }
+        size_t pos = 4;
+        while (true) {
+            if (pos + 4 > len) return pos + 4;
+            bool last = audio[pos] & 0x80;
+            pos += 4 + read_be24(audio + pos + 1);
+            if (last) return pos;
+        }
+    }
+
+    /**
+     * @brief PICTURE block body in the layout of the FLAC format specification
+     */
+    void flac_picture(vector<unsigned char>& out, const tag_set& tags) {
+        const char* mime = image_mime(tags.cover, tags.cover_size);
+        put_be32(out, FRONT_COVER);
+        put_be32(out, (uint32_t)strlen(mime));
+        put_bytes(out, mime, strlen(mime));
+        put_be32(out, (uint32_t)strlen(COVER_DESCRIPTION));
+        put_bytes(out, COVER_DESCRIPTION, strlen(COVER_DESCRIPTION));
+        put_be32(out, 0);   // width, height, depth and palette size: unknown
+        put_be32(out, 0);
+        put_be32(out, 0);
+        put_be32(out, 0);
+        put_be32(out, (uint32_t)tags.cover_size);
+        put_bytes(out, tags.cover, tags.cover_size);
+    }
+
+    /**
+     * @brief Whether a Vorbis comment "KEY=value" has the given key, ignoring case
+     */
+    bool comment_key_is(const unsigned char* comment, size_t len, const char* key) {
+        size_t n = strlen(key);
+        if (len <= n || comment[n] != '=') return false;
+        for (size_t i = 0; i < n; ++i) {
+            unsigned char c = comment[i];
+            if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+            if (c != (unsigned char)key[i]) return false;
+        }
+        return true;
+    }
+
+    void put_comment(vector<unsigned char>& out, const char* key, const string& value) {
+        put_le32(out, (uint32_t)(strlen(key) + 1 + value.size()));
+        put_bytes(out, key, strlen(key));
+        out.push_back('=');
+        put_bytes(out, value.data(), value.size());
+    }
+
+    /**
+     * @brief VORBIS_COMMENT block body with the tag fields replaced
+     * @param existing Body of the existing block, nullptr for none
+     * @details Keeps the vendor string and the comments not being written.
+     * A malformed existing block is replaced as a whole.
+     */
+    void flac_comments(vector<unsigned char>& out, const unsigned char* existing, size_t size, const tag_set& tags) {
+        vector<pair<const unsigned char*, size_t>> kept;
+        const unsigned char* vendor = (const unsigned char*)VORBIS_VENDOR;
+        size_t vendor_size = strlen(VORBIS_VENDOR);
+
+        if (existing && size >= 8) {
+            size_t pos = 4 + read_le32(existing);
+            bool valid = pos + 4 <= size;
+            if (valid) {
+                uint32_t count = read_le32(existing + pos);
+                pos += 4;
+                for (uint32_t i = 0; i < count && valid; ++i) {
+                    valid = pos + 4 <= size && pos + 4 + read_le32(existing + pos) <= size;
+                    if (!valid) break;
+                    size_t len = read_le32(existing + pos);
+                    const unsigned char* c = existing + pos + 4;
+                    bool replaced = (!tags.title.empty() && comment_key_is(c, len, "TITLE")) ||
+                                    (!tags.artists.empty() && comment_key_is(c, len, "ARTIST")) ||
+                                    (!tags.album.empty() && comment_key_is(c, len, "ALBUM"));
+                    if (!replaced) {
+                        kept.emplace_back(c, len);
+                    }
+                    pos += 4 + len;
+                }
+            }
+            if (valid) {
+                vendor = existing + 4;
+                vendor_size = read_le32(existing);
+            } else {
+                kept.clear();
+            }
+        }
+
+        size_t count = kept.size() + (tags.title.empty() ? 0 : 1) + tags.artists.size() + (tags.album.empty() ? 0 : 1);
+        put_le32(out, (uint32_t)vendor_size);
+        put_bytes(out, vendor, vendor_size);
+        put_le32(out, (uint32_t)count);
+        for (const auto& [c, len] : kept) {
+            put_le32(out, (uint32_t)len);
+            put_bytes(out, c, len);
+        }
+        if (!tags.title.empty()) put_comment(out, "TITLE", tags.title);
+        for (const string& artist : tags.artists) {
+            put_comment(out, "ARTIST", artist);
+        }
+        if (!tags.album.empty()) put_comment(out, "ALBUM", tags.album);
+    }
+
+    bool flac_rewrite(const unsigned char* audio, size_t len, const tag_set& tags,
+                      vector<unsigned char>& head, size_t& consumed) {
+        if (len < 4 || memcmp(audio, "fLaC", 4) != 0) {
+            return false;
+        }
+
+        struct block {
+            unsigned char type;
+            const unsigned char* body;
+            size_t size;
+        };
+        vector<block> kept;
+        vector<block> padding;
+        bool comments = has_text(tags);
+        size_t comment_index = 0;   // 0: no VORBIS_COMMENT block seen
+        size_t pos = 4;
+        while (true) {
+            if (pos + 4 > len) return false;
+            unsigned char type = audio[pos] & 0x7f;
+            bool last = audio[pos] & 0x80;
+            size_t size = read_be24(audio + pos + 1);
+            if (pos + 4 + size > len) return false;
+            block b{type, audio + pos + 4, size};
+            if (type == FLAC_PADDING) {
+                padding.push_back(b);
+            } else if (type == FLAC_VORBIS_COMMENT && comments) {
+                // Further comment blocks are invalid per the specification and dropped
+                if (comment_index == 0) {
+                    comment_index = kept.size();
+                    kept.push_back(b);
+                }
+            } else if (type != FLAC_PICTURE || !tags.cover) {
+                kept.push_back(b);
+            }
+            pos += 4 + size;
+            if (last) break;
+        }
+        // STREAMINFO must stay the first block
+        if (kept.empty() || kept[0].type != 0) {
+            return false;
+        }
+
+        vector<unsigned char> comment_block;
+        if (comments) {
+            const block* existing = comment_index ? &kept[comment_index] : nullptr;
+            flac_comments(comment_block, existing ? existing->body : nullptr, existing ? existing->size : 0, tags);
+            if (comment_block.size() > FLAC_MAX_BLOCK) {
+                return false;
+            }
+            block b{FLAC_VORBIS_COMMENT, comment_block.data(), comment_block.size()};
+            if (comment_index) {
+                kept[comment_index] = b;
+            } else {
+                kept.insert(kept.begin() + 1, b);
+            }
+        }
+
+        vector<unsigned char> picture;
+        if (tags.cover) {
+            flac_picture(picture, tags);
+            if (picture.size() > FLAC_MAX_BLOCK) {
+                return false;
+            }
+            kept.push_back({FLAC_PICTURE, picture.data(), picture.size()});
+        }
+        kept.insert(kept.end(), padding.begin(), padding.end());
+
+        head.assign({'f', 'L', 'a', 'C'});
+        for (size_t i = 0; i < kept.size(); ++i) {
+            const block& b = kept[i];
+            head.push_back((unsigned char)(b.type | (i + 1 == kept.size() ? 0x80 : 0)));
+            head.push_back((unsigned char)(b.size >> 16));
+            head.push_back((unsigned char)(b.size >> 8));
+            head.push_back((unsigned char)b.size);
+            put_bytes(head, b.body, b.size);
+        }
+        consumed = pos;
+        return true;
+    }
+
+    // ID3v2
+
+    bool has_id3(const unsigned char* audio, size_t len) {
+        return len >= 10 && memcmp(audio, "ID3", 3) == 0;
+    }
+
+    size_t mp3_head_size(const unsigned char* audio, size_t len) {
+        if (len < 10) return 10;
+        if (!has_id3(audio, len)) return 0;
+        bool footer = audio[3] == 4 && (audio[5] & 0x10);
+        return 10 + read_syncsafe(audio + 6) + (footer ? 10 : 0);
+    }
+
+    /**
+     * @brief Append an ID3v2 frame in the given major version
+     */
+    void id3_frame(vector<unsigned char>& out, unsigned char major, const char* id, const vector<unsigned char>& body) {
+        put_bytes(out, id, 4);
+        if (major == 4) {
+            put_syncsafe(out, (uint32_t)body.size());
+        } else {
+            put_be32(out, (uint32_t)body.size());
+        }
+        out.push_back(0);
+        out.push_back(0);
+        put_bytes(out, body.data(), body.size());
+    }
+
+    void id3_picture(vector<unsigned char>& frames, unsigned char major, const tag_set& tags) {
+        const char* mime = image_mime(tags.cover, tags.cover_size);
+        vector<unsigned char> body;
+        body.push_back(major == 4 ? 3 : 0);     // UTF-8 in v2.4, Latin-1 in v2.3; the text is ASCII
+        put_bytes(body, mime, strlen(mime) + 1);
+        body.push_back(FRONT_COVER);
+        put_bytes(body, COVER_DESCRIPTION, sizeof(COVER_DESCRIPTION));
+        put_bytes(body, tags.cover, tags.cover_size);
+        id3_frame(frames, major, "APIC", body);
+    }
+
+    /**
+     * @brief Append UTF-8 text as UTF-16LE, replacing malformed sequences with U+FFFD
+     */
+    void put_utf16(vector<unsigned char>& out, const string& text) {
+        auto unit = [&out](uint32_t u) {
+            out.push_back((unsigned char)u);
+            out.push_back((unsigned char)(u >> 8));
+        };
+        const unsigned char* p = (const unsigned char*)text.data();
+        size_t len = text.size();
+        size_t i = 0;
+        while (i < len) {
+            unsigned char c = p[i];
+            size_t extra = c < 0x80 ? 0 : (c >> 5) == 6 ? 1 : (c >> 4) == 14 ? 2 : (c >> 3) == 30 ? 3 : 4;
+            uint32_t cp = extra == 0 ? c : extra == 1 ? (c & 0x1f) : extra == 2 ? (c & 0x0f) : (c & 0x07);
+            bool valid = extra < 4 && i + extra < len;
+            for (size_t k = 1; valid && k <= extra; ++k) {
+                valid = (p[i + k] & 0xc0) == 0x80;
+                cp = cp << 6 | (p[i + k] & 0x3f);
+            }
+            if (!valid || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+                unit(0xFFFD);
+                i += 1;
+                continue;
+            }
+            if (cp >= 0x10000) {
+                cp -= 0x10000;
+                unit(0xD800 | (cp >> 10));
+                unit(0xDC00 | (cp & 0x3ff));
+            } else {
+                unit(cp);
+            }
+            i += 1 + extra;
+        }
+    }
+
+    /**
+     * @brief Append a text information frame
+     * @details v2.4 stores UTF-8 with multiple values separated by NUL. v2.3
+     * has no UTF-8, so non-ASCII text is stored as UTF-16 with a BOM, and
+     * multiple values are joined with "/" as v2.3 readers expect.
+     */
+    void id3_text(vector<unsigned char>& frames, unsigned char major, const char* id, const vector<string>& values) {
+        vector<unsigned char> body;
+        if (major == 4) {
+            body.push_back(3);
+            for (size_t i = 0; i < values.size(); ++i) {
+                if (i > 0) body.push_back(0);
+                put_bytes(body, values[i].data(), values[i].size());
+            }
+        } else {
+            string joined;
+            for (size_t i = 0; i < values.size(); ++i) {
+                if (i > 0) joined += '/';
+                joined += values[i];
+            }
+            bool ascii = true;
+            for (unsigned char c : joined) {
+                ascii = ascii && c < 0x80;
+            }
+            if (ascii) {
+                body.push_back(0);
+                put_bytes(body, joined.data(), joined.size());
+            } else {
+                body.assign({1, 0xFF, 0xFE});
+                put_utf16(body, joined);
+            }
+        }
+        id3_frame(frames, major, id, body);
+    }
+
+    /**
+     * @brief Whether an existing frame is replaced by one written from tags
+     */
+    bool id3_replaced(const unsigned char* id, const tag_set& tags) {
+        return (tags.cover && memcmp(id, "APIC", 4) == 0) ||
+               (!tags.title.empty() && memcmp(id, "TIT2", 4) == 0) ||
+               (!tags.artists.empty() && memcmp(id, "TPE1", 4) == 0) ||
+               (!tags.album.empty() && memcmp(id, "TALB", 4) == 0) ||
+               (tags.duration_ms > 0 && memcmp(id, "TLEN", 4) == 0);
+    }
+
+    bool mp3_rewrite(const unsigned char* audio, size_t len, const tag_set& tags,
+                     vector<unsigned char>& head, size_t& consumed) {
+        unsigned char major = 4;
+        vector<unsigned char> frames;
+        consumed = 0;
+
+        if (has_id3(audio, len)) {
+            major = audio[3];
+            unsigned char flags = audio[5];
+            // v2.2 uses other frame ids; tag-wide unsynchronisation would need decoding
+            if ((major != 3 && major != 4) || (flags & 0x80)) {
+                return false;
+            }
+            size_t end = 10 + read_syncsafe(audio + 6);
+            consumed = end + (major == 4 && (flags & 0x10) ? 10 : 0);
+            if (consumed > len) {
+                return false;
+            }
+
+            size_t pos = 10;
+            if (flags & 0x40) {
+                // The extended header is dropped; its CRC would not match the new tag
+                if (pos + 4 > end) return false;
+                pos += major == 4 ? read_syncsafe(audio + pos) : 4 + read_be32(audio + pos);
+            }
+            while (pos + 10 <= end && audio[pos] != 0) {
+                size_t size = major == 4 ? read_syncsafe(audio + pos + 4) : read_be32(audio + pos + 4);
+                if (pos + 10 + size > end) return false;
+                if (!id3_replaced(audio + pos, tags)) {
+                    put_bytes(frames, audio + pos, 10 + size);
+                }
+                pos += 10 + size;
+            }
+        }
+
+        if (!tags.title.empty()) id3_text(frames, major, "TIT2", {tags.title});
+        if (!tags.artists.empty()) id3_text(frames, major, "TPE1", tags.artists);
+        if (!tags.album.empty()) id3_text(frames, major, "TALB", {tags.album});
+        if (tags.duration_ms > 0) id3_text(frames, major, "TLEN", {to_string(tags.duration_ms)});
+        if (tags.cover) {
+            id3_picture(frames, major, tags);
+        }
+        if (frames.size() > ID3_MAX_SIZE) {
+            return false;
+        }
+
+        head.assign({'I', 'D', '3', major, 0, 0});
+        put_syncsafe(head, (uint32_t)frames.size());
+        put_bytes(head, frames.data(), frames.size());
+        return true;
+    }
+} // anonymous namespace
+
+bool supported(const string& format) {
+    return format == "flac" || format == "mp3";
+}
+
+size_t head_size(const string& format, const unsigned char* audio, size_t len) {
+    if (format == "flac") return flac_head_size(audio, len);
+    if (format == "mp3") return mp3_head_size(audio, len);
+    return 0;
+}
+
+bool rewrite_head(const string& format, const unsigned char* audio, size_t len, const tag_set& tags,
+                  vector<unsigned char>& head, size_t& consumed) {
+    head.clear();
+    consumed = 0;
+    bool ok = false;
+    if (format == "flac") {
+        ok = flac_rewrite(audio, len, tags, head, consumed);
+    } else if (format == "mp3") {
+        ok = mp3_rewrite(audio, len, tags, head, consumed);
+    }
+    if (!ok) {
+        head.clear();
+        consumed = 0;
+    }
+    return ok;
+}
+
+} // namespace tags
+} // namespace ncm
@@ -0,0 +1,85 @@
+/**
+ * @file tags.h
+ * @brief In-stream metadata embedding for decrypted audio
+ * @details Builds the leading bytes of the output file so that tags are
+ * written together with the audio: a rewritten FLAC metadata block chain or
+ * an ID3v2 tag in front of MP3 frames. Only the head of the audio is
+ * decoded and replaced; the rest of the stream is copied unchanged.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ncm {
+namespace tags {
+
+/**
+ * @brief Metadata to embed
+ */
+struct tag_set {
+    /** @brief Front cover image bytes (JPEG or PNG), nullptr for none */
+    const unsigned char* cover = nullptr;
+
+    /** @brief Size of the cover image */
+    std::size_t cover_size = 0;
+
+    /** @brief Track title (UTF-8), empty to leave the existing one */
+    std::string title;
+
+    /** @brief Artist names (UTF-8), empty to leave the existing ones */
+    std::vector<std::string> artists;
+
+    /** @brief Album name (UTF-8), empty to leave the existing one */
+    std::string album;
+
+    /** @brief Duration in milliseconds, 0 for unknown */
+    std::uint64_t duration_ms = 0;
+
+    /** @brief Whether there is anything to write */
+    bool empty() const {
+        return !cover && title.empty() && artists.empty() && album.empty() && duration_ms == 0;
+    }
+};
+
+/**
+ * @brief Whether tags can be embedded into audio of this format
+ * @param format Format from the NCM metadata ("flac", "mp3")
+ */
+bool supported(const std::string& format);
+
+/**
+ * @brief Leading audio bytes needed by rewrite_head()
+ * @param format Audio format
+ * @param audio Decrypted audio bytes available so far
+ * @param len Number of bytes available
+ * @return Total number of leading bytes to provide; a value not above len
+ * means the head is complete
+ * @details Call again after providing the requested bytes, as each FLAC
+ * block header or ID3 size reveals how much follows.
+ */
+std::size_t head_size(const std::string& format, const unsigned char* audio, std::size_t len);
+
+/**
+ * @brief Build the tagged head of the output
+ * @param format Audio format
+ * @param audio Decrypted leading audio, at least head_size() bytes unless the audio is shorter
+ * @param len Number of bytes available
+ * @param tags Metadata to embed
+ * @param head Receives the bytes to write in place of the first consumed audio bytes
+ * @param consumed Receives the number of leading audio bytes replaced by head
+ * @return false if the stream cannot be tagged (unexpected or unsupported
+ * container header, or an oversized picture); head is left empty
+ * @details Existing pictures and existing fields for the text tags given
+ * are replaced, all other existing metadata is kept. FLAC gets one Vorbis
+ * comment per field, TITLE, ARTIST (once per artist) and ALBUM; its
+ * STREAMINFO already carries the duration. MP3 gets TIT2, TPE1, TALB and
+ * TLEN frames.
+ */
+bool rewrite_head(const std::string& format, const unsigned char* audio, std::size_t len, const tag_set& tags,
+                  std::vector<unsigned char>& head, std::size_t& consumed);
+
+} // namespace tags
+} // namespace ncm
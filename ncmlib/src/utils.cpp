@@ -1,4 +1,3 @@
-
 /**
  * @file utils.cpp
  * @brief Utility functions for NCM file processing
@@ -6,8 +5,8 @@
  */
 
 #include "utils.h"
-#include <sstream>
-#include <iostream>
+#include "ncmlib/log.h"
+#include <string>
 
 namespace ncm {
 namespace utils {
@@ -21,47 +20,21 @@ namespace utils {
  */
 void hex2str(const char* src, unsigned char* dest) {
     if (!src || !dest) {
-        std::cerr << "[ERROR] hex2str: Invalid input parameters" << std::endl;
+        NCM_LOG(log::level::error, "hex2str: Invalid input parameters");
         return;
     }
     
-    std::string hs(src, 32);
-    std::stringstream ss;
-    
     for (int i = 0; i < 16; i++) {
-        ss.clear();
-        ss.str(hs.substr(i * 2, 2));
-        unsigned int value = 0;
-        ss >> std::hex >> value;
-        dest[i] = static_cast<unsigned char>(value);
-        
-        if (ss.fail()) {
-            std::cerr << "[ERROR] hex2str: Failed to parse hex at position " << i << std::endl;
+        int hi = hex_digit(src[i * 2]);
+        int lo = hi < 0 ? -1 : hex_digit(src[i * 2 + 1]);
+        if (hi < 0 || lo < 0) {
+            NCM_LOG(log::level::error, "hex2str: Failed to parse hex at position " + std::to_string(i));
             dest[i] = 0;
+            continue;
         }
+        dest[i] = static_cast<unsigned char>(hi << 4 | lo);
     }
 }
 
-/**
- * @brief Convert little-endian bytes to unsigned int
- * @param src Pointer to 4 bytes of little-endian data
- * @return Converted unsigned integer value
- * @details Handles endian conversion from little-endian format
- */
-unsigned int little_int(const unsigned char* src) {
-    if (!src) {
-        std::cerr << "[ERROR] little_int: NULL input pointer" << std::endl;
-        return 0;
-    }
-    
-    unsigned int result = 0;
-    for (int i = 3; i >= 0; i--) {
-        result <<= 8;
-        result += src[i];
-    }
-    
-    return result;
-}
-
 }
 }
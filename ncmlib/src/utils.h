@@ -1,13 +1,62 @@
+/**
+ * @file utils.h
+ * @brief Utility functions for NCM file processing
+ * @details Hex and little-endian helpers; the constexpr forms let fixed key
+ * material and header constants be decoded at compile time.
+ */
 
 #pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace ncm {
 namespace utils {
 
+/**
+ * @brief Value of a single hex digit
+ * @return Digit value, or -1 if c is not a hex digit
+ */
+constexpr int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Decode a hex string literal into bytes at compile time
+ * @param src Hex literal with an even number of digits
+ * @return Decoded bytes
+ */
+template <std::size_t N>
+constexpr std::array<unsigned char, (N - 1) / 2> hex_bytes(const char (&src)[N]) {
+    static_assert(N % 2 == 1, "hex literal needs an even number of digits");
+    std::array<unsigned char, (N - 1) / 2> out{};
+    for (std::size_t i = 0; i < out.size(); i++) {
+        out[i] = (unsigned char)(hex_digit(src[2 * i]) << 4 | hex_digit(src[2 * i + 1]));
+    }
+    return out;
+}
+
 void hex2str(const char* src, unsigned char* dest);
-unsigned int little_int(const unsigned char* src);
+
+/**
+ * @brief Convert little-endian bytes to an unsigned integer
+ * @tparam T Result type; sizeof(T) bytes are read
+ * @param src Pointer to the little-endian data
+ * @return Converted value
+ */
+template <typename T = unsigned int>
+constexpr T little_int(const unsigned char* src) {
+    T result = 0;
+    for (std::size_t i = sizeof(T); i-- > 0;) {
+        result = (T)(result << 8 | src[i]);
+    }
+    return result;
+}
 
 }
 }
@@ -2,16 +2,21 @@
 """
 ncmpp.py - All-in-one NCM processing tool
 
-Usage: python ncmpp.py /path/to/music/directory
+Usage: python ncmpp.py [--manifest FILE] /path/to/music/directory
 
 This script:
 1. Finds .ncm files recursively
-2. Generates input and output lists
-3. Runs ncmpp binary to convert files
-4. Embeds cover images into converted files
-5. Cleans up cover images
+2. Converts them in-process with the ncmlib Python module when it is built
+   (cmake -DNCMPP_BUILD_PYTHON=ON), embedding cover images and tags
+3. Otherwise generates input and output lists, runs the ncmpp binary and
+   cleans up the temporary lists
+
+Both paths skip files that are unchanged since an earlier run, tracked in a
+manifest kept in the user's cache directory (one per music directory).
 """
 
+import argparse
+import hashlib
 import sys
 import os
 import subprocess
@@ -65,14 +70,21 @@ except Exception:
     error = ColorLogger.error
     success = ColorLogger.success
 
+# In-process converter, built next to the ncmpp binary
+sys.path.append(str(Path(__file__).parent / "build"))
+try:
+    import ncmlib
+except ImportError:
+    ncmlib = None
+
 
-def find_ncm_files(music_dir):
-    """Find .ncm files recursively and generate input/output lists."""
+def scan_ncm_files(music_dir):
+    """Find .ncm files recursively; returns None if there are none."""
     music_path = Path(music_dir)
 
     if not music_path.is_dir():
         error(f"Directory not found at '{ColorLogger.path(music_dir)}'")
-        return None, None
+        return None
 
     info(f"Scanning for .ncm files in '{ColorLogger.path(music_path.resolve())}'...")
 
@@ -80,8 +92,14 @@ def find_ncm_files(music_dir):
 
     if not ncm_files:
         info(f"No .ncm files found in '{ColorLogger.path(music_path.resolve())}'.")
-        return None, None
+        return None
+
+    success(f"Found {len(ncm_files)} .ncm files.")
+    return ncm_files
+
 
+def write_file_lists(ncm_files):
+    """Generate the input/output lists for the ncmpp binary."""
     # Create temporary files for ncmpp
     temp_dir = Path.cwd() / "ncmpp_temp"
     temp_dir.mkdir(exist_ok=True)
@@ -92,21 +110,68 @@ def find_ncm_files(music_dir):
     with open(input_list_path, 'w', encoding='utf-8') as f_in, \
          open(output_list_path, 'w', encoding='utf-8') as f_out:
         for ncm_file in ncm_files:
-            # Write the full path to the input file
-            f_in.write(str(ncm_file.resolve()) + '\n')
+            # Full input path and the output path without the .ncm extension;
+            # the stem preserves a full filename including dots
+            input_path, output_path = conversion_job(ncm_file)
+            f_in.write(input_path + '\n')
+            f_out.write(output_path + '\n')
 
-            # Write the desired output path (without .ncm extension)
-            # Use stem to preserve full filename including dots
-            base_name = ncm_file.stem
-            output_path = ncm_file.parent / base_name
-            f_out.write(str(output_path) + '\n')
-
-    success(f"Found {len(ncm_files)} .ncm files.")
     return input_list_path, output_list_path
 
 
-def run_ncmpp(input_file, output_file):
-    """Run the ncmpp binary to convert files."""
+def default_manifest_path(music_dir):
+    """Manifest of music_dir in the user's cache directory, out of the music library."""
+    if os.name == 'nt':
+        cache_root = Path(os.environ.get('LOCALAPPDATA') or Path.home() / 'AppData' / 'Local')
+    else:
+        cache_root = Path(os.environ.get('XDG_CACHE_HOME') or Path.home() / '.cache')
+    digest = hashlib.sha1(str(Path(music_dir).resolve()).encode('utf-8')).hexdigest()[:16]
+    return cache_root / 'ncmpp' / f'{digest}.manifest'
+
+
+def conversion_job(ncm_file):
+    """Input and output (without extension) of ncm_file, as the manifest records them."""
+    return str(ncm_file.resolve()), str(ncm_file.parent / ncm_file.stem)
+
+
+def convert_in_process(ncm_files, manifest_file):
+    """Convert files with the ncmlib module, skipping those the manifest records as up to date."""
+    manifest = ncmlib.Manifest(str(manifest_file))
+    jobs = [job for job in map(conversion_job, ncm_files)
+            if not manifest.up_to_date(*job, embed_cover=True, write_tags=True)]
+    skipped = len(ncm_files) - len(jobs)
+    if skipped:
+        info(f"Skipping {skipped} files that are already converted.")
+    if not jobs:
+        return True
+
+    info(f"Converting {len(jobs)} files in-process with ncmlib...")
+
+    def on_progress(done, total, result):
+        input_path, output_path = jobs[result.index]
+        if not result.ok:
+            manifest.forget(input_path)
+            error(f"Error processing {ColorLogger.path(input_path)}: {result.error}")
+        else:
+            manifest.record(input_path, output_path, result.result.format, embed_cover=True, write_tags=True)
+            if done % 100 == 0 or done == total:
+                info(f"Converted {done}/{total} files")
+
+    try:
+        results = ncmlib.dump_batch(jobs, embed_cover=True, write_tags=True, on_progress=on_progress)
+    finally:
+        # Keep the files converted before an interruption
+        manifest.save()
+    failed = sum(1 for r in results if not r.ok)
+    if failed:
+        error(f"{failed} of {len(jobs)} files failed to convert.")
+        return False
+    success("ncmlib conversion completed successfully!")
+    return True
+
+
+def run_ncmpp(input_file, output_file, manifest_file=None):
+    """Run the ncmpp binary to convert files, skipping those recorded as up to date in manifest_file."""
     info("Running ncmpp to convert files...")
 
     try:
@@ -128,8 +193,12 @@ def run_ncmpp(input_file, output_file):
             ncmpp_cmd,
             "-i", str(input_file),
             "-o", str(output_file),
-            "-s"  # Show timing
+            "-s",  # Show timing
+            "--embed-cover",  # Write covers into the audio files
+            "--tags"  # Write title, artist and album from the NCM metadata
         ]
+        if manifest_file:
+            cmd += ["--manifest", str(manifest_file)]
 
         info(f"Executing: {' '.join(cmd)}")
         result = subprocess.run(cmd, capture_output=True, text=True)
@@ -149,37 +218,6 @@ def run_ncmpp(input_file, output_file):
         return False
 
 
-def run_embed_cover(output_file):
-    """Run embed_cover.py to embed covers."""
-    info("Running embed_cover.py to embed cover images...")
-
-    try:
-        # Check if we're in the right environment
-        if Path("ncmpp_env").exists():
-            activate_script = Path("ncmpp_env") / "bin" / "activate"
-            cmd = f"source {activate_script} && python embed_cover.py {output_file}"
-            info("Using virtual environment for embed_cover.py")
-            result = subprocess.run(cmd, shell=True, capture_output=True, text=True)
-        else:
-            cmd = [sys.executable, "embed_cover.py", str(output_file)]
-            info(f"Executing: {' '.join(cmd)}")
-            result = subprocess.run(cmd, capture_output=True, text=True)
-
-        if result.returncode == 0:
-            success("Cover embedding completed successfully!")
-            if result.stdout:
-                info(result.stdout)
-            return True
-        else:
-            error("Error running embed_cover.py:")
-            error(result.stderr)
-            return False
-
-    except Exception as e:
-        error(f"Error running embed_cover.py: {e}")
-        return False
-
-
 def cleanup_temp_files(temp_dir):
     """Clean up temporary files."""
     try:
@@ -194,31 +232,41 @@ def cleanup_temp_files(temp_dir):
 
 def main():
     """Main function."""
-    if len(sys.argv) != 2:
-        error("Usage: python ncmpp.py /path/to/music/directory")
-        sys.exit(1)
+    parser = argparse.ArgumentParser(description="Convert every .ncm file under a music directory.")
+    parser.add_argument("music_dir", help="Directory to search for .ncm files")
+    parser.add_argument("--manifest", type=Path,
+                        help="Manifest of converted files (default: one per music directory in the user's cache)")
+    args = parser.parse_args()
 
-    music_dir = sys.argv[1]
+    music_dir = args.music_dir
+    manifest_file = args.manifest or default_manifest_path(music_dir)
+    manifest_file.parent.mkdir(parents=True, exist_ok=True)
 
     info("=== NCM All-in-One Processing Tool ===")
     info(f"Processing directory: {ColorLogger.path(music_dir)}")
 
-    # Step 1: Find NCM files and generate lists
-    input_file, output_file = find_ncm_files(music_dir)
-    if not input_file or not output_file:
+    # Step 1: Find NCM files
+    ncm_files = scan_ncm_files(music_dir)
+    if not ncm_files:
         sys.exit(1)
 
-    # Step 2: Run ncmpp to convert files
-    if not run_ncmpp(input_file, output_file):
-        error("Conversion failed. Skipping cover embedding.")
+    # In-process conversion needs no lists, no subprocess and no log parsing
+    if ncmlib is not None:
+        if not convert_in_process(ncm_files, manifest_file):
+            error("Conversion failed.")
+            sys.exit(1)
+        success("=== Processing Complete ===")
+        return
+
+    input_file, output_file = write_file_lists(ncm_files)
+
+    # Step 2: Run ncmpp to convert files; the manifest lets repeated runs skip unchanged files
+    if not run_ncmpp(input_file, output_file, manifest_file):
+        error("Conversion failed.")
         cleanup_temp_files(input_file.parent)
         sys.exit(1)
 
-    # Step 3: Run embed_cover.py to embed covers
-    if not run_embed_cover(output_file):
-        error("Cover embedding failed.")
-
-    # Step 4: Clean up
+    # Step 3: Clean up
     cleanup_temp_files(input_file.parent)
 
     success("=== Processing Complete ===")
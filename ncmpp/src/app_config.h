@@ -6,20 +6,54 @@
  */
 
 #pragma once
+#include "ncmlib/log.h"
+#include "topology.h"
 #include <string>
+#include <cstdint>
 #include <filesystem>
+#include <utility>
+#include <vector>
 
 /**
  * @brief Configuration structure for ncmpp application
  * @details Contains all runtime configuration parameters including:
- * - Thread count for concurrent processing
+ * - Thread count for concurrent processing, fixed or adaptive
+ * - Worker CPU and NUMA placement
  * - Timing display preference
  * - Input/output file list paths for batch mode
  * - Output directory for fallback mode
+ * - Binary job files and NUL-separated job streams
+ * - Output I/O tuning
+ * - Optional io_uring batch engine
+ * - Optional staged batch pipeline
+ * - Intra-file parallelism threshold
+ * - Metadata probe mode
+ * - Streaming to stdout
+ * - Incremental conversion manifest
+ * - Checkpoint journal, resume and failure report
+ * - Watch mode
+ * - Cover embedding and tag writing
+ * - Cover downscaling
+ * - Duplicate track and cover linking
+ * - Durable output commits
+ * - Log verbosity
+ * - Per-stage metrics and trace output
  */
 struct app_config {
     /** @brief Number of threads for concurrent processing */
     unsigned int thread_count;
+
+    /** @brief --threads auto: thread_count bounds the files in flight, tuned per device from throughput */
+    bool auto_threads = false;
+
+    /** @brief --threads auto: most files in flight on a device without its own limit */
+    unsigned int io_limit = 0;
+
+    /** @brief --threads auto: most files in flight on the devices holding these paths */
+    std::vector<std::pair<std::filesystem::path, unsigned int>> device_limits;
+
+    /** @brief Pinning of pool workers; pinned pools also route files to the node of their storage */
+    affinity_mode affinity = affinity_mode::off;
     
     /** @brief Whether to display processing time information */
     bool show_time;
@@ -32,4 +66,85 @@ struct app_config {
     
     /** @brief Output directory path (fallback mode) */
     std::filesystem::path output_dir;
+
+    /** @brief Job file to convert ("-" for NUL-separated input/output pairs on stdin, empty disables) */
+    std::string job_file;
+
+    /** @brief Skip this many jobs of the job file or stream, to resume an interrupted run */
+    std::uint64_t jobs_from = 0;
+
+    /** @brief Write the -i/-o lists or the scanned files as a job file here and exit (empty disables) */
+    std::string write_jobs;
+
+    /** @brief Whether to write audio with direct I/O, bypassing the page cache */
+    bool direct_io = false;
+
+    /** @brief Whether to use the io_uring engine instead of blocking worker threads */
+    bool io_uring = false;
+
+    /** @brief Number of files the io_uring engine keeps in flight */
+    unsigned int inflight = 16;
+
+    /** @brief Whether batch mode streams the file lists through the staged pipeline */
+    bool pipeline = false;
+
+    /** @brief Audio sections of at least this many MiB are split across workers (0 disables) */
+    unsigned int split_mb = 64;
+
+    /** @brief Minimum severity that is logged */
+    ncm::log::level log_level = ncm::log::level::info;
+
+    /** @brief Probe-only mode: write one JSON line per input here ("-" for stdout, empty disables) */
+    std::string probe_output;
+
+    /** @brief Stream mode: decrypt this one input ("-" for stdin) to stdout (empty disables) */
+    std::string stream_input;
+
+    /** @brief Manifest of previous conversions; unchanged inputs are skipped (empty disables) */
+    std::string manifest_path;
+
+    /** @brief Journal of finished and failed jobs, appended in batches during the run (empty disables) */
+    std::string journal_path;
+
+    /** @brief Skip the jobs the journal records as converted and append to it */
+    bool resume = false;
+
+    /** @brief Failed jobs written here as JSON lines at exit (empty disables) */
+    std::string failures_output;
+
+    /** @brief Watch mode: keep converting new and changed files below these directories (empty disables) */
+    std::vector<std::filesystem::path> watch_dirs;
+
+    /** @brief Watch mode: convert a file once it has not changed for this long */
+    unsigned int debounce_ms = 300;
+
+    /** @brief Embed covers into the audio instead of writing .jpg files */
+    bool embed_cover = false;
+
+    /** @brief Write title, artist, album and duration tags from the NCM metadata */
+    bool write_tags = false;
+
+    /** @brief Downscale covers whose longest side exceeds this many pixels (0 keeps them as stored) */
+    unsigned int cover_size = 0;
+
+    /** @brief JPEG quality of downscaled covers, 1 to 100 */
+    unsigned int cover_quality = 85;
+
+    /** @brief Link outputs of duplicate tracks and covers instead of writing them again */
+    bool dedupe = false;
+
+    /** @brief Link duplicates with hard links instead of reflinks */
+    bool dedupe_hardlink = false;
+
+    /** @brief Make outputs durable before renaming them into place, syncing once per directory and batch */
+    bool fsync = false;
+
+    /** @brief Per-stage metrics written here at exit ("-" for stderr, empty disables) */
+    std::string metrics_output;
+
+    /** @brief Write the metrics in the Prometheus text format instead of JSON */
+    bool metrics_prometheus = false;
+
+    /** @brief Chrome trace of every timed stage call, written at exit (empty disables) */
+    std::string trace_output;
 };
@@ -1,38 +1,101 @@
 #include "app_logic.h"
+#include "ncmlib/commit.h"
+#include "ncmlib/error.h"
+#include "ncmlib/log.h"
+#include "ncmlib/metrics.h"
 #include "ncmlib/ncmdump.h"
+#include "ncmlib/probe.h"
 #include "pool.h"
+#include "pipeline.h"
 #include "file_utils.h"
+#include "job_file.h"
+#include "journal.h"
+#include "watcher.h"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
 #include <mutex>
 #include <functional>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 using namespace std;
 
 namespace {
+    using ncm::log::level;
+
     /**
-     * @brief Thread-safe logging utility
-     * @note Uses mutex to ensure thread-safe console output
+     * @brief Queue a message on the shared asynchronous logger
+     * @param message Message to log
+     * @param lvl Severity; messages below the configured level are dropped
      */
-    mutex log_mtx;
+    void log(const string& message, level lvl = level::info) {
+        ncm::log::write(lvl, message);
+    }
 
     /**
-     * @brief Log message to console with thread safety
-     * @param message Message to log
-     * @param level Log level (INFO, WARN, ERROR, DEBUG)
+     * @brief Append a string as a quoted JSON literal
      */
-    void log(const string& message, const string& level = "INFO") {
-        lock_guard<mutex> lock(log_mtx);
-        
-        // Color codes for different log levels
-        string color_code;
-        if (level == "ERROR") color_code = "\033[31m";
-        else if (level == "WARN") color_code = "\033[33m";
-        else if (level == "DEBUG") color_code = "\033[36m";
-        else color_code = "\033[32m";
-        
-        cout << color_code << "[" << level << "] " << message << "\033[0m" << endl;
+    void append_json_string(string& out, const string& value) {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        for (unsigned char c : value) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        out += "\\u00";
+                        out += hex[c >> 4];
+                        out += hex[c & 0xf];
+                    } else {
+                        out += (char)c;
+                    }
+            }
+        }
+        out += '"';
+    }
+
+    /**
+     * @brief Format a probe result as a single-line JSON object
+     */
+    string track_info_json(const filesystem::path& path, const ncm::track_info& info) {
+        string out = "{\"path\":";
+        append_json_string(out, path.string());
+        out += ",\"format\":";
+        append_json_string(out, info.format);
+        out += ",\"musicId\":" + to_string(info.music_id);
+        out += ",\"musicName\":";
+        append_json_string(out, info.music_name);
+        out += ",\"artists\":[";
+        for (size_t i = 0; i < info.artists.size(); ++i) {
+            if (i) out += ',';
+            append_json_string(out, info.artists[i]);
+        }
+        out += "],\"album\":";
+        append_json_string(out, info.album);
+        out += ",\"bitrate\":" + to_string(info.bitrate);
+        out += ",\"duration\":" + to_string(info.duration);
+        out += ",\"coverOffset\":" + to_string(info.cover_offset);
+        out += ",\"coverSize\":" + to_string(info.cover_size);
+        out += ",\"audioOffset\":" + to_string(info.audio_offset);
+        out += ",\"audioSize\":" + to_string(info.audio_size);
+        out += '}';
+        return out;
     }
 
     /**
@@ -56,10 +119,92 @@ namespace {
             file.close();
             log("Read " + to_string(lines.size()) + " lines from " + file_path + " (" + to_string(line_count) + " total)");
         } else {
-            log("Error: Unable to open file: " + file_path, "ERROR");
+            log("Error: Unable to open file: " + file_path, level::error);
         }
         return lines;
     }
+
+    /**
+     * @brief Next non-empty line of a list file
+     * @return false at the end of the file
+     */
+    bool next_list_line(istream& in, string& line) {
+        while (getline(in, line)) {
+            if (!line.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** @brief Set by SIGINT/SIGTERM to end watch mode, a job file run or a journaled batch */
+    volatile sig_atomic_t stop_requested = 0;
+
+    extern "C" void request_stop(int) {
+        stop_requested = 1;
+    }
+
+    /** @brief Longest wait for changes, bounding how late a stop request is noticed */
+    constexpr chrono::milliseconds WATCH_IDLE_WAIT{1000};
+
+    /** @brief Outputs queued for a durable commit before a batch is flushed */
+    constexpr size_t COMMIT_BATCH_FILES = 256;
+
+    /** @brief Jobs of a job file handed to a worker at once */
+    constexpr size_t JOB_CHUNK = 64;
+
+    /** @brief Jobs read from a job stream or the -i/-o lists but not yet converted, per worker thread */
+    constexpr size_t JOBS_QUEUED_PER_THREAD = 8;
+
+    /** @brief Interval at which watch mode saves a changed manifest */
+    constexpr chrono::seconds MANIFEST_SAVE_INTERVAL{10};
+
+    /** @brief manifest::output_options() of the io_uring and pipeline engines, which write plain audio */
+    constexpr uint64_t ENGINE_OUTPUT_OPTIONS = 0;
+
+    /**
+     * @brief Size of a file, or 0 if it cannot be read
+     * @note Used as the scheduling weight, so errors only affect ordering
+     */
+    uint64_t file_size_or_zero(const filesystem::path& path) {
+        error_code ec;
+        uintmax_t size = filesystem::file_size(path, ec);
+        return ec ? 0 : (uint64_t)size;
+    }
+
+    /**
+     * @brief Bounds the jobs read ahead of the workers
+     * @details The reading thread takes a place before queueing a job and
+     * the job gives it back when it finishes, so memory follows the window
+     * and not the length of the job source.
+     */
+    class submit_window {
+    public:
+        explicit submit_window(size_t limit) : limit_(limit ? limit : 1) {}
+
+        /** @brief Wait for a free place; returns early once a stop is requested */
+        void acquire() {
+            unique_lock<mutex> lock(mtx_);
+            while (queued_ >= limit_ && !stop_requested) {
+                cv_.wait_for(lock, chrono::milliseconds(200));
+            }
+            queued_++;
+        }
+
+        void release() {
+            {
+                lock_guard<mutex> lock(mtx_);
+                queued_--;
+            }
+            cv_.notify_one();
+        }
+
+    private:
+        mutex mtx_;
+        condition_variable cv_;
+        size_t queued_ = 0;
+        size_t limit_;
+    };
 } // anonymous namespace
 
 ncm_app::ncm_app(app_config config) : config_(std::move(config)) {}
@@ -72,16 +217,128 @@ ncm_app::ncm_app(app_config config) : config_(std::move(config)) {}
  */
 int ncm_app::run() {
     setup_logging();
+    if (!config_.metrics_output.empty() || !config_.trace_output.empty()) {
+        ncm::metrics::enable(true, !config_.trace_output.empty());
+    }
     log("Starting NCM processing with " + to_string(config_.thread_count) + " threads");
     log("Configuration:");
     log("  Input file: " + (config_.input_file_list.empty() ? "<auto-detect>" : config_.input_file_list));
     log("  Output file: " + (config_.output_file_list.empty() ? config_.output_dir.string() : config_.output_file_list));
     log("  Show timing: " + string(config_.show_time ? "true" : "false"));
+    log("  Direct I/O: " + string(config_.direct_io ? "true" : "false"));
+    log("  Pipeline: " + string(config_.pipeline ? "true" : "false"));
+
+    if ((config_.embed_cover || config_.write_tags) && (config_.io_uring || config_.pipeline)) {
+        // Tags are built by ncmlib while it streams the audio, which the engines bypass
+        log("--embed-cover and --tags run on the worker threads; ignoring --io-uring and --pipeline", level::warn);
+        config_.io_uring = false;
+        config_.pipeline = false;
+    }
+    if (config_.cover_size > 0 && !cover_transcoder::available()) {
+        log("Built without libjpeg; --cover-size is ignored and covers are kept as stored", level::warn);
+        config_.cover_size = 0;
+    }
+    if (config_.cover_size > 0 && (config_.io_uring || config_.pipeline)) {
+        log("--cover-size runs on the worker threads; ignoring --io-uring and --pipeline", level::warn);
+        config_.io_uring = false;
+        config_.pipeline = false;
+    }
+    if (config_.dedupe && (config_.io_uring || config_.pipeline)) {
+        log("--dedupe runs on the worker threads; ignoring --io-uring and --pipeline", level::warn);
+        config_.io_uring = false;
+        config_.pipeline = false;
+    }
+    if (!config_.job_file.empty() && (config_.io_uring || config_.pipeline)) {
+        log("--jobs runs on the worker threads; ignoring --io-uring and --pipeline", level::warn);
+        config_.io_uring = false;
+        config_.pipeline = false;
+    }
+    if (!config_.journal_path.empty() && (config_.io_uring || config_.pipeline)) {
+        log("--journal runs on the worker threads; ignoring --io-uring and --pipeline", level::warn);
+        config_.io_uring = false;
+        config_.pipeline = false;
+    }
+    if (config_.fsync && (config_.io_uring || config_.pipeline)) {
+        log("--fsync runs on the worker threads; ignoring --io-uring and --pipeline", level::warn);
+        config_.io_uring = false;
+        config_.pipeline = false;
+    }
+    if (config_.auto_threads) {
+        if (config_.io_uring || config_.pipeline) {
+            // The engines keep --inflight files in flight on their own; only the CPU side is sized here
+            config_.thread_count = max(1u, thread::hardware_concurrency());
+            log("--threads auto: " + to_string(config_.thread_count) + " CPU threads behind --inflight " +
+                to_string(config_.inflight) + " files");
+        } else {
+            // Workers are I/O tasks here; decryption gets its own, fixed number of slots
+            limiter_ = make_unique<io_limiter>(config_.io_limit, config_.device_limits);
+            unsigned int cores = max(1u, thread::hardware_concurrency());
+            decrypt_slots_ = make_unique<counting_semaphore<>>((ptrdiff_t)cores);
+            log("--threads auto: tuning files in flight per device, at most " + to_string(config_.io_limit) +
+                " on devices without their own --io-limit, decrypting on " + to_string(cores) + " threads");
+        }
+    }
+    if (config_.affinity != affinity_mode::off) {
+        placement_ = plan_workers(config_.thread_count, config_.affinity);
+        log("Pinning " + to_string(placement_.size()) + " workers " +
+            (config_.affinity == affinity_mode::cpu ? "to single CPUs" : "to NUMA nodes") + " across " +
+            to_string(numa_nodes().size()) + " node(s)");
+    }
+    if (config_.fsync) {
+        commits_ = make_unique<ncm::CommitBatch>(COMMIT_BATCH_FILES);
+    }
+    if (config_.cover_size > 0) {
+        covers_ = make_unique<cover_transcoder>(config_.cover_size, (int)config_.cover_quality);
+        log("Downscaling covers to " + to_string(config_.cover_size) + " px at quality " +
+            to_string(config_.cover_quality) + (cover_transcoder::png_available() ? "" : "; PNG covers are kept"));
+    }
+    if (config_.dedupe) {
+        // A duplicate may arrive while the first copy's commit is still queued
+        ncm::CommitBatch* commits = commits_.get();
+        dedupe_ = make_unique<dedupe_index>(config_.dedupe_hardlink ? link_mode::hardlink : link_mode::reflink,
+                                            [commits] { if (commits) commits->flush(); });
+    }
 
     auto start = chrono::steady_clock::now();
+    void (*previous_int)(int) = SIG_DFL;
+    void (*previous_term)(int) = SIG_DFL;
 
     try {
-        if (!config_.input_file_list.empty() && !config_.output_file_list.empty()) {
+        if (!config_.manifest_path.empty() && config_.probe_output.empty() && config_.stream_input.empty()) {
+            manifest_ = make_unique<manifest>(config_.manifest_path);
+            log("Loaded manifest with " + to_string(manifest_->size()) + " entries: " + config_.manifest_path);
+        }
+        if (!config_.journal_path.empty() && config_.probe_output.empty() && config_.stream_input.empty() &&
+            config_.write_jobs.empty()) {
+            journal_ = make_unique<journal>(config_.journal_path, config_.resume);
+            if (config_.resume) {
+                log("Resuming from journal " + config_.journal_path + ": " + to_string(journal_->completed_count()) +
+                    " jobs converted, " + to_string(journal_->failed_count()) + " failed and retried");
+            }
+            // Let the running conversions finish and their outcomes reach the journal
+            stop_requested = 0;
+            previous_int = signal(SIGINT, request_stop);
+            previous_term = signal(SIGTERM, request_stop);
+        }
+
+        if (!config_.stream_input.empty()) {
+            log("Running in stream mode");
+            run_stream_mode();
+        } else if (!config_.write_jobs.empty()) {
+            write_job_file();
+        } else if (config_.job_file == "-") {
+            log("Running in job stream mode");
+            run_job_stream_mode();
+        } else if (!config_.job_file.empty()) {
+            log("Running in job file mode");
+            run_job_file_mode();
+        } else if (!config_.watch_dirs.empty()) {
+            log("Running in watch mode");
+            run_watch_mode();
+        } else if (!config_.probe_output.empty()) {
+            log("Running in probe mode");
+            run_probe_mode();
+        } else if (!config_.input_file_list.empty() && !config_.output_file_list.empty()) {
             log("Running in batch mode with file lists");
             run_batch_mode();
         } else {
@@ -89,20 +346,75 @@ int ncm_app::run() {
             run_fallback_mode();
         }
 
+        if (commits_) {
+            commits_->flush();
+        }
+        if (journal_) {
+            journal_->flush();
+            signal(SIGINT, previous_int);
+            signal(SIGTERM, previous_term);
+        }
+
         auto end = chrono::steady_clock::now();
         double elapsed_seconds = chrono::duration_cast<chrono::milliseconds>(end - start).count() / 1000.0;
         
+        if (manifest_) {
+            manifest_->save();
+        }
+
         log("Processing complete!");
         log("Total files processed: " + to_string(total_pieces_));
+        if (skipped_ > 0) {
+            log("Files skipped as up to date: " + to_string(skipped_));
+        }
+        if (linked_ > 0) {
+            log("Duplicates linked instead of decrypted: " + to_string(linked_));
+        }
+        if (resumed_ > 0) {
+            log("Files skipped as converted in the journal: " + to_string(resumed_));
+        }
+        if (failed_ > 0) {
+            log("Files failed: " + to_string(failed_) +
+                    (config_.failures_output.empty() ? string() : " (listed in " + config_.failures_output + ")"),
+                level::warn);
+        }
+        if (journal_ && stop_requested && unstarted_ > 0) {
+            log("Interrupted before " + to_string(unstarted_) + " jobs started; run again with --resume to continue",
+                level::warn);
+        }
+        if (limiter_) {
+            limiter_->report();
+        }
+        if (covers_) {
+            covers_->report();
+        }
         
         if (config_.show_time) {
             log("Total time elapsed: " + to_string(elapsed_seconds) + "s");
         }
         
+        write_failures();
+        write_metrics();
+        ncm::log::flush();
         return 0;
         
     } catch (const exception& e) {
-        log("Fatal error: " + string(e.what()), "ERROR");
+        log("Fatal error: " + string(e.what()), level::error);
+        try {
+            // Keep what was converted before the failure
+            if (commits_) commits_->flush();
+            if (manifest_) manifest_->save();
+            if (journal_) journal_->flush();
+        } catch (const exception& save_error) {
+            log(save_error.what(), level::error);
+        }
+        if (journal_) {
+            signal(SIGINT, previous_int);
+            signal(SIGTERM, previous_term);
+        }
+        write_failures();
+        write_metrics();
+        ncm::log::flush();
         return 1;
     }
 }
@@ -112,63 +424,337 @@ int ncm_app::run() {
  * @param input_path Path to the input .ncm file
  * @param output_path Path where the decrypted file should be written
  * @details Handles the processing of individual NCM files with error handling
- * and progress reporting.
+ * and progress reporting. With --fsync the outputs are handed to the commit
+ * batch, and the manifest records the file once its audio is durable.
+ * job_flags from a job file add to the options given on the command line.
  */
-void ncm_app::process_file(const filesystem::path& input_path, const filesystem::path& output_path) {
+void ncm_app::process_file(const filesystem::path& input_path, const filesystem::path& output_path,
+                           uint32_t job_flags) {
+    vector<pair<string, string>> deferred;  // temporary file, target
+    if (journal_ && config_.resume && journal_->completed(input_path, output_path)) {
+        resumed_++;
+        return;
+    }
     try {
         filesystem::path output_dir = output_path.parent_path();
         if (!output_dir.empty() && !filesystem::exists(output_dir)) {
             filesystem::create_directories(output_dir);
         }
 
+        ncm::dump_options options;
+        options.direct_io = config_.direct_io || (job_flags & job_flag::direct_io);
+        options.embed_cover = config_.embed_cover || (job_flags & job_flag::embed_cover);
+        options.write_tags = config_.write_tags || (job_flags & job_flag::write_tags);
+        // A watched file may be rewritten by its downloader mid-conversion;
+        // read, it fails as truncated where a mapping would raise SIGBUS.
+        // With --threads auto reads must happen outside the decrypt slots,
+        // not as page faults inside them
+        options.map_input = config_.watch_dirs.empty() && !decrypt_slots_;
+        if (decrypt_slots_) {
+            counting_semaphore<>* slots = decrypt_slots_.get();
+            options.decrypt_gate = [slots](const function<void()>& task) {
+                slots->acquire();
+                task();
+                slots->release();
+            };
+        }
+        if (covers_) {
+            cover_transcoder* covers = covers_.get();
+            options.transform_cover = [covers](const unsigned char* data, size_t len) {
+                return covers->transcode(data, len);
+            };
+        }
+        uint64_t output_key = manifest::output_options(options, config_.cover_size, config_.cover_quality);
+
+        manifest::fingerprint fp;
+        bool tracked = manifest_ && manifest::take_fingerprint(input_path, fp);
+        if (tracked && manifest_->up_to_date(input_path, output_path, fp, output_key)) {
+            log("Skipped (up to date): " + input_path.filename().string(), level::debug);
+            skipped_++;
+            if (journal_) journal_->record(input_path, output_path);
+            return;
+        }
+
+        io_limiter::ticket slots;
+        if (limiter_) {
+            slots = limiter_->acquire(input_path, output_path);
+        }
+
         log("Processing: " + input_path.filename().string());
         
         auto start_time = chrono::steady_clock::now();
-        ncm::ncmDump(input_path.string(), output_path.string());
+        if (pool_ && config_.split_mb > 0) {
+            thread_pool* pool = pool_;
+            options.executor = [pool](function<void()> task) { pool->enqueue(std::move(task)); };
+            options.parallel_threshold = (uint64_t)config_.split_mb * 1024 * 1024;
+        }
+        if (commits_) {
+            options.commit = [&deferred](const string& temp, const string& target) {
+                deferred.emplace_back(temp, target);
+            };
+        }
+        // The job only counts as done once its audio is in place
+        bool record_now = true;
+        auto queue_commits = [&](const ncm::dump_result& result) {
+            for (auto& [temp, target] : deferred) {
+                ncm::CommitBatch::callback on_done;
+                if ((tracked || journal_) && target == result.audio_path) {
+                    record_now = false;
+                    on_done = [this, input_path, output_path, fp, output_key, tracked,
+                               format = result.format](const string& error) {
+                        if (error.empty()) {
+                            if (tracked) manifest_->record(input_path, output_path, fp, output_key, format);
+                            if (journal_) journal_->record(input_path, output_path);
+                        } else {
+                            if (tracked) manifest_->forget(input_path);
+                            total_pieces_--;
+                            record_failure(input_path, output_path, ncm::error_kind::output, error, false);
+                        }
+                    };
+                }
+                commits_->add(temp, target, std::move(on_done));
+            }
+            deferred.clear();
+        };
+
+        // With --dedupe the commits are queued before duplicates may link to the outputs
+        bool linked = false;
+        ncm::dump_result result;
+        if (dedupe_) {
+            result = dedupe_->convert(input_path, output_path, options, linked, queue_commits);
+        } else {
+            result = ncm::ncmDump(input_path.string(), output_path.string(), options);
+            queue_commits(result);
+        }
+        slots.add_bytes(file_size_or_zero(input_path));
+        if (record_now) {
+            if (tracked) manifest_->record(input_path, output_path, fp, output_key, result.format);
+            if (journal_) journal_->record(input_path, output_path);
+        }
         
         auto end_time = chrono::steady_clock::now();
         auto duration = chrono::duration_cast<chrono::milliseconds>(end_time - start_time).count();
         
-        log("Completed: " + input_path.filename().string() + " (" + to_string(duration) + "ms)");
+        if (linked) {
+            log("Linked duplicate: " + input_path.filename().string() + " (" + to_string(duration) + "ms)");
+            linked_++;
+        } else {
+            log("Completed: " + input_path.filename().string() + " (" + to_string(duration) + "ms)");
+        }
         total_pieces_++;
         
     } catch (const exception& e) {
-        log("Error processing " + input_path.string() + ": " + e.what(), "ERROR");
+        record_failure(input_path, output_path, ncm::classify(e), e.what());
+        if (manifest_) {
+            manifest_->forget(input_path);
+        }
+        for (const auto& d : deferred) {
+            error_code ec;
+            filesystem::remove(d.first, ec);
+        }
     }
 }
 
 /**
- * @brief Run in batch mode using input/output file lists
- * @details Processes files using lists provided via -i and -o flags
+ * @brief NUMA node to run the conversion of input on
+ * @return The node of the input's storage when workers are pinned, otherwise -1
  */
-void ncm_app::run_batch_mode() {
-    vector<string> input_files = read_file_lines(config_.input_file_list);
-    vector<string> output_files = read_file_lines(config_.output_file_list);
+int ncm_app::node_of(const filesystem::path& input_path) const {
+    return placement_.empty() ? -1 : storage_node(input_path);
+}
+
+/**
+ * @brief Check an input against the manifest before handing it to an engine
+ * @return true if the input is unchanged and its output exists
+ */
+bool ncm_app::skip_unchanged(const filesystem::path& input_path, const filesystem::path& output_path) {
+    manifest::fingerprint fp;
+    if (!manifest_ || !manifest::take_fingerprint(input_path, fp) ||
+        !manifest_->up_to_date(input_path, output_path, fp, ENGINE_OUTPUT_OPTIONS)) {
+        return false;
+    }
+    log("Skipped (up to date): " + input_path.filename().string(), level::debug);
+    skipped_++;
+    return true;
+}
 
-    if (input_files.empty() || output_files.empty()) {
-        log("Input or output file list is empty.", "ERROR");
+/**
+ * @brief Report an engine completion and update the manifest
+ * @details The fingerprint is taken after the conversion here; an input
+ * replaced while it was converted is therefore only caught on the run after.
+ */
+void ncm_app::record_result(const filesystem::path& input_path, const filesystem::path& output_path,
+                            ncm::error_kind kind, const string& error, const string& format) {
+    if (!error.empty()) {
+        record_failure(input_path, output_path, kind, error);
+        if (manifest_) {
+            manifest_->forget(input_path);
+        }
         return;
     }
+    total_pieces_++;
+    manifest::fingerprint fp;
+    if (manifest_ && manifest::take_fingerprint(input_path, fp)) {
+        manifest_->record(input_path, output_path, fp, ENGINE_OUTPUT_OPTIONS, format);
+    }
+}
+
+/**
+ * @brief Count, log and journal a failed job and keep it for the failure report
+ * @param logged Whether the failure has been logged already
+ */
+void ncm_app::record_failure(const filesystem::path& input_path, const filesystem::path& output_path,
+                             ncm::error_kind kind, const string& message, bool logged) {
+    if (!logged) {
+        log("Error processing " + input_path.string() + ": " + message, level::error);
+    }
+    failed_++;
+    if (journal_) {
+        journal_->record(input_path, output_path, kind, message);
+    }
+    if (!config_.failures_output.empty()) {
+        lock_guard<mutex> lock(failures_mtx_);
+        failures_.push_back({input_path.string(), output_path.string(), kind, message});
+    }
+}
 
-    if (input_files.size() != output_files.size()) {
-        log("Input file count: " + to_string(input_files.size()) + ", Output file count: " + to_string(output_files.size()), "ERROR");
-        log("Error: Input and output file lists must have the same number of lines.", "ERROR");
+/**
+ * @brief Convert jobs on a work-stealing pool, largest input first
+ * @param jobs Jobs with their input sizes; reordered in place
+ * @details Starting the biggest files first keeps one large track queued
+ * last from stretching the tail of the batch. Returns once all jobs are done.
+ */
+void ncm_app::enqueue_largest_first(vector<sized_job>& jobs) {
+    stable_sort(jobs.begin(), jobs.end(), [](const sized_job& a, const sized_job& b) { return a.size > b.size; });
+
+    {
+        thread_pool pool(config_.thread_count, placement_);
+        pool_ = &pool;
+        for (auto& job : jobs) {
+            int node = node_of(job.input);
+            pool.enqueue([this, input = std::move(job.input), output = std::move(job.output)] {
+                if (stop_requested) {
+                    unstarted_++;
+                    return;
+                }
+                process_file(input, output);
+            }, job.size, node);
+        }
+        log("All tasks queued for " + to_string(jobs.size()) + " files, waiting for completion...");
+    }
+    pool_ = nullptr;
+}
+
+/**
+ * @brief Run in batch mode using input/output file lists
+ * @details Processes files using lists provided via -i and -o flags. The
+ * lists are read in lockstep while files are converted, with at most
+ * JOBS_QUEUED_PER_THREAD jobs per thread queued ahead, so memory does not
+ * grow with the length of the lists. Queued jobs start largest first. The
+ * io_uring engine takes the whole batch, read from both lists in one pass.
+ * @throws std::runtime_error if a list cannot be opened or the lists differ
+ * in length; on the worker threads files listed before the mismatch are
+ * still converted, io_uring converts none
+ */
+void ncm_app::run_batch_mode() {
+    if (config_.pipeline) {
+        run_pipeline();
         return;
     }
 
-    log("Processing " + to_string(input_files.size()) + " files in batch mode");
-    
-    thread_pool pool(config_.thread_count);
-    for (size_t i = 0; i < input_files.size(); ++i) {
-        pool.enqueue(std::bind(&ncm_app::process_file, this, input_files[i], output_files[i]));
+    ifstream inputs(config_.input_file_list);
+    if (!inputs.is_open()) {
+        throw runtime_error("Unable to open file: " + config_.input_file_list);
+    }
+    ifstream outputs(config_.output_file_list);
+    if (!outputs.is_open()) {
+        throw runtime_error("Unable to open file: " + config_.output_file_list);
+    }
+
+    if (config_.io_uring) {
+        // The engine takes the whole batch at once
+        vector<uring_job> jobs;
+        string input, output;
+        while (true) {
+            bool has_input = next_list_line(inputs, input);
+            bool has_output = next_list_line(outputs, output);
+            if (has_input != has_output) {
+                throw runtime_error("Input and output file lists must have the same number of lines.");
+            }
+            if (!has_input) {
+                break;
+            }
+            jobs.push_back({input, output});
+        }
+        if (!jobs.empty() && run_uring_engine(jobs)) {
+            return;
+        }
+        // Without io_uring the worker threads read the lists again from the start
+        inputs.clear();
+        inputs.seekg(0);
+        outputs.clear();
+        outputs.seekg(0);
+    }
+
+    submit_window window((size_t)config_.thread_count * JOBS_QUEUED_PER_THREAD);
+    size_t count = 0;
+    bool mismatch = false;
+    {
+        thread_pool pool(config_.thread_count, placement_);
+        pool_ = &pool;
+        string input, output;
+        while (true) {
+            bool has_input = next_list_line(inputs, input);
+            bool has_output = next_list_line(outputs, output);
+            if (has_input != has_output) {
+                mismatch = true;
+                break;
+            }
+            if (!has_input) {
+                break;
+            }
+            count++;
+            // Converted jobs are dropped before their inputs are even sized
+            if (journal_ && config_.resume && journal_->completed(input, output)) {
+                resumed_++;
+                continue;
+            }
+            if (stop_requested) {
+                unstarted_++;
+                continue;
+            }
+            window.acquire();
+            filesystem::path in_path(input);
+            uint64_t size = file_size_or_zero(in_path);
+            int node = node_of(in_path);
+            pool.enqueue([this, &window, in_path, out_path = filesystem::path(output)] {
+                if (stop_requested) {
+                    unstarted_++;
+                } else {
+                    process_file(in_path, out_path);
+                }
+                window.release();
+            }, size, node);
+        }
+        if (count > 0) {
+            log("Read " + to_string(count) + " jobs from the lists, waiting for completion...");
+        }
+    }
+    pool_ = nullptr;
+
+    if (mismatch) {
+        throw runtime_error("Input and output file lists must have the same number of lines.");
+    }
+    if (count == 0) {
+        log("Input or output file list is empty.", level::error);
     }
-    
-    log("All tasks queued, waiting for completion...");
 }
 
 /**
  * @brief Run in fallback mode using directory scanning
- * @details Scans directory for .ncm files and processes them automatically
+ * @details Scans directory for .ncm files and processes them automatically.
+ * Files are queued for conversion as the crawler finds them, so work starts
+ * before the scan completes; queued files still start largest first.
  */
 void ncm_app::run_fallback_mode() {
     if (!filesystem::exists(config_.output_dir)) {
@@ -176,24 +762,594 @@ void ncm_app::run_fallback_mode() {
         filesystem::create_directory(config_.output_dir);
     }
 
-    vector<filesystem::path> files_to_process = find_files(".", ".ncm");
-    if (files_to_process.empty()) {
-        log("No .ncm files found to process.", "WARN");
+    if (config_.io_uring) {
+        vector<filesystem::path> files_to_process = find_files(".", ".ncm");
+        if (files_to_process.empty()) {
+            log("No .ncm files found to process.", level::warn);
+            return;
+        }
+        log("Found " + to_string(files_to_process.size()) + " .ncm files to process");
+
+        vector<uring_job> jobs;
+        jobs.reserve(files_to_process.size());
+        for (const auto& file_path : files_to_process) {
+            jobs.push_back({file_path, config_.output_dir / file_path.stem()});
+        }
+        if (run_uring_engine(jobs)) {
+            return;
+        }
+
+        vector<sized_job> sized;
+        sized.reserve(files_to_process.size());
+        for (const auto& file_path : files_to_process) {
+            sized.push_back({file_size_or_zero(file_path), file_path, config_.output_dir / file_path.stem()});
+        }
+        enqueue_largest_first(sized);
+        return;
+    }
+
+    atomic<size_t> found = 0;
+    {
+        thread_pool pool(config_.thread_count, placement_);
+        pool_ = &pool;
+        dir_crawler(CRAWL_THREADS).crawl(".", ".ncm", [this, &pool, &found](const dir_crawler::entry& e) {
+            found++;
+            pool.enqueue([this, input = e.path, output = config_.output_dir / e.path.stem()] {
+                if (stop_requested) {
+                    unstarted_++;
+                    return;
+                }
+                process_file(input, output);
+            }, e.size, node_of(e.path));
+        });
+
+        if (found == 0) {
+            log("No .ncm files found to process.", level::warn);
+        } else {
+            log("Found " + to_string(found) + " .ncm files, waiting for completion...");
+        }
+    }
+    pool_ = nullptr;
+}
+
+/**
+ * @brief Read metadata of every input without decrypting audio
+ * @details Inputs come from the -i list or, without one, from scanning the
+ * current directory. Files are probed on the thread pool and each result is
+ * written as one JSON line in completion order; failures are written as
+ * objects with an "error" member.
+ */
+void ncm_app::run_probe_mode() {
+    vector<filesystem::path> files;
+    if (!config_.input_file_list.empty()) {
+        for (const string& line : read_file_lines(config_.input_file_list)) {
+            files.emplace_back(line);
+        }
+    } else {
+        files = find_files(".", ".ncm");
+    }
+    if (files.empty()) {
+        log("No .ncm files found to probe.", level::warn);
         return;
     }
 
-    log("Found " + to_string(files_to_process.size()) + " .ncm files to process");
-    
-    thread_pool pool(config_.thread_count);
-    for (const auto& file_path : files_to_process) {
-        filesystem::path output_path = config_.output_dir / file_path.stem();
-        pool.enqueue(std::bind(&ncm_app::process_file, this, file_path, output_path));
+    ofstream file_out;
+    ostream* out = &cout;
+    if (config_.probe_output != "-") {
+        file_out.open(config_.probe_output, ios::binary | ios::trunc);
+        if (!file_out.is_open()) {
+            throw runtime_error("Unable to open probe output: " + config_.probe_output);
+        }
+        out = &file_out;
+    }
+
+    log("Probing " + to_string(files.size()) + " files");
+
+    mutex out_mtx;
+    {
+        thread_pool pool(config_.thread_count, placement_);
+        for (const auto& path : files) {
+            pool.enqueue([this, &path, &out_mtx, out] {
+                string line;
+                try {
+                    line = track_info_json(path, ncm::probe(path));
+                    total_pieces_++;
+                } catch (const exception& e) {
+                    line = "{\"path\":";
+                    append_json_string(line, path.string());
+                    line += ",\"error\":";
+                    append_json_string(line, e.what());
+                    line += '}';
+                    log("Error probing " + path.string() + ": " + e.what(), level::error);
+                }
+                line += '\n';
+                lock_guard<mutex> lock(out_mtx);
+                out->write(line.data(), line.size());
+            });
+        }
     }
-    
-    log("All tasks queued for " + to_string(files_to_process.size()) + " files");
+    out->flush();
 }
 
+/**
+ * @brief Decrypt one input to stdout for piping into a transcoder or upload
+ * @details The format is written to stderr as a "format: <ext>" line before
+ * the first audio byte. Audio is decoded and written in fixed-size chunks;
+ * each blocking write holds the decoder back, so memory stays constant
+ * however slowly the reader drains the pipe. Covers are only output when
+ * embedded.
+ * @throws std::runtime_error if decoding or writing fails
+ */
+void ncm_app::run_stream_mode() {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    ncm::dump_options options;
+    options.embed_cover = config_.embed_cover;
+    options.write_tags = config_.write_tags;
+    if (covers_) {
+        cover_transcoder* covers = covers_.get();
+        options.transform_cover = [covers](const unsigned char* data, size_t len) {
+            return covers->transcode(data, len);
+        };
+    }
+
+    ncm::dump_sink sink;
+    sink.on_format = [](const string& format) {
+        string line = "format: " + format + "\n";
+        fputs(line.c_str(), stderr);
+        fflush(stderr);
+    };
+    sink.on_audio = [](const unsigned char* data, size_t len) {
+        if (fwrite(data, 1, len, stdout) != len) {
+            throw runtime_error("Failed to write audio to stdout");
+        }
+    };
+
+    if (config_.stream_input == "-") {
+        ncm::ncmDecode(cin, sink, options);
+    } else {
+        ncm::ncmDecode(config_.stream_input, sink, options);
+    }
+    if (fflush(stdout) != 0) {
+        throw runtime_error("Failed to write audio to stdout");
+    }
+    total_pieces_++;
+}
+
+/**
+ * @brief Convert new and changed files below the watched directories until stopped
+ * @details Existing files are converted first, skipping unchanged ones when
+ * a manifest is given. Afterwards change notifications are debounced: a file
+ * is queued once it has not changed for debounce_ms, and a file still being
+ * converted waits for that conversion to finish. The pool and its decoder
+ * contexts stay warm for the whole run. SIGINT or SIGTERM drain the queued
+ * conversions and return; a changed manifest is saved every few seconds.
+ */
+void ncm_app::run_watch_mode() {
+    if (!filesystem::exists(config_.output_dir)) {
+        log("Creating output directory: " + config_.output_dir.string());
+        filesystem::create_directories(config_.output_dir);
+    }
+
+    stop_requested = 0;
+    auto previous_int = signal(SIGINT, request_stop);
+    auto previous_term = signal(SIGTERM, request_stop);
+
+    using clock = chrono::steady_clock;
+    mutex active_mtx;
+    unordered_set<string> active;                   // inputs queued or converting
+    unordered_map<string, clock::time_point> pending;
+    auto debounce = chrono::milliseconds(config_.debounce_ms);
+    auto last_save = clock::now();
+
+    {
+        thread_pool pool(config_.thread_count, placement_);
+        pool_ = &pool;
+
+        auto convert = [&](const filesystem::path& input, uint64_t size) {
+            {
+                lock_guard<mutex> lock(active_mtx);
+                if (!active.insert(input.string()).second) {
+                    return false;
+                }
+            }
+            pool.enqueue([this, &active_mtx, &active, input, output = config_.output_dir / input.stem()] {
+                process_file(input, output);
+                lock_guard<mutex> lock(active_mtx);
+                active.erase(input.string());
+            }, size, node_of(input));
+            return true;
+        };
+        auto scan_all = [&] {
+            for (const auto& dir : config_.watch_dirs) {
+                dir_crawler(CRAWL_THREADS).crawl(dir, ".ncm", [&](const dir_crawler::entry& e) {
+                    // Reported concurrently; the pool and the active set are thread-safe
+                    convert(e.path, e.size);
+                });
+            }
+        };
+
+        // Watch first, so nothing written during the initial scan is missed
+        dir_watcher watcher(config_.watch_dirs, ".ncm");
+        log("Watching " + to_string(config_.watch_dirs.size()) + " directories with " + dir_watcher::backend_name());
+        scan_all();
+
+        vector<filesystem::path> changed;
+        while (!stop_requested) {
+            // Sleep until the oldest pending file settles, or a while if none is pending
+            auto now = clock::now();
+            auto timeout = WATCH_IDLE_WAIT;
+            for (const auto& p : pending) {
+                auto left = chrono::duration_cast<chrono::milliseconds>(p.second + debounce - now);
+                timeout = max(chrono::milliseconds(1), min(timeout, left));
+            }
+
+            changed.clear();
+            bool complete = watcher.wait(timeout, changed);
+            now = clock::now();
+            for (const auto& path : changed) {
+                pending[path.string()] = now;
+            }
+            if (!complete) {
+                log("Change notifications may have been lost; rescanning", level::debug);
+                scan_all();
+            }
+
+            for (auto it = pending.begin(); it != pending.end();) {
+                if (now - it->second < debounce) {
+                    ++it;
+                    continue;
+                }
+                filesystem::path input = it->first;
+                if (convert(input, file_size_or_zero(input))) {
+                    it = pending.erase(it);
+                } else {
+                    it->second = now;   // Still converting an older version; retry once that is done
+                    ++it;
+                }
+            }
+
+            if (commits_) {
+                // Commit as soon as the queue runs dry instead of waiting for a full batch
+                bool idle;
+                {
+                    lock_guard<mutex> lock(active_mtx);
+                    idle = active.empty();
+                }
+                if (idle) commits_->flush();
+            }
+            if (manifest_ && now - last_save >= MANIFEST_SAVE_INTERVAL) {
+                manifest_->save();
+                last_save = now;
+            }
+        }
+        log("Stopping watch mode, finishing queued files...");
+    }
+    pool_ = nullptr;
+
+    signal(SIGINT, previous_int);
+    signal(SIGTERM, previous_term);
+}
+
+/**
+ * @brief Convert the jobs of a binary job file
+ * @details The file is mapped and indexed once; jobs are handed to the pool
+ * in chunks of JOB_CHUNK, weighted by their expected sizes, and their paths
+ * are read from the mapping when a worker gets to them. SIGINT or SIGTERM
+ * let the running conversions finish and log the index to pass to
+ * --jobs-from; every job before it has been converted or has failed.
+ * @throws std::runtime_error if the job file cannot be read
+ */
+void ncm_app::run_job_file_mode() {
+    job_file jobs(config_.job_file);
+    size_t first = (size_t)min<uint64_t>(config_.jobs_from, jobs.size());
+    log("Indexed " + to_string(jobs.size()) + " jobs from " + config_.job_file +
+        (first > 0 ? ", starting at job " + to_string(first) : string()));
+    if (first == jobs.size()) {
+        log("No jobs to run.", level::warn);
+        return;
+    }
+
+    stop_requested = 0;
+    auto previous_int = signal(SIGINT, request_stop);
+    auto previous_term = signal(SIGTERM, request_stop);
+    atomic<size_t> resume_at{jobs.size()};
+    {
+        thread_pool pool(config_.thread_count, placement_);
+        pool_ = &pool;
+        size_t chunks = 0;
+        for (size_t begin = first; begin < jobs.size(); begin += JOB_CHUNK, ++chunks) {
+            size_t end = min(begin + JOB_CHUNK, jobs.size());
+            uint64_t weight = 0;
+            for (size_t i = begin; i < end; ++i) {
+                weight += jobs[i].expected_size;
+            }
+            int node = node_of(filesystem::path(jobs[begin].input));
+            pool.enqueue([this, &jobs, &resume_at, begin, end] {
+                for (size_t i = begin; i < end; ++i) {
+                    if (stop_requested) {
+                        size_t current = resume_at.load();
+                        while (i < current && !resume_at.compare_exchange_weak(current, i)) {
+                        }
+                        return;
+                    }
+                    job_entry job = jobs[i];
+                    process_file(filesystem::path(job.input), filesystem::path(job.output), job.flags);
+                }
+            }, weight, node);
+        }
+        log("All " + to_string(jobs.size() - first) + " jobs queued in " + to_string(chunks) +
+            " chunks, waiting for completion...");
+    }
+    pool_ = nullptr;
+
+    signal(SIGINT, previous_int);
+    signal(SIGTERM, previous_term);
+    if (stop_requested && resume_at < jobs.size()) {
+        log("Interrupted; resume with --jobs " + config_.job_file + " --jobs-from " + to_string(resume_at.load()),
+            level::warn);
+    }
+}
+
+/**
+ * @brief Convert NUL-separated "input\0output\0" pairs read from stdin
+ * @details Jobs are converted while the stream is read, with at most
+ * JOBS_QUEUED_PER_THREAD jobs per thread queued ahead, so memory stays
+ * bounded however long the stream is. --jobs-from counts jobs of the
+ * stream like those of a job file.
+ */
+void ncm_app::run_job_stream_mode() {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    stop_requested = 0;
+    auto previous_int = signal(SIGINT, request_stop);
+    auto previous_term = signal(SIGTERM, request_stop);
+
+    submit_window window((size_t)config_.thread_count * JOBS_QUEUED_PER_THREAD);
+    size_t index = 0;
+    atomic<size_t> resume_at{SIZE_MAX};
+    {
+        thread_pool pool(config_.thread_count, placement_);
+        pool_ = &pool;
+        string input, output;
+        while (!stop_requested && next_nul_job(cin, input, output)) {
+            size_t i = index++;
+            if (i < config_.jobs_from) {
+                continue;
+            }
+            window.acquire();
+            filesystem::path in_path(input);
+            uint64_t size = file_size_or_zero(in_path);
+            int node = node_of(in_path);
+            pool.enqueue([this, &window, &resume_at, i, in_path, out_path = filesystem::path(output)] {
+                if (stop_requested) {
+                    size_t current = resume_at.load();
+                    while (i < current && !resume_at.compare_exchange_weak(current, i)) {
+                    }
+                } else {
+                    process_file(in_path, out_path);
+                }
+                window.release();
+            }, size, node);
+        }
+        log("Read " + to_string(index) + " jobs from stdin, waiting for completion...");
+    }
+    pool_ = nullptr;
+
+    signal(SIGINT, previous_int);
+    signal(SIGTERM, previous_term);
+    if (stop_requested) {
+        log("Interrupted; resume with --jobs - --jobs-from " + to_string(min(resume_at.load(), index)), level::warn);
+    }
+}
+
+/**
+ * @brief Write the -i/-o lists, or the .ncm files below the current directory, as a job file
+ * @details Inputs are sized now, so the run that reads the file schedules
+ * without touching them first. --embed-cover, --tags and --direct-io are
+ * stored as flags of every job.
+ * @throws std::runtime_error if a list cannot be read, the lists differ in
+ * length or the job file cannot be written
+ */
+void ncm_app::write_job_file() {
+    uint32_t flags = (config_.embed_cover ? job_flag::embed_cover : 0) |
+                     (config_.write_tags ? job_flag::write_tags : 0) |
+                     (config_.direct_io ? job_flag::direct_io : 0);
+    job_file_writer writer(config_.write_jobs);
+    if (!config_.input_file_list.empty()) {
+        ifstream inputs(config_.input_file_list);
+        if (!inputs.is_open()) {
+            throw runtime_error("Unable to open file: " + config_.input_file_list);
+        }
+        ifstream outputs(config_.output_file_list);
+        if (!outputs.is_open()) {
+            throw runtime_error("Unable to open file: " + config_.output_file_list);
+        }
+        string input, output;
+        while (true) {
+            bool has_input = next_list_line(inputs, input);
+            bool has_output = next_list_line(outputs, output);
+            if (has_input != has_output) {
+                throw runtime_error("Input and output file lists must have the same number of lines.");
+            }
+            if (!has_input) {
+                break;
+            }
+            writer.add(input, output, file_size_or_zero(input), flags);
+        }
+    } else {
+        mutex writer_mtx;
+        dir_crawler(CRAWL_THREADS).crawl(".", ".ncm", [&](const dir_crawler::entry& e) {
+            string output = (config_.output_dir / e.path.stem()).string();
+            lock_guard<mutex> lock(writer_mtx);
+            writer.add(e.path.string(), output, e.size, flags);
+        });
+    }
+    writer.close();
+    log("Wrote " + to_string(writer.count()) + " jobs to " + config_.write_jobs);
+}
+
+/**
+ * @brief Run batch mode through the staged pipeline
+ * @details The lists are read in lockstep while files are converted, so
+ * neither the lists nor the per-file state are held in memory as a whole.
+ * Audio buffers are budgeted like the io_uring engine: four chunks per file
+ * in flight.
+ * @throws std::runtime_error if a list cannot be opened or the lists differ
+ * in length; files listed before the mismatch are still converted
+ */
+void ncm_app::run_pipeline() {
+    ifstream inputs(config_.input_file_list);
+    if (!inputs.is_open()) {
+        throw runtime_error("Unable to open file: " + config_.input_file_list);
+    }
+    ifstream outputs(config_.output_file_list);
+    if (!outputs.is_open()) {
+        throw runtime_error("Unable to open file: " + config_.output_file_list);
+    }
+
+    batch_pipeline::options opts;
+    opts.decrypt_threads = config_.thread_count;
+    opts.buffers = config_.inflight * 4;
+
+    log("Using pipeline with " + to_string(opts.buffers) + " buffers of " + to_string(opts.chunk_size / 1024) + " KiB");
+
+    batch_pipeline pipeline(opts);
+    pipeline.run(
+        [this, &inputs, &outputs](batch_pipeline::job& j) {
+            string input, output;
+            while (true) {
+                bool has_input = next_list_line(inputs, input);
+                bool has_output = next_list_line(outputs, output);
+                if (has_input != has_output) {
+                    throw runtime_error("Input and output file lists must have the same number of lines.");
+                }
+                if (!has_input) {
+                    return false;
+                }
+                if (!skip_unchanged(input, output)) {
+                    break;
+                }
+            }
+            j.input = input;
+            j.output = output;
+            return true;
+        },
+        [this](const batch_pipeline::job& j, ncm::error_kind kind, const string& error, const string& format,
+               long long elapsed_ms) {
+            if (error.empty()) {
+                log("Completed: " + j.input.filename().string() + " (" + to_string(elapsed_ms) + "ms)");
+            }
+            record_result(j.input, j.output, kind, error, format);
+        });
+}
+
+/**
+ * @brief Process jobs with the io_uring engine
+ * @param jobs Input/output pairs
+ * @return false if io_uring is unavailable and the caller should fall back
+ * to the thread pool
+ */
+bool ncm_app::run_uring_engine(const vector<uring_job>& jobs) {
+    if (!uring_engine::available()) {
+        log("io_uring is not available, falling back to worker threads", level::warn);
+        return false;
+    }
+
+    uring_engine::options opts;
+    opts.cpu_threads = config_.thread_count;
+    opts.files_in_flight = config_.inflight;
+
+    log("Using io_uring engine with " + to_string(opts.files_in_flight) + " files in flight");
+
+    vector<uring_job> pending;
+    pending.reserve(jobs.size());
+    for (const auto& job : jobs) {
+        if (!skip_unchanged(job.input, job.output)) {
+            pending.push_back(job);
+        }
+    }
+
+    uring_engine engine(opts);
+    engine.run(pending, [this](const uring_job& job, ncm::error_kind kind, const string& error, const string& format,
+                               long long elapsed_ms) {
+        if (error.empty()) {
+            log("Completed: " + job.input.filename().string() + " (" + to_string(elapsed_ms) + "ms)");
+        }
+        record_result(job.input, job.output, kind, error, format);
+    });
+    return true;
+}
+
+/**
+ * @brief Write the failures of this run as JSON lines, if requested
+ * @details One object per failed job with its input, output, numeric error
+ * code, error kind and message. The file is written even when nothing
+ * failed, so a stale report never survives a clean run.
+ */
+void ncm_app::write_failures() const {
+    if (config_.failures_output.empty()) {
+        return;
+    }
+    ofstream out(config_.failures_output, ios::binary | ios::trunc);
+    for (const auto& f : failures_) {
+        string line = "{\"input\":";
+        append_json_string(line, f.input);
+        line += ",\"output\":";
+        append_json_string(line, f.output);
+        line += ",\"code\":" + to_string((int)f.kind) + ",\"kind\":\"" + ncm::error_kind_name(f.kind) + "\"";
+        line += ",\"error\":";
+        append_json_string(line, f.message);
+        line += "}\n";
+        out.write(line.data(), (streamsize)line.size());
+    }
+    out.close();
+    if (!out) {
+        log("Failed to write failure report: " + config_.failures_output, level::error);
+    }
+}
+
+/**
+ * @brief Write the merged stage metrics and the trace, if requested
+ * @details Called once the workers have exited, so their thread-local
+ * counters have been merged. Failures are logged and do not change the exit code.
+ */
+void ncm_app::write_metrics() const {
+    if (!config_.metrics_output.empty()) {
+        ncm::metrics::snapshot snap = ncm::metrics::collect();
+        string text = config_.metrics_prometheus ? ncm::metrics::to_prometheus(snap) : ncm::metrics::to_json(snap) + "\n";
+        if (config_.metrics_output == "-") {
+            ncm::log::flush();
+            fputs(text.c_str(), stderr);
+            fflush(stderr);
+        } else {
+            ofstream out(config_.metrics_output, ios::binary | ios::trunc);
+            out << text;
+            if (!out.flush()) {
+                log("Unable to write metrics: " + config_.metrics_output, level::error);
+            }
+        }
+    }
+    if (!config_.trace_output.empty()) {
+        ofstream out(config_.trace_output, ios::binary | ios::trunc);
+        ncm::metrics::write_trace(out);
+        if (!out.flush()) {
+            log("Unable to write trace: " + config_.trace_output, level::error);
+        } else {
+            log("Trace written to " + config_.trace_output);
+        }
+    }
+}
+
+/**
+ * @brief Route ncmpp and ncmlib messages through the asynchronous logger
+ * @details Logs go to stdout unless probe results or streamed audio are written there.
+ */
 void ncm_app::setup_logging() const {
-    // In the future, we could set up a more sophisticated logging system here.
-    // For now, we just use stdout.
-}
\ No newline at end of file
+    FILE* out = config_.probe_output == "-" || !config_.stream_input.empty() ? stderr : stdout;
+    ncm::log::set_sink(ncm::log::make_stream_sink(out, true));
+    ncm::log::set_level(config_.log_level);
+}
@@ -1,19 +1,85 @@
 #pragma once
 #include "app_config.h"
+#include "cover_transcode.h"
+#include "dedupe.h"
+#include "io_limiter.h"
+#include "journal.h"
+#include "ncmlib/commit.h"
+#include "ncmlib/error.h"
+#include "manifest.h"
+#include "topology.h"
+#include "uring_engine.h"
 #include <atomic>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <semaphore>
+#include <string>
+#include <vector>
+
+class thread_pool;
 
 class ncm_app {
 public:
+    /** @brief Failed job kept for the --failures report */
+    struct failure {
+        std::string input;
+        std::string output;
+        ncm::error_kind kind;
+        std::string message;
+    };
+
+    /** @brief Input/output pair with the input size used for scheduling */
+    struct sized_job {
+        std::uint64_t size;
+        std::filesystem::path input;
+        std::filesystem::path output;
+    };
+
     explicit ncm_app(app_config config);
     int run();
 
 private:
     void run_batch_mode();
     void run_fallback_mode();
+    void run_probe_mode();
+    void run_stream_mode();
+    void run_watch_mode();
+    void run_job_file_mode();
+    void run_job_stream_mode();
+    void write_job_file();
+    void run_pipeline();
+    void enqueue_largest_first(std::vector<sized_job>& jobs);
     void setup_logging() const;
-    void process_file(const std::filesystem::path& input_path, const std::filesystem::path& output_path);
+    void write_metrics() const;
+    void write_failures() const;
+    void process_file(const std::filesystem::path& input_path, const std::filesystem::path& output_path,
+                      std::uint32_t job_flags = 0);
+    int node_of(const std::filesystem::path& input_path) const;
+    bool run_uring_engine(const std::vector<uring_job>& jobs);
+    bool skip_unchanged(const std::filesystem::path& input_path, const std::filesystem::path& output_path);
+    void record_result(const std::filesystem::path& input_path, const std::filesystem::path& output_path,
+                       ncm::error_kind kind, const std::string& error, const std::string& format);
+    void record_failure(const std::filesystem::path& input_path, const std::filesystem::path& output_path,
+                        ncm::error_kind kind, const std::string& message, bool logged = false);
 
     app_config config_;
     std::atomic<int> total_pieces_ = 0;
+    std::atomic<int> skipped_ = 0;
+    std::atomic<int> linked_ = 0;
+    std::atomic<int> failed_ = 0;
+    std::atomic<int> resumed_ = 0;
+    std::atomic<int> unstarted_ = 0;
+    std::unique_ptr<manifest> manifest_;
+    std::unique_ptr<dedupe_index> dedupe_;
+    std::unique_ptr<ncm::CommitBatch> commits_;
+    std::unique_ptr<io_limiter> limiter_;
+    std::unique_ptr<std::counting_semaphore<>> decrypt_slots_;
+    std::unique_ptr<cover_transcoder> covers_;
+    std::unique_ptr<journal> journal_;
+    std::mutex failures_mtx_;
+    std::vector<failure> failures_;
+    std::vector<worker_placement> placement_;
+    thread_pool* pool_ = nullptr;
 };
\ No newline at end of file
@@ -0,0 +1,147 @@
+/**
+ * @file bounded_queue.h
+ * @brief Fixed-capacity lock-free queue linking pipeline stages
+ * @details Multi-producer, multi-consumer ring with a per-slot sequence
+ * number (after D. Vyukov). try_push/try_pop never lock; the blocking
+ * push/pop park on C++20 atomic waits when the queue is full or empty, so
+ * idle stages do not spin.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+/**
+ * @brief Bounded MPMC queue
+ * @tparam T Movable element type
+ */
+template <typename T>
+class bounded_queue {
+public:
+    /**
+     * @param capacity Maximum number of queued elements, rounded up to a power of two
+     */
+    explicit bounded_queue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        mask_ = n - 1;
+        slots_ = std::make_unique<slot[]>(n);
+        for (size_t i = 0; i < n; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bounded_queue(const bounded_queue&) = delete;
+    bounded_queue& operator=(const bounded_queue&) = delete;
+
+    /**
+     * @brief Append without blocking
+     * @return false if the queue is full; value is left untouched
+     */
+    bool try_push(T& value) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            slot& s = slots_[pos & mask_];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    s.value = std::move(value);
+                    s.seq.store(pos + 1, std::memory_order_release);
+                    signal(pushes_);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Remove the oldest element without blocking
+     * @return false if the queue is empty
+     */
+    bool try_pop(T& out) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            slot& s = slots_[pos & mask_];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(s.value);
+                    s.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    signal(pops_);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Append, waiting while the queue is full
+     */
+    void push(T value) {
+        while (true) {
+            uint32_t seen = pops_.load(std::memory_order_acquire);
+            if (try_push(value)) return;
+            pops_.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+    /**
+     * @brief Remove the oldest element, waiting while the queue is empty
+     * @return std::nullopt once the queue is closed and drained
+     */
+    std::optional<T> pop() {
+        T value;
+        while (true) {
+            uint32_t seen = pushes_.load(std::memory_order_acquire);
+            if (try_pop(value)) return value;
+            if (closed_.load(std::memory_order_acquire)) {
+                // A push may have landed between the failed pop and the check
+                if (try_pop(value)) return value;
+                return std::nullopt;
+            }
+            pushes_.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+    /**
+     * @brief Mark the end of input; consumers return once the queue drains
+     * @note Must only be called after the last push has returned
+     */
+    void close() {
+        closed_.store(true, std::memory_order_release);
+        signal(pushes_);
+    }
+
+private:
+    struct slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    static void signal(std::atomic<uint32_t>& counter) {
+        counter.fetch_add(1, std::memory_order_release);
+        counter.notify_all();
+    }
+
+    std::unique_ptr<slot[]> slots_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) std::atomic<uint32_t> pushes_{0};
+    alignas(64) std::atomic<uint32_t> pops_{0};
+    std::atomic<bool> closed_{false};
+};
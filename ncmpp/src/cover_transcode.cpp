@@ -0,0 +1,429 @@
+/**
+ * @file cover_transcode.cpp
+ * @brief Cover downscaling implementation
+ * @details JPEG covers are decoded at the largest IDCT scale (1/2, 1/4 or
+ * 1/8) that stays at or above the bound, then area-averaged down to it; PNG
+ * covers, when libpng is available, are decoded in full and composited onto
+ * white. The result is always a baseline JPEG with optimized Huffman tables.
+ * libjpeg reports errors through longjmp, so its state lives on the heap and
+ * only C objects are touched between setjmp and the library calls.
+ */
+
+#include "cover_transcode.h"
+#include "ncmlib/log.h"
+#include "ncmlib/metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <string>
+
+#ifdef NCMPP_HAVE_JPEG
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <jpeglib.h>
+#endif
+#ifdef NCMPP_HAVE_PNG
+#include <png.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using ncm::log::level;
+
+    /** @brief Transcoded covers kept for reuse */
+    constexpr size_t CACHE_BYTES = 64 * 1024 * 1024;
+    constexpr size_t CACHE_ENTRIES = 16384;
+
+    /** @brief 64-bit FNV-1a, continued from h */
+    uint64_t fnv1a(const unsigned char* data, size_t len, uint64_t h = 0xcbf29ce484222325ull) {
+        for (size_t i = 0; i < len; ++i) {
+            h ^= data[i];
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+
+#ifdef NCMPP_HAVE_JPEG
+    /**
+     * @brief Decoded pixels, rows packed without padding
+     */
+    struct raster {
+        unsigned int width = 0;
+        unsigned int height = 0;
+        unsigned int components = 3;  // 1 for grayscale, 3 for RGB
+        vector<unsigned char> pixels;
+    };
+
+    enum class decoded_as {
+        ok,
+        fits,    // already within the bound, left undecoded
+        failed,
+    };
+
+    bool is_jpeg(const unsigned char* data, size_t len) {
+        return len >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+    }
+
+    bool is_png(const unsigned char* data, size_t len) {
+        static const unsigned char SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        return len >= 8 && memcmp(data, SIGNATURE, 8) == 0;
+    }
+
+    /**
+     * @brief Source pixels and weights making up one output pixel along one axis
+     */
+    struct span {
+        unsigned int first = 0;
+        vector<float> weights;
+    };
+
+    /**
+     * @brief Box-filter weights for shrinking src pixels to dst
+     * @details Each output pixel averages the source pixels it covers,
+     * partially covered edge pixels weighted by their overlap.
+     */
+    vector<span> area_weights(unsigned int src, unsigned int dst) {
+        vector<span> spans(dst);
+        double scale = (double)src / dst;
+        for (unsigned int i = 0; i < dst; ++i) {
+            double start = i * scale;
+            double end = min((double)src, (i + 1) * scale);
+            span& s = spans[i];
+            s.first = (unsigned int)start;
+            for (unsigned int p = s.first; p < end; ++p) {
+                double covered = min(end, p + 1.0) - max(start, (double)p);
+                s.weights.push_back((float)(covered / scale));
+            }
+        }
+        return spans;
+    }
+
+    /**
+     * @brief Shrink in to width x height by area averaging
+     * @details Rows are filtered first; the vertical pass then accumulates
+     * whole rows, which the compiler vectorizes.
+     */
+    raster shrink(const raster& in, unsigned int width, unsigned int height) {
+        const unsigned int c = in.components;
+        vector<span> columns = area_weights(in.width, width);
+        vector<span> rows = area_weights(in.height, height);
+
+        vector<float> narrow((size_t)width * c * in.height);
+        for (unsigned int y = 0; y < in.height; ++y) {
+            const unsigned char* src = in.pixels.data() + (size_t)y * in.width * c;
+            float* dst = narrow.data() + (size_t)y * width * c;
+            for (unsigned int x = 0; x < width; ++x) {
+                const span& s = columns[x];
+                for (unsigned int k = 0; k < c; ++k) {
+                    float sum = 0;
+                    for (size_t i = 0; i < s.weights.size(); ++i) {
+                        sum += s.weights[i] * src[(s.first + i) * c + k];
+                    }
+                    dst[x * c + k] = sum;
+                }
+            }
+        }
+
+        raster out;
+        out.width = width;
+        out.height = height;
+        out.components = c;
+        out.pixels.resize((size_t)width * height * c);
+        const size_t row_len = (size_t)width * c;
+        vector<float> acc(row_len);
+        for (unsigned int y = 0; y < height; ++y) {
+            const span& s = rows[y];
+            fill(acc.begin(), acc.end(), 0.0f);
+            for (size_t i = 0; i < s.weights.size(); ++i) {
+                const float* src = narrow.data() + (s.first + i) * row_len;
+                float w = s.weights[i];
+                for (size_t j = 0; j < row_len; ++j) {
+                    acc[j] += w * src[j];
+                }
+            }
+            unsigned char* dst = out.pixels.data() + y * row_len;
+            for (size_t j = 0; j < row_len; ++j) {
+                dst[j] = (unsigned char)min(255.0f, acc[j] + 0.5f);
+            }
+        }
+        return out;
+    }
+
+    struct jpeg_error : jpeg_error_mgr {
+        jmp_buf jump;
+    };
+
+    void on_jpeg_error(j_common_ptr cinfo) {
+        longjmp(static_cast<jpeg_error*>(cinfo->err)->jump, 1);
+    }
+
+    void on_jpeg_message(j_common_ptr cinfo) {
+        char text[JMSG_LENGTH_MAX];
+        cinfo->err->format_message(cinfo, text);
+        NCM_LOG(level::trace, string("libjpeg: ") + text);
+    }
+
+    struct decode_state {
+        jpeg_decompress_struct cinfo;
+        jpeg_error err;
+    };
+
+    /**
+     * @brief Decode a JPEG at the smallest IDCT scale still at least max_size on its longest side
+     * @return failed for corrupt or CMYK images
+     */
+    decoded_as decode_jpeg(const unsigned char* data, size_t len, unsigned int max_size, raster& out) {
+        auto state = make_unique<decode_state>();
+        jpeg_decompress_struct& cinfo = state->cinfo;
+        cinfo.err = jpeg_std_error(&state->err);
+        state->err.error_exit = on_jpeg_error;
+        state->err.output_message = on_jpeg_message;
+        if (setjmp(state->err.jump)) {
+            jpeg_destroy_decompress(&cinfo);
+            return decoded_as::failed;
+        }
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data), (unsigned long)len);
+        jpeg_read_header(&cinfo, TRUE);
+        unsigned int longest = max(cinfo.image_width, cinfo.image_height);
+        if (longest <= max_size) {
+            jpeg_destroy_decompress(&cinfo);
+            return decoded_as::fits;
+        }
+        if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+            jpeg_destroy_decompress(&cinfo);
+            return decoded_as::failed;
+        }
+
+        cinfo.out_color_space = cinfo.jpeg_color_space == JCS_GRAYSCALE ? JCS_GRAYSCALE : JCS_RGB;
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = 1;
+        for (unsigned int denom = 8; denom > 1; denom /= 2) {
+            if (longest / denom >= max_size) {
+                cinfo.scale_denom = denom;
+                break;
+            }
+        }
+
+        jpeg_start_decompress(&cinfo);
+        out.width = cinfo.output_width;
+        out.height = cinfo.output_height;
+        out.components = (unsigned int)cinfo.output_components;
+        out.pixels.resize((size_t)out.width * out.height * out.components);
+        while (cinfo.output_scanline < cinfo.output_height) {
+            JSAMPROW row = out.pixels.data() + (size_t)cinfo.output_scanline * out.width * out.components;
+            jpeg_read_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+        return decoded_as::ok;
+    }
+
+    struct encode_state {
+        jpeg_compress_struct cinfo;
+        jpeg_error err;
+        unsigned char* buffer = nullptr;
+        unsigned long size = 0;
+    };
+
+    /** @brief Encode in as a JPEG of the given quality */
+    bool encode_jpeg(const raster& in, int quality, vector<unsigned char>& out) {
+        auto state = make_unique<encode_state>();
+        jpeg_compress_struct& cinfo = state->cinfo;
+        cinfo.err = jpeg_std_error(&state->err);
+        state->err.error_exit = on_jpeg_error;
+        state->err.output_message = on_jpeg_message;
+        if (setjmp(state->err.jump)) {
+            jpeg_destroy_compress(&cinfo);
+            free(state->buffer);
+            return false;
+        }
+        jpeg_create_compress(&cinfo);
+        jpeg_mem_dest(&cinfo, &state->buffer, &state->size);
+        cinfo.image_width = in.width;
+        cinfo.image_height = in.height;
+        cinfo.input_components = (int)in.components;
+        cinfo.in_color_space = in.components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, quality, TRUE);
+        cinfo.optimize_coding = TRUE;
+
+        jpeg_start_compress(&cinfo, TRUE);
+        while (cinfo.next_scanline < cinfo.image_height) {
+            JSAMPROW row = const_cast<unsigned char*>(in.pixels.data()) +
+                           (size_t)cinfo.next_scanline * in.width * in.components;
+            jpeg_write_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_compress(&cinfo);
+        out.assign(state->buffer, state->buffer + state->size);
+        jpeg_destroy_compress(&cinfo);
+        free(state->buffer);
+        return true;
+    }
+
+#ifdef NCMPP_HAVE_PNG
+    /** @brief Decode a PNG larger than max_size to RGB, composited onto white */
+    decoded_as decode_png(const unsigned char* data, size_t len, unsigned int max_size, raster& out) {
+        png_image image;
+        memset(&image, 0, sizeof(image));
+        image.version = PNG_IMAGE_VERSION;
+        if (!png_image_begin_read_from_memory(&image, data, len)) {
+            return decoded_as::failed;
+        }
+        if (max(image.width, image.height) <= max_size) {
+            png_image_free(&image);
+            return decoded_as::fits;
+        }
+        image.format = PNG_FORMAT_RGB;
+        out.width = image.width;
+        out.height = image.height;
+        out.components = 3;
+        out.pixels.resize(PNG_IMAGE_SIZE(image));
+        png_color white = {255, 255, 255};
+        if (!png_image_finish_read(&image, &white, out.pixels.data(), 0, nullptr)) {
+            png_image_free(&image);
+            return decoded_as::failed;
+        }
+        return decoded_as::ok;
+    }
+#endif
+#endif
+} // anonymous namespace
+
+cover_transcoder::cover_transcoder(unsigned int max_size, int quality)
+    : max_size_(max(1u, max_size)), quality_(clamp(quality, 1, 100)) {}
+
+bool cover_transcoder::available() {
+#ifdef NCMPP_HAVE_JPEG
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool cover_transcoder::png_available() {
+#if defined(NCMPP_HAVE_JPEG) && defined(NCMPP_HAVE_PNG)
+    return true;
+#else
+    return false;
+#endif
+}
+
+cover_transcoder::image cover_transcoder::transcode(const unsigned char* data, size_t len) {
+    uint64_t size = len;
+    uint64_t hash = fnv1a((const unsigned char*)&size, sizeof(size), fnv1a(data, len));
+
+    shared_future<image> pending;
+    promise<image> mine;
+    {
+        lock_guard<mutex> lock(mtx_);
+        auto it = cache_.find(hash);
+        if (it != cache_.end()) {
+            pending = it->second;
+        } else {
+            cache_.emplace(hash, mine.get_future().share());
+        }
+    }
+
+    image result;
+    if (pending.valid()) {
+        reused_++;
+        result = pending.get();
+    } else {
+        try {
+            ncm::metrics::span t(ncm::metrics::stage::cover_transcode);
+            result = convert(data, len);
+        } catch (const exception& e) {
+            NCM_LOG(level::warn, string("Failed to transcode cover, keeping it as stored: ") + e.what());
+        }
+        (result ? transcoded_ : kept_)++;
+        mine.set_value(result);
+
+        lock_guard<mutex> lock(mtx_);
+        order_.push_back(hash);
+        cached_bytes_ += result ? result->size() : 0;
+        evict();
+    }
+
+    if (result) {
+        bytes_in_ += len;
+        bytes_out_ += result->size();
+    }
+    return result;
+}
+
+/**
+ * @brief Decode, shrink and re-encode one cover
+ * @return null if the cover fits the bound, is not a decodable JPEG or PNG,
+ * or re-encoding would not make it smaller
+ */
+cover_transcoder::image cover_transcoder::convert(const unsigned char* data, size_t len) {
+#ifdef NCMPP_HAVE_JPEG
+    raster decoded;
+    decoded_as status = decoded_as::failed;
+    if (is_jpeg(data, len)) {
+        status = decode_jpeg(data, len, max_size_, decoded);
+#ifdef NCMPP_HAVE_PNG
+    } else if (is_png(data, len)) {
+        status = decode_png(data, len, max_size_, decoded);
+#endif
+    }
+    if (status == decoded_as::fits) {
+        return nullptr;
+    }
+    if (status == decoded_as::failed) {
+        NCM_LOG(level::debug, "Keeping cover of " + to_string(len) + " bytes: not a decodable JPEG or PNG");
+        return nullptr;
+    }
+
+    unsigned int longest = max(decoded.width, decoded.height);
+    if (longest > max_size_) {
+        // Keep the aspect ratio; the short side is rounded to the nearest pixel
+        unsigned int width = decoded.width >= decoded.height
+            ? max_size_ : max(1u, (unsigned int)lround((double)decoded.width * max_size_ / longest));
+        unsigned int height = decoded.height >= decoded.width
+            ? max_size_ : max(1u, (unsigned int)lround((double)decoded.height * max_size_ / longest));
+        decoded = shrink(decoded, width, height);
+    }
+
+    auto encoded = make_shared<vector<unsigned char>>();
+    if (!encode_jpeg(decoded, quality_, *encoded) || encoded->size() >= len) {
+        return nullptr;
+    }
+    NCM_LOG(level::debug, "Downscaled cover to " + to_string(decoded.width) + "x" + to_string(decoded.height) +
+                              ", " + to_string(len / 1024) + " KiB -> " + to_string(encoded->size() / 1024) + " KiB");
+    return encoded;
+#else
+    (void)data;
+    (void)len;
+    return nullptr;
+#endif
+}
+
+void cover_transcoder::evict() {
+    while (!order_.empty() && (cached_bytes_ > CACHE_BYTES || order_.size() > CACHE_ENTRIES)) {
+        auto it = cache_.find(order_.front());
+        order_.pop_front();
+        if (it == cache_.end()) continue;
+        image cached = it->second.get();
+        cached_bytes_ -= cached ? cached->size() : 0;
+        cache_.erase(it);
+    }
+}
+
+void cover_transcoder::report() const {
+    uint64_t done = transcoded_, kept = kept_, reused = reused_;
+    if (done + kept + reused == 0) {
+        return;
+    }
+    NCM_LOG(level::info, "Covers: " + to_string(done) + " downscaled, " + to_string(kept) + " kept as stored, " +
+                             to_string(reused) + " reused from the cache");
+    uint64_t in = bytes_in_, out = bytes_out_;
+    if (in > 0) {
+        NCM_LOG(level::info, "Cover bytes written: " + to_string(out / 1024) + " KiB instead of " +
+                                 to_string(in / 1024) + " KiB");
+    }
+}
@@ -0,0 +1,74 @@
+/**
+ * @file cover_transcode.h
+ * @brief Downscaling of cover images, once per unique cover
+ * @details NCM files carry the cover as downloaded, often a multi-megabyte
+ * JPEG or PNG, and every track of an album carries the same one. Covers
+ * larger than the configured bound are decoded, resized and re-encoded as
+ * JPEG by the worker converting the track, so different albums are
+ * transcoded in parallel; the result is cached by content, and the other
+ * tracks of the album reuse it. Decoding uses libjpeg's scaled IDCT, which
+ * with libjpeg-turbo is SIMD accelerated, so most of the reduction happens
+ * before a pixel is produced. Built without libjpeg, covers are kept as
+ * stored.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Thread-safe cover downscaler with a content-addressed cache
+ */
+class cover_transcoder {
+public:
+    using image = std::shared_ptr<const std::vector<unsigned char>>;
+
+    /**
+     * @param max_size Longest side of the output in pixels
+     * @param quality JPEG quality of the output, 1 to 100
+     */
+    cover_transcoder(unsigned int max_size, int quality);
+
+    /** @brief Whether this build can decode and encode JPEG */
+    static bool available();
+
+    /** @brief Whether this build can decode PNG covers */
+    static bool png_available();
+
+    /**
+     * @brief Downscaled copy of a cover, usable as dump_options::transform_cover
+     * @return The re-encoded cover, or null to keep the original: it already
+     * fits, cannot be decoded, or would not get smaller
+     * @details A cover being transcoded by another thread is waited for
+     * rather than transcoded twice.
+     */
+    image transcode(const unsigned char* data, std::size_t len);
+
+    /** @brief Log how many covers were transcoded and reused, and the bytes saved */
+    void report() const;
+
+private:
+    image convert(const unsigned char* data, std::size_t len);
+    void evict();
+
+    unsigned int max_size_;
+    int quality_;
+
+    std::mutex mtx_;
+    std::unordered_map<std::uint64_t, std::shared_future<image>> cache_;  // content hash -> result
+    std::deque<std::uint64_t> order_;  // cached hashes, oldest first
+    std::size_t cached_bytes_ = 0;
+
+    std::atomic<std::uint64_t> transcoded_{0};
+    std::atomic<std::uint64_t> kept_{0};
+    std::atomic<std::uint64_t> reused_{0};
+    std::atomic<std::uint64_t> bytes_in_{0};
+    std::atomic<std::uint64_t> bytes_out_{0};
+};
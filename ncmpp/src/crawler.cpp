@@ -0,0 +1,182 @@
+/**
+ * @file crawler.cpp
+ * @brief Parallel directory crawler implementation
+ * @details Each directory is listed by one pool task, which queues a task
+ * per subdirectory. On Linux a listing is a loop of large getdents64 reads
+ * on one directory descriptor; entries whose type the kernel does not
+ * report, symlinks and matching files are resolved with statx relative to
+ * that descriptor, so no path is walked twice. Elsewhere the listing uses
+ * std::filesystem::directory_iterator.
+ */
+
+#include "crawler.h"
+#include "ncmlib/log.h"
+#include "pool.h"
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstddef>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using ncm::log::level;
+
+    /**
+     * @brief Whether a file name has the extension, by path::extension() rules
+     * @details A leading dot starts a hidden name, not an extension.
+     */
+    bool has_extension(string_view name, const string& extension) {
+        size_t dot = name.rfind('.');
+        if (dot == string_view::npos || dot == 0) {
+            return false;
+        }
+        return name.substr(dot) == extension;
+    }
+
+    /**
+     * @brief Shared state of one crawl
+     */
+    class crawl_run {
+    public:
+        crawl_run(const string& extension, const dir_crawler::visitor& on_file)
+            : extension_(extension), on_file_(on_file) {}
+
+        /**
+         * @brief List root and everything below it on pool
+         * @details The pool destructor runs every queued listing, including
+         * those queued by other listings, so this returns once the crawl is done.
+         */
+        void run(unsigned int threads, const filesystem::path& root) {
+            thread_pool pool(threads);
+            pool_ = &pool;
+            queue(root);
+        }
+
+    private:
+        void queue(filesystem::path dir) {
+            pool_->enqueue([this, dir = std::move(dir)] { list(dir); });
+        }
+
+        void list(const filesystem::path& dir);
+
+        thread_pool* pool_ = nullptr;
+        const string& extension_;
+        const dir_crawler::visitor& on_file_;
+    };
+
+#ifdef __linux__
+    /** @brief Bytes requested per getdents64 call */
+    constexpr size_t DIRENT_BUFFER = 64 * 1024;
+
+    /** @brief Fixed part of a getdents64 record; the name follows d_type */
+    struct dirent_header {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    void crawl_run::list(const filesystem::path& dir) {
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            NCM_LOG(level::warn, "Unable to read directory " + dir.string() + ": " + strerror(errno));
+            return;
+        }
+
+        // Subdirectories are queued rather than listed recursively, so one buffer per thread suffices
+        thread_local vector<uint64_t> buffer(DIRENT_BUFFER / sizeof(uint64_t));
+        char* base = (char*)buffer.data();
+
+        while (true) {
+            long n = syscall(SYS_getdents64, fd, base, DIRENT_BUFFER);
+            if (n < 0) {
+                NCM_LOG(level::warn, "Unable to read directory " + dir.string() + ": " + strerror(errno));
+                break;
+            }
+            if (n == 0) {
+                break;
+            }
+
+            for (long off = 0; off < n;) {
+                const dirent_header* d = (const dirent_header*)(base + off);
+                off += d->d_reclen;
+                const char* name = base + (off - d->d_reclen) + offsetof(dirent_header, d_name);
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                    continue;
+                }
+
+                unsigned char type = d->d_type;
+                bool matches = has_extension(name, extension_);
+                if (type == DT_DIR) {
+                    queue(dir / name);
+                    continue;
+                }
+                if (!matches && type != DT_UNKNOWN) {
+                    continue;
+                }
+
+                // Sizes only order the conversions, so cached attributes are good enough
+                struct statx st;
+                if (statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE, &st) != 0) {
+                    continue;
+                }
+                if (S_ISDIR(st.stx_mode)) {
+                    queue(dir / name);
+                    continue;
+                }
+                if (!matches) {
+                    continue;
+                }
+                if (S_ISLNK(st.stx_mode) &&
+                    statx(fd, name, AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE, &st) != 0) {
+                    continue;
+                }
+                if (S_ISREG(st.stx_mode)) {
+                    on_file_({dir / name, (uint64_t)st.stx_size});
+                }
+            }
+        }
+        close(fd);
+    }
+#else
+    void crawl_run::list(const filesystem::path& dir) {
+        error_code ec;
+        filesystem::directory_iterator it(dir, ec);
+        for (; !ec && it != filesystem::directory_iterator(); it.increment(ec)) {
+            const filesystem::directory_entry& e = *it;
+            error_code entry_ec;
+            if (e.is_directory(entry_ec) && !e.is_symlink(entry_ec)) {
+                queue(e.path());
+            } else if (has_extension(e.path().filename().string(), extension_) && e.is_regular_file(entry_ec)) {
+                uintmax_t size = e.file_size(entry_ec);
+                on_file_({e.path(), entry_ec ? 0 : (uint64_t)size});
+            }
+        }
+        if (ec) {
+            NCM_LOG(level::warn, "Unable to read directory " + dir.string() + ": " + ec.message());
+        }
+    }
+#endif
+} // anonymous namespace
+
+dir_crawler::dir_crawler(unsigned int threads) : threads_(threads) {}
+
+void dir_crawler::crawl(const filesystem::path& root, const string& extension, const visitor& on_file) {
+    error_code ec;
+    if (!filesystem::is_directory(root, ec)) {
+        return;
+    }
+    crawl_run(extension, on_file).run(threads_, root);
+}
@@ -0,0 +1,58 @@
+/**
+ * @file crawler.h
+ * @brief Parallel directory crawler for file discovery
+ * @details Directories are listed as independent tasks on a work-stealing
+ * pool, so slow listings (e.g. on network file systems) overlap instead of
+ * running one after another. Matches are handed to the caller as soon as
+ * they are found.
+ */
+
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+/**
+ * @brief Recursive crawler fanning subdirectories out across threads
+ * @details Follows the rules of std::filesystem::recursive_directory_iterator
+ * with default options: symlinks to files are reported, symlinks to
+ * directories are not descended into. Unreadable directories are skipped
+ * with a warning.
+ */
+class dir_crawler {
+public:
+    /**
+     * @brief One matching file
+     */
+    struct entry {
+        /** @brief Path below the crawl root */
+        std::filesystem::path path;
+
+        /** @brief File size in bytes, 0 if unknown */
+        std::uint64_t size;
+    };
+
+    /**
+     * @brief Called once per matching file, concurrently from crawler threads
+     */
+    using visitor = std::function<void(const entry& e)>;
+
+    /**
+     * @param threads Number of directories listed concurrently
+     */
+    explicit dir_crawler(unsigned int threads);
+
+    /**
+     * @brief Find regular files below root with the given extension
+     * @param root Directory to crawl; nothing is reported if it is not a directory
+     * @param extension Extension to match, including the dot (e.g. ".ncm")
+     * @param on_file Receives each match
+     * @details Returns once every directory has been listed and every
+     * on_file call has returned.
+     */
+    void crawl(const std::filesystem::path& root, const std::string& extension, const visitor& on_file);
+
+private:
+    unsigned int threads_;
+};
@@ -0,0 +1,265 @@
+/**
+ * @file dedupe.cpp
+ * @brief Duplicate track and cover reuse implementation
+ * @details The cover bytes are read straight from the input, where they are
+ * stored unencrypted, before the dump; the key block is never decrypted for
+ * a duplicate.
+ */
+
+#include "dedupe.h"
+#include "ncmlib/commit.h"
+#include "ncmlib/log.h"
+#include "ncmlib/probe.h"
+#include <atomic>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using ncm::log::level;
+
+    /** @brief 64-bit FNV-1a, continued from h */
+    uint64_t fnv1a(const unsigned char* data, size_t len, uint64_t h = 0xcbf29ce484222325ull) {
+        for (size_t i = 0; i < len; ++i) {
+            h ^= data[i];
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    /**
+     * @brief Hash of the cover image and its size, 0 without a cover
+     * @throws std::runtime_error if the cover cannot be read
+     */
+    uint64_t hash_cover(const filesystem::path& input, const ncm::track_info& info) {
+        if (info.cover_size == 0) {
+            return 0;
+        }
+        vector<unsigned char> cover(info.cover_size);
+        ifstream in(input, ios::binary);
+        in.seekg((streamoff)info.cover_offset);
+        if (!in.read((char*)cover.data(), (streamsize)cover.size())) {
+            throw runtime_error("Failed to read cover image: " + input.string());
+        }
+        uint64_t size = info.cover_size;
+        return fnv1a((const unsigned char*)&size, sizeof(size), fnv1a(cover.data(), cover.size()));
+    }
+
+    /**
+     * @brief Clone from into a new file at to, sharing its extents
+     * @return false if the file system cannot clone or the files are on different file systems
+     */
+    bool clone_file(const filesystem::path& from, const filesystem::path& to) {
+#if defined(__linux__) && defined(FICLONE)
+        int src = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (src < 0) {
+            return false;
+        }
+        int dst = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (dst < 0) {
+            close(src);
+            return false;
+        }
+        bool cloned = ioctl(dst, FICLONE, src) == 0;
+        close(dst);
+        close(src);
+        if (!cloned) {
+            unlink(to.c_str());
+        }
+        return cloned;
+#else
+        (void)from;
+        (void)to;
+        return false;
+#endif
+    }
+} // anonymous namespace
+
+bool link_file(const filesystem::path& from, const filesystem::path& to, link_mode mode,
+               const commit_function& commit) {
+    error_code ec;
+    if (filesystem::equivalent(from, to, ec)) {
+        return true;  // Both inputs map to the same output, which is already there
+    }
+
+    string temp = ncm::temp_path(to.string());
+    bool created;
+    if (mode == link_mode::hardlink) {
+        filesystem::create_hard_link(from, temp, ec);
+        created = !ec;
+    } else {
+        created = clone_file(from, temp);
+    }
+    if (!created) {
+        static atomic<bool> warned{false};
+        if (!warned.exchange(true)) {
+            NCM_LOG(level::warn, string("Cannot ") + (mode == link_mode::hardlink ? "hard link " : "clone ") +
+                                     to.string() + ", copying duplicates instead");
+        }
+        filesystem::copy_file(from, temp, filesystem::copy_options::overwrite_existing, ec);
+        if (ec) {
+            filesystem::remove(temp, ec);
+            return false;
+        }
+    }
+
+    try {
+        if (commit) {
+            commit(temp, to.string());
+        } else {
+            ncm::commit_file(temp, to.string());
+        }
+    } catch (const exception&) {
+        filesystem::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+dedupe_index::dedupe_index(link_mode mode, function<void()> flush_commits)
+    : mode_(mode), flush_commits_(std::move(flush_commits)) {}
+
+ncm::dump_result dedupe_index::convert(const filesystem::path& input, const filesystem::path& output,
+                                       ncm::dump_options options, bool& linked, const written_callback& on_written) {
+    linked = false;
+    ncm::track_info info = ncm::probe(input);
+    uint64_t cover_hash = hash_cover(input, info);
+    if (info.music_id == 0) {
+        return dump(input, output, options, cover_hash, on_written);
+    }
+
+    // Outputs written with other tag or cover options differ in their bytes
+    unsigned int option_bits = (options.embed_cover ? 1 : 0) | (options.write_tags ? 2 : 0) |
+                               (options.transform_cover ? 4 : 0);
+    string key = info.format + '/' + to_string(info.music_id) + '/' + to_string(info.audio_size) + '/' +
+                 to_string(cover_hash) + '/' + to_string(option_bits);
+    promise<ncm::dump_result> own;
+    shared_future<ncm::dump_result> first;
+    {
+        lock_guard<mutex> lock(mtx_);
+        auto [it, inserted] = tracks_.try_emplace(key);
+        if (inserted) {
+            it->second = own.get_future().share();
+        } else {
+            first = it->second;
+        }
+    }
+
+    if (first.valid()) {
+        try {
+            ncm::dump_result result;
+            if (reuse(first.get(), output, options.commit, result)) {
+                linked = true;
+                if (on_written) {
+                    on_written(result);
+                }
+                return result;
+            }
+        } catch (const exception&) {
+            // The first copy failed; convert this one on its own
+        }
+        return dump(input, output, options, cover_hash, on_written);
+    }
+
+    try {
+        ncm::dump_result result = dump(input, output, options, cover_hash, on_written);
+        own.set_value(result);
+        return result;
+    } catch (...) {
+        {
+            // Let the next duplicate try again
+            lock_guard<mutex> lock(mtx_);
+            tracks_.erase(key);
+        }
+        own.set_exception(current_exception());
+        throw;
+    }
+}
+
+/**
+ * @brief Convert input, linking its cover to an identical one if possible
+ * @details on_written runs before the cover is registered, so other tracks
+ * only link to it once its commit is queued.
+ */
+ncm::dump_result dedupe_index::dump(const filesystem::path& input, const filesystem::path& output,
+                                    ncm::dump_options& options, uint64_t cover_hash,
+                                    const written_callback& on_written) {
+    options.place_cover = [this, cover_hash, commit = options.commit](const unsigned char*, size_t,
+                                                                      const string& path) {
+        return place_cover(cover_hash, path, commit);
+    };
+    ncm::dump_result result = ncm::ncmDump(input.string(), output.string(), options);
+    if (on_written) {
+        on_written(result);
+    }
+    if (!result.cover_path.empty()) {
+        lock_guard<mutex> lock(mtx_);
+        covers_.try_emplace(cover_hash, result.cover_path);
+    }
+    return result;
+}
+
+/**
+ * @brief Link the files of an earlier conversion to output
+ * @return false if the audio could not be linked
+ */
+bool dedupe_index::reuse(const ncm::dump_result& first, const filesystem::path& output, const commit_function& commit,
+                         ncm::dump_result& result) {
+    result = first;
+    filesystem::path audio = output;
+    audio += "." + first.format;
+    if (audio.has_parent_path()) {
+        filesystem::create_directories(audio.parent_path());
+    }
+    error_code ec;
+    if (flush_commits_ && !filesystem::exists(first.audio_path, ec)) {
+        flush_commits_();
+    }
+    if (!link_file(first.audio_path, audio, mode_, commit)) {
+        return false;
+    }
+    result.audio_path = audio.string();
+
+    if (!first.cover_path.empty()) {
+        filesystem::path cover = output;
+        cover += ".jpg";
+        if (link_file(first.cover_path, cover, mode_, commit)) {
+            result.cover_path = cover.string();
+        } else {
+            NCM_LOG(level::warn, "Failed to link cover image " + cover.string());
+            result.cover_path.clear();
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Link target to the cover written earlier with the same content
+ * @return false if no such cover exists or the link failed
+ */
+bool dedupe_index::place_cover(uint64_t hash, const filesystem::path& target, const commit_function& commit) {
+    string first;
+    {
+        lock_guard<mutex> lock(mtx_);
+        auto it = covers_.find(hash);
+        if (it == covers_.end()) {
+            return false;
+        }
+        first = it->second;
+    }
+    error_code ec;
+    if (flush_commits_ && !filesystem::exists(first, ec)) {
+        flush_commits_();
+    }
+    return link_file(first, target, mode_, commit);
+}
@@ -0,0 +1,96 @@
+/**
+ * @file dedupe.h
+ * @brief Reuse of outputs for duplicate tracks and covers
+ * @details Libraries often hold the same track several times, once per
+ * playlist it was downloaded into, and every track of an album carries the
+ * same cover. Duplicates are recognised from the header alone, so the second
+ * copy of a track costs a probe and a link instead of a decrypt and a full
+ * write.
+ */
+
+#pragma once
+#include "ncmlib/ncmdump.h"
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief How a duplicate output is created from the first copy
+ */
+enum class link_mode {
+    /** @brief Copy-on-write clone (FICLONE); files stay independent. Falls back to a copy */
+    reflink,
+    /** @brief Hard link sharing one inode. Falls back to a copy across file systems */
+    hardlink,
+};
+
+/** @brief Moves a finished temporary file into place, as ncm::dump_options::commit */
+using commit_function = std::function<void(const std::string& temp, const std::string& target)>;
+
+/**
+ * @brief Create to as a clone or hard link of from, replacing an existing file
+ * @details The link or copy is made at a temporary path and handed to commit,
+ * or renamed at once if commit is empty, so an interrupted copy never leaves
+ * a partial file under the final name.
+ * @return false if neither the link nor the fallback copy could be created
+ */
+bool link_file(const std::filesystem::path& from, const std::filesystem::path& to, link_mode mode,
+               const commit_function& commit = {});
+
+/**
+ * @brief Thread-safe index of the tracks and covers written during a run
+ * @details A track is identified by its format, NetEase music id, encrypted
+ * audio size, cover hash and the dump options that change the output bytes
+ * (embed_cover, write_tags, transform_cover); tracks without a music id are
+ * always converted.
+ * Covers written as separate files are identified by their content hash and
+ * size, so every track of an album links to the first extracted .jpg.
+ */
+class dedupe_index {
+public:
+    /** @brief Called with the result of a conversion before duplicates may link to its files */
+    using written_callback = std::function<void(const ncm::dump_result& result)>;
+
+    /**
+     * @param mode How duplicates are linked
+     * @param flush_commits Called when the first copy's audio is not in
+     * place yet because its commit was deferred; optional
+     */
+    explicit dedupe_index(link_mode mode, std::function<void()> flush_commits = {});
+
+    /**
+     * @brief Convert input, or link the output of an identical track converted before
+     * @param input Input .ncm file
+     * @param output Output path without extension
+     * @param options Dump options; place_cover is set here, and linked files
+     * are committed through options.commit like converted ones
+     * @param linked Receives whether the audio was linked instead of decrypted
+     * @param on_written Optional; runs after input was converted or linked and
+     * before its audio and cover are offered to duplicates, e.g. to queue
+     * deferred commits
+     * @return Result describing the files at output
+     * @details A duplicate of a track still being converted waits for that
+     * conversion. If it failed, or the link cannot be created, the duplicate
+     * is converted on its own.
+     * @throws std::exception if the conversion fails
+     */
+    ncm::dump_result convert(const std::filesystem::path& input, const std::filesystem::path& output,
+                             ncm::dump_options options, bool& linked, const written_callback& on_written = {});
+
+private:
+    ncm::dump_result dump(const std::filesystem::path& input, const std::filesystem::path& output,
+                          ncm::dump_options& options, std::uint64_t cover_hash, const written_callback& on_written);
+    bool reuse(const ncm::dump_result& first, const std::filesystem::path& output, const commit_function& commit,
+               ncm::dump_result& result);
+    bool place_cover(std::uint64_t hash, const std::filesystem::path& target, const commit_function& commit);
+
+    link_mode mode_;
+    std::function<void()> flush_commits_;
+    std::mutex mtx_;
+    std::unordered_map<std::string, std::shared_future<ncm::dump_result>> tracks_;
+    std::unordered_map<std::uint64_t, std::string> covers_;    // content hash -> first .jpg written
+};
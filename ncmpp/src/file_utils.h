@@ -5,40 +5,40 @@
  */
 
 #pragma once
+#include "crawler.h"
+#include <algorithm>
 #include <filesystem>
+#include <mutex>
 #include <vector>
 #include <string>
 
+/**
+ * @brief Directories listed concurrently during discovery
+ * @details Listing is bound by file system latency rather than CPU, so this
+ * is independent of the conversion thread count.
+ */
+constexpr unsigned int CRAWL_THREADS = 8;
+
 /**
  * @brief Recursively find files with specific extension
  * @param dir Directory path to search in
  * @param extension File extension to match (including the dot, e.g., ".ncm")
- * @return Vector of file paths matching the extension
- * @details Performs recursive directory traversal to find all files
- * with the specified extension. Handles edge cases like:
+ * @return Vector of file paths matching the extension, sorted
+ * @details Crawls subdirectories in parallel with dir_crawler. Handles edge
+ * cases like:
  * - Non-existent directories
  * - Non-directory paths
  * - Empty results gracefully
+ * @note Callers that can start work before the crawl finishes should use
+ * dir_crawler directly.
  */
 inline std::vector<std::filesystem::path> find_files(const std::filesystem::path& dir, const std::string& extension) {
     std::vector<std::filesystem::path> files;
-    
-    // Validate input directory
-    if (!std::filesystem::exists(dir) || !std::filesystem::is_directory(dir)) {
-        return files;
-    }
-
-    try {
-        // Recursive directory traversal
-        for (const auto& entry : std::filesystem::recursive_directory_iterator(dir)) {
-            if (entry.is_regular_file() && entry.path().extension() == extension) {
-                files.push_back(entry.path());
-            }
-        }
-    } catch (const std::filesystem::filesystem_error& e) {
-        // Handle filesystem errors gracefully
-        return files;
-    }
-
+    std::mutex files_mtx;
+    dir_crawler(CRAWL_THREADS).crawl(dir, extension, [&](const dir_crawler::entry& e) {
+        std::lock_guard<std::mutex> lock(files_mtx);
+        files.push_back(e.path);
+    });
+    std::sort(files.begin(), files.end());
     return files;
 }
@@ -0,0 +1,222 @@
+/**
+ * @file io_limiter.cpp
+ * @brief Adaptive per-device limits implementation
+ * @details Throughput is counted when a file finishes, so a window spans at
+ * least one completion per slot; otherwise a window that happens to see
+ * none of the large files in flight would look like a collapse.
+ */
+
+#include "io_limiter.h"
+#include "ncmlib/log.h"
+#include <algorithm>
+#include <cstdio>
+#include <system_error>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using ncm::log::level;
+    using clock_type = chrono::steady_clock;
+
+    constexpr auto MIN_WINDOW = chrono::seconds(1);
+    constexpr double GAIN = 1.05;       // Change that counts as better or worse
+    constexpr double COLLAPSE = 0.8;    // Fall that halves the limit
+
+    /**
+     * @brief Identify the device holding p, walking up to an existing parent
+     */
+    string device_key(filesystem::path p) {
+        error_code ec;
+        p = filesystem::absolute(p, ec);
+#ifdef _WIN32
+        return p.root_name().string();
+#else
+        for (;;) {
+            struct stat st;
+            if (::stat(p.c_str(), &st) == 0) {
+                return to_string((unsigned long long)st.st_dev);
+            }
+            if (!p.has_relative_path()) {
+                return string();
+            }
+            p = p.parent_path();
+        }
+#endif
+    }
+
+    string format_rate(double bytes_per_sec) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.1f MB/s", bytes_per_sec / 1e6);
+        return buf;
+    }
+} // anonymous namespace
+
+adaptive_limit::adaptive_limit(string name, unsigned int initial, unsigned int max)
+    : name_(std::move(name)), limit_(std::clamp(initial, 1u, max ? max : 1u)), max_(max ? max : 1u),
+      window_start_(clock_type::now()), idle_since_(window_start_) {}
+
+void adaptive_limit::acquire() {
+    unique_lock<mutex> lock(mtx_);
+    waiting_++;
+    cv_.wait(lock, [this] { return active_ < limit_; });
+    waiting_--;
+    if (idle_) {
+        // Nothing was in flight or waiting; idle time (watch mode, a slow
+        // producer) must not count as slow, so the window skips it
+        window_start_ += clock_type::now() - idle_since_;
+        idle_ = false;
+    }
+    active_++;
+}
+
+void adaptive_limit::release(uint64_t bytes, chrono::nanoseconds elapsed) {
+    {
+        lock_guard<mutex> lock(mtx_);
+        active_--;
+        window_bytes_ += bytes;
+        window_done_++;
+        window_latency_ += elapsed;
+        auto now = clock_type::now();
+        if (now - window_start_ >= MIN_WINDOW && window_done_ >= limit_) {
+            adjust(now);
+        }
+        if (active_ == 0 && waiting_ == 0) {
+            // A waiter taking over the slot is a handoff, not idle time
+            idle_ = true;
+            idle_since_ = now;
+        }
+    }
+    cv_.notify_all();
+}
+
+unsigned int adaptive_limit::limit() const {
+    lock_guard<mutex> lock(mtx_);
+    return limit_;
+}
+
+/**
+ * @brief Close the measurement window and move the limit; mtx_ is held
+ */
+void adaptive_limit::adjust(clock_type::time_point now) {
+    double seconds = chrono::duration<double>(now - window_start_).count();
+    double rate = (double)window_bytes_ / seconds;
+    double latency_ms = chrono::duration<double, milli>(window_latency_).count() / window_done_;
+    unsigned int old = limit_;
+
+    if (prev_rate_ == 0) {
+        limit_ = slow_start_ ? limit_ * 2 : limit_ + 1;
+    } else if (rate >= prev_rate_ * GAIN) {
+        // Better: keep going the same way
+        if (slow_start_) {
+            limit_ *= 2;
+        } else if (direction_ > 0) {
+            limit_++;
+        } else if (limit_ > 1) {
+            limit_--;
+        }
+    } else if (rate <= prev_rate_ * COLLAPSE) {
+        slow_start_ = false;
+        direction_ = -1;
+        limit_ = max(1u, limit_ / 2);
+    } else if (rate * GAIN <= prev_rate_) {
+        // Worse: turn around
+        slow_start_ = false;
+        direction_ = -direction_;
+        limit_ = direction_ > 0 ? limit_ + 1 : max(1u, limit_ - 1);
+    } else {
+        // Flat: same throughput with fewer files in flight means less latency
+        slow_start_ = false;
+        direction_ = -1;
+        limit_ = max(1u, limit_ - 1);
+    }
+    limit_ = min(limit_, max_);
+
+    if (limit_ != old) {
+        NCM_LOG(level::debug, "Files in flight on " + name_ + ": " + to_string(old) + " -> " + to_string(limit_) + " (" +
+                                  format_rate(rate) + ", " + to_string((long long)latency_ms) + " ms per file)");
+    }
+    prev_rate_ = rate;
+    window_start_ = now;
+    window_bytes_ = 0;
+    window_done_ = 0;
+    window_latency_ = chrono::nanoseconds(0);
+}
+
+io_limiter::ticket::ticket(ticket&& other) noexcept
+    : held_(std::move(other.held_)), bytes_(other.bytes_), start_(other.start_) {
+    other.held_.clear();
+}
+
+io_limiter::ticket& io_limiter::ticket::operator=(ticket&& other) noexcept {
+    if (this != &other) {
+        release();
+        held_ = std::move(other.held_);
+        other.held_.clear();
+        bytes_ = other.bytes_;
+        start_ = other.start_;
+    }
+    return *this;
+}
+
+io_limiter::ticket::~ticket() {
+    release();
+}
+
+void io_limiter::ticket::release() {
+    auto elapsed = clock_type::now() - start_;
+    for (auto it = held_.rbegin(); it != held_.rend(); ++it) {
+        (*it)->release(bytes_, chrono::duration_cast<chrono::nanoseconds>(elapsed));
+    }
+    held_.clear();
+}
+
+io_limiter::io_limiter(unsigned int default_max, const vector<pair<filesystem::path, unsigned int>>& device_max)
+    : default_max_(default_max ? default_max : 1) {
+    for (const auto& [path, max] : device_max) {
+        device_max_[device_key(path)] = max;
+    }
+}
+
+io_limiter::ticket io_limiter::acquire(const filesystem::path& input, const filesystem::path& output) {
+    string in_key = device_key(input);
+    string out_key = device_key(output.has_parent_path() ? output.parent_path() : filesystem::path("."));
+
+    // Always lock in key order so two files never wait on each other
+    vector<pair<string, const filesystem::path*>> keys{{in_key, &input}};
+    if (out_key != in_key) {
+        keys.emplace_back(out_key, &output);
+        if (keys[1].first < keys[0].first) swap(keys[0], keys[1]);
+    }
+
+    ticket t;
+    for (const auto& [key, example] : keys) {
+        adaptive_limit& limit = device(key, *example);
+        limit.acquire();
+        t.held_.push_back(&limit);
+    }
+    t.start_ = clock_type::now();
+    return t;
+}
+
+void io_limiter::report() const {
+    lock_guard<mutex> lock(mtx_);
+    for (const auto& [key, limit] : devices_) {
+        NCM_LOG(level::info, "Files in flight on " + limit->name() + ": " + to_string(limit->limit()));
+    }
+}
+
+adaptive_limit& io_limiter::device(const string& key, const filesystem::path& example) {
+    lock_guard<mutex> lock(mtx_);
+    auto it = devices_.find(key);
+    if (it == devices_.end()) {
+        auto cap = device_max_.find(key);
+        unsigned int max = cap != device_max_.end() ? cap->second : default_max_;
+        string name = "device " + (key.empty() ? string("?") : key) + " (" + example.parent_path().string() + ")";
+        it = devices_.emplace(key, make_unique<adaptive_limit>(std::move(name), 2, max)).first;
+    }
+    return *it->second;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file io_limiter.h
+ * @brief Adaptive per-device limits on files in flight
+ * @details One sequential writer saturates a hard disk and a few dozen are
+ * needed to saturate an NVMe drive, so no single thread count suits both.
+ * With --threads auto every file takes a slot on the devices holding its
+ * input and output for the whole conversion, and each device tunes its own
+ * slot count from the throughput it delivers. The worker pool is sized for
+ * the largest limit and the workers without a slot wait here. Decryption is
+ * bounded separately: each audio chunk takes one of hardware_concurrency()
+ * decrypt slots, so the files in flight follow the devices while the CPU
+ * work stays at one task per core.
+ */
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Counting semaphore whose size follows the measured throughput
+ * @details The limit starts small and doubles while throughput improves by
+ * at least 5 %. After that it moves one slot at a time towards the higher
+ * throughput; a drop of a fifth or more halves it. When throughput stays
+ * within 5 % it steps down, since fewer files in flight then give the same MB/s
+ * at lower latency. A measurement window closes after at least a second
+ * and as many completions as there are slots. Windows run on across files;
+ * only spans with nothing in flight and nothing waiting are left out.
+ */
+class adaptive_limit {
+public:
+    /**
+     * @param name Device description for log messages
+     * @param initial Slots at start
+     * @param max Upper bound of the limit
+     */
+    adaptive_limit(std::string name, unsigned int initial, unsigned int max);
+
+    /** @brief Wait for a free slot */
+    void acquire();
+
+    /**
+     * @brief Free a slot
+     * @param bytes Bytes the task moved, 0 if it failed
+     * @param elapsed Time the slot was held
+     */
+    void release(std::uint64_t bytes, std::chrono::nanoseconds elapsed);
+
+    /** @brief Current number of slots */
+    unsigned int limit() const;
+
+    const std::string& name() const { return name_; }
+
+private:
+    void adjust(std::chrono::steady_clock::time_point now);
+
+    std::string name_;
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    unsigned int limit_;
+    unsigned int max_;
+    unsigned int active_ = 0;
+    unsigned int waiting_ = 0;
+
+    std::chrono::steady_clock::time_point window_start_;
+    std::chrono::steady_clock::time_point idle_since_;
+    bool idle_ = true;
+    std::uint64_t window_bytes_ = 0;
+    unsigned int window_done_ = 0;
+    std::chrono::nanoseconds window_latency_{0};
+    double prev_rate_ = 0;
+    int direction_ = 1;
+    bool slow_start_ = true;
+};
+
+/**
+ * @brief Adaptive limits for every device touched by a run
+ * @details Devices are told apart by st_dev (the drive on Windows). A file
+ * whose input and output share a device takes one slot there. Slots are
+ * always taken in device order, so files never deadlock across devices.
+ */
+class io_limiter {
+public:
+    /**
+     * @brief Slots held by one file, released on destruction
+     */
+    class ticket {
+    public:
+        ticket() = default;
+        ticket(ticket&& other) noexcept;
+        ticket& operator=(ticket&& other) noexcept;
+        ticket(const ticket&) = delete;
+        ticket& operator=(const ticket&) = delete;
+        ~ticket();
+
+        /** @brief Count bytes moved by the file; reported when the slots are released */
+        void add_bytes(std::uint64_t n) { bytes_ += n; }
+
+    private:
+        friend class io_limiter;
+        void release();
+
+        std::vector<adaptive_limit*> held_;
+        std::uint64_t bytes_ = 0;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    /**
+     * @param default_max Upper bound for devices without their own limit
+     * @param device_max Upper bounds for the devices holding these paths
+     */
+    io_limiter(unsigned int default_max, const std::vector<std::pair<std::filesystem::path, unsigned int>>& device_max);
+
+    /**
+     * @brief Wait for slots on the devices of input and output
+     * @param output Output path without extension; its directory must exist
+     */
+    ticket acquire(const std::filesystem::path& input, const std::filesystem::path& output);
+
+    /** @brief Log the limit each device settled on */
+    void report() const;
+
+private:
+    adaptive_limit& device(const std::string& key, const std::filesystem::path& example);
+
+    unsigned int default_max_;
+    std::map<std::string, unsigned int> device_max_;
+    mutable std::mutex mtx_;
+    std::map<std::string, std::unique_ptr<adaptive_limit>> devices_;
+};
@@ -0,0 +1,231 @@
+/**
+ * @file job_file.cpp
+ * @brief Binary job list implementation
+ * @details Indexing touches each record header once; for a few million jobs
+ * the index is a few tens of MB of offsets while the paths stay in the page
+ * cache.
+ */
+
+#include "job_file.h"
+#include "ncmlib/commit.h"
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+    constexpr char MAGIC[8] = {'N', 'C', 'M', 'J', 'O', 'B', 'S', '\0'};
+    constexpr uint32_t VERSION = 1;
+    constexpr size_t HEADER_SIZE = 32;
+    constexpr size_t RECORD_HEADER_SIZE = 20;
+
+    uint32_t get_u32(const unsigned char* p) {
+        return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    uint64_t get_u64(const unsigned char* p) {
+        return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+    }
+
+    void put_u32(string& out, uint32_t v) {
+        for (int i = 0; i < 4; ++i) out.push_back((char)(v >> (8 * i)));
+    }
+
+    void put_u64(string& out, uint64_t v) {
+        put_u32(out, (uint32_t)v);
+        put_u32(out, (uint32_t)(v >> 32));
+    }
+
+    size_t padded(size_t n) {
+        return (n + 7) / 8 * 8;
+    }
+} // anonymous namespace
+
+job_file::job_file(const filesystem::path& path) {
+    string name = path.string();
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw runtime_error("Unable to open job file: " + name);
+    }
+    file_ = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        throw runtime_error("Unable to read job file size: " + name);
+    }
+    len_ = (size_t)size.QuadPart;
+    if (len_ > 0) {
+        mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        data_ = mapping_ ? (const unsigned char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!data_) {
+            if (mapping_) CloseHandle(mapping_);
+            CloseHandle(file);
+            throw runtime_error("Unable to map job file: " + name);
+        }
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw runtime_error("Unable to open job file: " + name);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw runtime_error("Unable to read job file size: " + name);
+    }
+    len_ = (size_t)st.st_size;
+    if (len_ > 0) {
+        void* p = mmap(nullptr, len_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw runtime_error("Unable to map job file: " + name);
+        }
+        data_ = (const unsigned char*)p;
+        madvise(p, len_, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+#endif
+
+    try {
+        if (len_ < HEADER_SIZE || memcmp(data_, MAGIC, sizeof(MAGIC)) != 0) {
+            throw runtime_error("Not a job file: " + name);
+        }
+        uint32_t version = get_u32(data_ + 8);
+        if (version != VERSION) {
+            throw runtime_error("Unsupported job file version " + to_string(version) + ": " + name);
+        }
+        size_t header_size = get_u32(data_ + 12);
+        uint64_t count = get_u64(data_ + 16);
+        if (header_size < HEADER_SIZE || header_size > len_) {
+            throw runtime_error("Corrupt job file header: " + name);
+        }
+
+        offsets_.reserve((size_t)min<uint64_t>(count, (len_ - header_size) / RECORD_HEADER_SIZE));
+        size_t pos = header_size;
+        while (pos < len_) {
+            if (len_ - pos < RECORD_HEADER_SIZE) {
+                throw runtime_error("Truncated job file: " + name);
+            }
+            size_t record = padded(RECORD_HEADER_SIZE + (size_t)get_u32(data_ + pos) + get_u32(data_ + pos + 4));
+            if (record > len_ - pos) {
+                throw runtime_error("Truncated job file: " + name);
+            }
+            has_flags_ = has_flags_ || get_u32(data_ + pos + 16) != 0;
+            offsets_.push_back(pos);
+            pos += record;
+        }
+        if (offsets_.size() != count) {
+            throw runtime_error("Job file holds " + to_string(offsets_.size()) + " jobs, its header " +
+                                to_string(count) + ": " + name);
+        }
+    } catch (...) {
+        unmap();
+        throw;
+    }
+}
+
+job_file::~job_file() {
+    unmap();
+}
+
+void job_file::unmap() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_) CloseHandle(file_);
+    mapping_ = file_ = nullptr;
+#else
+    if (data_) munmap((void*)data_, len_);
+#endif
+    data_ = nullptr;
+}
+
+job_entry job_file::operator[](size_t i) const {
+    const unsigned char* p = data_ + offsets_[i];
+    uint32_t input_len = get_u32(p);
+    uint32_t output_len = get_u32(p + 4);
+    job_entry job;
+    job.expected_size = get_u64(p + 8);
+    job.flags = get_u32(p + 16);
+    job.input = string_view((const char*)p + RECORD_HEADER_SIZE, input_len);
+    job.output = string_view((const char*)p + RECORD_HEADER_SIZE + input_len, output_len);
+    return job;
+}
+
+job_file_writer::job_file_writer(const filesystem::path& path)
+    : path_(path.string()), temp_(ncm::temp_path(path_)) {
+    out_.open(temp_, ios::binary | ios::trunc);
+    if (!out_.is_open()) {
+        throw runtime_error("Unable to create job file: " + path_);
+    }
+    string header(MAGIC, sizeof(MAGIC));
+    put_u32(header, VERSION);
+    put_u32(header, (uint32_t)HEADER_SIZE);
+    put_u64(header, 0);  // Job count, written by close()
+    put_u64(header, 0);
+    out_.write(header.data(), (streamsize)header.size());
+}
+
+job_file_writer::~job_file_writer() {
+    if (!closed_) {
+        out_.close();
+        error_code ec;
+        filesystem::remove(temp_, ec);
+    }
+}
+
+void job_file_writer::add(string_view input, string_view output, uint64_t expected_size, uint32_t flags) {
+    string record;
+    record.reserve(padded(RECORD_HEADER_SIZE + input.size() + output.size()));
+    put_u32(record, (uint32_t)input.size());
+    put_u32(record, (uint32_t)output.size());
+    put_u64(record, expected_size);
+    put_u32(record, flags);
+    record.append(input);
+    record.append(output);
+    record.resize(padded(record.size()), '\0');
+    out_.write(record.data(), (streamsize)record.size());
+    count_++;
+}
+
+void job_file_writer::close() {
+    string count;
+    put_u64(count, count_);
+    out_.seekp(16);
+    out_.write(count.data(), (streamsize)count.size());
+    out_.close();
+    if (out_.fail()) {
+        throw runtime_error("Failed to write job file: " + path_);
+    }
+    ncm::commit_file(temp_, path_);
+    closed_ = true;
+}
+
+bool next_nul_job(istream& in, string& input, string& output) {
+    do {
+        if (!getline(in, input, '\0')) {
+            return false;
+        }
+    } while (input.empty());
+    if (!getline(in, output, '\0') || output.empty()) {
+        throw runtime_error("Job stream ended after input without an output: " + input);
+    }
+    return true;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file job_file.h
+ * @brief Versioned binary job lists for batch mode
+ * @details A job file carries the input path, output path, expected input
+ * size and option flags of every job in one file, so the -i/-o text lists
+ * cannot drift apart and a run never parses or copies the whole list. The
+ * file is memory-mapped and indexed with one offset per job; paths are read
+ * in place.
+ *
+ * Layout, all integers little-endian:
+ *
+ *     header   char magic[8] = "NCMJOBS\0"
+ *              u32 version (1), u32 header size (32)
+ *              u64 job count, u64 reserved (0)
+ *     record   u32 input length, u32 output length
+ *              u64 expected input size (0 = unknown), u32 flags (job_flag)
+ *              input bytes, output bytes, zero padding to a multiple of 8
+ *
+ * The job count is written last, so a file whose writer was interrupted is
+ * rejected instead of being read short.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Per-job options; they add to the options given on the command line
+ */
+namespace job_flag {
+    constexpr std::uint32_t embed_cover = 1u << 0;
+    constexpr std::uint32_t write_tags = 1u << 1;
+    constexpr std::uint32_t direct_io = 1u << 2;
+    constexpr std::uint32_t known = embed_cover | write_tags | direct_io;
+}
+
+/**
+ * @brief One job, pointing into the mapped file
+ */
+struct job_entry {
+    std::string_view input;
+    std::string_view output;
+    std::uint64_t expected_size = 0;
+    std::uint32_t flags = 0;
+};
+
+/**
+ * @brief Read-only, memory-mapped job file
+ */
+class job_file {
+public:
+    /**
+     * @brief Map and index a job file
+     * @throws std::runtime_error if the file cannot be mapped, has another
+     * version or is truncated
+     */
+    explicit job_file(const std::filesystem::path& path);
+    ~job_file();
+    job_file(const job_file&) = delete;
+    job_file& operator=(const job_file&) = delete;
+
+    /** @brief Number of jobs */
+    std::size_t size() const { return offsets_.size(); }
+
+    /** @brief Job i; the views stay valid while the file is open */
+    job_entry operator[](std::size_t i) const;
+
+    /** @brief Whether any job sets flags of its own */
+    bool has_job_flags() const { return has_flags_; }
+
+private:
+    void unmap();
+
+    const unsigned char* data_ = nullptr;
+    std::size_t len_ = 0;
+    std::vector<std::uint64_t> offsets_;
+    bool has_flags_ = false;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
+
+/**
+ * @brief Writes a job file through a temporary file renamed into place on close()
+ */
+class job_file_writer {
+public:
+    /** @throws std::runtime_error if the file cannot be created */
+    explicit job_file_writer(const std::filesystem::path& path);
+
+    /** @brief Removes the unfinished file unless close() succeeded */
+    ~job_file_writer();
+
+    void add(std::string_view input, std::string_view output, std::uint64_t expected_size, std::uint32_t flags = 0);
+
+    /**
+     * @brief Write the job count and move the file into place
+     * @throws std::runtime_error if writing fails
+     */
+    void close();
+
+    std::uint64_t count() const { return count_; }
+
+private:
+    std::string path_;
+    std::string temp_;
+    std::ofstream out_;
+    std::uint64_t count_ = 0;
+    bool closed_ = false;
+};
+
+/**
+ * @brief Read the next job of a NUL-separated "input\0output\0" stream
+ * @return false at the end of the stream
+ * @throws std::runtime_error if the stream ends between an input and its output
+ */
+bool next_nul_job(std::istream& in, std::string& input, std::string& output);
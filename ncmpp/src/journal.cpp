@@ -0,0 +1,191 @@
+/**
+ * @file journal.cpp
+ * @brief Checkpoint journal implementation
+ * @details Converted jobs are kept as 64-bit hashes of their input and
+ * output paths, so a resumed run of a million jobs holds a few tens of MB
+ * and checks each job without touching the file system.
+ */
+
+#include "journal.h"
+#include "ncmlib/log.h"
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    using ncm::log::level;
+
+    constexpr const char* HEADER = "# ncmpp journal 1";
+
+    /** @brief Lines collected before the journal is written */
+    constexpr size_t JOURNAL_BATCH = 256;
+
+    /** @brief Longest time a finished job waits to be written, as long as jobs keep finishing */
+    constexpr chrono::seconds JOURNAL_INTERVAL{1};
+
+    /** @brief 64-bit FNV-1a, continued from h */
+    uint64_t fnv1a(const string& s, uint64_t h = 0xcbf29ce484222325ull) {
+        for (unsigned char c : s) {
+            h ^= c;
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    uint64_t job_key(const string& input, const string& output) {
+        return fnv1a(output, fnv1a(string(1, '\0'), fnv1a(input)));
+    }
+
+    void append_field(string& out, const string& field) {
+        for (char c : field) {
+            switch (c) {
+                case '\\': out += "\\\\"; break;
+                case '\t': out += "\\t"; break;
+                case '\r': out += "\\r"; break;
+                case '\n': out += "\\n"; break;
+                default: out += c;
+            }
+        }
+    }
+
+    /** @brief Split a journal line into its unescaped fields */
+    vector<string> split_fields(const string& line) {
+        vector<string> fields(1);
+        for (size_t i = 0; i < line.size(); ++i) {
+            char c = line[i];
+            if (c == '\t') {
+                fields.emplace_back();
+            } else if (c == '\\' && i + 1 < line.size()) {
+                char e = line[++i];
+                fields.back() += e == 't' ? '\t' : e == 'r' ? '\r' : e == 'n' ? '\n' : e;
+            } else {
+                fields.back() += c;
+            }
+        }
+        return fields;
+    }
+} // anonymous namespace
+
+journal::journal(const filesystem::path& path, bool resume) : path_(path.string()) {
+    bool append = false;
+    if (resume) {
+        ifstream in(path, ios::binary);
+        stringstream text;
+        if (in.is_open()) {
+            text << in.rdbuf();
+        }
+        if (!text.str().empty()) {
+            load(text.str());
+            append = true;
+            // A run killed mid-write leaves a partial last line; start on a fresh one
+            if (text.str().back() != '\n') {
+                pending_ = "\n";
+            }
+        } else {
+            NCM_LOG(level::info, "No journal at " + path_ + " yet; starting a new one");
+        }
+    }
+
+    out_.open(path, ios::binary | (append ? ios::app : ios::trunc));
+    if (!out_.is_open()) {
+        throw runtime_error("Unable to open journal: " + path_);
+    }
+    if (!append) {
+        out_ << HEADER << '\n';
+        out_.flush();
+    }
+    last_write_ = chrono::steady_clock::now();
+}
+
+journal::~journal() {
+    try {
+        flush();
+    } catch (const exception& e) {
+        NCM_LOG(level::error, e.what());
+    }
+}
+
+/**
+ * @brief Rebuild the set of converted jobs from a journal's text
+ * @details A torn last line, from a run killed while writing, is ignored.
+ * @throws std::runtime_error if the text does not start with the journal header
+ */
+void journal::load(const string& text) {
+    size_t end = text.find('\n');
+    if (text.compare(0, end, HEADER) != 0) {
+        throw runtime_error("Not an ncmpp journal: " + path_);
+    }
+
+    unordered_set<uint64_t> failed;
+    size_t pos = end == string::npos ? text.size() : end + 1;
+    while (pos < text.size()) {
+        end = text.find('\n', pos);
+        if (end == string::npos) {
+            break;
+        }
+        vector<string> fields = split_fields(text.substr(pos, end - pos));
+        pos = end + 1;
+        if (fields.size() < 3) {
+            continue;
+        }
+        uint64_t key = job_key(fields[1], fields[2]);
+        if (fields[0] == "ok") {
+            done_.insert(key);
+            failed.erase(key);
+        } else {
+            failed.insert(key);
+            done_.erase(key);
+        }
+    }
+    loaded_failed_ = failed.size();
+}
+
+bool journal::completed(const filesystem::path& input, const filesystem::path& output) const {
+    return !done_.empty() && done_.count(job_key(input.string(), output.string())) != 0;
+}
+
+void journal::record(const filesystem::path& input, const filesystem::path& output, ncm::error_kind kind,
+                     const string& message) {
+    string line = kind == ncm::error_kind::none ? "ok" : ncm::error_kind_name(kind);
+    line += '\t';
+    append_field(line, input.string());
+    line += '\t';
+    append_field(line, output.string());
+    line += '\t';
+    append_field(line, message);
+    line += '\n';
+
+    lock_guard<mutex> lock(mtx_);
+    pending_ += line;
+    pending_lines_++;
+    if (pending_lines_ >= JOURNAL_BATCH || chrono::steady_clock::now() - last_write_ >= JOURNAL_INTERVAL) {
+        write_pending();
+    }
+}
+
+void journal::flush() {
+    lock_guard<mutex> lock(mtx_);
+    write_pending();
+}
+
+/**
+ * @brief Append the pending lines with one write; the caller holds mtx_
+ * @details A failed write is logged once and the lines are dropped: the
+ * conversions stand, and --resume only repeats them.
+ */
+void journal::write_pending() {
+    last_write_ = chrono::steady_clock::now();
+    if (pending_.empty()) {
+        return;
+    }
+    out_.write(pending_.data(), (streamsize)pending_.size());
+    out_.flush();
+    if (!out_ && !write_failed_) {
+        write_failed_ = true;
+        NCM_LOG(level::error, "Failed to write journal " + path_ + "; --resume will convert the unrecorded jobs again");
+    }
+    pending_.clear();
+    pending_lines_ = 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file journal.h
+ * @brief Checkpoint journal of finished jobs for resumable runs
+ * @details Every finished job is appended as one line: its outcome, input,
+ * output and error message. Lines are written in batches, so a run of
+ * millions of files costs one write per batch instead of one per file, and
+ * a killed run loses at most the last batch; those jobs are converted again
+ * on resume, which is safe because outputs are replaced atomically.
+ *
+ * Format: a "# ncmpp journal 1" header line, then one line per job with
+ * four tab-separated fields:
+ *
+ *     <outcome>  "ok" or the ncm::error_kind name ("corrupt", "output", ...)
+ *     <input>    input path as given
+ *     <output>   output path without extension
+ *     <message>  error message, empty for ok
+ *
+ * Backslash, tab, CR and LF inside fields are written as \\, \t, \r and \n.
+ * A job may appear more than once; its last line wins.
+ */
+
+#pragma once
+#include "ncmlib/error.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+/**
+ * @brief Thread-safe, append-only journal of job outcomes
+ */
+class journal {
+public:
+    /**
+     * @brief Open the journal at path
+     * @param resume Load the outcomes already recorded and append to them;
+     * otherwise the journal is started afresh
+     * @throws std::runtime_error if the journal cannot be read or created
+     */
+    journal(const std::filesystem::path& path, bool resume);
+
+    /** @brief Writes the pending lines; failures are logged */
+    ~journal();
+
+    journal(const journal&) = delete;
+    journal& operator=(const journal&) = delete;
+
+    /**
+     * @brief Whether the journal loaded on resume records input -> output as converted
+     * @details One hash lookup; safe to call from any thread.
+     */
+    bool completed(const std::filesystem::path& input, const std::filesystem::path& output) const;
+
+    /** @brief Record a finished job; kind none records a success */
+    void record(const std::filesystem::path& input, const std::filesystem::path& output,
+                ncm::error_kind kind = ncm::error_kind::none, const std::string& message = {});
+
+    /** @brief Write the pending lines now */
+    void flush();
+
+    /** @brief Converted jobs loaded on resume */
+    std::size_t completed_count() const { return done_.size(); }
+
+    /** @brief Jobs loaded on resume whose last outcome was a failure */
+    std::size_t failed_count() const { return loaded_failed_; }
+
+private:
+    void load(const std::string& text);
+    void write_pending();
+
+    std::string path_;
+    std::unordered_set<std::uint64_t> done_;  // key() of converted jobs; fixed after construction
+    std::size_t loaded_failed_ = 0;
+
+    std::mutex mtx_;
+    std::ofstream out_;
+    std::string pending_;
+    std::size_t pending_lines_ = 0;
+    std::chrono::steady_clock::time_point last_write_;
+    bool write_failed_ = false;
+};
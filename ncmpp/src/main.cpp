@@ -9,8 +9,69 @@
 #include "cmdline.h"
 #include "app_config.h"
 #include "app_logic.h"
+#include <algorithm>
 #include <thread>
 #include <iostream>
+#include <sstream>
+
+namespace {
+    /**
+     * @brief Split a PATH-style directory list
+     * @details Entries are separated by ';' on Windows, where ':' follows
+     * drive letters, and by ':' elsewhere.
+     */
+    std::vector<std::filesystem::path> split_dir_list(const std::string& list) {
+#ifdef _WIN32
+        const char separator = ';';
+#else
+        const char separator = ':';
+#endif
+        std::vector<std::filesystem::path> dirs;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, separator)) {
+            if (!item.empty()) {
+                dirs.emplace_back(item);
+            }
+        }
+        return dirs;
+    }
+
+    /**
+     * @brief Parse a positive count
+     * @return false if text is not a number of at least 1
+     */
+    bool parse_count(const std::string& text, unsigned int& value) {
+        if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos || text.size() > 9) {
+            return false;
+        }
+        value = (unsigned int)std::stoul(text);
+        return value > 0;
+    }
+
+    /**
+     * @brief Parse --io-limit entries: "N" for every device, "<path>=N" for the device holding path
+     */
+    bool parse_io_limits(const std::string& spec, app_config& config) {
+        std::stringstream ss(spec);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (item.empty()) {
+                continue;
+            }
+            size_t eq = item.rfind('=');
+            unsigned int count;
+            if (eq == std::string::npos) {
+                if (!parse_count(item, count)) return false;
+                config.io_limit = count;
+            } else {
+                if (eq == 0 || !parse_count(item.substr(eq + 1), count)) return false;
+                config.device_limits.emplace_back(item.substr(0, eq), count);
+            }
+        }
+        return true;
+    }
+} // anonymous namespace
 
 /**
  * @brief Main entry point for ncmpp application
@@ -27,9 +88,17 @@ int main(int argc, char* argv[]) {
         cmd.set_program_name("ncmpp");
         
         // Thread count option
-        cmd.add<unsigned int>("threads", 't', 
-            "Maximum number of concurrent processing threads", 
-            false, std::thread::hardware_concurrency());
+        cmd.add<std::string>("threads", 't', 
+            "Maximum number of concurrent processing threads (0 = one per core), or auto to tune files in flight per device", 
+            false, std::to_string(std::max(1u, std::thread::hardware_concurrency())));
+        cmd.add<std::string>("io-limit", '\0',
+            "--threads auto: most files in flight per device, as N and/or <path>=N entries separated by ','",
+            false, "");
+        
+        // Worker placement option
+        cmd.add<std::string>("affinity", '\0',
+            "Pin worker threads: off, node (to the CPUs of one NUMA node each) or cpu (one CPU each)",
+            false, "off", cmdline::oneof<std::string>("off", "node", "cpu"));
         
         // Timing option
         cmd.add("showtime", 's', 
@@ -45,6 +114,107 @@ int main(int argc, char* argv[]) {
             "Path to text file for output file list (batch mode) or directory for fallback mode", 
             false, "unlocked");
         
+        // Job file options
+        cmd.add<std::string>("jobs", '\0',
+            "Convert the jobs of a binary job file, or NUL-separated input/output pairs from stdin (-)",
+            false, "");
+        cmd.add<unsigned long long>("jobs-from", '\0',
+            "Skip this many jobs of --jobs, to resume an interrupted run",
+            false, 0);
+        cmd.add<std::string>("write-jobs", '\0',
+            "Write the -i/-o lists (or the .ncm files below the current directory) as a job file and exit",
+            false, "");
+        
+        // Direct I/O option
+        cmd.add("direct-io", '\0',
+            "Write audio files with direct I/O, bypassing the page cache");
+        
+        // io_uring engine options
+        cmd.add("io-uring", '\0',
+            "Use the asynchronous io_uring engine (Linux); --threads sets its CPU threads");
+        cmd.add<unsigned int>("inflight", '\0',
+            "Number of files kept in flight by the io_uring engine or the pipeline",
+            false, 16);
+        
+        // Pipelined batch mode option
+        cmd.add("pipeline", '\0',
+            "Stream the batch lists through separate read, decrypt and write stages with bounded memory");
+        
+        // Intra-file parallelism option
+        cmd.add<unsigned int>("split", '\0',
+            "Split audio of at least this many MiB across idle threads (0 disables)",
+            false, 64);
+        
+        // Probe mode option
+        cmd.add<std::string>("probe", '\0',
+            "Only read metadata and write one JSON object per file to this path (- for stdout)",
+            false, "");
+        
+        // Stream mode option
+        cmd.add<std::string>("stream", '\0',
+            "Decrypt this one .ncm file (- for stdin) to stdout; \"format: <ext>\" goes to stderr first",
+            false, "");
+        
+        // Incremental conversion option
+        cmd.add<std::string>("manifest", '\0',
+            "Skip inputs that are unchanged since they were converted, tracked in this file",
+            false, "");
+        
+        // Checkpoint options
+        cmd.add<std::string>("journal", '\0',
+            "Append every finished and failed job to this journal while the run progresses",
+            false, "");
+        cmd.add("resume", '\0',
+            "Skip the jobs --journal records as converted and retry the failed ones");
+        cmd.add<std::string>("failures", '\0',
+            "Write the failed jobs with their error codes to this path as JSON lines at exit",
+            false, "");
+        
+        // Watch mode options
+        cmd.add<std::string>("watch", '\0',
+            "Keep running and convert new or changed .ncm files below these directories (':'-separated, ';' on Windows) into -o",
+            false, "");
+        cmd.add<unsigned int>("debounce", '\0',
+            "Watch mode: convert a file once it has not changed for this many milliseconds",
+            false, 300);
+        
+        // Cover embedding option
+        cmd.add("embed-cover", '\0',
+            "Embed covers into FLAC/MP3 output instead of writing .jpg files");
+        cmd.add("tags", '\0',
+            "Write title, artist, album and duration from the NCM metadata into FLAC/MP3 output");
+        cmd.add<unsigned int>("cover-size", '\0',
+            "Downscale covers larger than this many pixels on their longest side to JPEG (0 keeps them as stored)",
+            false, 0);
+        cmd.add<unsigned int>("cover-quality", '\0',
+            "JPEG quality of downscaled covers",
+            false, 85, cmdline::range(1u, 100u));
+        
+        // Deduplication option
+        cmd.add<std::string>("dedupe", '\0',
+            "Link duplicate tracks and covers to the first copy: off, reflink (copy-on-write) or hardlink",
+            false, "off", cmdline::oneof<std::string>("off", "reflink", "hardlink"));
+        
+        // Durability option
+        cmd.add("fsync", '\0',
+            "Flush outputs to disk before renaming them into place, batched per directory");
+        
+        // Logging option
+        cmd.add<std::string>("log-level", '\0',
+            "Minimum log level: trace, debug, info, warn, error or off",
+            false, "info");
+        
+        // Instrumentation options
+        cmd.add<std::string>("metrics", '\0',
+            "Write per-stage counters and latency histograms to this path at exit (- for stderr)",
+            false, "");
+        cmd.add<std::string>("metrics-format", '\0',
+            "Format of --metrics: json or prometheus",
+            false, "json", cmdline::oneof<std::string>("json", "prometheus"));
+        cmd.add<std::string>("trace", '\0',
+            "Write one Chrome trace event per timed stage call to this path at exit",
+            false, "");
+        
         // Help option
         cmd.add("help", 'h', "Print this help message");
 
@@ -52,13 +222,73 @@ int main(int argc, char* argv[]) {
 
         // Configure application
         app_config config;
-        config.thread_count = cmd.get<unsigned int>("threads");
+        std::string threads = cmd.get<std::string>("threads");
+        config.auto_threads = threads == "auto";
+        if (!config.auto_threads) {
+            if (threads == "0") {
+                // Same as thread_pool(0): hardware concurrency, or 2 if unknown
+                unsigned int hw = std::thread::hardware_concurrency();
+                config.thread_count = hw ? hw : 2;
+            } else if (!parse_count(threads, config.thread_count)) {
+                std::cerr << "[ERROR] Thread count must be a number or auto" << std::endl;
+                return 1;
+            }
+        }
+        if (!parse_io_limits(cmd.get<std::string>("io-limit"), config)) {
+            std::cerr << "[ERROR] Invalid --io-limit: " << cmd.get<std::string>("io-limit") << std::endl;
+            return 1;
+        }
+        if (config.auto_threads) {
+            // Enough workers for the largest limit; the devices decide how many are busy
+            unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+            if (config.io_limit == 0) {
+                config.io_limit = std::clamp(cores * 4, 8u, 256u);
+            }
+            config.thread_count = config.io_limit;
+            for (const auto& limit : config.device_limits) {
+                config.thread_count = std::max(config.thread_count, limit.second);
+            }
+        }
+        std::string affinity = cmd.get<std::string>("affinity");
+        config.affinity = affinity == "cpu" ? affinity_mode::cpu
+                          : affinity == "node" ? affinity_mode::node
+                                               : affinity_mode::off;
         config.show_time = cmd.exist("showtime");
         config.input_file_list = cmd.get<std::string>("input");
+        config.job_file = cmd.get<std::string>("jobs");
+        config.jobs_from = cmd.get<unsigned long long>("jobs-from");
+        config.write_jobs = cmd.get<std::string>("write-jobs");
+        config.direct_io = cmd.exist("direct-io");
+        config.io_uring = cmd.exist("io-uring");
+        config.inflight = cmd.get<unsigned int>("inflight");
+        config.pipeline = cmd.exist("pipeline");
+        config.split_mb = cmd.get<unsigned int>("split");
+        config.probe_output = cmd.get<std::string>("probe");
+        config.stream_input = cmd.get<std::string>("stream");
+        config.manifest_path = cmd.get<std::string>("manifest");
+        config.journal_path = cmd.get<std::string>("journal");
+        config.resume = cmd.exist("resume");
+        config.failures_output = cmd.get<std::string>("failures");
+        config.watch_dirs = split_dir_list(cmd.get<std::string>("watch"));
+        config.debounce_ms = cmd.get<unsigned int>("debounce");
+        config.embed_cover = cmd.exist("embed-cover");
+        config.write_tags = cmd.exist("tags");
+        config.cover_size = cmd.get<unsigned int>("cover-size");
+        config.cover_quality = cmd.get<unsigned int>("cover-quality");
+        config.dedupe = cmd.get<std::string>("dedupe") != "off";
+        config.dedupe_hardlink = cmd.get<std::string>("dedupe") == "hardlink";
+        config.fsync = cmd.exist("fsync");
+        config.metrics_output = cmd.get<std::string>("metrics");
+        config.metrics_prometheus = cmd.get<std::string>("metrics-format") == "prometheus";
+        config.trace_output = cmd.get<std::string>("trace");
+        if (!ncm::log::parse_level(cmd.get<std::string>("log-level"), config.log_level)) {
+            std::cerr << "[ERROR] Unknown log level: " << cmd.get<std::string>("log-level") << std::endl;
+            return 1;
+        }
 
         // Determine output mode based on input file list
         std::string output_path_str = cmd.get<std::string>("output");
-        if (!config.input_file_list.empty()) {
+        if (!config.input_file_list.empty() && config.watch_dirs.empty()) {
             // Batch mode: output is a file list
             config.output_file_list = output_path_str;
         } else {
@@ -66,9 +296,13 @@ int main(int argc, char* argv[]) {
             config.output_dir = output_path_str;
         }
 
-        // Validate thread count
-        if (config.thread_count == 0) {
-            std::cerr << "[ERROR] Thread count must be at least 1" << std::endl;
+        if (config.resume && config.journal_path.empty()) {
+            std::cerr << "[ERROR] --resume needs --journal" << std::endl;
+            return 1;
+        }
+
+        if (config.inflight == 0) {
+            std::cerr << "[ERROR] In-flight file count must be at least 1" << std::endl;
             return 1;
         }
 
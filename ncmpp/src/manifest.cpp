@@ -0,0 +1,226 @@
+/**
+ * @file manifest.cpp
+ * @brief Conversion manifest implementation
+ */
+
+#include "manifest.h"
+#include "ncmlib/log.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    using ncm::log::level;
+
+    /** @brief Magic and version at the start of a manifest file */
+    constexpr char MAGIC[8] = {'N', 'C', 'M', 'P', 'P', 'M', 'F', 2};
+
+    /**
+     * @brief Bytes hashed at the start of each input
+     * @details Covers the per-file random key and the start of the metadata,
+     * which tells re-downloaded tracks apart even with equal size and mtime.
+     */
+    constexpr size_t HEADER_HASH_BYTES = 4096;
+
+    /** @brief 64-bit FNV-1a */
+    uint64_t fnv1a(const unsigned char* data, size_t len) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < len; ++i) {
+            h ^= data[i];
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    void put_u32(string& out, uint32_t v) {
+        for (int i = 0; i < 4; ++i) out += (char)(v >> (8 * i));
+    }
+
+    void put_u64(string& out, uint64_t v) {
+        for (int i = 0; i < 8; ++i) out += (char)(v >> (8 * i));
+    }
+
+    void put_string(string& out, const string& s) {
+        put_u32(out, (uint32_t)s.size());
+        out += s;
+    }
+
+    /**
+     * @brief Bounds-checked reader over a loaded manifest
+     */
+    class reader {
+    public:
+        reader(const string& data) : data_(data) {}
+
+        uint64_t u64(int bytes = 8) {
+            need(bytes);
+            uint64_t v = 0;
+            for (int i = 0; i < bytes; ++i) {
+                v |= (uint64_t)(unsigned char)data_[pos_ + i] << (8 * i);
+            }
+            pos_ += bytes;
+            return v;
+        }
+
+        uint32_t u32() { return (uint32_t)u64(4); }
+
+        string str() {
+            uint32_t len = u32();
+            need(len);
+            string s = data_.substr(pos_, len);
+            pos_ += len;
+            return s;
+        }
+
+    private:
+        void need(size_t n) {
+            if (data_.size() - pos_ < n) {
+                throw runtime_error("truncated manifest");
+            }
+        }
+
+        const string& data_;
+        size_t pos_ = sizeof(MAGIC);
+    };
+} // anonymous namespace
+
+uint64_t manifest::output_options(const ncm::dump_options& options, unsigned int cover_size,
+                                  unsigned int cover_quality) {
+    uint64_t key = (options.embed_cover ? 1 : 0) | (options.write_tags ? 2 : 0);
+    if (options.transform_cover) {
+        key |= (uint64_t)cover_size << 8 | (uint64_t)cover_quality << 40;
+    }
+    return key;
+}
+
+bool manifest::take_fingerprint(const filesystem::path& input, fingerprint& out) {
+    error_code ec;
+    uintmax_t size = filesystem::file_size(input, ec);
+    if (ec) return false;
+    auto mtime = filesystem::last_write_time(input, ec);
+    if (ec) return false;
+
+    ifstream in(input, ios::binary);
+    if (!in.is_open()) return false;
+    unsigned char header[HEADER_HASH_BYTES];
+    in.read((char*)header, sizeof(header));
+
+    out.size = (uint64_t)size;
+    out.mtime = (int64_t)mtime.time_since_epoch().count();
+    out.header_hash = fnv1a(header, (size_t)in.gcount());
+    return true;
+}
+
+manifest::manifest(filesystem::path path) : path_(std::move(path)) {
+    load();
+}
+
+bool manifest::up_to_date(const filesystem::path& input, const filesystem::path& output, const fingerprint& fp,
+                          uint64_t options) const {
+    string audio;
+    {
+        lock_guard<mutex> lock(mtx_);
+        auto it = entries_.find(input.string());
+        if (it == entries_.end()) return false;
+        const entry& e = it->second;
+        if (e.fp.size != fp.size || e.fp.mtime != fp.mtime || e.fp.header_hash != fp.header_hash ||
+            e.options != options || e.output != output.string()) {
+            return false;
+        }
+        audio = e.output + "." + e.format;
+    }
+    error_code ec;
+    return filesystem::is_regular_file(audio, ec);
+}
+
+void manifest::record(const filesystem::path& input, const filesystem::path& output, const fingerprint& fp,
+                      uint64_t options, const string& format) {
+    lock_guard<mutex> lock(mtx_);
+    entries_[input.string()] = {fp, options, output.string(), format};
+    dirty_ = true;
+}
+
+void manifest::forget(const filesystem::path& input) {
+    lock_guard<mutex> lock(mtx_);
+    if (entries_.erase(input.string()) > 0) {
+        dirty_ = true;
+    }
+}
+
+void manifest::save() {
+    lock_guard<mutex> lock(mtx_);
+    if (!dirty_) return;
+
+    string data(MAGIC, sizeof(MAGIC));
+    put_u32(data, (uint32_t)entries_.size());
+    for (const auto& [input, e] : entries_) {
+        put_u64(data, e.fp.size);
+        put_u64(data, (uint64_t)e.fp.mtime);
+        put_u64(data, e.fp.header_hash);
+        put_u64(data, e.options);
+        put_string(data, input);
+        put_string(data, e.output);
+        put_string(data, e.format);
+    }
+
+    filesystem::path tmp = path_;
+    tmp += ".tmp";
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        out.write(data.data(), data.size());
+        out.close();
+        if (!out) {
+            throw runtime_error("Unable to write manifest: " + tmp.string());
+        }
+    }
+    error_code ec;
+    filesystem::rename(tmp, path_, ec);
+    if (ec) {
+        throw runtime_error("Unable to replace manifest " + path_.string() + ": " + ec.message());
+    }
+    dirty_ = false;
+}
+
+size_t manifest::size() const {
+    lock_guard<mutex> lock(mtx_);
+    return entries_.size();
+}
+
+void manifest::load() {
+    ifstream in(path_, ios::binary);
+    if (!in.is_open()) {
+        return;
+    }
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    try {
+        if (data.size() < sizeof(MAGIC) || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            throw runtime_error("not a manifest of this version");
+        }
+        reader r(data);
+        uint32_t count = r.u32();
+        unordered_map<string, entry> entries;
+        // Every entry takes more than 44 bytes, which bounds a corrupt count
+        entries.reserve(min<size_t>(count, data.size() / 44));
+        for (uint32_t i = 0; i < count; ++i) {
+            entry e;
+            e.fp.size = r.u64();
+            e.fp.mtime = (int64_t)r.u64();
+            e.fp.header_hash = r.u64();
+            e.options = r.u64();
+            string input = r.str();
+            e.output = r.str();
+            e.format = r.str();
+            entries.emplace(std::move(input), std::move(e));
+        }
+        entries_ = std::move(entries);
+    } catch (const exception& e) {
+        NCM_LOG(level::warn, "Ignoring manifest " + path_.string() + ": " + e.what());
+    }
+}
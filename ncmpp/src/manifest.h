@@ -0,0 +1,121 @@
+/**
+ * @file manifest.h
+ * @brief Persistent index of converted files for incremental runs
+ * @details Maps each input path to a fingerprint of the input, the options
+ * that shaped the output and the output it produced. A later run skips inputs
+ * whose fingerprint and options are unchanged and whose output still exists, with one hash lookup, one stat and one small
+ * read per file.
+ */
+
+#pragma once
+#include "ncmlib/ncmdump.h"
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Thread-safe conversion manifest stored as a compact binary file
+ * @details File layout (little endian):
+ * - 8-byte magic "NCMPPMF" followed by a version byte
+ * - u32 entry count
+ * - Per entry: u64 size, i64 mtime, u64 header hash, u64 output options,
+ *   then the input path, output path and format, each as a u32 length and
+ *   the bytes
+ */
+class manifest {
+public:
+    /**
+     * @brief Identity of an input file
+     */
+    struct fingerprint {
+        /** @brief File size in bytes */
+        std::uint64_t size = 0;
+
+        /** @brief Last write time in the file clock's native ticks */
+        std::int64_t mtime = 0;
+
+        /** @brief Hash of the first bytes of the file (key and metadata blocks) */
+        std::uint64_t header_hash = 0;
+    };
+
+    /**
+     * @brief Fingerprint an input file
+     * @param input File to fingerprint
+     * @param out Receives the fingerprint
+     * @return false if the file cannot be read
+     */
+    static bool take_fingerprint(const std::filesystem::path& input, fingerprint& out);
+
+    /**
+     * @brief Value identifying the options that change the bytes of an output
+     * @details Kept in the manifest, so a rerun with other tag or cover
+     * options converts the files again. direct_io only changes how the bytes
+     * are written and is left out.
+     * @param options Options of the dump
+     * @param cover_size Edge of the transformed cover, used with options.transform_cover
+     * @param cover_quality JPEG quality of the transformed cover, used with options.transform_cover
+     */
+    static std::uint64_t output_options(const ncm::dump_options& options, unsigned int cover_size = 0,
+                                        unsigned int cover_quality = 0);
+
+    /**
+     * @brief Load the manifest at path, starting empty if it does not exist
+     * @details A manifest that cannot be parsed is discarded with a warning,
+     * which only costs a full conversion.
+     */
+    explicit manifest(std::filesystem::path path);
+
+    /**
+     * @brief Whether input was converted to output with these options and is unchanged since
+     * @param input Input path as listed
+     * @param output Output path without extension
+     * @param fp Current fingerprint of input
+     * @param options Value identifying the options that change the bytes written
+     */
+    bool up_to_date(const std::filesystem::path& input, const std::filesystem::path& output, const fingerprint& fp,
+                    std::uint64_t options) const;
+
+    /**
+     * @brief Record a successful conversion
+     * @param input Input path as listed
+     * @param output Output path without extension
+     * @param fp Fingerprint of input taken before the conversion
+     * @param options Options the output was written with, as passed to up_to_date()
+     * @param format Audio format written
+     */
+    void record(const std::filesystem::path& input, const std::filesystem::path& output, const fingerprint& fp,
+                std::uint64_t options, const std::string& format);
+
+    /**
+     * @brief Drop the entry of input, e.g. after a failed conversion
+     */
+    void forget(const std::filesystem::path& input);
+
+    /**
+     * @brief Write the manifest if it changed since it was loaded
+     * @details Writes a temporary file and renames it over the manifest, so
+     * an interrupted save leaves the previous manifest intact.
+     * @throws std::runtime_error if the manifest cannot be written
+     */
+    void save();
+
+    /** @brief Number of entries */
+    std::size_t size() const;
+
+private:
+    struct entry {
+        fingerprint fp;
+        std::uint64_t options = 0;
+        std::string output;
+        std::string format;
+    };
+
+    void load();
+
+    std::filesystem::path path_;
+    mutable std::mutex mtx_;
+    std::unordered_map<std::string, entry> entries_;
+    bool dirty_ = false;
+};
@@ -0,0 +1,367 @@
+/**
+ * @file pipeline.cpp
+ * @brief Staged batch converter implementation
+ * @details Jobs flow source -> read -> decrypt -> write as pieces carrying
+ * one pool buffer each. A file's state is shared by its pieces; the read
+ * stage publishes the piece count with the last piece it queues, and the
+ * write stage finishes the file once it has written that many pieces.
+ */
+
+#include "pipeline.h"
+#include "bounded_queue.h"
+#include "ncmlib/commit.h"
+#include "ncmlib/decoder.h"
+#include "ncmlib/error.h"
+#include "ncmlib/log.h"
+#include "ncmlib/metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    using ncm::log::level;
+
+    /** @brief First header read; large enough for the key and metadata of typical files */
+    constexpr size_t INITIAL_HEADER_READ = 64 * 1024;
+
+    /**
+     * @brief State of one file, shared by all of its pieces
+     */
+    struct file_state {
+        batch_pipeline::job job;
+        ncm::Decoder decoder;
+        chrono::steady_clock::time_point start;
+
+        /** @brief File bytes through the end of the cover; released once the cover is written */
+        vector<unsigned char> header;
+
+        // Read stage; read_error and read_kind are published by the last piece
+        atomic<size_t> pieces{0};   // total pieces, 0 while still reading
+        string read_error;
+        ncm::error_kind read_kind = ncm::error_kind::none;
+
+        /** @brief Set by the write stage so the read stage stops early */
+        atomic<bool> failed{false};
+
+        // Write stage only; the audio goes to temp until it is complete
+        ofstream out;
+        string audio_path;
+        string temp_path;
+        bool opened = false;
+        size_t written = 0;
+        string write_error;
+        ncm::error_kind write_kind = ncm::error_kind::none;
+    };
+
+    /**
+     * @brief One audio chunk moving through the stages
+     */
+    struct piece {
+        shared_ptr<file_state> file;
+        uint64_t pos = 0;           // position relative to the audio start
+        unsigned char* buf = nullptr;
+        size_t len = 0;
+        bool last = false;
+    };
+
+    /**
+     * @brief One pipeline run
+     */
+    class pipeline_run {
+    public:
+        pipeline_run(const batch_pipeline::options& opts, const batch_pipeline::source& next,
+                     const batch_pipeline::completion& on_done)
+            : opts_(opts), next_(next), on_done_(on_done),
+              jobs_(opts.buffers), free_(opts.buffers), reads_(opts.buffers), writes_(opts.buffers) {
+            storage_.resize(opts_.buffers);
+            for (auto& b : storage_) {
+                b.reset(new unsigned char[opts_.chunk_size]);
+                free_.push(b.get());
+            }
+        }
+
+        void run() {
+            readers_left_.store(opts_.read_threads);
+            decrypters_left_.store(opts_.decrypt_threads);
+
+            vector<thread> threads;
+            threads.emplace_back([this] { source_stage(); });
+            for (unsigned int i = 0; i < opts_.read_threads; ++i) {
+                threads.emplace_back([this] { read_stage(); });
+            }
+            for (unsigned int i = 0; i < opts_.decrypt_threads; ++i) {
+                threads.emplace_back([this] { decrypt_stage(); });
+            }
+
+            write_stage();
+
+            for (auto& t : threads) {
+                t.join();
+            }
+            if (source_error_) {
+                rethrow_exception(source_error_);
+            }
+        }
+
+    private:
+        void source_stage() {
+            try {
+                batch_pipeline::job j;
+                while (next_(j)) {
+                    jobs_.push(std::move(j));
+                    j = batch_pipeline::job();
+                }
+            } catch (...) {
+                source_error_ = current_exception();
+            }
+            jobs_.close();
+        }
+
+        void read_stage() {
+            while (auto j = jobs_.pop()) {
+                auto f = make_shared<file_state>();
+                f->job = std::move(*j);
+                f->start = chrono::steady_clock::now();
+                read_file(f);
+            }
+            if (readers_left_.fetch_sub(1) == 1) {
+                reads_.close();
+            }
+        }
+
+        /**
+         * @brief Parse the header and queue the audio as pieces
+         * @details Always queues at least one piece, the last one carrying the
+         * piece count and any read error.
+         */
+        void read_file(const shared_ptr<file_state>& f) {
+            size_t queued = 0;
+            try {
+                NCM_LOG(level::info, "Processing: " + f->job.input.filename().string());
+                ifstream in;
+                {
+                    ncm::metrics::span t(ncm::metrics::stage::open);
+                    in.open(f->job.input, ios::binary);
+                }
+                if (!in.is_open()) {
+                    throw ncm::Error(ncm::error_kind::input, "Unable to open input file");
+                }
+                read_header(in, *f);
+
+                in.seekg((streamoff)f->decoder.audio_offset());
+                uint64_t pos = 0;
+                while (!f->failed.load(memory_order_relaxed)) {
+                    unsigned char* buf = *free_.pop();
+                    size_t len;
+                    {
+                        ncm::metrics::span t(ncm::metrics::stage::audio_read);
+                        in.read((char*)buf, opts_.chunk_size);
+                        len = (size_t)in.gcount();
+                        t.add_bytes(len);
+                    }
+                    if (len == 0) {
+                        free_.push(buf);
+                        if (in.bad()) {
+                            throw ncm::Error(ncm::error_kind::input, "Failed to read audio data");
+                        }
+                        break;
+                    }
+                    reads_.push({f, pos, buf, len, false});
+                    queued++;
+                    pos += len;
+                }
+            } catch (const exception& e) {
+                f->read_error = e.what();
+                f->read_kind = ncm::classify(e);
+            }
+
+            // Empty marker closing the file; also creates outputs of files without audio
+            f->pieces.store(queued + 1, memory_order_release);
+            writes_.push({f, 0, nullptr, 0, true});
+        }
+
+        /**
+         * @brief Read and parse the header through the cover image
+         * @details The input size bounds what the length fields may claim, so
+         * a corrupt file fails here instead of sizing the buffer from them.
+         */
+        void read_header(ifstream& in, file_state& f) {
+            in.seekg(0, ios::end);
+            streamoff file_size = in.tellg();
+            in.seekg(0);
+            if (file_size < 0) {
+                throw ncm::Error(ncm::error_kind::input, "Unable to determine the input size");
+            }
+
+            size_t len = 0;
+            size_t needed = (size_t)min<uint64_t>(INITIAL_HEADER_READ, (uint64_t)file_size);
+            while (true) {
+                f.header.resize(needed);
+                in.read((char*)f.header.data() + len, needed - len);
+                len += (size_t)in.gcount();
+                needed = f.decoder.parse_header(f.header.data(), len, (uint64_t)file_size);
+                if (needed == 0) {
+                    break;
+                }
+                if (len < f.header.size()) {
+                    throw ncm::Error(ncm::error_kind::truncated, "Truncated NCM header");
+                }
+            }
+            size_t cover_end = (size_t)(f.decoder.cover_offset() + f.decoder.cover_size());
+            f.header.resize(cover_end);
+            in.clear();
+        }
+
+        void decrypt_stage() {
+            while (auto p = reads_.pop()) {
+                const file_state& f = *p->file;
+                if (p->len > 0 && !f.failed.load(memory_order_relaxed)) {
+                    f.decoder.decrypt(p->buf, p->buf, p->len, p->pos);
+                }
+                writes_.push(std::move(*p));
+            }
+            if (decrypters_left_.fetch_sub(1) == 1) {
+                // Last pieces of each file bypass decryption, so this stage
+                // only owns the queue once the readers are done as well
+                writes_.close();
+            }
+        }
+
+        void write_stage() {
+            while (auto p = writes_.pop()) {
+                file_state& f = *p->file;
+                bool read_failed = p->last && !f.read_error.empty();
+                if (!read_failed && f.write_error.empty()) {
+                    try {
+                        if (!f.opened) {
+                            open_outputs(f);
+                        }
+                        if (p->len > 0) {
+                            ncm::metrics::span t(ncm::metrics::stage::audio_write);
+                            t.add_bytes(p->len);
+                            f.out.seekp((streamoff)p->pos);
+                            f.out.write((const char*)p->buf, p->len);
+                            if (!f.out) {
+                                throw ncm::Error(ncm::error_kind::output, "Failed to write audio data");
+                            }
+                        }
+                    } catch (const exception& e) {
+                        f.write_error = e.what();
+                        f.write_kind = ncm::classify(e);
+                        f.failed.store(true, memory_order_relaxed);
+                    }
+                }
+                if (p->buf) {
+                    free_.push(p->buf);
+                }
+
+                f.written++;
+                if (f.written == f.pieces.load(memory_order_acquire)) {
+                    finish(f);
+                }
+            }
+        }
+
+        void open_outputs(file_state& f) {
+            f.opened = true;
+            filesystem::path dir = f.job.output.parent_path();
+            if (!dir.empty()) {
+                filesystem::create_directories(dir);
+            }
+
+            if (f.decoder.cover_size() > 0) {
+                filesystem::path cover_path = f.job.output;
+                cover_path += ".jpg";
+                string temp = ncm::temp_path(cover_path.string());
+                ofstream cover(temp, ios::binary | ios::trunc);
+                cover.write((const char*)f.header.data() + f.decoder.cover_offset(), f.decoder.cover_size());
+                cover.close();
+                bool written = !cover.fail();
+                if (written) {
+                    try {
+                        ncm::commit_file(temp, cover_path.string());
+                    } catch (const exception&) {
+                        written = false;
+                    }
+                }
+                if (!written) {
+                    NCM_LOG(level::warn, "Failed to write cover image " + cover_path.string());
+                    error_code ec;
+                    filesystem::remove(temp, ec);
+                }
+            }
+            f.header = vector<unsigned char>();
+
+            f.audio_path = f.job.output.string() + "." + f.decoder.format();
+            f.temp_path = ncm::temp_path(f.audio_path);
+            f.out.open(f.temp_path, ios::binary | ios::trunc);
+            if (!f.out.is_open()) {
+                throw ncm::Error(ncm::error_kind::output, "Unable to open output file: " + f.temp_path);
+            }
+        }
+
+        void finish(file_state& f) {
+            if (f.out.is_open()) {
+                f.out.close();
+                if (f.out.fail() && f.write_error.empty()) {
+                    f.write_error = "Failed to close output file";
+                    f.write_kind = ncm::error_kind::output;
+                }
+            }
+            if (!f.temp_path.empty()) {
+                if (f.read_error.empty() && f.write_error.empty()) {
+                    try {
+                        ncm::commit_file(f.temp_path, f.audio_path);
+                    } catch (const exception& e) {
+                        f.write_error = e.what();
+                        f.write_kind = ncm::classify(e);
+                    }
+                }
+                if (!f.read_error.empty() || !f.write_error.empty()) {
+                    error_code ec;
+                    filesystem::remove(f.temp_path, ec);
+                }
+            }
+            bool read_failed = !f.read_error.empty();
+            const string& error = read_failed ? f.read_error : f.write_error;
+            ncm::error_kind kind = read_failed ? f.read_kind : f.write_kind;
+            auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - f.start).count();
+            on_done_(f.job, kind, error, f.decoder.format(), elapsed);
+        }
+
+        const batch_pipeline::options& opts_;
+        const batch_pipeline::source& next_;
+        const batch_pipeline::completion& on_done_;
+
+        vector<unique_ptr<unsigned char[]>> storage_;
+        bounded_queue<batch_pipeline::job> jobs_;
+        bounded_queue<unsigned char*> free_;
+        bounded_queue<piece> reads_;
+        bounded_queue<piece> writes_;
+
+        atomic<unsigned int> readers_left_{0};
+        atomic<unsigned int> decrypters_left_{0};
+        exception_ptr source_error_;
+    };
+} // anonymous namespace
+
+batch_pipeline::batch_pipeline(options opts) : opts_(opts) {
+    if (opts_.read_threads == 0) opts_.read_threads = 1;
+    if (opts_.decrypt_threads == 0) opts_.decrypt_threads = 1;
+    if (opts_.buffers == 0) opts_.buffers = 1;
+    if (opts_.chunk_size == 0) opts_.chunk_size = 1024 * 1024;
+}
+
+void batch_pipeline::run(const source& next, const completion& on_done) {
+    pipeline_run(opts_, next, on_done).run();
+}
@@ -0,0 +1,85 @@
+/**
+ * @file pipeline.h
+ * @brief Staged batch converter with bounded memory
+ * @details Splits conversion into a job source, read, decrypt and write
+ * stages running on their own threads and linked by bounded lock-free
+ * queues. Audio moves through the stages in chunks taken from a fixed
+ * buffer pool, so memory use follows the pool size rather than the number
+ * of files, and disk reads overlap with decryption and writes.
+ */
+
+#pragma once
+#include "ncmlib/error.h"
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+/**
+ * @brief Four-stage conversion pipeline
+ * @details
+ * - Source: one thread pulling jobs from a caller-supplied generator
+ * - Read: threads parsing headers and reading audio chunks into pool buffers
+ * - Decrypt: threads applying the keystream in place
+ * - Write: the calling thread, writing chunks at their offsets and
+ *   returning buffers to the pool
+ */
+class batch_pipeline {
+public:
+    /**
+     * @brief One input/output pair
+     */
+    struct job {
+        /** @brief Path to the input .ncm file */
+        std::filesystem::path input;
+
+        /** @brief Output path without extension */
+        std::filesystem::path output;
+    };
+
+    /**
+     * @brief Pipeline tuning parameters
+     */
+    struct options {
+        /** @brief Threads reading headers and audio */
+        unsigned int read_threads = 2;
+
+        /** @brief Threads decrypting audio chunks */
+        unsigned int decrypt_threads = 2;
+
+        /** @brief Audio buffers shared by all files in flight */
+        unsigned int buffers = 64;
+
+        /** @brief Size of each audio buffer */
+        std::size_t chunk_size = 1024 * 1024;
+    };
+
+    /**
+     * @brief Produce the next job
+     * @return false once there are no more jobs
+     * @details Called from the source thread only. An exception stops the
+     * source; jobs already produced still complete and run() rethrows it.
+     */
+    using source = std::function<bool(job& out)>;
+
+    /**
+     * @brief Per-file completion callback
+     * @details Called on the thread running run() with kind none and an empty
+     * error on success. format is the audio format written, empty if the
+     * header was not parsed.
+     */
+    using completion = std::function<void(const job& j, ncm::error_kind kind, const std::string& error,
+                                          const std::string& format, long long elapsed_ms)>;
+
+    explicit batch_pipeline(options opts);
+
+    /**
+     * @brief Process jobs until the source is exhausted and every file completed
+     * @param next Job generator
+     * @param on_done Called once per job
+     */
+    void run(const source& next, const completion& on_done);
+
+private:
+    options opts_;
+};
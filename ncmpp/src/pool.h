@@ -1,108 +1,326 @@
 /**
  * @file pool.h
- * @brief Thread pool implementation for concurrent NCM file processing
- * @details Provides a simple thread pool for parallel processing of NCM files
- * @note Uses C++11 features for cross-platform compatibility
+ * @brief Work-stealing thread pool for concurrent NCM file processing
+ * @details Each worker owns a queue of move-only tasks. Tasks submitted from
+ * outside the pool are spread over the queues and kept in a heap by weight,
+ * so the largest files start first; idle workers steal the heaviest
+ * remaining task of another queue before going to sleep. Workers may be
+ * pinned to NUMA nodes; tasks can then be routed to a node, and stealing
+ * prefers the worker's own node.
  */
 
 #pragma once
-#include <vector>
-#include <functional>
-#include <future>
-#include <queue>
-#include <mutex>
+#include "ncmlib/metrics.h"
+#include "ncmlib/ncmdump.h"
+#include "topology.h"
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 /**
- * @brief Simple thread pool for concurrent task execution
- * @details Implements a basic thread pool with:
- * - Dynamic thread count based on hardware concurrency
- * - Safe task enqueuing with future support
- * - Automatic cleanup in destructor
- * - Graceful handling of empty thread counts
+ * @brief Work-stealing pool running move-only tasks without futures
+ * @details
+ * - Per-worker queues, each behind its own short-held mutex
+ * - External submissions go into a per-queue heap by weight (e.g. file
+ *   size), heaviest first and in submission order among equal weights;
+ *   unsorted producers cost O(log n) per task
+ * - Submissions from a worker go to the front of its own queue, ahead of
+ *   the heap, where idle workers steal them first
+ * - The destructor runs every queued task before joining
+ * - Exceptions escaping a task are discarded
+ * - While ncm::metrics is recording, the time each task spent queued is
+ *   recorded as the queue_wait stage
+ * - Pinned workers allocate their per-thread decoding state right after
+ *   pinning, so it is placed on their node
  */
 class thread_pool {
-    std::vector<std::thread> threads;
-    std::mutex mtx;
-    std::condition_variable cv;
-    std::queue<std::function<void()>> tasks;
-    bool stop = false;
-
 public:
+    /**
+     * @brief Type-erased, move-only nullary callable
+     */
+    class task {
+    public:
+        task() = default;
+
+        template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, task>>>
+        task(F&& f) : impl_(std::make_unique<model<std::decay_t<F>>>(std::forward<F>(f))) {}
+
+        task(task&&) noexcept = default;
+        task& operator=(task&&) noexcept = default;
+
+        void operator()() { impl_->run(); }
+        explicit operator bool() const { return impl_ != nullptr; }
+
+    private:
+        struct concept_t {
+            virtual ~concept_t() = default;
+            virtual void run() = 0;
+        };
+
+        template <typename F>
+        struct model : concept_t {
+            F fn;
+            template <typename G>
+            explicit model(G&& g) : fn(std::forward<G>(g)) {}
+            void run() override { fn(); }
+        };
+
+        std::unique_ptr<concept_t> impl_;
+    };
+
     /**
      * @brief Construct a thread pool with specified number of threads
      * @param n Number of threads to create (0 = use hardware concurrency)
-     * @details Automatically adjusts for edge cases:
-     * - If n=0, uses std::thread::hardware_concurrency()
-     * - If hardware_concurrency() returns 0, defaults to 2 threads
-     * - Creates worker threads that wait for tasks
+     * @param placement CPUs and node of each worker, see plan_workers(); empty leaves them unpinned
+     * @details If hardware_concurrency() returns 0 as well, defaults to 2 threads.
      */
-    thread_pool(unsigned int n) {
+    explicit thread_pool(unsigned int n, std::vector<worker_placement> placement = {})
+        : placement_(std::move(placement)) {
         if (n == 0) {
             n = std::thread::hardware_concurrency();
         }
         if (n == 0) { // hardware_concurrency might return 0
             n = 2;
         }
-        for (auto i = 0u; i < n; ++i) {
-            threads.emplace_back([this] {
-                while (true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(mtx);
-                        cv.wait(lock, [this] { return stop || !tasks.empty(); });
-                        if (stop && tasks.empty()) {
-                            return;
-                        }
-                        task = std::move(tasks.front());
-                        tasks.pop();
-                    }
-                    task();
-                }
-            });
+        queues_.reserve(n);
+        for (unsigned int i = 0; i < n; ++i) {
+            queues_.push_back(std::make_unique<worker_queue>());
+        }
+        placement_.resize(n);
+        plan_stealing();
+        threads_.reserve(n);
+        for (unsigned int i = 0; i < n; ++i) {
+            threads_.emplace_back([this, i] { worker_loop(i); });
         }
     }
 
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
     /**
-     * @brief Destructor cleans up all threads
-     * @details Signals all threads to stop and joins them safely
+     * @brief Run all queued tasks, then join the workers
      */
     ~thread_pool() {
         {
-            std::unique_lock<std::mutex> lock(mtx);
-            stop = true;
+            std::lock_guard<std::mutex> lock(idle_mtx_);
+            stop_.store(true);
         }
-        cv.notify_all();
-        for (auto& i : threads) {
-            if (i.joinable()) {
-                i.join();
+        idle_cv_.notify_all();
+        for (auto& t : threads_) {
+            if (t.joinable()) {
+                t.join();
             }
         }
     }
 
     /**
-     * @brief Enqueue a task for execution in the thread pool
-     * @tparam F Function type
-     * @tparam Args Argument types
-     * @param f Function to execute
-     * @param args Arguments to pass to the function
-     * @return std::future for retrieving the result
-     * @throws std::runtime_error if trying to enqueue on stopped pool
-     * @details Provides thread-safe task enqueuing with future support
+     * @brief Queue a task
+     * @param t Task to run
+     * @param weight Relative cost used for ordering; heavier tasks start first
+     * @param node Preferred NUMA node; ignored if no worker is pinned there
+     * or the caller is a worker
+     * @throws std::runtime_error if the pool is stopping and the caller is not
+     * one of its workers
+     * @details Workers may still enqueue while the pool shuts down: the
+     * enqueuing worker is alive and drains the queues before exiting.
+     */
+    void enqueue(task t, std::uint64_t weight = 0, int node = -1) {
+        std::uint64_t queued_ns = ncm::metrics::enabled() ? ncm::metrics::now_ns() : 0;
+        worker_id& self = current();
+        if (self.pool == this) {
+            worker_queue& q = *queues_[self.index];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            // Counted before the task becomes visible, so pending_ never underflows
+            pending_.fetch_add(1);
+            q.local.push_front({weight, 0, queued_ns, std::move(t)});
+        } else {
+            if (stop_.load()) {
+                throw std::runtime_error("enqueue on stopped thread_pool");
+            }
+            size_t index = pick_queue(node);
+            worker_queue& q = *queues_[index];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            pending_.fetch_add(1);
+            q.heap.push_back({weight, q.next_seq++, queued_ns, std::move(t)});
+            std::push_heap(q.heap.begin(), q.heap.end(), lighter);
+        }
+        if (sleepers_.load() > 0) {
+            std::lock_guard<std::mutex> lock(idle_mtx_);
+            idle_cv_.notify_one();
+        }
+    }
+
+    /** @brief Number of worker threads */
+    size_t size() const { return threads_.size(); }
+
+private:
+    struct entry {
+        std::uint64_t weight;
+        std::uint64_t seq;          // Submission order within the heap
+        std::uint64_t queued_ns;    // 0 unless metrics were recording
+        task fn;
+    };
+
+    /** @brief Heap order: heavier first, then earlier */
+    static bool lighter(const entry& a, const entry& b) {
+        return a.weight != b.weight ? a.weight < b.weight : a.seq > b.seq;
+    }
+
+    struct worker_queue {
+        std::mutex mtx;
+        std::deque<entry> local;    // Submitted by the owning worker, newest first
+        std::vector<entry> heap;    // Submitted from outside, max-heap by lighter()
+        std::uint64_t next_seq = 0;
+    };
+
+    /** @brief Workers pinned to one node */
+    struct node_queues {
+        int node;
+        std::vector<size_t> workers;
+        std::atomic<size_t> next{0};
+    };
+
+    struct worker_id {
+        thread_pool* pool = nullptr;
+        size_t index = 0;
+    };
+
+    /** @brief Pool and queue owned by the calling worker thread, if any */
+    static worker_id& current() {
+        thread_local worker_id id;
+        return id;
+    }
+
+    /**
+     * @brief Take the next task of queue index: the newest worker submission, else the heaviest
      */
-    template <typename F, typename... Args> 
-    auto enqueue(F&& f, Args &&...args) -> std::future<std::invoke_result_t<F, Args...>> {
-        using return_type = std::invoke_result_t<F, Args...>;
-        auto task = std::make_shared<std::packaged_task<return_type()>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-        auto ret = task->get_future();
+    bool try_pop(size_t index, task& out) {
+        worker_queue& q = *queues_[index];
+        std::uint64_t queued_ns;
         {
-            std::unique_lock<std::mutex> lock(mtx);
-            if(stop) throw std::runtime_error("enqueue on stopped thread_pool");
-            tasks.emplace([task] { (*task)(); });
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if (!q.local.empty()) {
+                queued_ns = q.local.front().queued_ns;
+                out = std::move(q.local.front().fn);
+                q.local.pop_front();
+            } else if (!q.heap.empty()) {
+                std::pop_heap(q.heap.begin(), q.heap.end(), lighter);
+                queued_ns = q.heap.back().queued_ns;
+                out = std::move(q.heap.back().fn);
+                q.heap.pop_back();
+            } else {
+                return false;
+            }
+            pending_.fetch_sub(1);
+        }
+        if (queued_ns) {
+            std::uint64_t now = ncm::metrics::now_ns();
+            ncm::metrics::record(ncm::metrics::stage::queue_wait, queued_ns, now - queued_ns);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Order in which each worker visits the other queues: its own node first, then the rest in turn
+     */
+    void plan_stealing() {
+        size_t n = queues_.size();
+        steal_order_.resize(n);
+        for (size_t self = 0; self < n; ++self) {
+            std::vector<size_t> remote;
+            for (size_t k = 1; k < n; ++k) {
+                size_t other = (self + k) % n;
+                (placement_[other].node == placement_[self].node ? steal_order_[self] : remote).push_back(other);
+            }
+            steal_order_[self].insert(steal_order_[self].end(), remote.begin(), remote.end());
+        }
+        for (size_t i = 0; i < n; ++i) {
+            int node = placement_[i].node;
+            if (node < 0) continue;
+            auto it = std::find_if(nodes_.begin(), nodes_.end(), [node](const auto& q) { return q->node == node; });
+            if (it == nodes_.end()) {
+                nodes_.push_back(std::make_unique<node_queues>());
+                nodes_.back()->node = node;
+                it = nodes_.end() - 1;
+            }
+            (*it)->workers.push_back(i);
+        }
+    }
+
+    /**
+     * @brief Queue for an external submission: the next worker of node, or of the whole pool
+     */
+    size_t pick_queue(int node) {
+        if (node >= 0) {
+            for (auto& q : nodes_) {
+                if (q->node == node) {
+                    return q->workers[q->next.fetch_add(1, std::memory_order_relaxed) % q->workers.size()];
+                }
+            }
         }
-        cv.notify_one();
-        return ret;
+        return next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
     }
-};
\ No newline at end of file
+
+    /**
+     * @brief Find work: own queue first, then the node's queues, then the rest
+     */
+    bool find_task(size_t self, task& out) {
+        if (try_pop(self, out)) {
+            return true;
+        }
+        for (size_t other : steal_order_[self]) {
+            if (try_pop(other, out)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(size_t self) {
+        current() = {this, self};
+        if (!placement_[self].cpus.empty() && pin_current_thread(placement_[self].cpus)) {
+            ncm::prepare_thread();
+        }
+        task t;
+        while (true) {
+            if (find_task(self, t)) {
+                try {
+                    t();
+                } catch (...) {
+                    // Tasks report their own failures; keep the worker alive
+                }
+                t = task();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(idle_mtx_);
+            sleepers_.fetch_add(1);
+            idle_cv_.wait(lock, [this] { return pending_.load() > 0 || stop_.load(); });
+            sleepers_.fetch_sub(1);
+            if (pending_.load() == 0 && stop_.load()) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<worker_queue>> queues_;
+    std::vector<worker_placement> placement_;           // per worker; node -1 when unpinned
+    std::vector<std::vector<size_t>> steal_order_;      // per worker, queues to steal from
+    std::vector<std::unique_ptr<node_queues>> nodes_;   // workers of each pinned node
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_queue_{0};
+    std::atomic<size_t> pending_{0};
+    std::atomic<unsigned int> sleepers_{0};
+    std::atomic<bool> stop_{false};
+    std::mutex idle_mtx_;
+    std::condition_variable idle_cv_;
+};
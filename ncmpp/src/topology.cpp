@@ -0,0 +1,198 @@
+/**
+ * @file topology.cpp
+ * @brief NUMA topology, CPU pinning and storage locality implementation
+ * @details Linux exposes nodes as /sys/devices/system/node/node<N>/cpulist
+ * and the node of a PCI device as a numa_node file somewhere above its block
+ * device in /sys/devices. CPUs outside the process's affinity mask (taskset,
+ * cgroup cpusets) are dropped, and nodes left without CPUs are ignored.
+ */
+
+#include "topology.h"
+#include "ncmlib/log.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using ncm::log::level;
+
+    /**
+     * @brief Parse a sysfs CPU list such as "0-3,8-11"
+     */
+    vector<int> parse_cpu_list(const string& text) {
+        vector<int> cpus;
+        stringstream ss(text);
+        string range;
+        while (getline(ss, range, ',')) {
+            if (range.empty() || range == "\n") continue;
+            try {
+                size_t dash = range.find('-');
+                int first = stoi(range.substr(0, dash));
+                int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+                for (int c = first; c <= last; ++c) {
+                    cpus.push_back(c);
+                }
+            } catch (const exception&) {
+                return {};
+            }
+        }
+        return cpus;
+    }
+
+    /** @brief CPUs the process may run on */
+    vector<int> allowed_cpus() {
+        vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int c = 0; c < CPU_SETSIZE; ++c) {
+                if (CPU_ISSET(c, &set)) cpus.push_back(c);
+            }
+        }
+#endif
+        if (cpus.empty()) {
+            unsigned int n = max(1u, thread::hardware_concurrency());
+            for (unsigned int c = 0; c < n; ++c) cpus.push_back((int)c);
+        }
+        return cpus;
+    }
+
+    vector<numa_node> read_nodes() {
+        vector<int> allowed = allowed_cpus();
+        vector<numa_node> nodes;
+#ifdef __linux__
+        error_code ec;
+        for (const auto& entry : filesystem::directory_iterator("/sys/devices/system/node", ec)) {
+            string name = entry.path().filename().string();
+            if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+                name.find_first_not_of("0123456789", 4) != string::npos) {
+                continue;
+            }
+            ifstream in(entry.path() / "cpulist");
+            string list;
+            getline(in, list);
+            numa_node node;
+            node.id = stoi(name.substr(4));
+            for (int c : parse_cpu_list(list)) {
+                if (binary_search(allowed.begin(), allowed.end(), c)) node.cpus.push_back(c);
+            }
+            if (!node.cpus.empty()) nodes.push_back(std::move(node));
+        }
+        sort(nodes.begin(), nodes.end(), [](const numa_node& a, const numa_node& b) { return a.id < b.id; });
+#endif
+        if (nodes.empty()) {
+            nodes.push_back({0, allowed});
+        }
+        return nodes;
+    }
+
+#ifdef __linux__
+    /**
+     * @brief Node of the device behind st_dev, from the first numa_node file above its sysfs entry
+     */
+    int read_device_node(dev_t dev) {
+        error_code ec;
+        filesystem::path sys = "/sys/dev/block/" + to_string(major(dev)) + ":" + to_string(minor(dev));
+        filesystem::path p = filesystem::canonical(sys, ec);
+        if (ec) return -1;
+        for (; p.has_relative_path() && p != "/sys/devices"; p = p.parent_path()) {
+            ifstream in(p / "numa_node");
+            int node;
+            if (in >> node) {
+                return node;
+            }
+        }
+        return -1;
+    }
+#endif
+} // anonymous namespace
+
+const vector<numa_node>& numa_nodes() {
+    static const vector<numa_node> nodes = read_nodes();
+    return nodes;
+}
+
+vector<worker_placement> plan_workers(unsigned int n, affinity_mode mode) {
+    vector<worker_placement> plan;
+    if (mode == affinity_mode::off) {
+        return plan;
+    }
+    const auto& nodes = numa_nodes();
+    vector<size_t> next_cpu(nodes.size(), 0);
+    plan.reserve(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        size_t k = i % nodes.size();
+        worker_placement w;
+        w.node = nodes[k].id;
+        if (mode == affinity_mode::node) {
+            w.cpus = nodes[k].cpus;
+        } else {
+            w.cpus.push_back(nodes[k].cpus[next_cpu[k]++ % nodes[k].cpus.size()]);
+        }
+        plan.push_back(std::move(w));
+    }
+    return plan;
+}
+
+bool pin_current_thread(const vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus) {
+        if (c >= 0 && c < CPU_SETSIZE) CPU_SET(c, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (int c : cpus) {
+        if (c >= 0 && c < (int)(sizeof(mask) * 8)) mask |= (DWORD_PTR)1 << c;
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+int storage_node(const filesystem::path& p) {
+    if (numa_nodes().size() < 2) {
+        return -1;
+    }
+#ifdef __linux__
+    struct stat st;
+    if (::stat(p.c_str(), &st) != 0) {
+        return -1;
+    }
+    static mutex mtx;
+    static map<dev_t, int> cache;
+    lock_guard<mutex> lock(mtx);
+    auto it = cache.find(st.st_dev);
+    if (it == cache.end()) {
+        it = cache.emplace(st.st_dev, read_device_node(st.st_dev)).first;
+        NCM_LOG(level::debug, "Storage of " + p.parent_path().string() + " is on NUMA node " + to_string(it->second));
+    }
+    return it->second;
+#else
+    (void)p;
+    return -1;
+#endif
+}
@@ -0,0 +1,69 @@
+/**
+ * @file topology.h
+ * @brief NUMA topology, CPU pinning and storage locality
+ * @details On multi-socket machines a worker that floats between sockets
+ * reads its buffers and key tables across the interconnect, and a file read
+ * from a disk behind the other socket's controller crosses it once more.
+ * The topology is read from sysfs on Linux without linking libnuma; other
+ * systems report a single node.
+ */
+
+#pragma once
+#include <filesystem>
+#include <vector>
+
+/**
+ * @brief How pool workers are bound to CPUs
+ */
+enum class affinity_mode {
+    /** @brief Leave placement to the scheduler */
+    off,
+    /** @brief Bind each worker to the CPUs of one NUMA node, nodes taken in turn */
+    node,
+    /** @brief Bind each worker to a single CPU, spread across nodes */
+    cpu,
+};
+
+/**
+ * @brief One NUMA node and the CPUs this process may run on there
+ */
+struct numa_node {
+    int id = 0;
+    std::vector<int> cpus;
+};
+
+/**
+ * @brief Where one pool worker runs
+ */
+struct worker_placement {
+    /** @brief NUMA node id, -1 if not pinned */
+    int node = -1;
+    /** @brief CPUs the worker is bound to; empty leaves it unpinned */
+    std::vector<int> cpus;
+};
+
+/**
+ * @brief NUMA nodes with at least one CPU allowed for this process
+ * @return At least one node; a single node 0 where NUMA is unknown
+ */
+const std::vector<numa_node>& numa_nodes();
+
+/**
+ * @brief Placement for n workers: workers go to the nodes round-robin
+ * @return Empty for affinity_mode::off
+ */
+std::vector<worker_placement> plan_workers(unsigned int n, affinity_mode mode);
+
+/**
+ * @brief Bind the calling thread to cpus
+ * @return false if the system refused or pinning is unsupported
+ */
+bool pin_current_thread(const std::vector<int>& cpus);
+
+/**
+ * @brief NUMA node of the storage controller behind the file system holding p
+ * @return Node id, or -1 if unknown (virtual file systems, non-Linux, single node)
+ * @details Results are cached per device, so calling this per file is cheap.
+ */
+int storage_node(const std::filesystem::path& p);
+
@@ -0,0 +1,621 @@
+/**
+ * @file uring_engine.cpp
+ * @brief io_uring batch engine implementation
+ * @details Every file moves through open -> header read -> parse -> output
+ * open -> chunked read/decrypt/write -> close. All I/O is submitted from one
+ * thread; parsing and decryption run on a small thread_pool and hand their
+ * results back through an eventfd that the ring is polling.
+ */
+
+#include "uring_engine.h"
+#include <stdexcept>
+
+#ifdef NCMPP_HAVE_IO_URING
+#include "ncmlib/commit.h"
+#include "ncmlib/decoder.h"
+#include "pool.h"
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#endif
+
+using namespace std;
+
+#ifdef NCMPP_HAVE_IO_URING
+
+namespace {
+    /** @brief First header read; large enough for the key and metadata of typical files */
+    constexpr size_t INITIAL_HEADER_READ = 64 * 1024;
+
+    enum class op_kind {
+        open_input,
+        read_header,
+        open_output,
+        open_cover,
+        write_cover,
+        close_cover,
+        read_audio,
+        write_audio,
+        close_input,
+        close_output,
+        wakeup
+    };
+
+    struct file_state;
+    struct chunk;
+
+    /**
+     * @brief Submission context attached to every SQE as user data
+     */
+    struct op {
+        op_kind kind;
+        file_state* file = nullptr;
+        chunk* owner = nullptr;
+    };
+
+    /**
+     * @brief One audio buffer cycling through read, decrypt and write
+     */
+    struct chunk {
+        unsigned char* data = nullptr;
+        uint64_t pos = 0;   // position relative to the audio start
+        size_t size = 0;    // bytes this chunk covers
+        size_t len = 0;     // bytes read so far
+        size_t written = 0; // bytes already written
+        op io;
+    };
+
+    /**
+     * @brief Per-file state machine
+     */
+    struct file_state {
+        const uring_job* job = nullptr;
+        string input_path;
+        string audio_path;
+        string cover_path;
+        string audio_temp;  // Written first, renamed to audio_path once complete
+        string cover_temp;
+        ncm::Decoder decoder;
+
+        int in_fd = -1;
+        int out_fd = -1;
+        int cover_fd = -1;
+
+        uint64_t in_size = 0;       // bounds the header the length fields may claim and the audio read
+        vector<unsigned char> header;
+        size_t header_len = 0;
+        size_t cover_written = 0;
+
+        vector<chunk> chunks;
+        uint64_t next_pos = 0;
+        bool eof = false;
+        bool closing = false;
+
+        int pending = 0;
+        string error;
+        ncm::error_kind kind = ncm::error_kind::none;
+        chrono::steady_clock::time_point start;
+
+        op open_in{op_kind::open_input};
+        op read_hdr{op_kind::read_header};
+        op open_out{op_kind::open_output};
+        op cover{op_kind::open_cover};
+        op close_in{op_kind::close_input};
+        op close_out{op_kind::close_output};
+    };
+
+    /**
+     * @brief One engine run over a job list
+     */
+    class batch_runner {
+    public:
+        batch_runner(const uring_engine::options& opts, const vector<uring_job>& jobs,
+                     const uring_engine::completion& on_done)
+            : opts_(opts), jobs_(jobs), on_done_(on_done) {
+            size_t buffers = (size_t)opts_.files_in_flight * opts_.chunks_per_file;
+            buffer_storage_.resize(buffers);
+            for (auto& b : buffer_storage_) {
+                b.reset(new unsigned char[opts_.chunk_size]);
+                free_buffers_.push_back(b.get());
+            }
+
+            event_fd_ = eventfd(0, EFD_CLOEXEC);
+            if (event_fd_ < 0) {
+                throw runtime_error(string("eventfd failed: ") + strerror(errno));
+            }
+            unsigned int entries = max(64u, opts_.files_in_flight * (opts_.chunks_per_file + 4) + 1);
+            int rc = io_uring_queue_init(entries, &ring_, 0);
+            if (rc < 0) {
+                close(event_fd_);
+                throw runtime_error(string("io_uring_queue_init failed: ") + strerror(-rc));
+            }
+            cpu_ = make_unique<thread_pool>(opts_.cpu_threads);
+        }
+
+        ~batch_runner() {
+            // Join the CPU workers first: one may still be signalling the eventfd.
+            cpu_.reset();
+            io_uring_queue_exit(&ring_);
+            close(event_fd_);
+        }
+
+        void run() {
+            arm_wakeup();
+            while (next_job_ < jobs_.size() || active_ > 0) {
+                while (active_ < opts_.files_in_flight && next_job_ < jobs_.size()) {
+                    start_file(jobs_[next_job_++]);
+                }
+
+                io_uring_submit_and_wait(&ring_, 1);
+
+                io_uring_cqe* cqe;
+                while (io_uring_peek_cqe(&ring_, &cqe) == 0) {
+                    op* o = (op*)io_uring_cqe_get_data(cqe);
+                    int res = cqe->res;
+                    io_uring_cqe_seen(&ring_, cqe);
+                    handle(*o, res);
+                }
+                drain_completions();
+            }
+        }
+
+    private:
+        io_uring_sqe* get_sqe() {
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+            while (!sqe) {
+                io_uring_submit(&ring_);
+                sqe = io_uring_get_sqe(&ring_);
+            }
+            return sqe;
+        }
+
+        void track(io_uring_sqe* sqe, op& o) {
+            io_uring_sqe_set_data(sqe, &o);
+            if (o.file) o.file->pending++;
+        }
+
+        void arm_wakeup() {
+            io_uring_sqe* sqe = get_sqe();
+            io_uring_prep_read(sqe, event_fd_, &event_value_, sizeof(event_value_), 0);
+            track(sqe, wakeup_op_);
+        }
+
+        /**
+         * @brief Queue a continuation from a CPU thread to the submission thread
+         */
+        void post(function<void()> continuation) {
+            {
+                lock_guard<mutex> lock(done_mtx_);
+                done_.push_back(std::move(continuation));
+            }
+            uint64_t one = 1;
+            ssize_t rc = write(event_fd_, &one, sizeof(one));
+            (void)rc;
+        }
+
+        void drain_completions() {
+            vector<function<void()>> ready;
+            {
+                lock_guard<mutex> lock(done_mtx_);
+                ready.swap(done_);
+            }
+            for (auto& fn : ready) {
+                fn();
+            }
+        }
+
+        void start_file(const uring_job& job) {
+            file_state* f = new file_state();
+            f->job = &job;
+            f->input_path = job.input.string();
+            f->start = chrono::steady_clock::now();
+            f->open_in.file = f;
+            f->read_hdr.file = f;
+            f->open_out.file = f;
+            f->cover.file = f;
+            f->close_in.file = f;
+            f->close_out.file = f;
+            active_++;
+
+            io_uring_sqe* sqe = get_sqe();
+            io_uring_prep_openat(sqe, AT_FDCWD, f->input_path.c_str(), O_RDONLY | O_CLOEXEC, 0);
+            track(sqe, f->open_in);
+        }
+
+        void fail(file_state* f, ncm::error_kind kind, const string& message) {
+            if (f->error.empty()) {
+                f->error = message;
+                f->kind = kind;
+            }
+        }
+
+        void handle(op& o, int res) {
+            if (o.kind == op_kind::wakeup) {
+                arm_wakeup();
+                return;
+            }
+
+            file_state* f = o.file;
+            f->pending--;
+
+            switch (o.kind) {
+            case op_kind::open_input:
+                if (res < 0) {
+                    fail(f, ncm::error_kind::input, "Failed to open file: " + f->input_path + ": " + strerror(-res));
+                    break;
+                }
+                f->in_fd = res;
+                {
+                    struct stat st;
+                    if (fstat(res, &st) != 0) {
+                        fail(f, ncm::error_kind::input, "Failed to stat file: " + f->input_path + ": " + strerror(errno));
+                        break;
+                    }
+                    f->in_size = (uint64_t)st.st_size;
+                }
+                f->header.resize(INITIAL_HEADER_READ);
+                read_header(f);
+                break;
+
+            case op_kind::read_header:
+                if (res < 0) {
+                    fail(f, ncm::error_kind::input, string("Failed to read header: ") + strerror(-res));
+                } else if (res == 0) {
+                    fail(f, ncm::error_kind::truncated, "Unexpected end of file while reading header");
+                } else {
+                    f->header_len += res;
+                    parse_header(f);
+                }
+                break;
+
+            case op_kind::open_output:
+                if (res < 0) {
+                    fail(f, ncm::error_kind::output, "Failed to open output file: " + f->audio_path + ": " + strerror(-res));
+                    break;
+                }
+                f->out_fd = res;
+                start_audio(f);
+                break;
+
+            case op_kind::open_cover:
+            case op_kind::write_cover:
+            case op_kind::close_cover:
+                handle_cover(f, o.kind, res);
+                break;
+
+            case op_kind::read_audio:
+                handle_audio_read(f, o.owner, res);
+                break;
+
+            case op_kind::write_audio:
+                handle_audio_write(f, o.owner, res);
+                break;
+
+            case op_kind::close_input:
+                f->in_fd = -1;
+                break;
+
+            case op_kind::close_output:
+                f->out_fd = -1;
+                if (res < 0) {
+                    fail(f, ncm::error_kind::output, string("Failed to close output file: ") + strerror(-res));
+                }
+                break;
+
+            case op_kind::wakeup:
+                break;
+            }
+
+            maybe_finish(f);
+        }
+
+        void read_header(file_state* f) {
+            io_uring_sqe* sqe = get_sqe();
+            io_uring_prep_read(sqe, f->in_fd, f->header.data() + f->header_len,
+                               f->header.size() - f->header_len, f->header_len);
+            track(sqe, f->read_hdr);
+        }
+
+        void parse_header(file_state* f) {
+            f->pending++;
+            cpu_->enqueue([this, f] {
+                size_t needed = 0;
+                string error;
+                ncm::error_kind kind = ncm::error_kind::none;
+                try {
+                    needed = f->decoder.parse_header(f->header.data(), f->header_len, f->in_size);
+                    if (needed == 0) {
+                        filesystem::path dir = f->job->output.parent_path();
+                        if (!dir.empty()) {
+                            filesystem::create_directories(dir);
+                        }
+                    }
+                } catch (const exception& e) {
+                    error = e.what();
+                    kind = ncm::classify(e);
+                }
+                post([this, f, needed, error, kind] {
+                    f->pending--;
+                    if (!error.empty()) {
+                        fail(f, kind, error);
+                    } else if (needed > 0) {
+                        f->header.resize(needed);
+                        read_header(f);
+                    } else {
+                        open_outputs(f);
+                    }
+                    maybe_finish(f);
+                });
+            });
+        }
+
+        void open_outputs(file_state* f) {
+            f->audio_path = f->job->output.string() + "." + f->decoder.format();
+            f->audio_temp = ncm::temp_path(f->audio_path);
+            io_uring_sqe* sqe = get_sqe();
+            io_uring_prep_openat(sqe, AT_FDCWD, f->audio_temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            track(sqe, f->open_out);
+
+            if (f->decoder.cover_size() > 0) {
+                f->cover_path = f->job->output.string() + ".jpg";
+                f->cover_temp = ncm::temp_path(f->cover_path);
+                f->cover.kind = op_kind::open_cover;
+                sqe = get_sqe();
+                io_uring_prep_openat(sqe, AT_FDCWD, f->cover_temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                track(sqe, f->cover);
+            }
+        }
+
+        /**
+         * @brief Cover extraction is best effort, as in ncmlib: failures are ignored
+         */
+        void handle_cover(file_state* f, op_kind kind, int res) {
+            if (kind == op_kind::close_cover) {
+                f->cover_fd = -1;
+                bool complete = res == 0 && f->cover_written == f->decoder.cover_size();
+                if (!complete || rename(f->cover_temp.c_str(), f->cover_path.c_str()) != 0) {
+                    unlink(f->cover_temp.c_str());
+                }
+                return;
+            }
+            if (kind == op_kind::open_cover) {
+                if (res < 0) return;
+                f->cover_fd = res;
+            } else if (res <= 0) {
+                close_cover(f);
+                return;
+            } else {
+                f->cover_written += res;
+            }
+
+            size_t remaining = f->decoder.cover_size() - f->cover_written;
+            if (remaining == 0 || !f->error.empty()) {
+                close_cover(f);
+                return;
+            }
+            f->cover.kind = op_kind::write_cover;
+            io_uring_sqe* sqe = get_sqe();
+            io_uring_prep_write(sqe, f->cover_fd, f->header.data() + f->decoder.cover_offset() + f->cover_written,
+                                remaining, f->cover_written);
+            track(sqe, f->cover);
+        }
+
+        void close_cover(file_state* f) {
+            f->cover.kind = op_kind::close_cover;
+            io_uring_sqe* sqe = get_sqe();
+            io_uring_prep_close(sqe, f->cover_fd);
+            track(sqe, f->cover);
+        }
+
+        void start_audio(file_state* f) {
+            f->chunks.resize(opts_.chunks_per_file);
+            for (chunk& c : f->chunks) {
+                c.data = free_buffers_.back();
+                free_buffers_.pop_back();
+                c.io.kind = op_kind::read_audio;
+                c.io.file = f;
+                c.io.owner = &c;
+                read_chunk(f, &c);
+            }
+        }
+
+        /**
+         * @brief Bytes of audio after audio_offset(), from the size taken at open
+         */
+        static uint64_t audio_size(const file_state* f) {
+            uint64_t offset = f->decoder.audio_offset();
+            return f->in_size > offset ? f->in_size - offset : 0;
+        }
+
+        void read_chunk(file_state* f, chunk* c) {
+            if (f->eof || !f->error.empty()) return;
+            uint64_t end = audio_size(f);
+            if (f->next_pos >= end) {
+                f->eof = true;
+                return;
+            }
+            c->pos = f->next_pos;
+            c->size = (size_t)min<uint64_t>(opts_.chunk_size, end - c->pos);
+            c->len = 0;
+            c->written = 0;
+            f->next_pos += c->size;
+            if (f->next_pos == end) {
+                f->eof = true;
+            }
+            submit_read(f, c);
+        }
+
+        void submit_read(file_state* f, chunk* c) {
+            c->io.kind = op_kind::read_audio;
+            io_uring_sqe* sqe = get_sqe();
+            io_uring_prep_read(sqe, f->in_fd, c->data + c->len, c->size - c->len,
+                               f->decoder.audio_offset() + c->pos + c->len);
+            track(sqe, c->io);
+        }
+
+        /**
+         * @brief Collect a chunk read, resubmitting short ones
+         * @details Network and FUSE filesystems may return short reads in the
+         * middle of a file, so only the size taken at open marks the end; a
+         * file that ends before it is truncated.
+         */
+        void handle_audio_read(file_state* f, chunk* c, int res) {
+            if (res < 0) {
+                fail(f, ncm::error_kind::input, string("Failed to read audio: ") + strerror(-res));
+                return;
+            }
+            if (res == 0) {
+                fail(f, ncm::error_kind::truncated, "Unexpected end of file while reading audio");
+                return;
+            }
+            if (!f->error.empty()) return;
+
+            c->len += res;
+            if (c->len < c->size) {
+                submit_read(f, c);
+                return;
+            }
+            f->pending++;
+            cpu_->enqueue([this, f, c] {
+                f->decoder.decrypt(c->data, c->data, c->len, c->pos);
+                post([this, f, c] {
+                    f->pending--;
+                    write_chunk(f, c);
+                    maybe_finish(f);
+                });
+            });
+        }
+
+        void write_chunk(file_state* f, chunk* c) {
+            if (!f->error.empty()) return;
+            c->io.kind = op_kind::write_audio;
+            io_uring_sqe* sqe = get_sqe();
+            io_uring_prep_write(sqe, f->out_fd, c->data + c->written, c->len - c->written, c->pos + c->written);
+            track(sqe, c->io);
+        }
+
+        void handle_audio_write(file_state* f, chunk* c, int res) {
+            if (res < 0) {
+                fail(f, ncm::error_kind::output, "Failed to write output file: " + f->audio_path + ": " + strerror(-res));
+                return;
+            }
+            c->written += res;
+            if (c->written < c->len) {
+                write_chunk(f, c);
+            } else {
+                read_chunk(f, c);
+            }
+        }
+
+        /**
+         * @brief Close descriptors once all work is done, then report the file
+         */
+        void maybe_finish(file_state* f) {
+            if (f->pending > 0) return;
+
+            if (f->error.empty() && !f->closing) {
+                f->closing = true;
+                if (f->in_fd >= 0) {
+                    io_uring_sqe* sqe = get_sqe();
+                    io_uring_prep_close(sqe, f->in_fd);
+                    track(sqe, f->close_in);
+                }
+                if (f->out_fd >= 0) {
+                    io_uring_sqe* sqe = get_sqe();
+                    io_uring_prep_close(sqe, f->out_fd);
+                    track(sqe, f->close_out);
+                }
+                if (f->pending > 0) return;
+            }
+
+            if (f->cover_fd >= 0) {
+                unlink(f->cover_temp.c_str());  // Failed before the cover was complete
+            }
+            for (int* fd : {&f->in_fd, &f->out_fd, &f->cover_fd}) {
+                if (*fd >= 0) {
+                    close(*fd);
+                    *fd = -1;
+                }
+            }
+            for (chunk& c : f->chunks) {
+                free_buffers_.push_back(c.data);
+            }
+            if (!f->audio_temp.empty()) {
+                if (f->error.empty()) {
+                    try {
+                        ncm::commit_file(f->audio_temp, f->audio_path);
+                    } catch (const exception& e) {
+                        fail(f, ncm::classify(e), e.what());
+                    }
+                }
+                if (!f->error.empty()) {
+                    unlink(f->audio_temp.c_str());
+                }
+            }
+
+            auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - f->start).count();
+            on_done_(*f->job, f->kind, f->error, f->decoder.format(), elapsed);
+            delete f;
+            active_--;
+        }
+
+        const uring_engine::options& opts_;
+        const vector<uring_job>& jobs_;
+        const uring_engine::completion& on_done_;
+
+        io_uring ring_;
+        int event_fd_ = -1;
+        uint64_t event_value_ = 0;
+        op wakeup_op_{op_kind::wakeup};
+
+        vector<unique_ptr<unsigned char[]>> buffer_storage_;
+        vector<unsigned char*> free_buffers_;
+        size_t next_job_ = 0;
+        unsigned int active_ = 0;
+
+        mutex done_mtx_;
+        vector<function<void()>> done_;
+
+        unique_ptr<thread_pool> cpu_;
+    };
+} // anonymous namespace
+
+bool uring_engine::available() {
+    io_uring ring;
+    if (io_uring_queue_init(2, &ring, 0) < 0) {
+        return false;
+    }
+    io_uring_queue_exit(&ring);
+    return true;
+}
+
+uring_engine::uring_engine(options opts) : opts_(opts) {}
+
+void uring_engine::run(const vector<uring_job>& jobs, const completion& on_done) {
+    if (jobs.empty()) return;
+    batch_runner runner(opts_, jobs, on_done);
+    runner.run();
+}
+
+#else
+
+bool uring_engine::available() {
+    return false;
+}
+
+uring_engine::uring_engine(options opts) : opts_(opts) {}
+
+void uring_engine::run(const vector<uring_job>&, const completion&) {
+    throw runtime_error("ncmpp was built without io_uring support");
+}
+
+#endif
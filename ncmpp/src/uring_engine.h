@@ -0,0 +1,76 @@
+/**
+ * @file uring_engine.h
+ * @brief Asynchronous batch engine built on Linux io_uring
+ * @details Keeps opens, reads and writes for many files in flight on a single
+ * submission thread while a small CPU pool runs only header parsing and
+ * keystream decryption. Available when ncmpp is built with liburing.
+ */
+
+#pragma once
+#include "ncmlib/error.h"
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief One input/output pair for the engine
+ */
+struct uring_job {
+    /** @brief Path to the input .ncm file */
+    std::filesystem::path input;
+
+    /** @brief Output path without extension */
+    std::filesystem::path output;
+};
+
+/**
+ * @brief io_uring batch engine
+ */
+class uring_engine {
+public:
+    /**
+     * @brief Engine tuning parameters
+     */
+    struct options {
+        /** @brief Threads running header parsing and decryption */
+        unsigned int cpu_threads = 2;
+
+        /** @brief Files processed concurrently */
+        unsigned int files_in_flight = 16;
+
+        /** @brief Audio chunks in flight per file */
+        unsigned int chunks_per_file = 4;
+
+        /** @brief Size of each audio read/write */
+        std::size_t chunk_size = 1024 * 1024;
+    };
+
+    /**
+     * @brief Per-file completion callback
+     * @details Called on the submission thread with kind none and an empty
+     * error on success. format is the audio format written, empty if the
+     * header was not parsed.
+     */
+    using completion = std::function<void(const uring_job& job, ncm::error_kind kind, const std::string& error,
+                                          const std::string& format, long long elapsed_ms)>;
+
+    /**
+     * @brief Whether the engine was compiled in and the kernel supports io_uring
+     */
+    static bool available();
+
+    explicit uring_engine(options opts);
+
+    /**
+     * @brief Process all jobs and return when every file has completed
+     * @param jobs Jobs to process
+     * @param on_done Called once per job
+     * @throws std::runtime_error if the ring cannot be created
+     */
+    void run(const std::vector<uring_job>& jobs, const completion& on_done);
+
+private:
+    options opts_;
+};
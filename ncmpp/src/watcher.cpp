@@ -0,0 +1,296 @@
+/**
+ * @file watcher.cpp
+ * @brief Directory tree watcher implementation
+ * @details inotify watches single directories, so every subdirectory gets
+ * its own watch, added as directories appear. ReadDirectoryChangesW watches
+ * a whole tree per handle. Files are reported on IN_CLOSE_WRITE or
+ * IN_MOVED_TO; Windows has no close event, so files are reported on every
+ * write and the caller's debounce waits for them to settle.
+ */
+
+#include "watcher.h"
+#include "ncmlib/log.h"
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+#include <climits>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <unordered_map>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+using namespace std;
+
+namespace {
+    using ncm::log::level;
+
+    bool matches(const filesystem::path& path, const string& extension) {
+        return path.extension() == extension;
+    }
+
+    /**
+     * @brief Report matching files below dir and call on_dir for dir and its subdirectories
+     */
+    template <typename F>
+    void scan_tree(const filesystem::path& dir, const string& extension, vector<filesystem::path>& changed, F on_dir) {
+        error_code ec;
+        on_dir(dir);
+        filesystem::recursive_directory_iterator it(dir, filesystem::directory_options::skip_permission_denied, ec);
+        for (; !ec && it != filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            error_code type_ec;
+            if (it->is_directory(type_ec) && !it->is_symlink(type_ec)) {
+                on_dir(it->path());
+            } else if (it->is_regular_file(type_ec) && matches(it->path(), extension)) {
+                changed.push_back(it->path());
+            }
+        }
+    }
+} // anonymous namespace
+
+#ifdef __linux__
+
+struct dir_watcher::impl {
+    string extension;
+    int fd = -1;
+    unordered_map<int, filesystem::path> dirs;     // watch descriptor -> directory
+
+    void add_dir(const filesystem::path& dir) {
+        int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+        if (wd < 0) {
+            NCM_LOG(level::warn, "Cannot watch " + dir.string() + ": " + error_code(errno, generic_category()).message());
+            return;
+        }
+        dirs[wd] = dir;
+    }
+};
+
+dir_watcher::dir_watcher(const vector<filesystem::path>& roots, const string& extension) : impl_(make_unique<impl>()) {
+    impl_->extension = extension;
+    impl_->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (impl_->fd < 0) {
+        throw runtime_error("inotify_init1 failed: " + error_code(errno, generic_category()).message());
+    }
+    // Existing files are the caller's initial scan; only the watches are needed here
+    vector<filesystem::path> ignored;
+    for (const auto& root : roots) {
+        scan_tree(root, extension, ignored, [this](const filesystem::path& dir) { impl_->add_dir(dir); });
+    }
+    if (impl_->dirs.empty()) {
+        close(impl_->fd);
+        throw runtime_error("No directory could be watched");
+    }
+}
+
+dir_watcher::~dir_watcher() {
+    close(impl_->fd);
+}
+
+bool dir_watcher::wait(chrono::milliseconds timeout, vector<filesystem::path>& changed) {
+    pollfd pfd{impl_->fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, (int)min<chrono::milliseconds::rep>(timeout.count(), INT_MAX));
+    if (ready <= 0) {
+        return true;  // Timed out, or interrupted by a signal the caller checks
+    }
+
+    bool complete = true;
+    alignas(inotify_event) char buf[64 * 1024];
+    while (true) {
+        ssize_t n = read(impl_->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;  // EAGAIN once the queue is drained
+        }
+        for (char* p = buf; p < buf + n;) {
+            const inotify_event* ev = (const inotify_event*)p;
+            p += sizeof(inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                complete = false;
+                continue;
+            }
+            auto dir = impl_->dirs.find(ev->wd);
+            if (dir == impl_->dirs.end()) {
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                impl_->dirs.erase(dir);  // Directory removed or unmounted
+                continue;
+            }
+            if (ev->len == 0) {
+                continue;
+            }
+            filesystem::path path = dir->second / ev->name;
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    // Files can land in a new directory before its watch exists
+                    scan_tree(path, impl_->extension, changed, [this](const filesystem::path& d) { impl_->add_dir(d); });
+                }
+            } else if ((ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && matches(path, impl_->extension)) {
+                changed.push_back(std::move(path));
+            }
+        }
+    }
+    return complete;
+}
+
+const char* dir_watcher::backend_name() {
+    return "inotify";
+}
+
+#elif defined(_WIN32)
+
+namespace {
+    /** @brief Notification buffer per watched tree */
+    constexpr DWORD NOTIFY_BUFFER = 64 * 1024;
+
+    constexpr DWORD NOTIFY_FILTER = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+                                    FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+
+    struct tree_watch {
+        filesystem::path root;
+        HANDLE dir = INVALID_HANDLE_VALUE;
+        OVERLAPPED overlapped{};
+        // DWORD-aligned as ReadDirectoryChangesW requires
+        unique_ptr<DWORD[]> buffer = make_unique<DWORD[]>(NOTIFY_BUFFER / sizeof(DWORD));
+
+        bool arm() {
+            ResetEvent(overlapped.hEvent);
+            return ReadDirectoryChangesW(dir, buffer.get(), NOTIFY_BUFFER, TRUE, NOTIFY_FILTER, nullptr, &overlapped,
+                                         nullptr) != 0;
+        }
+    };
+} // anonymous namespace
+
+struct dir_watcher::impl {
+    string extension;
+    vector<unique_ptr<tree_watch>> trees;
+
+    ~impl() {
+        for (auto& t : trees) {
+            CancelIoEx(t->dir, &t->overlapped);
+            DWORD ignored;
+            GetOverlappedResult(t->dir, &t->overlapped, &ignored, TRUE);
+            CloseHandle(t->dir);
+            CloseHandle(t->overlapped.hEvent);
+        }
+    }
+};
+
+dir_watcher::dir_watcher(const vector<filesystem::path>& roots, const string& extension) : impl_(make_unique<impl>()) {
+    impl_->extension = extension;
+    for (const auto& root : roots) {
+        auto t = make_unique<tree_watch>();
+        t->root = root;
+        t->dir = CreateFileW(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                             nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        if (t->dir == INVALID_HANDLE_VALUE) {
+            NCM_LOG(level::warn, "Cannot watch " + root.string());
+            continue;
+        }
+        t->overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (!t->overlapped.hEvent || !t->arm()) {
+            NCM_LOG(level::warn, "Cannot watch " + root.string());
+            if (t->overlapped.hEvent) CloseHandle(t->overlapped.hEvent);
+            CloseHandle(t->dir);
+            continue;
+        }
+        impl_->trees.push_back(std::move(t));
+    }
+    if (impl_->trees.empty()) {
+        throw runtime_error("No directory could be watched");
+    }
+}
+
+dir_watcher::~dir_watcher() = default;
+
+bool dir_watcher::wait(chrono::milliseconds timeout, vector<filesystem::path>& changed) {
+    vector<HANDLE> events;
+    for (auto& t : impl_->trees) {
+        events.push_back(t->overlapped.hEvent);
+    }
+    DWORD ready = WaitForMultipleObjects((DWORD)events.size(), events.data(), FALSE,
+                                         (DWORD)min<chrono::milliseconds::rep>(timeout.count(), INFINITE - 1));
+    if (ready == WAIT_TIMEOUT || ready == WAIT_FAILED) {
+        return true;
+    }
+
+    bool complete = true;
+    for (auto& t : impl_->trees) {
+        DWORD bytes = 0;
+        if (!GetOverlappedResult(t->dir, &t->overlapped, &bytes, FALSE)) {
+            if (GetLastError() == ERROR_IO_INCOMPLETE) continue;
+            complete = false;
+        } else if (bytes == 0) {
+            complete = false;  // The buffer overflowed and the changes were dropped
+        } else {
+            const unsigned char* p = (const unsigned char*)t->buffer.get();
+            while (true) {
+                const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)p;
+                filesystem::path path = t->root / wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+                if (info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_MODIFIED ||
+                    info->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+                    error_code ec;
+                    if (filesystem::is_directory(path, ec)) {
+                        // Moved-in trees report only their top directory
+                        if (info->Action != FILE_ACTION_MODIFIED) {
+                            scan_tree(path, impl_->extension, changed, [](const filesystem::path&) {});
+                        }
+                    } else if (matches(path, impl_->extension)) {
+                        changed.push_back(std::move(path));
+                    }
+                }
+                if (info->NextEntryOffset == 0) break;
+                p += info->NextEntryOffset;
+            }
+        }
+        if (!t->arm()) {
+            NCM_LOG(level::warn, "Lost the watch on " + t->root.string());
+            complete = false;
+        }
+    }
+    return complete;
+}
+
+const char* dir_watcher::backend_name() {
+    return "ReadDirectoryChangesW";
+}
+
+#else
+
+namespace {
+    /** @brief Rescan interval of the polling fallback */
+    constexpr chrono::seconds POLL_INTERVAL{5};
+} // anonymous namespace
+
+struct dir_watcher::impl {
+    chrono::steady_clock::time_point last_scan = chrono::steady_clock::now();
+};
+
+dir_watcher::dir_watcher(const vector<filesystem::path>&, const string&) : impl_(make_unique<impl>()) {}
+
+dir_watcher::~dir_watcher() = default;
+
+bool dir_watcher::wait(chrono::milliseconds timeout, vector<filesystem::path>&) {
+    auto now = chrono::steady_clock::now();
+    auto due = impl_->last_scan + POLL_INTERVAL;
+    if (now >= due) {
+        impl_->last_scan = now;
+        return false;
+    }
+    this_thread::sleep_for(min<chrono::steady_clock::duration>(timeout, due - now));
+    return true;
+}
+
+const char* dir_watcher::backend_name() {
+    return "polling";
+}
+
+#endif
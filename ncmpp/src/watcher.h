@@ -0,0 +1,52 @@
+/**
+ * @file watcher.h
+ * @brief Change notifications for directory trees
+ * @details Reports files that were written or moved into watched trees,
+ * using inotify on Linux and ReadDirectoryChangesW on Windows. Elsewhere the
+ * watcher only asks the caller to rescan at a fixed interval.
+ */
+
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Recursive watcher for files with one extension
+ * @details Subdirectories created or moved in later are watched as well, and
+ * files they already contain are reported. Not thread-safe; one thread calls
+ * wait() in a loop.
+ */
+class dir_watcher {
+public:
+    /**
+     * @param roots Directories to watch, including everything below them
+     * @param extension Extension of reported files, including the dot (e.g. ".ncm")
+     * @throws std::runtime_error if no root can be watched
+     */
+    dir_watcher(const std::vector<std::filesystem::path>& roots, const std::string& extension);
+    ~dir_watcher();
+    dir_watcher(const dir_watcher&) = delete;
+    dir_watcher& operator=(const dir_watcher&) = delete;
+
+    /**
+     * @brief Wait for changes
+     * @param timeout Longest time to block; returns early once a change arrived
+     * @param changed Receives matching files that were closed after writing,
+     * moved in, or found in a new subdirectory; a file may be reported more
+     * than once while it is being written
+     * @return false if changes may have been lost (event queue overflow, or
+     * the polling interval of the fallback backend elapsed), and the caller
+     * should rescan the roots
+     */
+    bool wait(std::chrono::milliseconds timeout, std::vector<std::filesystem::path>& changed);
+
+    /** @brief Name of the notification backend ("inotify", "ReadDirectoryChangesW" or "polling") */
+    static const char* backend_name();
+
+private:
+    struct impl;
+    std::unique_ptr<impl> impl_;
+};
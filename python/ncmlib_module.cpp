@@ -0,0 +1,257 @@
+/**
+ * @file ncmlib_module.cpp
+ * @brief In-process Python binding of ncmlib
+ * @details Exposes probing, decoding to bytes, single dumps and batch dumps
+ * as the Python module `ncmlib`, plus the conversion manifest of the ncmpp
+ * binary so both skip the same files. Every call releases the GIL while ncmlib
+ * works, so batches run on ncmlib's own threads and other Python threads
+ * keep running. Results are returned as objects; failures of single calls
+ * raise RuntimeError, while batch failures are reported per file.
+ */
+
+#include "ncmlib/batch.h"
+#include "ncmlib/error.h"
+#include "ncmlib/log.h"
+#include "ncmlib/ncmdump.h"
+#include "ncmlib/probe.h"
+#include "manifest.h"
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include <pybind11/stl/filesystem.h>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace py = pybind11;
+using namespace std;
+
+namespace {
+    /**
+     * @brief Output of decode(): the audio and cover as bytes
+     */
+    struct decoded_track {
+        string format;
+        py::bytes audio;
+        py::object cover = py::none();
+        bool cover_embedded = false;
+        bool tags_written = false;
+    };
+
+    ncm::dump_options make_options(bool embed_cover, bool write_tags, bool direct_io = false) {
+        ncm::dump_options options;
+        options.embed_cover = embed_cover;
+        options.write_tags = write_tags;
+        options.direct_io = direct_io;
+        return options;
+    }
+
+    /**
+     * @brief Whether the manifest records input as converted to output with these options
+     */
+    bool manifest_up_to_date(const manifest& m, const filesystem::path& input, const filesystem::path& output,
+                             bool embed_cover, bool write_tags) {
+        py::gil_scoped_release release;
+        manifest::fingerprint fp;
+        return manifest::take_fingerprint(input, fp) &&
+               m.up_to_date(input, output, fp, manifest::output_options(make_options(embed_cover, write_tags)));
+    }
+
+    /**
+     * @brief Record a conversion, fingerprinting input as it is now
+     */
+    void manifest_record(manifest& m, const filesystem::path& input, const filesystem::path& output,
+                         const string& format, bool embed_cover, bool write_tags) {
+        py::gil_scoped_release release;
+        manifest::fingerprint fp;
+        if (manifest::take_fingerprint(input, fp)) {
+            m.record(input, output, fp, manifest::output_options(make_options(embed_cover, write_tags)), format);
+        }
+    }
+
+    /**
+     * @brief Decode with the GIL released, then hand the buffers to Python
+     * @param run Calls ncm::ncmDecode() with the sink and options
+     */
+    template <typename Run>
+    decoded_track decode_with(Run run, bool embed_cover, bool write_tags) {
+        string audio;
+        string cover;
+        ncm::dump_result result;
+        {
+            py::gil_scoped_release release;
+            ncm::dump_sink sink;
+            sink.on_cover = [&cover](const unsigned char* data, size_t len) { cover.assign((const char*)data, len); };
+            sink.on_audio = [&audio](const unsigned char* data, size_t len) { audio.append((const char*)data, len); };
+            result = run(sink, make_options(embed_cover, write_tags));
+        }
+        decoded_track out;
+        out.format = result.format;
+        out.audio = py::bytes(audio);
+        if (!cover.empty()) {
+            out.cover = py::bytes(cover);
+        }
+        out.cover_embedded = result.cover_embedded;
+        out.tags_written = result.tags_written;
+        return out;
+    }
+
+    /**
+     * @brief Convert jobs on ncmlib's thread pool
+     * @details Results are collected on this thread with the GIL released.
+     * The GIL is taken back after each file to call on_progress and to check
+     * for Ctrl-C. An interrupted batch is cancelled: the files already started
+     * finish, the rest are dropped, and the exception is raised right after.
+     */
+    vector<ncm::batch_result> dump_batch(const vector<pair<filesystem::path, filesystem::path>>& jobs,
+                                         unsigned int threads, bool embed_cover, bool write_tags, bool direct_io,
+                                         const py::object& on_progress) {
+        vector<ncm::batch_result> results(jobs.size());
+        bool interrupted = false;
+        {
+            py::gil_scoped_release release;
+            ncm::batch_options options;
+            options.threads = threads;
+            options.dump = make_options(embed_cover, write_tags, direct_io);
+            ncm::Batch batch(options);
+            for (const auto& [input, output] : jobs) {
+                ncm::batch_job job;
+                job.input = input;
+                job.output = output;
+                batch.submit(std::move(job));
+            }
+
+            ncm::batch_result r;
+            size_t done = 0;
+            while (!interrupted && batch.next(r)) {
+                size_t index = r.index;
+                results[index] = std::move(r);
+                done++;
+
+                py::gil_scoped_acquire acquire;
+                if (PyErr_CheckSignals() != 0) {
+                    interrupted = true;
+                } else if (!on_progress.is_none()) {
+                    try {
+                        on_progress(done, jobs.size(), results[index]);
+                    } catch (py::error_already_set& e) {
+                        e.restore();
+                        interrupted = true;
+                    }
+                }
+            }
+            if (interrupted) {
+                batch.cancel();
+            }
+        }
+        if (interrupted) {
+            throw py::error_already_set();
+        }
+        return results;
+    }
+} // anonymous namespace
+
+PYBIND11_MODULE(ncmlib, m) {
+    m.doc() = "Probe and convert NetEase Cloud Music .ncm files in-process";
+
+    py::class_<ncm::track_info>(m, "TrackInfo", "Metadata read from an NCM header")
+        .def_readonly("format", &ncm::track_info::format)
+        .def_readonly("music_id", &ncm::track_info::music_id)
+        .def_readonly("music_name", &ncm::track_info::music_name)
+        .def_readonly("artists", &ncm::track_info::artists)
+        .def_readonly("album", &ncm::track_info::album)
+        .def_readonly("bitrate", &ncm::track_info::bitrate)
+        .def_readonly("duration", &ncm::track_info::duration, "Duration in milliseconds")
+        .def_readonly("cover_offset", &ncm::track_info::cover_offset)
+        .def_readonly("cover_size", &ncm::track_info::cover_size)
+        .def_readonly("audio_offset", &ncm::track_info::audio_offset)
+        .def_readonly("audio_size", &ncm::track_info::audio_size)
+        .def("__repr__", [](const ncm::track_info& t) {
+            return "<TrackInfo " + t.format + " '" + t.music_name + "'>";
+        });
+
+    py::class_<ncm::dump_result>(m, "DumpResult", "Files written by a dump")
+        .def_readonly("format", &ncm::dump_result::format)
+        .def_readonly("audio_path", &ncm::dump_result::audio_path)
+        .def_readonly("cover_path", &ncm::dump_result::cover_path, "Empty if there is no cover or it was embedded")
+        .def_readonly("cover_embedded", &ncm::dump_result::cover_embedded)
+        .def_readonly("tags_written", &ncm::dump_result::tags_written)
+        .def("__repr__", [](const ncm::dump_result& r) { return "<DumpResult " + r.audio_path + ">"; });
+
+    py::class_<ncm::batch_result>(m, "BatchResult", "Outcome of one dump_batch() job")
+        .def_readonly("index", &ncm::batch_result::index, "Position of the job in the list passed to dump_batch()")
+        .def_readonly("result", &ncm::batch_result::result)
+        .def_readonly("error", &ncm::batch_result::error, "Failure description, empty on success")
+        .def_property_readonly("kind", [](const ncm::batch_result& r) { return ncm::error_kind_name(r.kind); },
+                               "Failure category (\"input\", \"truncated\", \"corrupt\", \"output\", ...), \"none\" on success")
+        .def_readonly("elapsed_us", &ncm::batch_result::elapsed_us)
+        .def_property_readonly("ok", &ncm::batch_result::ok)
+        .def("__repr__", [](const ncm::batch_result& r) {
+            return "<BatchResult " + to_string(r.index) + (r.ok() ? " ok>" : " failed: " + r.error + ">");
+        });
+
+    py::class_<decoded_track>(m, "DecodedTrack", "Audio and cover decoded into memory")
+        .def_readonly("format", &decoded_track::format)
+        .def_readonly("audio", &decoded_track::audio)
+        .def_readonly("cover", &decoded_track::cover, "Cover bytes, None if absent or embedded")
+        .def_readonly("cover_embedded", &decoded_track::cover_embedded)
+        .def_readonly("tags_written", &decoded_track::tags_written);
+
+    py::class_<manifest>(m, "Manifest",
+                         "Conversion manifest shared with the ncmpp binary's --manifest option")
+        .def(py::init<filesystem::path>(), py::arg("path"), "Load the manifest at path, starting empty if it does not exist")
+        .def("up_to_date", &manifest_up_to_date, py::arg("input"), py::arg("output"), py::kw_only(),
+             py::arg("embed_cover") = false, py::arg("write_tags") = false,
+             "Whether input is unchanged since it was converted to output with these options")
+        .def("record", &manifest_record, py::arg("input"), py::arg("output"), py::arg("format"), py::kw_only(),
+             py::arg("embed_cover") = false, py::arg("write_tags") = false, "Record a successful conversion")
+        .def("forget", &manifest::forget, py::arg("input"), "Drop the entry of input, e.g. after a failed conversion")
+        .def("save", &manifest::save, py::call_guard<py::gil_scoped_release>(), "Write the manifest if it changed")
+        .def("__len__", &manifest::size);
+
+    m.def("probe", [](const filesystem::path& path) {
+        py::gil_scoped_release release;
+        return ncm::probe(path);
+    }, py::arg("path"), "Read the metadata of an .ncm file without decrypting its audio");
+
+    m.def("decode", [](const filesystem::path& path, bool embed_cover, bool write_tags) {
+        return decode_with([&path](const ncm::dump_sink& sink, const ncm::dump_options& options) {
+            return ncm::ncmDecode(path.string(), sink, options);
+        }, embed_cover, write_tags);
+    }, py::arg("path"), py::kw_only(), py::arg("embed_cover") = false, py::arg("write_tags") = false,
+       "Decrypt an .ncm file into memory");
+
+    m.def("decode_bytes", [](py::buffer data, bool embed_cover, bool write_tags) {
+        py::buffer_info info = data.request();
+        const unsigned char* bytes = (const unsigned char*)info.ptr;
+        size_t len = (size_t)(info.size * info.itemsize);
+        return decode_with([bytes, len](const ncm::dump_sink& sink, const ncm::dump_options& options) {
+            return ncm::ncmDecode(bytes, len, sink, options);
+        }, embed_cover, write_tags);
+    }, py::arg("data"), py::kw_only(), py::arg("embed_cover") = false, py::arg("write_tags") = false,
+       "Decrypt an .ncm container held in a bytes-like object");
+
+    m.def("dump", [](const filesystem::path& input, const filesystem::path& output, bool embed_cover,
+                     bool write_tags, bool direct_io) {
+        py::gil_scoped_release release;
+        return ncm::ncmDump(input.string(), output.string(), make_options(embed_cover, write_tags, direct_io));
+    }, py::arg("input"), py::arg("output"), py::kw_only(), py::arg("embed_cover") = false,
+       py::arg("write_tags") = false, py::arg("direct_io") = false,
+       "Convert one file; output is the target path without extension");
+
+    m.def("dump_batch", &dump_batch, py::arg("jobs"), py::kw_only(), py::arg("threads") = 0,
+          py::arg("embed_cover") = false, py::arg("write_tags") = false, py::arg("direct_io") = false,
+          py::arg("on_progress") = py::none(),
+          "Convert (input, output) pairs on a thread pool; returns one BatchResult per job, in job order.\n"
+          "on_progress(done, total, result) is called on the calling thread after each file.");
+
+    m.def("set_log_level", [](const string& name) {
+        ncm::log::level lvl;
+        if (!ncm::log::parse_level(name, lvl)) {
+            throw py::value_error("Unknown log level: " + name);
+        }
+        ncm::log::set_sink(ncm::log::make_stream_sink(stderr, false));
+        ncm::log::set_level(lvl);
+    }, py::arg("level"), "Log ncmlib messages at or above this level to stderr (default: off)");
+}